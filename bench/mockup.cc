@@ -0,0 +1,441 @@
+// mockup.cc — nas-web mock upstream server (nas-web-mockup)
+// ─────────────────────────────────────────────────────────────────────────────
+//  Fake HTTP/1.1 backends on loopback for load-balancing, health-check and
+//  tail-latency tests. Every positional argument is one port with its own
+//  failure profile:
+//
+//    PORT[:key=value,key=value...]
+//
+//    latency=fixed:MS | lognormal:MEDIAN_MS:SIGMA | bimodal:FAST_MS:SLOW_MS:P_SLOW
+//    errors=P          answer P of requests with error_status (default 503)
+//    reset=P           reset the connection (RST) instead of answering
+//    hang=P            accept the request and never answer
+//    status=N body=BYTES chunked=1 chunk=BYTES
+//    trickle=BYTES:MS  slowloris-style: send BYTES every MS
+//    keepalive=0       always Connection: close;  max_requests=N per connection
+//    health=PATH       answered at once, health_status=N (default 200)
+//
+//  Per request: X-Mock-Delay-Ms / X-Mock-Status headers override the
+//  profile; GET /_mock/stats returns the port's counters as JSON.
+//
+//  Example (three backends):
+//    nas-web-mockup -t 2 19101:latency=lognormal:5:0.5
+//                        19102:latency=bimodal:2:200:0.05,errors=0.02
+//                        19103:reset=0.1,keepalive=0
+// ─────────────────────────────────────────────────────────────────────────────
+#include "../include/np_types.hh"
+#include "../src/http/parser.cc"
+// parser.cc logs through g_log; the real one lives in server.cc
+LogBuffer g_log;
+
+#include <uv.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// ── Profiles ──────────────────────────────────────────────────────────────────
+enum class LatencyKind { Fixed, LogNormal, Bimodal };
+
+struct MockProfile {
+    uint16_t    port{0};
+    std::string spec;
+    LatencyKind lat{LatencyKind::Fixed};
+    double      lat_a{0}, lat_b{0}, lat_c{0};   // ms / sigma / probability
+    double      err_rate{0};
+    int         err_status{503};
+    double      reset_rate{0};
+    double      hang_rate{0};
+    int         status{200};
+    size_t      body{128};
+    bool        chunked{false};
+    size_t      chunk{1024};
+    size_t      trickle_bytes{0};
+    int         trickle_ms{0};
+    bool        keepalive{true};
+    int         max_requests{0};
+    std::string health{"/health"};
+    int         health_status{200};
+    std::string body_data;                    // prebuilt payload
+
+    struct Counters {
+        std::atomic<uint64_t> requests{0}, errors{0}, resets{0}, hangs{0};
+        std::atomic<uint64_t> bytes_out{0}, conns{0};
+        std::atomic<int64_t>  active{0};
+    } st;
+    int fd{-1};
+};
+
+static std::vector<std::unique_ptr<MockProfile>> g_profiles;
+static bool g_quiet = false;
+
+static std::vector<std::string> split(const std::string& s, char sep) {
+    std::vector<std::string> out;
+    size_t b = 0;
+    for(;;) {
+        size_t e = s.find(sep, b);
+        out.push_back(s.substr(b, e == std::string::npos ? std::string::npos : e - b));
+        if(e == std::string::npos) break;
+        b = e + 1;
+    }
+    return out;
+}
+
+static bool parse_profile(const std::string& spec, MockProfile& p) {
+    p.spec = spec;
+    size_t colon = spec.find(':');
+    p.port = (uint16_t)atoi(spec.substr(0, colon).c_str());
+    if(!p.port) return false;
+    if(colon != std::string::npos) {
+        for(const std::string& kv : split(spec.substr(colon + 1), ',')) {
+            size_t eq = kv.find('=');
+            if(eq == std::string::npos) { fprintf(stderr, "bad option '%s'\n", kv.c_str()); return false; }
+            std::string k = kv.substr(0, eq);
+            std::vector<std::string> v = split(kv.substr(eq + 1), ':');
+            auto num = [&](size_t i, double def) { return i < v.size() ? atof(v[i].c_str()) : def; };
+            if(k == "latency") {
+                if(v[0] == "fixed")          { p.lat = LatencyKind::Fixed;     p.lat_a = num(1, 0); }
+                else if(v[0] == "lognormal") { p.lat = LatencyKind::LogNormal; p.lat_a = num(1, 5); p.lat_b = num(2, 0.5); }
+                else if(v[0] == "bimodal")   { p.lat = LatencyKind::Bimodal;   p.lat_a = num(1, 1); p.lat_b = num(2, 100); p.lat_c = num(3, 0.05); }
+                else { p.lat = LatencyKind::Fixed; p.lat_a = num(0, 0); }   // latency=MS
+            }
+            else if(k == "errors")        p.err_rate = num(0, 0);
+            else if(k == "error_status")  p.err_status = (int)num(0, 503);
+            else if(k == "reset")         p.reset_rate = num(0, 0);
+            else if(k == "hang")          p.hang_rate = num(0, 0);
+            else if(k == "status")        p.status = (int)num(0, 200);
+            else if(k == "body")          p.body = (size_t)num(0, 128);
+            else if(k == "chunked")       p.chunked = num(0, 1) != 0;
+            else if(k == "chunk")         p.chunk = std::max<size_t>(1, (size_t)num(0, 1024));
+            else if(k == "trickle")       { p.trickle_bytes = std::max<size_t>(1, (size_t)num(0, 1)); p.trickle_ms = (int)num(1, 100); }
+            else if(k == "keepalive")     p.keepalive = num(0, 1) != 0;
+            else if(k == "max_requests")  p.max_requests = (int)num(0, 0);
+            else if(k == "health")        p.health = kv.substr(eq + 1);
+            else if(k == "health_status") p.health_status = (int)num(0, 200);
+            else { fprintf(stderr, "unknown option '%s'\n", k.c_str()); return false; }
+        }
+    }
+    p.body_data.resize(p.body);
+    static const char FILL[] = "nas-web mock upstream payload 0123456789abcdefghijklmnopqrstuvwxyz\n";
+    for(size_t i = 0; i < p.body; i++) p.body_data[i] = FILL[i % (sizeof(FILL) - 1)];
+    return true;
+}
+
+// ── Connections ───────────────────────────────────────────────────────────────
+struct MockThread {
+    int          id{0};
+    uv_loop_t    loop{};
+    std::vector<uv_tcp_t> listeners;
+    uv_async_t   stop{};
+    std::mt19937_64 rng;
+};
+
+struct MockConn {
+    MockThread*  t{nullptr};
+    MockProfile* p{nullptr};
+    uv_tcp_t     tcp{};
+    uv_timer_t   timer{};
+    std::string  in;
+    std::string  out;          // pending response (trickle)
+    size_t       out_off{0};
+    int          served{0};
+    int          pending_status{0};   // answer waiting for the latency timer
+    int          handles{2};   // tcp + timer, freed when both are closed
+    bool         busy{false}, close_after{false}, closing{false};
+    char         rbuf[16384];
+};
+
+static void conn_close(MockConn* c, bool reset = false);
+static void next_request(MockConn* c);
+
+static double uniform01(MockThread* t) { return std::uniform_real_distribution<double>(0, 1)(t->rng); }
+
+static double sample_latency_ms(MockThread* t, const MockProfile& p) {
+    switch(p.lat) {
+    case LatencyKind::Fixed:
+        return p.lat_a;
+    case LatencyKind::LogNormal:
+        return std::exp(std::log(std::max(p.lat_a, 0.001)) + p.lat_b * std::normal_distribution<double>(0, 1)(t->rng));
+    case LatencyKind::Bimodal:
+        return uniform01(t) < p.lat_c ? p.lat_b : p.lat_a;
+    }
+    return 0;
+}
+
+struct MockWrite { uv_write_t req; std::string data; bool last; };
+
+static void write_out(MockConn* c, std::string data, bool last) {
+    c->p->st.bytes_out.fetch_add(data.size(), std::memory_order_relaxed);
+    auto* w = new MockWrite{{}, std::move(data), last};
+    w->req.data = c;
+    uv_buf_t b = uv_buf_init(w->data.data(), (unsigned)w->data.size());
+    uv_write(&w->req, (uv_stream_t*)&c->tcp, &b, 1, [](uv_write_t* r, int status) {
+        auto* w = reinterpret_cast<MockWrite*>(r);
+        MockConn* c = static_cast<MockConn*>(r->data);
+        bool last = w->last;
+        delete w;
+        if(c->closing) return;
+        if(status < 0) { conn_close(c); return; }
+        if(!last) return;
+        // response complete
+        c->served++;
+        c->busy = false;
+        if(c->close_after) { conn_close(c); return; }
+        next_request(c);
+    });
+}
+
+// Trickle: BYTES every MS until the response is out
+static void trickle_step(uv_timer_t* h) {
+    MockConn* c = static_cast<MockConn*>(h->data);
+    if(c->closing) return;
+    size_t n = std::min(c->p->trickle_bytes, c->out.size() - c->out_off);
+    bool last = c->out_off + n >= c->out.size();
+    write_out(c, c->out.substr(c->out_off, n), last);
+    c->out_off += n;
+    if(!last) uv_timer_start(&c->timer, trickle_step, (uint64_t)c->p->trickle_ms, 0);
+    else { c->out.clear(); c->out_off = 0; }
+}
+
+static void send_response(MockConn* c, int status, const std::string& body, const char* ctype) {
+    const MockProfile& p = *c->p;
+    bool close = c->close_after;
+    std::string r = "HTTP/1.1 " + std::to_string(status) + " " + std::string(Response::status_text(status)) + "\r\n";
+    r += "Content-Type: ";
+    r += ctype;
+    r += "\r\nX-Mock-Port: " + std::to_string(p.port) + "\r\n";
+    if(close) r += "Connection: close\r\n";
+    if(p.chunked && !body.empty()) {
+        r += "Transfer-Encoding: chunked\r\n\r\n";
+        char hex[32];
+        for(size_t off = 0; off < body.size(); off += p.chunk) {
+            size_t n = std::min(p.chunk, body.size() - off);
+            snprintf(hex, sizeof(hex), "%zx\r\n", n);
+            r += hex;
+            r.append(body, off, n);
+            r += "\r\n";
+        }
+        r += "0\r\n\r\n";
+    } else {
+        r += "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+        r += body;
+    }
+    if(p.trickle_bytes) {
+        c->out = std::move(r);
+        c->out_off = 0;
+        trickle_step(&c->timer);
+    } else {
+        write_out(c, std::move(r), true);
+    }
+}
+
+static std::string stats_json(const MockProfile& p) {
+    char buf[512];
+    snprintf(buf, sizeof(buf),
+        "{\"port\":%u,\"requests\":%llu,\"errors\":%llu,\"resets\":%llu,\"hangs\":%llu,"
+        "\"bytes_out\":%llu,\"connections\":%llu,\"active\":%lld}\n",
+        p.port, (unsigned long long)p.st.requests.load(), (unsigned long long)p.st.errors.load(),
+        (unsigned long long)p.st.resets.load(), (unsigned long long)p.st.hangs.load(),
+        (unsigned long long)p.st.bytes_out.load(), (unsigned long long)p.st.conns.load(),
+        (long long)p.st.active.load());
+    return buf;
+}
+
+static void next_request(MockConn* c) {
+    if(c->busy || c->closing) return;
+    Request req;
+    auto [res, used] = parse_request(c->in.data(), c->in.size(), req);
+    if(res == ParseResult::Incomplete) return;
+    if(res != ParseResult::Complete) {
+        c->busy = true;
+        c->close_after = true;
+        send_response(c, 400, "bad request\n", "text/plain");
+        return;
+    }
+    c->in.erase(0, used);
+    c->busy = true;
+    MockProfile& p = *c->p;
+    p.st.requests.fetch_add(1, std::memory_order_relaxed);
+    c->close_after = !p.keepalive || !req.keep_alive ||
+                     (p.max_requests > 0 && c->served + 1 >= p.max_requests);
+
+    if(req.path == "/_mock/stats") { send_response(c, 200, stats_json(p), "application/json"); return; }
+    if(req.path == p.health)       { send_response(c, p.health_status, "ok\n", "text/plain"); return; }
+
+    double r = uniform01(c->t);
+    if(r < p.reset_rate) {
+        p.st.resets.fetch_add(1, std::memory_order_relaxed);
+        conn_close(c, true);
+        return;
+    }
+    if(r < p.reset_rate + p.hang_rate) {
+        p.st.hangs.fetch_add(1, std::memory_order_relaxed);
+        return;   // stays busy until the client gives up
+    }
+    int status = p.status;
+    if(uniform01(c->t) < p.err_rate) status = p.err_status;
+    auto hs = req.headers.get("X-Mock-Status");
+    if(!hs.empty()) status = atoi(std::string(hs).c_str());
+    if(status >= 500) p.st.errors.fetch_add(1, std::memory_order_relaxed);
+
+    double delay = sample_latency_ms(c->t, p);
+    auto hd = req.headers.get("X-Mock-Delay-Ms");
+    if(!hd.empty()) delay = atof(std::string(hd).c_str());
+
+    c->pending_status = status;
+    uv_timer_start(&c->timer, [](uv_timer_t* h) {
+        MockConn* cc = static_cast<MockConn*>(h->data);
+        int st = cc->pending_status;
+        send_response(cc, st, st == cc->p->status ? cc->p->body_data : std::string("mock error\n"), "text/plain");
+    }, (uint64_t)std::llround(std::max(delay, 0.0)), 0);
+}
+
+static void conn_close(MockConn* c, bool reset) {
+    if(c->closing) return;
+    c->closing = true;
+    c->p->st.active.fetch_sub(1, std::memory_order_relaxed);
+    auto done = [](uv_handle_t* h) {
+        MockConn* cc = static_cast<MockConn*>(h->data);
+        if(--cc->handles == 0) delete cc;
+    };
+    uv_timer_stop(&c->timer);
+    uv_close((uv_handle_t*)&c->timer, done);
+    if(reset) uv_tcp_close_reset(&c->tcp, done);
+    else      uv_close((uv_handle_t*)&c->tcp, done);
+}
+
+static void on_connection(uv_stream_t* server, int status) {
+    if(status < 0) return;
+    MockThread* t = static_cast<MockThread*>(server->loop->data);
+    auto* c = new MockConn();
+    c->t = t;
+    c->p = static_cast<MockProfile*>(server->data);
+    uv_tcp_init(&t->loop, &c->tcp);
+    uv_timer_init(&t->loop, &c->timer);
+    c->tcp.data = c->timer.data = c;
+    if(uv_accept(server, (uv_stream_t*)&c->tcp) != 0) {
+        c->closing = true;
+        auto done = [](uv_handle_t* h) {
+            MockConn* cc = static_cast<MockConn*>(h->data);
+            if(--cc->handles == 0) delete cc;
+        };
+        uv_close((uv_handle_t*)&c->timer, done);
+        uv_close((uv_handle_t*)&c->tcp, done);
+        return;
+    }
+    c->p->st.conns.fetch_add(1, std::memory_order_relaxed);
+    c->p->st.active.fetch_add(1, std::memory_order_relaxed);
+    uv_tcp_nodelay(&c->tcp, 1);
+    uv_read_start((uv_stream_t*)&c->tcp,
+        [](uv_handle_t* h, size_t, uv_buf_t* b) {
+            MockConn* cc = static_cast<MockConn*>(h->data);
+            *b = uv_buf_init(cc->rbuf, sizeof(cc->rbuf));
+        },
+        [](uv_stream_t* s, ssize_t n, const uv_buf_t* b) {
+            MockConn* cc = static_cast<MockConn*>(s->data);
+            if(n < 0) { conn_close(cc); return; }
+            cc->in.append(b->base, (size_t)n);
+            next_request(cc);
+        });
+}
+
+// ── Threads ───────────────────────────────────────────────────────────────────
+static int make_listen_socket(uint16_t port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd < 0) { perror("socket"); return -1; }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr{};
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port        = htons(port);
+    if(bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0) { perror("bind"); close(fd); return -1; }
+    if(listen(fd, 4096) < 0) { perror("listen"); close(fd); return -1; }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    return fd;
+}
+
+static void thread_main(MockThread* t) {
+    t->rng.seed(0x6E61732D776562ull + (uint64_t)t->id * 7919);
+    t->listeners.resize(g_profiles.size());
+    for(size_t i = 0; i < g_profiles.size(); i++) {
+        uv_tcp_t* l = &t->listeners[i];
+        uv_tcp_init(&t->loop, l);
+        uv_tcp_open(l, dup(g_profiles[i]->fd));
+        l->data = g_profiles[i].get();
+        uv_listen((uv_stream_t*)l, 4096, on_connection);
+    }
+    uv_run(&t->loop, UV_RUN_DEFAULT);
+    uv_loop_close(&t->loop);
+}
+
+static void usage() {
+    fprintf(stderr,
+        "usage: nas-web-mockup [-t THREADS] [-q] PORT[:key=value,...] ...\n"
+        "  latency=fixed:MS | lognormal:MEDIAN_MS:SIGMA | bimodal:FAST_MS:SLOW_MS:P_SLOW\n"
+        "  errors=P error_status=N reset=P hang=P status=N body=BYTES\n"
+        "  chunked=1 chunk=BYTES trickle=BYTES:MS keepalive=0 max_requests=N\n"
+        "  health=PATH health_status=N\n");
+}
+
+int main(int argc, char** argv) {
+    int nthreads = 1;
+    for(int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if(a == "-t" && i + 1 < argc) nthreads = std::max(1, atoi(argv[++i]));
+        else if(a == "-q") g_quiet = true;
+        else if(a == "-h" || a == "--help") { usage(); return 0; }
+        else {
+            auto p = std::make_unique<MockProfile>();
+            if(!parse_profile(a, *p)) { usage(); return 2; }
+            g_profiles.push_back(std::move(p));
+        }
+    }
+    if(g_profiles.empty()) { usage(); return 2; }
+    for(auto& p : g_profiles) {
+        p->fd = make_listen_socket(p->port);
+        if(p->fd < 0) return 1;
+        if(!g_quiet) printf("[mockup] 127.0.0.1:%u  %s\n", p->port, p->spec.c_str());
+    }
+    fflush(stdout);
+
+    // Signals go to the main thread only
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &set, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    std::vector<std::unique_ptr<MockThread>> threads;
+    std::vector<std::thread> th;
+    for(int i = 0; i < nthreads; i++) {
+        threads.push_back(std::make_unique<MockThread>());
+        MockThread* t = threads.back().get();
+        t->id = i;
+        uv_loop_init(&t->loop);
+        t->loop.data = t;
+        uv_async_init(&t->loop, &t->stop, [](uv_async_t* a) {
+            uv_walk(a->loop, [](uv_handle_t* h, void*) { if(!uv_is_closing(h)) uv_close(h, nullptr); }, nullptr);
+        });
+        th.emplace_back(thread_main, threads.back().get());
+    }
+    int sig = 0;
+    sigwait(&set, &sig);
+    for(auto& t : threads) uv_async_send(&t->stop);
+    for(auto& x : th) x.join();
+    if(!g_quiet)
+        for(auto& p : g_profiles) printf("[mockup] %s", stats_json(*p).c_str());
+    return 0;
+}
@@ -0,0 +1,1127 @@
+// nas_web_bench.cc — nas-web HTTP/1.1 load generator (nas-web-bench)
+// ─────────────────────────────────────────────────────────────────────────────
+//  One libuv loop per thread, N keep-alive connections spread over the loops.
+//
+//  Closed loop (default): every connection keeps `--pipeline` requests in
+//  flight and sends the next one as soon as a response completes.
+//  Open loop (--rate R): each connection has a fixed schedule
+//  (R / connections req/s); latency is measured from the *intended* send
+//  time, so a stalled server shows up as queueing delay instead of silently
+//  lowering the offered load (coordinated omission).  In closed-loop mode
+//  the corrected histogram is derived afterwards, HdrHistogram style, by
+//  back-filling the samples an open-loop client would have seen.
+//
+//  Replay (--replay FILE): requests from a `capture` file (or a binary
+//  access log) are sent on their recorded schedule, optionally faster
+//  (--speed), spread round-robin over the connections; the report adds
+//  the status changes and the originally served latency next to the
+//  measured one.
+//
+//  Results: summary on stdout, --json FILE, --baseline FILE compares the
+//  run against a saved JSON (exit 3 on regression beyond --tolerance %).
+//
+//  Usage: nas-web-bench [options] http[s]://host:port/path
+// ─────────────────────────────────────────────────────────────────────────────
+#include "../src/core/latency_hist.cc"   // HistSnap, lh_bucket / lh_value
+#include <uv.h>
+#include <openssl/ssl.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include <openssl/err.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+static int64_t bench_now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// ── Options ───────────────────────────────────────────────────────────────────
+struct ReqTemplate {
+    std::string wire;      // complete request bytes
+    uint32_t    weight{1};
+    bool        head{false};
+    std::string label;     // "GET /path"
+};
+
+struct Options {
+    std::string url, scheme{"http"}, host, path{"/"};
+    int         port{80};
+    int         connections{50};
+    int         threads{1};
+    double      duration_s{10};
+    double      warmup_s{2};
+    double      rate{0};            // total req/s, 0 = closed loop
+    int         pipeline{1};
+    bool        keepalive{true};
+    int         timeout_ms{5000};
+    int64_t     expected_us{0};     // closed-loop CO correction interval, 0 = mean latency
+    std::vector<std::string> headers;
+    std::string requests_file;
+    std::string json_out;
+    std::string baseline;
+    double      tolerance{10};      // % for --baseline
+    std::string replay;             // capture / binary access log file
+    double      speed{1};           // replay time compression
+    bool        replay_scrubbed{false};
+    size_t      replay_limit{0};
+    std::vector<ReqTemplate> mix;
+    uint32_t    mix_total{0};
+    sockaddr_storage addr{};
+};
+static Options g_opt;
+
+// One recorded request of --replay
+struct ReplayReq {
+    std::string wire;
+    int64_t     off_us;     // since the first record
+    uint32_t    dur_us;     // as served when captured
+    uint16_t    status;
+    bool        head;
+};
+static std::vector<ReplayReq> g_replay;
+static int64_t g_replay_span_us = 0;
+
+static bool tpl_head(uint32_t t) { return g_replay.empty() ? g_opt.mix[t].head : g_replay[t].head; }
+static const std::string& tpl_wire(uint32_t t) { return g_replay.empty() ? g_opt.mix[t].wire : g_replay[t].wire; }
+static SSL_CTX* g_ssl_ctx = nullptr;
+
+// ── Stats ─────────────────────────────────────────────────────────────────────
+struct Stats {
+    HistSnap corr, raw;             // µs
+    uint64_t requests{0}, bytes_in{0};
+    uint64_t status[6]{};           // [0]=other, [1..5]=1xx..5xx
+    uint64_t err_connect{0}, err_read{0}, err_timeout{0}, err_parse{0};
+    uint64_t err_reset{0};          // connections reset by the server (RST, EPIPE)
+    // replay: captured latency, status class captured → replayed
+    HistSnap orig;
+    uint64_t st_same{0}, st_diff{0};
+    uint64_t trans[6][6]{};
+
+    static void put(HistSnap& h, int64_t us) {
+        uint64_t v = us > 0 ? (uint64_t)us : 0;
+        h.b[lh_bucket(v)]++;
+        h.count++;
+        h.sum_us += v;
+        if(v > h.max_us) h.max_us = v;
+    }
+    static void merge_hist(HistSnap& a, const HistSnap& b) {
+        for(int i = 0; i < LH_BUCKETS; i++) a.b[i] += b.b[i];
+        a.count += b.count; a.sum_us += b.sum_us;
+        if(b.max_us > a.max_us) a.max_us = b.max_us;
+    }
+    void merge(const Stats& o) {
+        merge_hist(corr, o.corr); merge_hist(raw, o.raw);
+        requests += o.requests; bytes_in += o.bytes_in;
+        for(int i = 0; i < 6; i++) status[i] += o.status[i];
+        err_connect += o.err_connect; err_read += o.err_read;
+        err_timeout += o.err_timeout; err_parse += o.err_parse;
+        err_reset += o.err_reset;
+        merge_hist(orig, o.orig);
+        st_same += o.st_same; st_diff += o.st_diff;
+        for(int i = 0; i < 6; i++) for(int j = 0; j < 6; j++) trans[i][j] += o.trans[i][j];
+    }
+    static int cls(int status) { return status >= 100 && status < 600 ? status / 100 : 0; }
+};
+
+// Closed loop: add the samples that requests queued behind a slow one would
+// have recorded (HdrHistogram copyCorrectedForCoordinatedOmission).
+static HistSnap co_correct(const HistSnap& raw, uint64_t expected_us) {
+    HistSnap out = raw;
+    if(!expected_us) return out;
+    for(int i = 0; i < LH_BUCKETS; i++) {
+        uint64_t c = raw.b[i];
+        if(!c) continue;
+        uint64_t v = lh_value(i);
+        for(uint64_t m = v > expected_us ? v - expected_us : 0; m >= expected_us; m -= expected_us) {
+            out.b[lh_bucket(m)] += c;
+            out.count  += c;
+            out.sum_us += m * c;
+        }
+    }
+    return out;
+}
+
+// ── Response framing ──────────────────────────────────────────────────────────
+static bool ci_prefix(const char* p, const char* end, const char* name) {
+    size_t n = strlen(name);
+    if((size_t)(end - p) < n) return false;
+    for(size_t i = 0; i < n; i++)
+        if(tolower((unsigned char)p[i]) != name[i]) return false;
+    return true;
+}
+
+enum class Frame { Need, Done, UntilEof, Bad };
+
+// Size of the response at p[0..n). Body by Content-Length, chunked, or
+// (no length) until the server closes.
+static Frame frame_response(const char* p, size_t n, bool head, size_t* len, int* status, bool* close) {
+    const char* end = p + n;
+    const char* hend = nullptr;
+    for(const char* q = p; q + 3 < end; q++)
+        if(q[0] == '\r' && q[1] == '\n' && q[2] == '\r' && q[3] == '\n') { hend = q + 4; break; }
+    if(!hend) return n > 65536 ? Frame::Bad : Frame::Need;
+    if(n < 12 || memcmp(p, "HTTP/1.", 7) != 0) return Frame::Bad;
+    *status = atoi(p + 9);
+    *close  = p[7] == '0';
+    long long clen = -1;
+    bool chunked = false;
+    for(const char* line = (const char*)memchr(p, '\n', hend - p) + 1; line < hend - 2; ) {
+        const char* eol = (const char*)memchr(line, '\n', hend - line);
+        if(!eol) break;
+        const char* v = (const char*)memchr(line, ':', eol - line);
+        if(v) {
+            v++;
+            while(v < eol && (*v == ' ' || *v == '\t')) v++;
+            if(ci_prefix(line, eol, "content-length:")) clen = atoll(v);
+            else if(ci_prefix(line, eol, "transfer-encoding:") && ci_prefix(v, eol, "chunked")) chunked = true;
+            else if(ci_prefix(line, eol, "connection:")) {
+                if(ci_prefix(v, eol, "close")) *close = true;
+                else if(ci_prefix(v, eol, "keep-alive")) *close = false;
+            }
+        }
+        line = eol + 1;
+    }
+    size_t hlen = (size_t)(hend - p);
+    if(head || (*status >= 100 && *status < 200) || *status == 204 || *status == 304) {
+        *len = hlen; return Frame::Done;
+    }
+    if(chunked) {
+        const char* q = hend;
+        for(;;) {
+            const char* eol = (const char*)memchr(q, '\n', end - q);
+            if(!eol) return Frame::Need;
+            size_t sz = strtoul(q, nullptr, 16);
+            q = eol + 1;
+            if(sz == 0) {
+                // trailers until an empty line
+                for(;;) {
+                    const char* e2 = (const char*)memchr(q, '\n', end - q);
+                    if(!e2) return Frame::Need;
+                    bool empty = e2 == q || (e2 == q + 1 && *q == '\r');
+                    q = e2 + 1;
+                    if(empty) { *len = (size_t)(q - p); return Frame::Done; }
+                }
+            }
+            if((size_t)(end - q) < sz + 2) return Frame::Need;
+            q += sz + 2;
+        }
+    }
+    if(clen >= 0) {
+        if(n < hlen + (size_t)clen) return Frame::Need;
+        *len = hlen + (size_t)clen; return Frame::Done;
+    }
+    *len = n;
+    return Frame::UntilEof;
+}
+
+// ── Connections ───────────────────────────────────────────────────────────────
+struct BenchThread;
+
+struct Inflight {
+    int64_t  intended_us;   // schedule time (open loop) or send time
+    int64_t  sent_us;
+    uint32_t tpl;           // g_opt.mix index, or g_replay index
+};
+
+struct Client {
+    BenchThread* t{nullptr};
+    int          id{0};
+    uv_tcp_t     tcp{};
+    uv_connect_t creq{};
+    uv_timer_t   timer{};
+    bool         tcp_open{false}, connected{false}, closing{false};
+    SSL*         ssl{nullptr};
+    BIO*         rbio{nullptr};
+    BIO*         wbio{nullptr};
+    bool         hs_done{false};
+    std::string  tls_pending;
+    std::string  in;            // response bytes (plaintext)
+    std::deque<Inflight> inflight;
+    int64_t      next_due{0};
+    int64_t      interval_us{0};
+    uint64_t     rng{0};
+    int          sent_on_conn{0};
+    int          done_on_conn{0};
+    bool         backoff{false};   // reconnect after a failure waits 100 ms
+    std::vector<uint32_t> rq;      // replay: this connection's records
+    size_t       rq_pos{0};
+    int64_t      t0{0};
+    char         rbuf[65536];
+};
+
+struct BenchThread {
+    int          id{0};
+    uv_loop_t    loop{};
+    uv_timer_t   tick{};
+    std::vector<std::unique_ptr<Client>> clients;
+    Stats        st;
+    int64_t      measure_start{0}, measure_end{0};
+    bool         stopping{false};
+    int64_t      finished_us{0};   // replay: last response
+};
+
+static void client_connect(Client* c);
+static void client_drop(Client* c, bool error);
+static void client_pump(Client* c);
+
+struct WriteReq { uv_write_t req; std::string data; };
+
+static bool is_reset(int err) { return err == UV_ECONNRESET || err == UV_EPIPE; }
+
+static void write_raw(Client* c, const char* p, size_t n) {
+    if(!c->tcp_open || c->closing) return;
+    uv_buf_t b = uv_buf_init((char*)p, (unsigned)n);
+    int w = uv_try_write((uv_stream_t*)&c->tcp, &b, 1);
+    if(w == (int)n) return;
+    if(w < 0 && w != UV_EAGAIN) {
+        if(is_reset(w)) c->t->st.err_reset++;
+        client_drop(c, true);
+        return;
+    }
+    size_t done = w > 0 ? (size_t)w : 0;
+    auto* wr = new WriteReq();
+    wr->req.data = c;
+    wr->data.assign(p + done, n - done);
+    b = uv_buf_init(wr->data.data(), (unsigned)wr->data.size());
+    uv_write(&wr->req, (uv_stream_t*)&c->tcp, &b, 1, [](uv_write_t* r, int status) {
+        auto* wr = reinterpret_cast<WriteReq*>(r);
+        Client* cl = static_cast<Client*>(r->data);
+        delete wr;
+        if(status < 0 && status != UV_ECANCELED) {
+            if(is_reset(status)) cl->t->st.err_reset++;
+            client_drop(cl, true);
+        }
+    });
+}
+
+static void tls_flush(Client* c) {
+    char buf[16384];
+    int n;
+    while((n = BIO_read(c->wbio, buf, sizeof(buf))) > 0) write_raw(c, buf, (size_t)n);
+}
+
+static void send_bytes(Client* c, const std::string& data) {
+    if(!c->ssl) { write_raw(c, data.data(), data.size()); return; }
+    if(!c->hs_done) { c->tls_pending += data; return; }
+    SSL_write(c->ssl, data.data(), (int)data.size());
+    tls_flush(c);
+}
+
+static uint32_t pick_template(Client* c) {
+    if(g_opt.mix.size() == 1) return 0;
+    c->rng ^= c->rng << 13; c->rng ^= c->rng >> 7; c->rng ^= c->rng << 17;
+    uint32_t r = (uint32_t)(c->rng % g_opt.mix_total);
+    for(size_t i = 0; i < g_opt.mix.size(); i++) {
+        if(r < g_opt.mix[i].weight) return (uint32_t)i;
+        r -= g_opt.mix[i].weight;
+    }
+    return 0;
+}
+
+// Keep the pipeline full (closed loop) or send what the schedule says is due
+static void client_pump(Client* c) {
+    BenchThread* t = c->t;
+    if(!c->connected || c->closing || t->stopping) return;
+    int depth = g_opt.keepalive ? g_opt.pipeline : 1;
+    if(!g_opt.keepalive && c->sent_on_conn >= 1) return;   // one request per connection
+    std::string batch;
+    int64_t now = bench_now_us();
+    auto queue = [&](int64_t intended, uint32_t tpl) {
+        c->inflight.push_back({intended, now, tpl});
+        batch += tpl_wire(tpl);
+        c->sent_on_conn++;
+    };
+    if(!g_replay.empty()) {
+        auto due = [&](size_t i) {
+            return c->t0 + (int64_t)((double)g_replay[c->rq[i]].off_us / g_opt.speed);
+        };
+        while((int)c->inflight.size() < depth && c->rq_pos < c->rq.size() && due(c->rq_pos) < now + 1000 &&
+              (g_opt.keepalive || c->sent_on_conn < 1)) {
+            queue(std::min(due(c->rq_pos), now), c->rq[c->rq_pos]);
+            c->rq_pos++;
+        }
+        if((int)c->inflight.size() < depth && c->rq_pos < c->rq.size() &&
+           (g_opt.keepalive || c->sent_on_conn < 1)) {
+            int64_t wait_ms = (due(c->rq_pos) - now) / 1000;
+            uv_timer_start(&c->timer, [](uv_timer_t* h) { client_pump(static_cast<Client*>(h->data)); },
+                           (uint64_t)std::max<int64_t>(wait_ms, 0), 0);
+        }
+    } else if(g_opt.rate <= 0) {
+        while((int)c->inflight.size() < depth && (g_opt.keepalive || c->sent_on_conn < 1))
+            queue(now, pick_template(c));
+    } else {
+        // libuv timers tick in ms: anything due within the next tick goes now
+        while((int)c->inflight.size() < depth && c->next_due < now + 1000 &&
+              (g_opt.keepalive || c->sent_on_conn < 1)) {
+            queue(std::min(c->next_due, now), pick_template(c));
+            c->next_due += c->interval_us;
+        }
+        if((int)c->inflight.size() < depth && (g_opt.keepalive || c->sent_on_conn < 1)) {
+            int64_t wait_ms = (c->next_due - now) / 1000;
+            uv_timer_start(&c->timer, [](uv_timer_t* h) { client_pump(static_cast<Client*>(h->data)); },
+                           (uint64_t)std::max<int64_t>(wait_ms, 0), 0);
+        }
+    }
+    if(!batch.empty()) send_bytes(c, batch);
+}
+
+static void record(Client* c, const Inflight& f, int status, size_t bytes) {
+    BenchThread* t = c->t;
+    int64_t now = bench_now_us();
+    if(now < t->measure_start || now >= t->measure_end) return;
+    Stats& s = t->st;
+    s.requests++;
+    s.bytes_in += bytes;
+    s.status[Stats::cls(status)]++;
+    Stats::put(s.raw, now - f.sent_us);
+    Stats::put(s.corr, now - f.intended_us);
+    if(!g_replay.empty()) {
+        const ReplayReq& r = g_replay[f.tpl];
+        Stats::put(s.orig, r.dur_us);
+        (r.status == status ? s.st_same : s.st_diff)++;
+        s.trans[Stats::cls(r.status)][Stats::cls(status)]++;
+        t->finished_us = now;
+    }
+}
+
+// Complete responses at the front of c->in; returns false if the conn was dropped
+static bool client_consume(Client* c, bool eof) {
+    size_t off = 0;
+    while(!c->inflight.empty() && off < c->in.size()) {
+        const Inflight& f = c->inflight.front();
+        size_t len = 0; int status = 0; bool close = false;
+        Frame fr = frame_response(c->in.data() + off, c->in.size() - off,
+                                  tpl_head(f.tpl), &len, &status, &close);
+        if(fr == Frame::Need) break;
+        if(fr == Frame::Bad) { c->t->st.err_parse++; client_drop(c, true); return false; }
+        if(fr == Frame::UntilEof) { if(!eof) break; close = true; }
+        off += len;
+        if(status >= 100 && status < 200 && status != 101) continue;   // interim
+        Inflight done = f;
+        c->inflight.pop_front();
+        c->done_on_conn++;
+        record(c, done, status, len);
+        if(close || !g_opt.keepalive) {
+            c->in.clear();
+            client_drop(c, false);
+            return false;
+        }
+    }
+    if(off) c->in.erase(0, off);
+    if(!eof) client_pump(c);
+    return true;
+}
+
+static void on_read(uv_stream_t* s, ssize_t n, const uv_buf_t* buf) {
+    Client* c = static_cast<Client*>(s->data);
+    if(n < 0) {
+        if(is_reset((int)n)) c->t->st.err_reset++;
+        if(!c->inflight.empty() && !client_consume(c, true)) return;
+        // A keep-alive connection closed cleanly between responses: the
+        // requests still queued are sent again on a new connection, like a
+        // browser. Resets count as errors.
+        bool retry = n == UV_EOF && c->in.empty() && c->done_on_conn > 0;
+        client_drop(c, !retry && !c->inflight.empty());
+        return;
+    }
+    if(n == 0) return;
+    if(!c->ssl) {
+        c->in.append(buf->base, (size_t)n);
+    } else {
+        BIO_write(c->rbio, buf->base, (int)n);
+        if(!c->hs_done) {
+            int r = SSL_connect(c->ssl);
+            tls_flush(c);
+            if(r != 1) {
+                int e = SSL_get_error(c->ssl, r);
+                if(e == SSL_ERROR_WANT_READ || e == SSL_ERROR_WANT_WRITE) return;
+                c->t->st.err_connect++;
+                client_drop(c, true);
+                return;
+            }
+            c->hs_done = true;
+            if(!c->tls_pending.empty()) {
+                std::string p; p.swap(c->tls_pending);
+                send_bytes(c, p);
+            }
+        }
+        char plain[16384];
+        int r;
+        while((r = SSL_read(c->ssl, plain, sizeof(plain))) > 0) c->in.append(plain, (size_t)r);
+        tls_flush(c);
+    }
+    client_consume(c, false);
+}
+
+static void on_connect(uv_connect_t* req, int status) {
+    Client* c = static_cast<Client*>(req->data);
+    if(c->closing) return;
+    if(status < 0) {
+        c->t->st.err_connect++;
+        client_drop(c, true);
+        return;
+    }
+    c->connected = true;
+    c->sent_on_conn = 0;
+    c->done_on_conn = 0;
+    uv_tcp_nodelay(&c->tcp, 1);
+    if(g_ssl_ctx) {
+        c->ssl  = SSL_new(g_ssl_ctx);
+        c->rbio = BIO_new(BIO_s_mem());
+        c->wbio = BIO_new(BIO_s_mem());
+        SSL_set_bio(c->ssl, c->rbio, c->wbio);
+        SSL_set_connect_state(c->ssl);
+        SSL_set_tlsext_host_name(c->ssl, g_opt.host.c_str());
+        SSL_connect(c->ssl);
+        tls_flush(c);
+    }
+    uv_read_start((uv_stream_t*)&c->tcp,
+        [](uv_handle_t* h, size_t, uv_buf_t* b) {
+            Client* cl = static_cast<Client*>(h->data);
+            *b = uv_buf_init(cl->rbuf, sizeof(cl->rbuf));
+        }, on_read);
+    // Requests a closed connection still owed are sent again (same schedule)
+    if(!c->inflight.empty()) {
+        std::string again;
+        int64_t now = bench_now_us();
+        for(auto& f : c->inflight) { f.sent_us = now; again += tpl_wire(f.tpl); }
+        c->sent_on_conn = (int)c->inflight.size();
+        send_bytes(c, again);
+    }
+    client_pump(c);
+}
+
+static void client_connect(Client* c) {
+    if(c->t->stopping) return;
+    uv_tcp_init(&c->t->loop, &c->tcp);
+    c->tcp.data  = c;
+    c->creq.data = c;
+    c->tcp_open  = true;
+    c->closing   = false;
+    c->connected = false;
+    c->hs_done   = false;
+    c->in.clear();
+    c->tls_pending.clear();
+    if(uv_tcp_connect(&c->creq, &c->tcp, (const sockaddr*)&g_opt.addr, on_connect) != 0) {
+        c->t->st.err_connect++;
+        client_drop(c, true);
+    }
+}
+
+// Close the socket and reconnect. `error` → in-flight requests are lost
+// (counted) and the reconnect waits 100 ms.
+static void client_drop(Client* c, bool error) {
+    if(!c->tcp_open || c->closing) return;
+    c->closing   = true;
+    c->connected = false;
+    if(error && !c->inflight.empty()) {
+        c->t->st.err_read += c->inflight.size();
+        c->inflight.clear();
+    }
+    c->backoff = error;
+    uv_timer_stop(&c->timer);
+    uv_close((uv_handle_t*)&c->tcp, [](uv_handle_t* h) {
+        Client* cl = static_cast<Client*>(h->data);
+        cl->tcp_open = false;
+        if(cl->ssl) { SSL_free(cl->ssl); cl->ssl = nullptr; cl->rbio = cl->wbio = nullptr; }
+        if(cl->t->stopping) return;
+        uv_timer_start(&cl->timer, [](uv_timer_t* tm) {
+            client_connect(static_cast<Client*>(tm->data));
+        }, cl->backoff ? 100 : 0, 0);
+    });
+}
+
+// ── Thread ────────────────────────────────────────────────────────────────────
+static void thread_main(BenchThread* t, int first_client, int nclients, int64_t t0) {
+    uv_loop_init(&t->loop);
+    t->measure_start = t0 + (int64_t)(g_opt.warmup_s * 1e6);
+    t->measure_end   = t->measure_start + (int64_t)(g_opt.duration_s * 1e6);
+    int total = g_opt.connections;
+    if(!g_replay.empty()) {   // no warmup; hard stop if the target stops answering
+        t->measure_start = t0;
+        t->measure_end   = t0 + (int64_t)((double)g_replay_span_us / g_opt.speed)
+                         + (int64_t)g_opt.timeout_ms * 1000 + 1000000;
+    }
+    for(int i = 0; i < nclients; i++) {
+        auto c = std::make_unique<Client>();
+        c->t   = t;
+        c->id  = first_client + i;
+        c->rng = 0x9E3779B97F4A7C15ull ^ (uint64_t)(c->id + 1) * 0xBF58476D1CE4E5B9ull;
+        uv_timer_init(&t->loop, &c->timer);
+        c->timer.data = c.get();
+        if(g_opt.rate > 0) {
+            c->interval_us = (int64_t)(1e6 * total / g_opt.rate);
+            c->next_due    = t0 + c->interval_us * c->id / total;   // spread starts evenly
+        }
+        if(!g_replay.empty()) {
+            c->t0 = t0;
+            for(size_t r = (size_t)c->id; r < g_replay.size(); r += (size_t)total) c->rq.push_back((uint32_t)r);
+        }
+        t->clients.push_back(std::move(c));
+    }
+    for(auto& c : t->clients) client_connect(c.get());
+
+    // 100 ms housekeeping: request timeouts, end of run
+    uv_timer_init(&t->loop, &t->tick);
+    t->tick.data = t;
+    uv_timer_start(&t->tick, [](uv_timer_t* h) {
+        BenchThread* bt = static_cast<BenchThread*>(h->data);
+        int64_t now = bench_now_us();
+        for(auto& c : bt->clients) {
+            if(!c->inflight.empty() && now - c->inflight.front().sent_us > (int64_t)g_opt.timeout_ms * 1000) {
+                bt->st.err_timeout += c->inflight.size();
+                c->inflight.clear();
+                client_drop(c.get(), false);
+            }
+        }
+        bool replay_done = !g_replay.empty();
+        for(auto& c : bt->clients)
+            if(c->rq_pos < c->rq.size() || !c->inflight.empty()) replay_done = false;
+        if(replay_done || now >= bt->measure_end) {
+            bt->stopping = true;
+            uv_walk(&bt->loop, [](uv_handle_t* hh, void*) {
+                if(!uv_is_closing(hh)) uv_close(hh, nullptr);
+            }, nullptr);
+        }
+    }, 100, 100);
+
+    uv_run(&t->loop, UV_RUN_DEFAULT);
+    for(auto& c : t->clients) if(c->ssl) { SSL_free(c->ssl); c->ssl = nullptr; }
+    uv_loop_close(&t->loop);
+}
+
+// ── Options parsing ───────────────────────────────────────────────────────────
+static void usage() {
+    fprintf(stderr,
+        "usage: nas-web-bench [options] http[s]://host[:port]/path\n"
+        "  -c N               connections (default 50)\n"
+        "  -t N               threads / event loops (default 1)\n"
+        "  -d SEC             measured duration (default 10)\n"
+        "  -w SEC             warmup, not measured (default 2)\n"
+        "  -R RATE            open loop: total requests/s (default: closed loop)\n"
+        "  -p N               pipeline depth per connection (default 1)\n"
+        "  -H 'Name: value'   extra request header (repeatable)\n"
+        "  --no-keepalive     one request per connection\n"
+        "  --requests FILE    request mix: 'METHOD PATH [WEIGHT] [@BODYFILE]' per line\n"
+        "  --timeout MS       per-request timeout (default 5000)\n"
+        "  --expected-us N    closed-loop CO correction interval (default: mean latency)\n"
+        "  --json FILE        write results as JSON\n"
+        "  --baseline FILE    compare against a saved --json result\n"
+        "  --tolerance PCT    allowed regression for --baseline (default 10)\n"
+        "  --replay FILE      replay a capture / binary access log on its recorded schedule\n"
+        "  --speed X          replay X times faster (default 1)\n"
+        "  --replay-scrubbed  also send headers whose value was scrubbed\n"
+        "  --replay-limit N   replay only the first N records\n");
+}
+
+static bool parse_url(const std::string& u) {
+    auto p = u.find("://");
+    if(p == std::string::npos) return false;
+    g_opt.scheme = u.substr(0, p);
+    if(g_opt.scheme != "http" && g_opt.scheme != "https") return false;
+    std::string rest = u.substr(p + 3);
+    auto slash = rest.find('/');
+    std::string hp = rest.substr(0, slash);
+    g_opt.path = slash == std::string::npos ? "/" : rest.substr(slash);
+    g_opt.port = g_opt.scheme == "https" ? 443 : 80;
+    if(!hp.empty() && hp[0] == '[') {
+        auto rb = hp.find(']');
+        if(rb == std::string::npos) return false;
+        g_opt.host = hp.substr(1, rb - 1);
+        if(rb + 1 < hp.size() && hp[rb + 1] == ':') g_opt.port = atoi(hp.c_str() + rb + 2);
+    } else {
+        auto colon = hp.rfind(':');
+        g_opt.host = hp.substr(0, colon);
+        if(colon != std::string::npos) g_opt.port = atoi(hp.c_str() + colon + 1);
+    }
+    return !g_opt.host.empty() && g_opt.port > 0;
+}
+
+static bool add_template(const std::string& method, const std::string& path, uint32_t weight,
+                         const std::string& body) {
+    ReqTemplate t;
+    t.weight = std::max<uint32_t>(weight, 1);
+    t.head   = method == "HEAD";
+    t.label  = method + " " + path;
+    std::string& w = t.wire;
+    w = method + " " + path + " HTTP/1.1\r\nHost: " + g_opt.host;
+    if((g_opt.scheme == "http" && g_opt.port != 80) || (g_opt.scheme == "https" && g_opt.port != 443))
+        w += ":" + std::to_string(g_opt.port);
+    w += "\r\n";
+    bool own_ua = false;
+    for(auto& h : g_opt.headers) {
+        w += h + "\r\n";
+        if(ci_prefix(h.data(), h.data() + h.size(), "user-agent:")) own_ua = true;
+    }
+    if(!own_ua) w += "User-Agent: nas-web-bench\r\n";
+    if(!g_opt.keepalive) w += "Connection: close\r\n";
+    if(!body.empty() || method == "POST" || method == "PUT")
+        w += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+    w += "\r\n";
+    w += body;
+    g_opt.mix_total += t.weight;
+    g_opt.mix.push_back(std::move(t));
+    return true;
+}
+
+static bool load_requests(const std::string& file) {
+    std::ifstream f(file);
+    if(!f) { fprintf(stderr, "cannot open %s\n", file.c_str()); return false; }
+    std::string line;
+    while(std::getline(f, line)) {
+        if(line.empty() || line[0] == '#') continue;
+        std::istringstream ls(line);
+        std::string method, path, tok, body;
+        uint32_t weight = 1;
+        if(!(ls >> method >> path)) continue;
+        while(ls >> tok) {
+            if(tok[0] == '@') {
+                std::ifstream bf(tok.substr(1), std::ios::binary);
+                if(!bf) { fprintf(stderr, "cannot open body %s\n", tok.c_str() + 1); return false; }
+                body.assign(std::istreambuf_iterator<char>(bf), {});
+            } else {
+                weight = (uint32_t)std::max(1, atoi(tok.c_str()));
+            }
+        }
+        add_template(method, path, weight, body);
+    }
+    if(g_opt.mix.empty()) { fprintf(stderr, "%s: no requests\n", file.c_str()); return false; }
+    return true;
+}
+
+// ── Replay file ───────────────────────────────────────────────────────────────
+// Binary access-log format (src/core/access_log.cc): "NWAL" v1 header, then
+// u16-length records. Type 1 = access log, type 2 = capture (headers packed
+// in the ua field). Either may be a concatenation of zstd frames.
+static const char* const REPLAY_METHOD[] = {
+    nullptr, "GET", "POST", "PUT", "DELETE", "PATCH", "HEAD", "OPTIONS", nullptr };
+static constexpr size_t REPLAY_FIXED = 4 + 8+4+2+1+1 + 8+4 + 1+1+2+2+2;
+
+template<class T> static T le(const unsigned char* p) {
+    uint64_t v = 0;
+    for(size_t i = 0; i < sizeof(T); i++) v |= (uint64_t)p[i] << (8 * i);
+    return (T)v;
+}
+
+static bool read_replay_file(const std::string& file, std::string& out) {
+    std::ifstream f(file, std::ios::binary);
+    if(!f) { fprintf(stderr, "cannot open %s\n", file.c_str()); return false; }
+    std::string raw((std::istreambuf_iterator<char>(f)), {});
+    if(raw.size() < 4 || memcmp(raw.data(), "\x28\xb5\x2f\xfd", 4) != 0) { out.swap(raw); return true; }
+#ifdef HAVE_ZSTD
+    ZSTD_DCtx* d = ZSTD_createDCtx();
+    ZSTD_inBuffer in{raw.data(), raw.size(), 0};
+    std::vector<char> buf(ZSTD_DStreamOutSize());
+    while(in.pos < in.size) {
+        ZSTD_outBuffer o{buf.data(), buf.size(), 0};
+        size_t r = ZSTD_decompressStream(d, &o, &in);
+        if(ZSTD_isError(r)) {
+            fprintf(stderr, "%s: %s (keeping %zu bytes)\n", file.c_str(), ZSTD_getErrorName(r), out.size());
+            break;
+        }
+        out.append(buf.data(), o.pos);
+        if(r != 0 && o.pos == 0 && in.pos == in.size) break;   // truncated last frame
+    }
+    ZSTD_freeDCtx(d);
+    return true;
+#else
+    fprintf(stderr, "%s is zstd-compressed; rebuild with zstd or decompress it first (zstd -d)\n", file.c_str());
+    return false;
+#endif
+}
+
+static bool load_replay(const std::string& file) {
+    std::string data;
+    if(!read_replay_file(file, data)) return false;
+    if(data.size() < 8 || memcmp(data.data(), "NWAL", 4) != 0 || data[4] != 1) {
+        fprintf(stderr, "%s: not a binary access log / capture file (NWAL v1)\n", file.c_str());
+        return false;
+    }
+    // -H replaces a captured header of the same name
+    std::vector<std::string> own;
+    for(auto& h : g_opt.headers) {
+        std::string n = h.substr(0, h.find(':'));
+        for(auto& ch : n) ch = (char)tolower((unsigned char)ch);
+        own.push_back(n);
+    }
+    auto is = [](std::string_view name, std::string_view lower) {
+        return name.size() == lower.size() && ci_prefix(name.data(), name.data() + name.size(), lower.data());
+    };
+    auto skip_header = [&](std::string_view name, std::string_view val) {
+        static const char* const hop[] = {"host", "content-length", "transfer-encoding",
+                                          "connection", "keep-alive", "upgrade"};
+        for(const char* h : hop) if(is(name, h)) return true;
+        for(auto& o : own) if(is(name, o)) return true;
+        return !g_opt.replay_scrubbed && val == "[scrubbed]";
+    };
+    std::string default_host = g_opt.host;
+    if((g_opt.scheme == "http" && g_opt.port != 80) || (g_opt.scheme == "https" && g_opt.port != 443))
+        default_host += ":" + std::to_string(g_opt.port);
+
+    struct Rec { int64_t ts; ReplayReq r; };
+    std::vector<Rec> recs;
+    size_t skipped = 0;
+    const unsigned char* p   = (const unsigned char*)data.data() + 8;
+    const unsigned char* end = (const unsigned char*)data.data() + data.size();
+    while(end - p >= 2) {
+        uint16_t len = le<uint16_t>(p);
+        if(len < REPLAY_FIXED || (size_t)(end - p) < len) break;   // truncated tail
+        const unsigned char* rp = p;
+        p += len;
+        uint8_t type = rp[2], nhdr = rp[3];
+        if(type != 1 && type != 2) continue;
+        int64_t  ts      = le<int64_t>(rp + 4);
+        uint32_t dur     = le<uint32_t>(rp + 12);
+        uint16_t status  = le<uint16_t>(rp + 16);
+        uint8_t  method  = rp[18];
+        uint32_t body    = le<uint32_t>(rp + 28);
+        uint8_t  ip_len  = rp[32], host_len = rp[33];
+        uint16_t path_len = le<uint16_t>(rp + 34), ua_len = le<uint16_t>(rp + 36), ref_len = le<uint16_t>(rp + 38);
+        const char* sp = (const char*)rp + REPLAY_FIXED;
+        if(REPLAY_FIXED + ip_len + host_len + path_len + ua_len + ref_len > len) { skipped++; continue; }
+        const char* m = method < sizeof(REPLAY_METHOD) / sizeof(*REPLAY_METHOD) ? REPLAY_METHOD[method] : nullptr;
+        if(!m) { skipped++; continue; }
+        std::string_view host(sp + ip_len, host_len), path(sp + ip_len + host_len, path_len);
+        std::string_view ua(path.data() + path_len, ua_len), ref(ua.data() + ua_len, ref_len);
+
+        Rec rec{ts, {}};
+        rec.r.dur_us = dur;
+        rec.r.status = status;
+        rec.r.head   = method == 6;
+        std::string& w = rec.r.wire;
+        w = std::string(m) + " " + (path.empty() ? std::string("/") : std::string(path)) + " HTTP/1.1\r\nHost: ";
+        w += host.empty() ? default_host : std::string(host);
+        w += "\r\n";
+        bool has_ua = false;
+        auto add = [&](std::string_view n, std::string_view v) {
+            if(v.empty() || skip_header(n, v)) return;
+            w.append(n); w += ": "; w.append(v); w += "\r\n";
+            if(is(n, "user-agent")) has_ua = true;
+        };
+        if(type == 1) {
+            add("User-Agent", ua);
+            add("Referer", ref);
+        } else {
+            const unsigned char* h = (const unsigned char*)ua.data();
+            const unsigned char* he = h + ua.size();
+            for(int i = 0; i < nhdr && he - h >= 3; i++) {
+                size_t nl = h[0], vl = (size_t)h[1] | (size_t)h[2] << 8;
+                if((size_t)(he - h) < 3 + nl + vl) break;
+                add({(const char*)h + 3, nl}, {(const char*)h + 3 + nl, vl});
+                h += 3 + nl + vl;
+            }
+        }
+        for(auto& hh : g_opt.headers) {
+            w += hh + "\r\n";
+            if(ci_prefix(hh.data(), hh.data() + hh.size(), "user-agent:")) has_ua = true;
+        }
+        if(!has_ua) w += "User-Agent: nas-web-bench\r\n";
+        if(!g_opt.keepalive) w += "Connection: close\r\n";
+        // Bodies are not captured: same length, filler bytes
+        body = std::min<uint32_t>(body, 16u << 20);
+        if(body || method == 2 || method == 3 || method == 5)
+            w += "Content-Length: " + std::to_string(body) + "\r\n";
+        w += "\r\n";
+        w.append(body, 'x');
+        recs.push_back(std::move(rec));
+    }
+    if(recs.empty()) { fprintf(stderr, "%s: no replayable records\n", file.c_str()); return false; }
+    // Workers flush in batches, so the file is only roughly in time order
+    std::stable_sort(recs.begin(), recs.end(), [](const Rec& a, const Rec& b) { return a.ts < b.ts; });
+    if(g_opt.replay_limit && recs.size() > g_opt.replay_limit) recs.resize(g_opt.replay_limit);
+    int64_t ts0 = recs.front().ts;
+    g_replay.reserve(recs.size());
+    for(auto& r : recs) {
+        r.r.off_us = r.ts - ts0;
+        g_replay.push_back(std::move(r.r));
+    }
+    g_replay_span_us = g_replay.back().off_us;
+    if(skipped) fprintf(stderr, "%s: %zu record(s) skipped\n", file.c_str(), skipped);
+    return true;
+}
+
+// ── Output ────────────────────────────────────────────────────────────────────
+struct Summary {
+    double   rps, mbps;
+    uint64_t corr[7], raw[7];   // p50 p90 p99 p99.9 p99.99 max mean
+};
+
+static const char* const STATUS_CLASS[6] = {"other", "1xx", "2xx", "3xx", "4xx", "5xx"};
+
+static void pct(const HistSnap& h, uint64_t out[7]) {
+    static const double q[5] = {0.50, 0.90, 0.99, 0.999, 0.9999};
+    for(int i = 0; i < 5; i++) out[i] = std::min(h.percentile(q[i]), h.max_us);
+    out[5] = h.max_us;
+    out[6] = h.avg_us();
+}
+
+// Captured → replayed status class, "2xx>5xx":N for every change
+static std::string replay_json(const Stats& s) {
+    static const char* k[7] = {"p50", "p90", "p99", "p999", "p9999", "max", "mean"};
+    char buf[256];
+    std::string o = ",\"replay\":{\"file\":\"";
+    for(char ch : g_opt.replay) { if(ch == '"' || ch == '\\') o += '\\'; o += ch; }
+    snprintf(buf, sizeof(buf), "\",\"records\":%zu,\"speed\":%g,\"status_same\":%llu,\"status_changed\":%llu,",
+             g_replay.size(), g_opt.speed, (unsigned long long)s.st_same, (unsigned long long)s.st_diff);
+    o += buf;
+    o += "\"transitions\":{";
+    bool first = true;
+    for(int i = 0; i < 6; i++)
+        for(int j = 0; j < 6; j++)
+            if(i != j && s.trans[i][j]) {
+                snprintf(buf, sizeof(buf), "%s\"%s>%s\":%llu", first ? "" : ",", STATUS_CLASS[i], STATUS_CLASS[j],
+                         (unsigned long long)s.trans[i][j]);
+                o += buf;
+                first = false;
+            }
+    o += "},\"captured_latency_us\":{";
+    uint64_t v[7];
+    pct(s.orig, v);
+    for(int i = 0; i < 7; i++) {
+        snprintf(buf, sizeof(buf), "%s\"%s\":%llu", i ? "," : "", k[i], (unsigned long long)v[i]);
+        o += buf;
+    }
+    o += "}}";
+    return o;
+}
+
+static std::string to_json(const Stats& s, const Summary& m, uint64_t expected_us) {
+    static const char* k[7] = {"p50", "p90", "p99", "p999", "p9999", "max", "mean"};
+    char buf[512];
+    std::string o = "{\"tool\":\"nas-web-bench\",\"url\":\"" + g_opt.url + "\"";
+    snprintf(buf, sizeof(buf),
+        ",\"connections\":%d,\"threads\":%d,\"pipeline\":%d,\"keepalive\":%s,\"rate\":%.1f,"
+        "\"mode\":\"%s\",\"duration_s\":%.3f,\"warmup_s\":%.3f,\"requests\":%llu,\"rps\":%.1f,"
+        "\"bytes_in\":%llu,\"mb_per_s\":%.3f,\"co_expected_us\":%llu,",
+        g_opt.connections, g_opt.threads, g_opt.pipeline, g_opt.keepalive ? "true" : "false",
+        g_opt.rate, !g_replay.empty() ? "replay" : g_opt.rate > 0 ? "open" : "closed", g_opt.duration_s, g_opt.warmup_s,
+        (unsigned long long)s.requests, m.rps, (unsigned long long)s.bytes_in, m.mbps,
+        (unsigned long long)expected_us);
+    o += buf;
+    snprintf(buf, sizeof(buf),
+        "\"status\":{\"1xx\":%llu,\"2xx\":%llu,\"3xx\":%llu,\"4xx\":%llu,\"5xx\":%llu,\"other\":%llu},"
+        "\"errors\":{\"connect\":%llu,\"read\":%llu,\"timeout\":%llu,\"parse\":%llu,\"reset\":%llu},",
+        (unsigned long long)s.status[1], (unsigned long long)s.status[2], (unsigned long long)s.status[3],
+        (unsigned long long)s.status[4], (unsigned long long)s.status[5], (unsigned long long)s.status[0],
+        (unsigned long long)s.err_connect, (unsigned long long)s.err_read,
+        (unsigned long long)s.err_timeout, (unsigned long long)s.err_parse,
+        (unsigned long long)s.err_reset);
+    o += buf;
+    o += "\"latency_us\":{";
+    for(int which = 0; which < 2; which++) {
+        const uint64_t* v = which == 0 ? m.corr : m.raw;
+        o += which == 0 ? "\"corrected\":{" : ",\"uncorrected\":{";
+        for(int i = 0; i < 7; i++) {
+            snprintf(buf, sizeof(buf), "%s\"%s\":%llu", i ? "," : "", k[i], (unsigned long long)v[i]);
+            o += buf;
+        }
+        o += "}";
+    }
+    o += "}";
+    if(!g_replay.empty()) o += replay_json(s);
+    o += "}\n";
+    return o;
+}
+
+// Number after `"key":`, optionally inside the object that follows `"section":`
+static bool json_num(const std::string& j, const char* section, const char* key, double* out) {
+    size_t from = 0;
+    if(section) {
+        std::string s = std::string("\"") + section + "\":";
+        from = j.find(s);
+        if(from == std::string::npos) return false;
+    }
+    std::string k = std::string("\"") + key + "\":";
+    size_t p = j.find(k, from);
+    if(p == std::string::npos) return false;
+    *out = strtod(j.c_str() + p + k.size(), nullptr);
+    return true;
+}
+
+// true = no regression
+static bool compare_baseline(const std::string& file, const Summary& m) {
+    std::ifstream f(file);
+    if(!f) { fprintf(stderr, "cannot open baseline %s\n", file.c_str()); return true; }
+    std::string j((std::istreambuf_iterator<char>(f)), {});
+    bool ok = true;
+    double tol = g_opt.tolerance / 100.0;
+    printf("\n  baseline %s (tolerance %.1f%%)\n", file.c_str(), g_opt.tolerance);
+    auto row = [&](const char* name, double base, double cur, bool higher_is_better) {
+        if(base <= 0) return;
+        double d = (cur - base) / base;
+        bool bad = higher_is_better ? d < -tol : d > tol;
+        if(bad) ok = false;
+        printf("    %-14s %12.1f → %12.1f  %+7.1f%%  %s\n", name, base, cur, d * 100, bad ? "REGRESSION" : "ok");
+    };
+    double b;
+    if(json_num(j, nullptr, "rps", &b)) row("rps", b, m.rps, true);
+    static const char* k[4] = {"p50", "p90", "p99", "p999"};
+    for(int i = 0; i < 4; i++)
+        if(json_num(j, "corrected", k[i], &b)) {
+            char name[32];
+            snprintf(name, sizeof(name), "%s (µs)", k[i]);
+            row(name, b, (double)m.corr[i], false);
+        }
+    return ok;
+}
+
+// ── main ──────────────────────────────────────────────────────────────────────
+int main(int argc, char** argv) {
+    std::string url;
+    for(int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        auto next = [&]() -> const char* {
+            if(i + 1 >= argc) { usage(); exit(2); }
+            return argv[++i];
+        };
+        if(a == "-c") g_opt.connections = std::max(1, atoi(next()));
+        else if(a == "-t") g_opt.threads = std::max(1, atoi(next()));
+        else if(a == "-d") g_opt.duration_s = std::max(0.1, atof(next()));
+        else if(a == "-w") g_opt.warmup_s = std::max(0.0, atof(next()));
+        else if(a == "-R") g_opt.rate = std::max(0.0, atof(next()));
+        else if(a == "-p") g_opt.pipeline = std::max(1, atoi(next()));
+        else if(a == "-H") g_opt.headers.push_back(next());
+        else if(a == "--no-keepalive") g_opt.keepalive = false;
+        else if(a == "--requests") g_opt.requests_file = next();
+        else if(a == "--timeout") g_opt.timeout_ms = std::max(1, atoi(next()));
+        else if(a == "--expected-us") g_opt.expected_us = std::max(0, atoi(next()));
+        else if(a == "--json") g_opt.json_out = next();
+        else if(a == "--baseline") g_opt.baseline = next();
+        else if(a == "--tolerance") g_opt.tolerance = atof(next());
+        else if(a == "--replay") g_opt.replay = next();
+        else if(a == "--speed") g_opt.speed = std::max(0.001, atof(next()));
+        else if(a == "--replay-scrubbed") g_opt.replay_scrubbed = true;
+        else if(a == "--replay-limit") g_opt.replay_limit = (size_t)std::max(0, atoi(next()));
+        else if(a == "-h" || a == "--help") { usage(); return 0; }
+        else if(a[0] == '-') { fprintf(stderr, "unknown option %s\n", a.c_str()); usage(); return 2; }
+        else url = a;
+    }
+    if(url.empty() || !parse_url(url)) { usage(); return 2; }
+    g_opt.url = url;
+    g_opt.threads = std::min(g_opt.threads, g_opt.connections);
+
+    addrinfo hints{}, *res = nullptr;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(g_opt.host.c_str(), std::to_string(g_opt.port).c_str(), &hints, &res) != 0 || !res) {
+        fprintf(stderr, "cannot resolve %s\n", g_opt.host.c_str());
+        return 2;
+    }
+    memcpy(&g_opt.addr, res->ai_addr, res->ai_addrlen);
+    freeaddrinfo(res);
+
+    if(!g_opt.replay.empty()) {
+        if(!load_replay(g_opt.replay)) return 2;
+        g_opt.rate     = 0;
+        g_opt.warmup_s = 0;
+        g_opt.duration_s  = std::max(0.001, g_replay_span_us / 1e6 / g_opt.speed);
+        g_opt.connections = (int)std::min<size_t>((size_t)g_opt.connections, g_replay.size());
+        g_opt.threads     = std::min(g_opt.threads, g_opt.connections);
+    }
+    if(!g_opt.requests_file.empty()) { if(!load_requests(g_opt.requests_file)) return 2; }
+    else add_template("GET", g_opt.path, 1, "");
+
+    if(g_opt.scheme == "https") {
+        g_ssl_ctx = SSL_CTX_new(TLS_client_method());
+        SSL_CTX_set_verify(g_ssl_ctx, SSL_VERIFY_NONE, nullptr);   // loopback / self-signed
+        static const unsigned char alpn[] = "\x08http/1.1";
+        SSL_CTX_set_alpn_protos(g_ssl_ctx, alpn, sizeof(alpn) - 1);
+        SSL_CTX_set_session_cache_mode(g_ssl_ctx, SSL_SESS_CACHE_CLIENT);
+    }
+
+    printf("nas-web-bench  %s\n  %d connection(s), %d thread(s), pipeline %d, %s, %s\n",
+           g_opt.url.c_str(), g_opt.connections, g_opt.threads, g_opt.pipeline,
+           g_opt.keepalive ? "keep-alive" : "no keep-alive",
+           !g_replay.empty() ? "recorded schedule" :
+           g_opt.rate > 0 ? ("open loop " + std::to_string((long)g_opt.rate) + " req/s").c_str() : "closed loop");
+    if(!g_replay.empty())
+        printf("  replay %s: %zu record(s) over %.1fs, speed %gx\n", g_opt.replay.c_str(), g_replay.size(),
+               g_replay_span_us / 1e6, g_opt.speed);
+    else
+        printf("  warmup %.1fs, measuring %.1fs, %zu request template(s)\n", g_opt.warmup_s, g_opt.duration_s, g_opt.mix.size());
+    fflush(stdout);
+
+    std::vector<std::unique_ptr<BenchThread>> threads(g_opt.threads);
+    std::vector<std::thread> th;
+    int64_t t0 = bench_now_us();
+    int per = g_opt.connections / g_opt.threads, extra = g_opt.connections % g_opt.threads, first = 0;
+    for(int i = 0; i < g_opt.threads; i++) {
+        threads[i] = std::make_unique<BenchThread>();
+        threads[i]->id = i;
+        int n = per + (i < extra ? 1 : 0);
+        th.emplace_back(thread_main, threads[i].get(), first, n, t0);
+        first += n;
+    }
+    for(auto& x : th) x.join();
+
+    Stats s;
+    for(auto& t : threads) s.merge(t->st);
+    if(!g_replay.empty()) {   // the run lasts as long as the replay did
+        int64_t last = t0;
+        for(auto& t : threads) last = std::max(last, t->finished_us);
+        g_opt.duration_s = std::max(0.001, (last - t0) / 1e6);
+    }
+    uint64_t expected = 0;
+    if(g_opt.rate <= 0 && g_replay.empty()) {   // open loop / replay: already from the schedule
+        expected = g_opt.expected_us > 0 ? (uint64_t)g_opt.expected_us : s.raw.avg_us();
+        s.corr = co_correct(s.raw, expected);
+    }
+
+    Summary m{};
+    m.rps  = s.requests / g_opt.duration_s;
+    m.mbps = s.bytes_in / g_opt.duration_s / (1024.0 * 1024.0);
+    pct(s.corr, m.corr);
+    pct(s.raw, m.raw);
+
+    printf("\n  requests %llu  rps %.1f  transfer %.2f MB/s\n", (unsigned long long)s.requests, m.rps, m.mbps);
+    printf("  status   2xx %llu  3xx %llu  4xx %llu  5xx %llu  other %llu\n",
+           (unsigned long long)s.status[2], (unsigned long long)s.status[3], (unsigned long long)s.status[4],
+           (unsigned long long)s.status[5], (unsigned long long)(s.status[0] + s.status[1]));
+    printf("  errors   connect %llu  read %llu  timeout %llu  parse %llu  reset %llu\n",
+           (unsigned long long)s.err_connect, (unsigned long long)s.err_read,
+           (unsigned long long)s.err_timeout, (unsigned long long)s.err_parse,
+           (unsigned long long)s.err_reset);
+    printf("\n  latency µs        p50       p90       p99     p99.9    p99.99       max      mean\n");
+    for(int which = 0; which < 2; which++) {
+        const uint64_t* v = which == 0 ? m.corr : m.raw;
+        printf("  %-12s", which == 0 ? "corrected" : "uncorrected");
+        for(int i = 0; i < 7; i++) printf("%10llu", (unsigned long long)v[i]);
+        printf("\n");
+    }
+    if(!g_replay.empty()) {
+        uint64_t o[7];
+        pct(s.orig, o);
+        printf("  %-12s", "captured");
+        for(int i = 0; i < 7; i++) printf("%10llu", (unsigned long long)o[i]);
+        printf("\n\n  replay   status same %llu  changed %llu\n",
+               (unsigned long long)s.st_same, (unsigned long long)s.st_diff);
+        for(int i = 0; i < 6; i++)
+            for(int j = 0; j < 6; j++)
+                if(i != j && s.trans[i][j])
+                    printf("    %s → %s  %llu\n", STATUS_CLASS[i], STATUS_CLASS[j], (unsigned long long)s.trans[i][j]);
+    }
+
+    if(!g_opt.json_out.empty()) {
+        std::ofstream f(g_opt.json_out);
+        f << to_json(s, m, expected);
+        printf("\n  JSON → %s\n", g_opt.json_out.c_str());
+    }
+    int rc = 0;
+    if(!g_opt.baseline.empty() && !compare_baseline(g_opt.baseline, m)) rc = 3;
+    if(g_ssl_ctx) SSL_CTX_free(g_ssl_ctx);
+    return rc;
+}
@@ -9,6 +9,7 @@
 #    --with-modsec    ModSecurity WAF (wymaga: apt install libmodsecurity-dev)
 #    --with-zstd      zstd kompresja  (wymaga: vendor/zstd/fetch_zstd.sh)
 #    --with-janet     Janet WAF       (wymaga: vendor/janet/fetch_janet.sh)
+#    --with-usdt      sondy USDT dla bpftrace/perf (wymaga: systemtap-sdt-dev)
 #    --with-sqlite    SQLite3 persistence (vendored, domyślnie ON)
 #    --no-sqlite      Wyłącz SQLite3
 #    --with-lua-cjson lua-cjson JSON  (vendored, domyślnie ON)
@@ -49,6 +50,7 @@ BUILD_DIR="${SCRIPT_DIR}/build"
 WITH_MODSEC="OFF"
 WITH_ZSTD="OFF"
 WITH_JANET="OFF"
+WITH_USDT="OFF"
 WITH_SQLITE="ON"
 WITH_LUA_CJSON="ON"
 NO_REBUILD=0
@@ -58,6 +60,7 @@ for arg in "$@"; do
         --with-modsec)   WITH_MODSEC="ON"    ;;
         --with-zstd)     WITH_ZSTD="ON"      ;;
         --with-janet)    WITH_JANET="ON"      ;;
+        --with-usdt)     WITH_USDT="ON"       ;;
         --with-sqlite)   WITH_SQLITE="ON"     ;;
         --no-sqlite)     WITH_SQLITE="OFF"    ;;
         --with-lua-cjson) WITH_LUA_CJSON="ON" ;;
@@ -81,6 +84,7 @@ fi
 # ── Sprawdź i zainstaluj zależności budowania ─────────────────────────────────
 BUILD_DEPS="liblua5.4-dev libuv1-dev libssl-dev libbrotli-dev libnghttp2-dev cmake build-essential pkg-config zlib1g-dev"
 [[ "${WITH_MODSEC}" == "ON" ]] && BUILD_DEPS="${BUILD_DEPS} libmodsecurity-dev"
+[[ "${WITH_USDT}" == "ON" ]] && BUILD_DEPS="${BUILD_DEPS} systemtap-sdt-dev"
 
 MISSING_DEPS=""
 for pkg in ${BUILD_DEPS}; do
@@ -116,6 +120,7 @@ printf "║   nas-web %-31s║\n" "${UPSTREAM_VER} — build .deb"
 printf "║   ModSecurity: %-26s║\n" "${WITH_MODSEC}"
 printf "║   zstd:        %-26s║\n" "${WITH_ZSTD}"
 printf "║   Janet WAF:   %-26s║\n" "${WITH_JANET}"
+printf "║   USDT:        %-26s║\n" "${WITH_USDT}"
 printf "║   SQLite3:     %-26s║\n" "${WITH_SQLITE}"
 printf "║   lua-cjson:   %-26s║\n" "${WITH_LUA_CJSON}"
 printf "╚══════════════════════════════════════════╝\n\n"
@@ -140,6 +145,7 @@ if [[ "${NO_REBUILD}" -eq 0 ]]; then
         -DWITH_ZSTD="${WITH_ZSTD}"                \
         -DWITH_JANET="${WITH_JANET}"              \
         -DWITH_MODSEC="${WITH_MODSEC}"            \
+        -DWITH_USDT="${WITH_USDT}"                \
         -DWITH_QUICHE=OFF
     cmake --build "${BUILD_DIR}" --parallel "$(nproc)"
 else
@@ -598,7 +598,7 @@ body.nav-open #nav-overlay { display: block; }
     </div>
     <div class="log-box" id="server-log" style="max-height:460px"></div>
     <div style="padding:6px 12px;font-size:10px;color:var(--dim);border-top:1px solid var(--border)">
-      Ring buffer 500 wpisów · źródło: <code>/np_logs</code> · odświeżanie co 3s
+      Ring buffer 500 wpisów · źródło: <code>/np_logs/stream</code> (SSE) · <code>/np_logs</code> co 5s gdy strumień niedostępny
     </div>
   </div>
 
@@ -1591,7 +1591,6 @@ sqlite3 /var/lib/nas-web/nas-web.db ".backup /backup/nas-web.db"
 <script>
 // ── Auth ─────────────────────────────────────────────────────────────────────
 let authHeader = sessionStorage.getItem('nw_auth') || '';
-let refreshTimer = null;
 
 
 function toggleNav(){
@@ -1983,7 +1982,7 @@ function doLogin(){
 }
 function doLogout(){
   sessionStorage.removeItem('nw_auth');authHeader='';
-  if(refreshTimer)clearInterval(refreshTimer);refreshTimer=null;
+  stopStatsStream();stopSSELog();
   document.getElementById('login-wrap').classList.remove('hidden');
   document.getElementById('app').style.display='none';
   document.getElementById('l-pass').value='';document.getElementById('l-err').textContent='';
@@ -2050,39 +2049,25 @@ function show(id,el){
   if(id==='workers')     renderWorkers(null);
   if(id==='ssl')         refreshAcme();
   if(id==='security'){
-    // Show current IP in allowlist panel
-    const ipEl = document.getElementById('admin-my-ip');
-    if(ipEl) {
-      api('/np_status').then(d => {
-        if(d && d.client_ip){
-          ipEl.textContent = d.client_ip;
-          ipEl.title = 'IP widziane przez serwer (może być IP proxy/gateway)';
-        }
-      });
-    }
-    // Show allowlist status from /np_status or fallback
+    // Current IP (allowlist panel) and allowlist status — one /np_status
     api('/np_status').then(d => {
+      const ipEl = document.getElementById('admin-my-ip');
+      if(ipEl && d && d.client_ip){
+        ipEl.textContent = d.client_ip;
+        ipEl.title = 'IP widziane przez serwer (może być IP proxy/gateway)';
+      }
       const el = document.getElementById('allowlist-status');
       if(el) el.textContent = d?.admin_allowlist_size > 0 ?
         d.admin_allowlist_size+' reguł' : 'brak ograniczeń (otwarte)';
     });
   }
+  if(id !== 'logs') stopSSELog();
   if(id==='logs'){
     fetchServerLogs();
-    if(!window._logTimer) window._logTimer = setInterval(()=>{
-      const active = document.getElementById('sec-logs');
-      if(active && active.classList.contains('active')){
-        fetchServerLogs();
-        addAccessLog();
-      }
-    }, 4000);
+    startSSELog();
+    addAccessLog();
   } else if(id === 'dashboard'){
     loadDashboard(120);
-    if(window._dashTimer){ clearInterval(window._dashTimer); window._dashTimer=null; }
-    window._dashTimer = setInterval(()=>{
-      const active = document.getElementById('sec-dashboard');
-      if(active && active.classList.contains('active')) loadDashboard(120);
-    }, 10000);
   } else if(id === 'audit'){
     loadAudit();
   } else if(id === 'db'){
@@ -2093,21 +2078,9 @@ function show(id,el){
     loadWaf();
   } else if(id === 'waf-regex'){
     loadWafRegex();
-    if(window._wafrTimer){ clearInterval(window._wafrTimer); window._wafrTimer=null; }
-    window._wafrTimer = setInterval(()=>{
-      const active = document.getElementById('sec-waf-regex');
-      if(active && active.classList.contains('active')) loadWafRegex();
-    }, 4000);
-  } else if(id === 'waf'){
-    loadWaf();
-    if(window._wafTimer){ clearInterval(window._wafTimer); window._wafTimer=null; }
-    window._wafTimer = setInterval(()=>{
-      const active = document.getElementById('sec-waf');
-      if(active && active.classList.contains('active')) loadWaf();
-    }, 4000);
-  } else {
-    stopSSELog();
   }
+  // Live sections refresh from /np_stats/stream (onStats), polling only without it
+  syncPolling();
 }
 
 // ── Clock ────────────────────────────────────────────────────────────────────
@@ -2155,7 +2128,6 @@ const IPS=['192.168.1.101','192.168.1.54','192.168.1.200','10.0.0.5'];
 // ── Log state ────────────────────────────────────────────────────────────────
 let logFilters = {f2xx:true, f4xx:true, f5xx:true, fstatic:true};
 let srvFilters = {error:true, warn:true, info:true, debug:false};
-let _logTimer = null;
 let _lastSrvTs = 0;  // last seen timestamp for incremental server log
 
 // ── HTTP Access Log (from /np_connections history) ────────────────────────────
@@ -2553,7 +2525,6 @@ async function acmeObtain(){
 
 
 // ── Dashboard Charts ──────────────────────────────────────────────────────────
-let _dashTimer = null;
 let _dashData  = [];
 
 function drawChart(canvasId, data, color, fillColor, unit='') {
@@ -2648,7 +2619,12 @@ async function loadDashboard(count=120) {
     return;
   }
   _dashData = d;
+  drawDashboard();
+}
 
+// Charts + current values from _dashData (history, then one sample per stats event)
+function drawDashboard() {
+  const d = _dashData;
   const rps  = d.map(s=>s.rps);
   const lat  = d.map(s=>s.lat);
   const err  = d.map(s=>s.eps);
@@ -2787,28 +2763,18 @@ async function dbPruneEvents() {
   setTimeout(loadDb, 500);
 }
 
-// ── SSE Live Log ──────────────────────────────────────────────────────────────
-let _sseSource = null;
-
-function startSSELog() {
-  if(_sseSource) return; // already connected
-  const box = document.getElementById('server-log');
-  if(!box) return;
-
-  const authHdr = btoa((window._adminUser||'admin') + ':' + (window._adminPass||''));
-  // EventSource doesn't support custom headers — use fetch with ReadableStream instead
-  _sseSource = true; // mark as started
-  const ctrl = new AbortController();
-  window._sseCtrl = ctrl;
-
-  fetch('/np_logs/stream', {
-    headers: { 'Authorization': 'Basic ' + authHdr },
+// ── SSE reader ────────────────────────────────────────────────────────────────
+// EventSource doesn't support custom headers — use fetch with ReadableStream instead.
+// onEvent(name, data) per JSON data line; onEnd() once the stream closes or fails.
+function sseFetch(path, ctrl, onEvent, onEnd) {
+  fetch(path, {
+    headers: { 'Authorization': authHeader },
     signal: ctrl.signal
   }).then(async resp => {
-    if(!resp.ok || !resp.body){ _sseSource=null; return; }
+    if(!resp.ok || !resp.body){ onEnd(); return; }
     const reader = resp.body.getReader();
     const dec = new TextDecoder();
-    let buf = '';
+    let buf = '', ev = 'message';
     while(true) {
       const {done, value} = await reader.read();
       if(done) break;
@@ -2816,23 +2782,125 @@ function startSSELog() {
       const lines = buf.split('\n');
       buf = lines.pop();
       for(const line of lines) {
+        if(line === '') { ev = 'message'; continue; }
+        if(line.startsWith('event: ')) { ev = line.slice(7); continue; }
         if(!line.startsWith('data: ')) continue;
-        try {
-          const raw = line.slice(6);
-          // Could be array (snapshot) or single object
-          const parsed = JSON.parse(raw);
-          const entries = Array.isArray(parsed) ? parsed : [parsed];
-          appendSSEEntries(entries);
-        } catch(e) {}
+        try { onEvent(ev, JSON.parse(line.slice(6))); } catch(e) {}
       }
     }
-    _sseSource = null;
-  }).catch(()=>{ _sseSource=null; });
+    onEnd();
+  }).catch(()=>onEnd());
+}
+
+// ── SSE Live Log ──────────────────────────────────────────────────────────────
+let _sseSource = null;   // AbortController of the running /np_logs/stream
+
+function startSSELog() {
+  if(_sseSource) return; // already connected
+  if(!document.getElementById('server-log')) return;
+  const ctrl = new AbortController();
+  _sseSource = ctrl;
+  sseFetch('/np_logs/stream', ctrl,
+    // Could be array (snapshot) or single object
+    (ev, d) => appendSSEEntries(Array.isArray(d) ? d : [d]),
+    () => { if(_sseSource === ctrl){ _sseSource = null; syncPolling(); } });
 }
 
 function stopSSELog() {
-  if(window._sseCtrl){ window._sseCtrl.abort(); window._sseCtrl=null; }
+  const ctrl = _sseSource;
   _sseSource = null;
+  if(ctrl) ctrl.abort();
+}
+
+// ── Live stats (SSE /np_stats/stream) ─────────────────────────────────────────
+// One event per second drives the overview counters, the RPS chart and the
+// dashboard charts. Sections without a stream of their own (access log, WAF)
+// reload when the request counter has moved. _pollTimer runs only while a
+// stream the visible section needs is down.
+let _statsCtrl  = null;   // AbortController of the running /np_stats/stream
+let _statsRetry = null;
+let _pollTimer  = null;
+const _secSeen  = {};     // section → {req, at} of its last stream-driven reload
+
+function startStatsStream() {
+  if(_statsCtrl) return;
+  const ctrl = new AbortController();
+  _statsCtrl = ctrl;
+  sseFetch('/np_stats/stream', ctrl,
+    (ev, s) => { if(ev === 'stats') onStats(s); },
+    () => {
+      if(_statsCtrl !== ctrl) return;   // stopped on purpose
+      _statsCtrl = null;
+      syncPolling();
+      if(!_statsRetry) _statsRetry = setTimeout(()=>{
+        _statsRetry = null;
+        if(authHeader) { startStatsStream(); syncPolling(); }
+      }, 15000);
+    });
+}
+
+function stopStatsStream() {
+  const ctrl = _statsCtrl;
+  _statsCtrl = null;
+  if(ctrl) ctrl.abort();
+  if(_statsRetry){ clearTimeout(_statsRetry); _statsRetry = null; }
+  if(_pollTimer){ clearInterval(_pollTimer); _pollTimer = null; }
+}
+
+function sectionActive(id){
+  return !!document.getElementById('sec-'+id)?.classList.contains('active');
+}
+
+// Reload a section when requests moved since its last reload, at most every minMs
+function refreshIfMoved(key, s, minMs, fn) {
+  const seen = _secSeen[key], now = Date.now();
+  if(seen && (seen.req === s.requests || now - seen.at < minMs)) return;
+  _secSeen[key] = {req: s.requests, at: now};
+  fn();
+}
+
+function onStats(s) {
+  RPS.push(s.rps); if(RPS.length>60) RPS.shift();
+  prevReq = s.requests; prevTime = Date.now();
+  const set=(id,v)=>{const e=document.getElementById(id);if(e)e.textContent=v;};
+  set('chart-rps', s.rps+' req/s');
+  drawRpsChart();
+  set('s-req',fmt(s.requests)); set('s-rps',s.rps+' req/s');
+  set('s-cache',fmt(s.cache||0)); set('s-err',fmt(s.errors||0));
+  const tot=s.requests||1,cP=Math.round((s.cache||0)/tot*100),eP=Math.round((s.errors||0)/tot*100);
+  set('s-cache-pct',cP+'% hit rate'); set('s-err-pct',eP+'% error rate');
+  gauge('g-cache',cP,'g-cache-txt');gauge('g-err',eP,'g-err-txt');
+  gauge('g-ok',Math.max(0,100-eP),'g-ok-txt');
+  set('up-req',fmt(s.requests||0)); set('up-err',fmt(s.errors||0));
+
+  if(sectionActive('dashboard') && _dashData.length) {
+    _dashData.push({ts:s.ts, rps:s.rps, eps:s.eps, cache:s.cache, conns:s.conns, lat:s.lat});
+    if(_dashData.length > 120) _dashData.shift();
+    if(_dashData.length > 1) drawDashboard();
+  }
+  if(sectionActive('overview') || sectionActive('dashboard'))
+    refreshIfMoved('waf-cards', s, 5000, updateWafDashboard);
+  if(sectionActive('logs'))      refreshIfMoved('logs', s, 2000, addAccessLog);
+  if(sectionActive('waf'))       refreshIfMoved('waf', s, 4000, loadWaf);
+  if(sectionActive('waf-regex')) refreshIfMoved('waf-regex', s, 4000, loadWafRegex);
+}
+
+// Fallback polling — what the streams would have delivered for the visible section
+function pollTick() {
+  if(!_statsCtrl) {
+    if(sectionActive('overview'))  { fetchAll(); animateRefresh(5000); }
+    if(sectionActive('dashboard')) { loadDashboard(120); updateWafDashboard(); }
+    if(sectionActive('logs'))      addAccessLog();
+    if(sectionActive('waf'))       loadWaf();
+    if(sectionActive('waf-regex')) loadWafRegex();
+  }
+  if(sectionActive('logs') && !_sseSource) fetchServerLogs();
+}
+
+function syncPolling() {
+  const need = authHeader && (!_statsCtrl || (sectionActive('logs') && !_sseSource));
+  if(need && !_pollTimer) _pollTimer = setInterval(pollTick, 5000);
+  if(!need && _pollTimer){ clearInterval(_pollTimer); _pollTimer = null; }
 }
 
 function appendSSEEntries(entries) {
@@ -3229,10 +3297,11 @@ async function fetchAll(){
     if(verEl) verEl.textContent = 'v' + d.version;
   }
   const now=Date.now();
-  // rps — use server-provided value (aggregated across all workers)
+  // rps — use server-provided value (aggregated across all workers);
+  // the chart history comes from /np_stats/stream while it runs
   const rps = d.req_per_sec || 0;
   prevReq=d.requests;prevTime=now;
-  RPS.push(rps);if(RPS.length>60)RPS.shift();
+  if(!_statsCtrl){RPS.push(rps);if(RPS.length>60)RPS.shift();}
   const $=(id)=>document.getElementById(id);
   const set=(id,v)=>{const e=$(id);if(e)e.textContent=v;};
   if($('chart-rps'))$('chart-rps').textContent=rps+' req/s';
@@ -3255,7 +3324,6 @@ async function fetchAll(){
   setEl('up-req',fmt(d.requests||0));
   setEl('up-err',fmt(d.errors||0));
   setEl('up-lat','<1ms');
-  addAccessLog();
   updateWafHeaderBadges();
   // Update WAF cards — zawsze (widoczne w Overview i Dashboard)
   updateWafDashboard();
@@ -3269,21 +3337,8 @@ function init(){
   loadBlacklist();loadSettings();loadUpstreams();
   fetchAll();animateRefresh(3000);
   updateWafHeaderBadges();
-  // Overview auto-refresh: only when overview tab active
-  refreshTimer=setInterval(()=>{
-    fetchAll();  // zawsze — zapewnia RPS array i WAF stats
-    const ov=document.getElementById('sec-overview');
-    if(ov&&ov.classList.contains('active')) animateRefresh(5000);
-  },5000);
-  // Logs auto-refresh: only when logs tab active  
-  setInterval(()=>{
-    const lv=document.getElementById('sec-logs');
-    if(lv&&lv.classList.contains('active')){addAccessLog();}
-  }, 6000);
-  setInterval(()=>{
-    const lv=document.getElementById('sec-logs');
-    if(lv&&lv.classList.contains('active')){fetchServerLogs();}
-  }, 6000);
+  // Live counters and charts: /np_stats/stream (polling only if it fails)
+  startStatsStream();
 }
 </script>
 
@@ -14,6 +14,8 @@
 #include <cstring>
 #include <algorithm>
 #include <functional>
+#include "np_mem.hh"
+#include "waf_input.hh"
 
 // ── Suspicious path patterns ─────────────────────────────────────────────────
 static constexpr const char* SCAN_PATHS[] = {
@@ -102,6 +104,24 @@ struct AutoBan {
                   int status_code = 0)
     {
         if(!cfg.enabled || ip.empty()) return Verdict::Allow;
+        std::string path_lower = path, ua_lower = ua;
+        std::transform(path_lower.begin(), path_lower.end(), path_lower.begin(), ::tolower);
+        std::transform(ua_lower.begin(), ua_lower.end(), ua_lower.begin(), ::tolower);
+        return check(ip, path, path_lower, ua_lower, status_code);
+    }
+
+    // Request already normalized: the folded views come from WafInput
+    Verdict check(const std::string& ip, const WafInput& in, int status_code = 0) {
+        if(!cfg.enabled || ip.empty()) return Verdict::Allow;
+        return check(ip, in.raw_path, in.path_lower, in.ua_lower, status_code);
+    }
+
+    Verdict check(const std::string& ip,
+                  std::string_view path,
+                  std::string_view path_lower,
+                  std::string_view ua_lower,
+                  int status_code)
+    {
         // Never ban private/loopback IPs
         if(ip == "127.0.0.1" || ip == "::1" ||
            ip.substr(0,8) == "192.168." ||
@@ -137,11 +157,9 @@ struct AutoBan {
         if(status_code == 404) st.err404_times.push_back(now);
 
         // ── 1. Bad User-Agent ─────────────────────────────────────────────────
-        if(cfg.ban_bad_ua && !ua.empty()) {
-            std::string ua_lower = ua;
-            std::transform(ua_lower.begin(), ua_lower.end(), ua_lower.begin(), ::tolower);
+        if(cfg.ban_bad_ua && !ua_lower.empty()) {
             for(int i = 0; BAD_UA[i]; i++) {
-                if(ua_lower.find(BAD_UA[i]) != std::string::npos) {
+                if(ua_lower.find(BAD_UA[i]) != std::string_view::npos) {
                     slide(st.ua_times, now, cfg.window_sec);
                     st.ua_times.push_back(now);
                     // Bad UA: ban immediately on first hit
@@ -151,16 +169,13 @@ struct AutoBan {
         }
 
         // ── 2. Scan path detection ────────────────────────────────────────────
-        if(cfg.ban_scanpaths && !path.empty()) {
-            std::string path_lower = path;
-            std::transform(path_lower.begin(), path_lower.end(),
-                           path_lower.begin(), ::tolower);
+        if(cfg.ban_scanpaths && !path_lower.empty()) {
             for(int i = 0; SCAN_PATHS[i]; i++) {
-                if(path_lower.find(SCAN_PATHS[i]) != std::string::npos) {
+                if(path_lower.find(SCAN_PATHS[i]) != std::string_view::npos) {
                     slide(st.scan_times, now, cfg.window_sec);
                     st.scan_times.push_back(now);
                     if((int)st.scan_times.size() >= cfg.scan_threshold)
-                        return do_ban(ip, "scan", path.substr(0, 80));
+                        return do_ban(ip, "scan", std::string(path.substr(0, 80)));
                     break;
                 }
             }
@@ -216,6 +231,17 @@ struct AutoBan {
         stats_.clear();
     }
 
+    // /np_memory: per-IP windows — one entry per IP ever checked, kept until
+    // clear(); each IpStats owns four deques (a block each, even when empty)
+    MemUsage ip_stats_mem() {
+        std::lock_guard<std::mutex> lk(mu_);
+        MemUsage m{mem_hash_nodes(stats_), stats_.size()};
+        for(auto& [ip, st] : stats_)
+            m.bytes += mem_heap(ip) + mem_deque(st.req_times) + mem_deque(st.err404_times)
+                     + mem_deque(st.scan_times) + mem_deque(st.ua_times);
+        return m;
+    }
+
     // Public mutex accessor for persistence helpers in server.cc
     std::mutex& mu_pub() { return mu_; }
 
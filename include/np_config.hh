@@ -47,6 +47,7 @@ struct UpstreamServer {
 };
 
 enum class LBStrategy { LeastConn, RoundRobin, WeightedRR, IPHash };
+enum class UpstreamProto { Http1, H2 };
 
 struct UpstreamConfig {
     std::string                  name;
@@ -58,6 +59,8 @@ struct UpstreamConfig {
     int   hc_expected_status{200};  // 200-399 = ok by default
     LBStrategy strategy{LBStrategy::LeastConn};
     bool  sticky_sessions{false};   // hash client IP → same backend
+    UpstreamProto proto{UpstreamProto::Http1};
+    int   h2_connections{2};        // proto h2: multiplexed connections per backend
 };
 
 // ── Rate limit ────────────────────────────────────────────────────────────────
@@ -147,8 +150,31 @@ struct ServerConfig {
     int   send_timeout{60};
     int   read_timeout{30};
 
-    std::string access_log{"/var/log/nodeproxy/access.log"};
-    std::string error_log{"/var/log/nodeproxy/error.log"};
+    // HTTP/2 (listen ... http2) — SETTINGS advertised to clients
+    int   http2_max_concurrent_streams{128};
+    int   http2_initial_window_size{65535};      // per-stream receive window (bytes)
+    int   http2_connection_window_size{1048576}; // connection receive window (bytes)
+
+    // access_log <path|off> [combined|json|binary] [zstd[=level]] [buffer=records];
+    // access_log and capture are written by one process-wide writer each:
+    // only the first server block's settings apply (other blocks → warning)
+    std::string access_log{"/var/log/nas-web/access.log"};
+    std::string access_log_format{"combined"};
+    int         access_log_zstd{0};          // zstd level, 0 = uncompressed
+    int         access_log_buffer{4096};     // ring slots per worker (512 B each)
+    // capture <path|off> [sample=0..1] [headers=A,B] [scrub=A,B] [zstd[=level]] [buffer=records];
+    std::string capture{"off"};
+    double      capture_sample{1.0};         // share of requests recorded
+    std::vector<std::string> capture_headers{
+        "Accept", "Accept-Encoding", "Accept-Language", "Content-Type", "User-Agent",
+        "Referer", "Cache-Control", "If-None-Match", "If-Modified-Since", "Range",
+        "X-Requested-With", "Cookie", "Authorization" };
+    std::vector<std::string> capture_scrub;  // values replaced, besides the built-in list
+    int         capture_zstd{0};
+    int         capture_buffer{4096};
+    bool        access_log_set{false};       // directive present in this block
+    bool        capture_set{false};
+    std::string error_log{"/var/log/nas-web/error.log"};
     std::unordered_map<int,std::string> error_pages;  // status → file/url
 };
 
@@ -179,6 +205,18 @@ struct Config {
     // Plain HTTP requests receive 301 redirect to https://.
     bool admin_tls_only = true;
 
+    // /metrics (OpenMetrics) — separate from admin auth, off unless enabled
+    // (otherwise /metrics goes to the locations like any other path).
+    // Neither allow-list nor token → loopback only.
+    bool metrics_enabled{false};
+    std::vector<std::string> metrics_allow;  // IP prefixes, e.g. "10.0.0."
+    std::string metrics_token;               // "Authorization: Bearer <token>"
+
+    // Per-request phase timing
+    std::vector<std::string> server_timing_allow; // IP prefixes that get Server-Timing; empty = none
+    int  slow_request_ms{1000};                   // → slow-request ring (/np_slow); 0 = off
+    int  loop_stall_warn_ms{500};                 // worker loop blocked this long → warning; 0 = off
+
     // ── Feature flags ────────────────────────────────────────────────────────
     bool  module_cache{true};
     bool  module_ratelimit{true};
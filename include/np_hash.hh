@@ -0,0 +1,56 @@
+#pragma once
+// ── SipHash-2-4, 128-bit output ──────────────────────────────────────────────
+// Keyed hash for lookups whose keys come from clients (a collision chosen by
+// an attacker must not be findable without the key). Reference algorithm
+// (Aumasson & Bernstein), little-endian loads; fnv1a (np_types.hh) stays
+// for non-adversarial ids.
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+struct SipKey  { uint64_t k0{0}, k1{0}; };
+struct Hash128 {
+    uint64_t lo{0}, hi{0};
+    bool operator==(const Hash128& o) const { return lo == o.lo && hi == o.hi; }
+};
+
+inline uint64_t sip_rotl(uint64_t x, int b) { return (x << b) | (x >> (64 - b)); }
+
+// A macro, not a lambda: the four words must stay in registers
+#define NP_SIPROUND do { \
+        v0 += v1; v1 = sip_rotl(v1, 13); v1 ^= v0; v0 = sip_rotl(v0, 32); \
+        v2 += v3; v3 = sip_rotl(v3, 16); v3 ^= v2; \
+        v0 += v3; v3 = sip_rotl(v3, 21); v3 ^= v0; \
+        v2 += v1; v1 = sip_rotl(v1, 17); v1 ^= v2; v2 = sip_rotl(v2, 32); \
+    } while(0)
+
+inline Hash128 siphash128(const SipKey& key, std::string_view s) {
+    uint64_t v0 = 0x736f6d6570736575ULL ^ key.k0;
+    uint64_t v1 = 0x646f72616e646f6dULL ^ key.k1 ^ 0xee;
+    uint64_t v2 = 0x6c7967656e657261ULL ^ key.k0;
+    uint64_t v3 = 0x7465646279746573ULL ^ key.k1;
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(s.data());
+    size_t n = s.size(), full = n & ~size_t(7);
+    for(size_t i = 0; i < full; i += 8) {
+        uint64_t m;
+        std::memcpy(&m, p + i, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        m = __builtin_bswap64(m);
+#endif
+        v3 ^= m; NP_SIPROUND; NP_SIPROUND; v0 ^= m;
+    }
+    uint64_t b = uint64_t(n) << 56;
+    for(size_t i = 0; i < (n & 7); i++) b |= uint64_t(p[full + i]) << (8 * i);
+    v3 ^= b; NP_SIPROUND; NP_SIPROUND; v0 ^= b;
+
+    v2 ^= 0xee;
+    NP_SIPROUND; NP_SIPROUND; NP_SIPROUND; NP_SIPROUND;
+    Hash128 h;
+    h.lo = v0 ^ v1 ^ v2 ^ v3;
+    v1 ^= 0xdd;
+    NP_SIPROUND; NP_SIPROUND; NP_SIPROUND; NP_SIPROUND;
+    h.hi = v0 ^ v1 ^ v2 ^ v3;
+    return h;
+}
+#undef NP_SIPROUND
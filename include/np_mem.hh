@@ -0,0 +1,67 @@
+// ─────────────────────────────────────────────────────────────────────────────
+//  np_mem.hh  —  memory accounting helpers (GET /np_memory)
+// ─────────────────────────────────────────────────────────────────────────────
+// Every subsystem that keeps data around reports a MemUsage: live bytes and
+// object count. Bytes are payload plus the node / bucket / block overhead of
+// the std container holding it, estimated from the libstdc++ layouts — good
+// enough for budgets and trends, not a byte-exact match for RSS.
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <deque>
+#include <list>
+#include <algorithm>
+#include <atomic>
+#include <memory_resource>
+
+struct MemUsage {
+    uint64_t bytes{0};
+    uint64_t objects{0};
+    MemUsage& operator+=(const MemUsage& o) { bytes += o.bytes; objects += o.objects; return *this; }
+};
+
+// Heap block of a string; 0 while it fits the small-string buffer
+inline uint64_t mem_heap(const std::string& s) {
+    static const size_t sso = std::string().capacity();
+    return s.capacity() > sso ? s.capacity() + 1 : 0;
+}
+
+// unordered_map / unordered_set: one node per element (next pointer + value
+// + cached hash) and the bucket array; heap behind the values is not included
+template<class M> inline uint64_t mem_hash_nodes(const M& m) {
+    return m.size() * (sizeof(typename M::value_type) + 2 * sizeof(void*))
+         + m.bucket_count() * sizeof(void*);
+}
+
+// std::list: value + prev/next per node
+template<class T> inline uint64_t mem_list_nodes(const std::list<T>& l) {
+    return l.size() * (sizeof(T) + 2 * sizeof(void*));
+}
+
+// std::deque: 512-byte blocks (one element per block when larger) plus the
+// block map; a default-constructed deque already owns one block
+template<class T> inline uint64_t mem_deque(const std::deque<T>& d) {
+    constexpr size_t per = sizeof(T) < 512 ? 512 / sizeof(T) : 1;
+    size_t blocks = d.size() / per + 1;
+    return blocks * per * sizeof(T) + std::max<size_t>(8, blocks + 2) * sizeof(void*);
+}
+
+// Heap-backed upstream for a pool resource that remembers how much it holds
+// (a pool keeps its blocks until destroyed — this is its footprint)
+class CountingResource : public std::pmr::memory_resource {
+public:
+    uint64_t bytes() const { return bytes_.load(std::memory_order_relaxed); }
+private:
+    void* do_allocate(size_t n, size_t al) override {
+        void* p = std::pmr::new_delete_resource()->allocate(n, al);
+        bytes_.fetch_add(n, std::memory_order_relaxed);
+        return p;
+    }
+    void do_deallocate(void* p, size_t n, size_t al) override {
+        std::pmr::new_delete_resource()->deallocate(p, n, al);
+        bytes_.fetch_sub(n, std::memory_order_relaxed);
+    }
+    bool do_is_equal(const std::pmr::memory_resource& o) const noexcept override { return this == &o; }
+    std::atomic<uint64_t> bytes_{0};
+};
@@ -0,0 +1,43 @@
+#pragma once
+// ── USDT static tracepoints, provider "nasweb" ────────────────────────────────
+// Built with -DWITH_USDT=ON (needs <sys/sdt.h>, systemtap-sdt-dev /
+// systemtap-sdt-devel) every NW_PROBEn() is a single nop plus a .note.stapsdt
+// entry until bpftrace / perf / bcc attaches to it — no rebuild, no logging.
+// Without it the macros expand to nothing and the arguments are not evaluated.
+//
+// Arguments must stay cheap (pointers, ints, c_str()): they are computed even
+// when nobody is attached. `conn` is the Conn* and correlates the probes of
+// one request (HTTP/2: the stream's Conn).
+//
+//   conn__accept       (conn, worker, ip, tls)
+//   request__parsed    (conn, method, path, parse_us)
+//   request__static    (conn, path)
+//   cache__hit         (conn, path, not_modified)
+//   cache__miss        (conn, path)
+//   request__proxy     (conn, backend_host, backend_port, path)
+//   waf__block         (conn, ip, engine, category)       engine: "regex" | "modsec" | "janet"
+//   autoban__ban       (conn, ip)
+//   ratelimit__reject  (conn, ip, location)
+//   upstream__acquire  (conn, backend_host, backend_port, connect_us)   -1 = reused, -2 = failed
+//   upstream__release  (backend_host, backend_port, ok, conn_requests)
+//   response__write    (conn, status, bytes, dur_us)       dur_us: request start → queued
+//   conn__close        (conn, requests_served)
+//
+// Example: bpftrace -e 'usdt:/usr/local/bin/nas-web:nasweb:response__write
+//                        { @us[arg1] = hist(arg3); }'
+// (the list is also in README.md, "Tracing (USDT)")
+
+#if defined(NW_USDT) && __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define NW_PROBE1(name, a)                DTRACE_PROBE1(nasweb, name, a)
+#define NW_PROBE2(name, a, b)             DTRACE_PROBE2(nasweb, name, a, b)
+#define NW_PROBE3(name, a, b, c)          DTRACE_PROBE3(nasweb, name, a, b, c)
+#define NW_PROBE4(name, a, b, c, d)       DTRACE_PROBE4(nasweb, name, a, b, c, d)
+#define NW_PROBES_ENABLED 1
+#else
+#define NW_PROBE1(name, a)                do {} while(0)
+#define NW_PROBE2(name, a, b)             do {} while(0)
+#define NW_PROBE3(name, a, b, c)          do {} while(0)
+#define NW_PROBE4(name, a, b, c, d)       do {} while(0)
+#define NW_PROBES_ENABLED 0
+#endif
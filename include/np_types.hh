@@ -5,6 +5,7 @@
 #include <cstdint>
 #include <cstddef>
 #include <cstring>
+#include <strings.h>
 #include <ctime>
 #include <string>
 #include <string_view>
@@ -13,11 +14,13 @@
 #include <optional>
 #include <unordered_map>
 #include <functional>
+#include <memory_resource>
 #include <chrono>
 #include <atomic>
 #include <variant>
 #include <algorithm>
 #include <sstream>
+#include "np_mem.hh"
 
 #ifdef NAS_WEB_VERSION
 inline constexpr std::string_view NP_VERSION = NAS_WEB_VERSION;
@@ -64,25 +67,44 @@ inline Method method_parse(std::string_view s) {
 enum class HttpVersion { HTTP10=10, HTTP11=11, HTTP20=20, HTTP30=30 };
 
 // ── Header map (insertion-ordered, case-insensitive lookup) ──────────────────
+// Names and values live on a std::pmr resource: the heap by default, the
+// connection's per-request arena for a parsed HTTP/1 request (Conn::arena,
+// released in one go when the response is written). A copy-constructed
+// Headers is on the heap again, so copies of a Request never point into an arena.
 struct Headers {
-    std::vector<std::pair<std::string,std::string>> items;
+    using Str  = std::pmr::string;
+    using Item = std::pair<Str,Str>;
+    std::pmr::vector<Item> items;
 
-    void set(std::string k, std::string v) {
+    Headers() = default;
+    explicit Headers(std::pmr::memory_resource* r) : items(r) {}
+
+    void set(std::string_view k, std::string_view v) {
         for(auto&[ek,ev]:items)
-            if(strcasecmp(ek.c_str(),k.c_str())==0){ev=std::move(v);return;}
-        items.emplace_back(std::move(k),std::move(v));
+            if(name_eq(ek,k)){ev.assign(v.data(),v.size());return;}
+        items.emplace_back(k,v);
     }
     std::string_view get(std::string_view k) const {
         for(auto&[ek,ev]:items)
-            if(strcasecmp(ek.c_str(),k.data())==0) return ev;
+            if(name_eq(ek,k)) return ev;
         return {};
     }
     bool has(std::string_view k) const { return !get(k).empty(); }
     void remove(std::string_view k){
         items.erase(std::remove_if(items.begin(),items.end(),
-            [&](auto&kv){return strcasecmp(kv.first.c_str(),k.data())==0;}),
+            [&](auto&kv){return name_eq(kv.first,k);}),
             items.end());
     }
+    // Drop everything and continue on `r` — must run before the resource
+    // the old items came from is released (a moved-into vector keeps its
+    // own resource, so plain assignment would not detach it)
+    void reset(std::pmr::memory_resource* r = std::pmr::get_default_resource()) {
+        std::destroy_at(&items);
+        std::construct_at(&items, r);
+    }
+    static bool name_eq(std::string_view a, std::string_view b) {
+        return a.size()==b.size() && strncasecmp(a.data(),b.data(),a.size())==0;
+    }
     // merge: add headers not already present
     void merge(const Headers& other){
         for(auto&[k,v]:other.items) if(!has(k)) set(k,v);
@@ -251,6 +273,10 @@ inline int64_t now_ms(){
     return std::chrono::duration_cast<std::chrono::milliseconds>(
         std::chrono::steady_clock::now().time_since_epoch()).count();
 }
+inline int64_t now_us(){
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 inline uint32_t fnv1a(std::string_view s){
     uint32_t h=2166136261u;
     for(unsigned char c:s){h^=c;h*=16777619u;}
@@ -264,8 +290,15 @@ inline bool ci_eq(std::string_view a,std::string_view b){
 }
 
 // ── Log ring buffer ───────────────────────────────────────────────────────────
+// NW_LOG checks the level before any formatting. A message that passes is
+// vsnprintf'd straight into the calling thread's own ring (single producer,
+// no lock). drain() moves ring contents into the shared history (/np_logs),
+// writes them to stderr in one go and feeds the SSE callback. Before start()
+// drain runs inline after every message (startup, unit tests); after start()
+// a background thread drains every DRAIN_MS.
 #include <mutex>
 #include <deque>
+#include <thread>
 #include <cstdio>
 #include <cstdarg>
 
@@ -278,34 +311,178 @@ struct LogEntry {
     std::string msg;
 };
 
+// One message as written by the producing thread — fixed size, no heap
+struct LogSlot {
+    int64_t  ts_us;
+    LogLevel level;
+    uint16_t len;
+    char     module[24];
+    char     msg[480];
+};
+
+struct ThreadLogRing {
+    static constexpr size_t CAP = 128;               // power of two
+    alignas(64) std::atomic<uint64_t> head{0};       // owner thread
+    alignas(64) std::atomic<uint64_t> tail{0};       // drain (under drain_mu)
+    std::atomic<bool> orphaned{false};               // owner thread exited
+    LogSlot slots[CAP];
+};
+
 struct LogBuffer {
-    static constexpr size_t MAX = 500;
+    static constexpr size_t MAX      = 500;
+    static constexpr int    DRAIN_MS = 20;
     std::deque<LogEntry>    entries;
     std::mutex              mu;
     std::atomic<int>        min_level{1}; // INFO by default
+    std::atomic<uint64_t>   dropped{0};   // messages lost to a full per-thread ring
 
     // Optional SSE broadcast callback — set by server.cc after startup
     std::function<void(const LogEntry&)> sse_broadcast;
 
+    bool enabled(LogLevel lv) const {
+        return (int)lv >= min_level.load(std::memory_order_relaxed);
+    }
+
+    static int level_from(std::string_view s) {
+        if(s == "debug") return 0;
+        if(s == "warn" || s == "warning") return 2;
+        if(s == "error") return 3;
+        return 1;
+    }
+
+    __attribute__((format(printf, 4, 5)))
+    void logf(LogLevel lv, const char* mod, const char* fmt, ...) {
+        LogSlot* s = reserve();
+        if(!s) return;
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(s->msg, sizeof(s->msg), fmt, ap);
+        va_end(ap);
+        fill(s, lv, mod, n < 0 ? 0 : std::min<size_t>((size_t)n, sizeof(s->msg) - 1));
+        commit();
+    }
+
     void push(LogLevel lv, std::string_view mod, std::string_view msg) {
-        if((int)lv < min_level.load()) return;
-        LogEntry e;
-        e.ts     = (int64_t)time(nullptr);
-        e.level  = lv;
-        e.module = std::string(mod);
-        e.msg    = std::string(msg);
+        if(!enabled(lv)) return;
+        LogSlot* s = reserve();
+        if(!s) return;
+        size_t n = std::min(msg.size(), sizeof(s->msg) - 1);
+        memcpy(s->msg, msg.data(), n);
+        fill(s, lv, std::string(mod).c_str(), n);
+        commit();
+    }
+
+    // Single consumer for all thread rings; safe to call from any thread.
+    void drain() {
+        std::lock_guard<std::mutex> dl(drain_mu);
+        std::vector<std::shared_ptr<ThreadLogRing>> rs;
+        {
+            std::lock_guard<std::mutex> rl(reg_mu);
+            rs = rings;
+        }
+        struct Item { int64_t ts_us; LogEntry e; };
+        std::vector<Item> batch;
+        for(auto& r : rs) {
+            uint64_t t = r->tail.load(std::memory_order_relaxed);
+            uint64_t h = r->head.load(std::memory_order_acquire);
+            for(; t != h; t++) {
+                const LogSlot& sl = r->slots[t & (ThreadLogRing::CAP - 1)];
+                batch.push_back({sl.ts_us, {sl.ts_us / 1000000, sl.level, sl.module,
+                                            std::string(sl.msg, sl.len)}});
+            }
+            r->tail.store(t, std::memory_order_release);
+        }
+        {
+            std::lock_guard<std::mutex> rl(reg_mu);
+            rings.erase(std::remove_if(rings.begin(), rings.end(), [](auto& r){
+                return r->orphaned.load() && r->tail.load() == r->head.load(); }), rings.end());
+        }
+        if(uint64_t lost = dropped.exchange(0)) {
+            char m[64]; snprintf(m, sizeof(m), "%llu log messages dropped (ring full)", (unsigned long long)lost);
+            batch.push_back({INT64_MAX, {(int64_t)time(nullptr), LogLevel::WARN, "log", m}});
+        }
+        if(batch.empty()) return;
+        std::stable_sort(batch.begin(), batch.end(),
+                         [](const Item& a, const Item& b){ return a.ts_us < b.ts_us; });
+
+        static const char* lvtags[]={"DEBUG","INFO","WARN","ERROR"};
+        std::string out;
+        for(auto& it : batch) {
+            out += '['; out += lvtags[(int)it.e.level]; out += "]["; out += it.e.module;
+            out += "] "; out += it.e.msg; out += '\n';
+        }
+        fwrite(out.data(), 1, out.size(), stderr);
         {
             std::lock_guard<std::mutex> lg(mu);
-            entries.push_back(e);
+            for(auto& it : batch) entries.push_back(it.e);
             while(entries.size() > MAX) entries.pop_front();
         }
-        // Push to SSE clients (non-blocking — callback must be thread-safe)
-        if(sse_broadcast) sse_broadcast(e);
+        // Push to SSE subscribers — callback only queues, never waits on a client
+        if(sse_broadcast)
+            for(auto& it : batch) sse_broadcast(it.e);
+    }
+
+    // Switch to background draining (call once the process is set up)
+    void start() {
+        if(running.exchange(true)) return;
+        drainer = std::thread([this]{
+            pthread_setname_np(pthread_self(), "nw-log");
+            while(running.load(std::memory_order_relaxed)) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(DRAIN_MS));
+                drain();
+            }
+        });
+        async.store(true);
+    }
+    // Back to inline draining; flushes everything still queued
+    void stop() {
+        if(!running.exchange(false)) return;
+        async.store(false);
+        if(drainer.joinable()) drainer.join();
+        drain();
+    }
+    ~LogBuffer() { stop(); }
+
+    // One entry as a JSON object (shared by /np_logs and the SSE stream)
+    static std::string entry_json(const LogEntry& e) {
+        static const char* lvnames[]={"debug","info","warn","error"};
+        char buf[64];
+        // format timestamp
+        struct tm tm_info;
+        time_t t = (time_t)e.ts;
+        localtime_r(&t, &tm_info);
+        strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm_info);
+        // escape msg
+        std::string emsg;
+        for(char c : e.msg) {
+            if(c=='"') emsg+="\\\"";
+            else if(c=='\\') emsg+="\\\\";
+            else if(c=='\n') emsg+="\\n";
+            else if(c=='\r') emsg+="\\r";
+            else emsg+=c;
+        }
+        std::string out="{\"ts\":\"";out+=buf;out+="\",\"level\":\"";
+        out+=lvnames[(int)e.level];out+="\",\"module\":\"";
+        out+=e.module;out+="\",\"msg\":\"";out+=emsg;out+="\"}";
+        return out;
+    }
+
+    // /np_memory: history entries + the per-thread rings (fixed 128 slots each)
+    MemUsage mem_usage() {
+        MemUsage m;
+        {
+            std::lock_guard<std::mutex> lg(mu);
+            m.objects = entries.size();
+            m.bytes   = mem_deque(entries);
+            for(auto& e : entries) m.bytes += mem_heap(e.module) + mem_heap(e.msg);
+        }
+        std::lock_guard<std::mutex> rl(reg_mu);
+        m.bytes += rings.size() * sizeof(ThreadLogRing) + rings.capacity() * sizeof(rings[0]);
+        return m;
     }
 
     // Serialize to JSON array, optionally filter by level & since timestamp
     std::string to_json(int min_lv=0, int64_t since=0, size_t limit=200) {
-        static const char* lvnames[]={"debug","info","warn","error"};
         std::string out="[";
         std::lock_guard<std::mutex> lg(mu);
         size_t count=0;
@@ -313,42 +490,71 @@ struct LogBuffer {
             if((int)it->level < min_lv) continue;
             if(it->ts < since) break;
             if(count) out+=',';
-            char buf[64];
-            // format timestamp
-            struct tm* tm_info = localtime(&it->ts);
-            strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", tm_info);
-            // escape msg
-            std::string emsg;
-            for(char c : it->msg) {
-                if(c=='"') emsg+="\\\"";
-                else if(c=='\\') emsg+="\\\\";
-                else if(c=='\n') emsg+="\\n";
-                else emsg+=c;
-            }
-            out+="{\"ts\":\"";out+=buf;out+="\",\"level\":\"";
-            out+=lvnames[(int)it->level];out+="\",\"module\":\"";
-            out+=it->module;out+="\",\"msg\":\"";out+=emsg;out+="\"}";
+            out+=entry_json(*it);
             count++;
         }
         out+="]";
         return out;
     }
+
+private:
+    std::mutex        reg_mu;   // guards `rings` (registration / pruning only)
+    std::vector<std::shared_ptr<ThreadLogRing>> rings;
+    std::mutex        drain_mu;
+    std::thread       drainer;
+    std::atomic<bool> running{false}, async{false};
+
+    ThreadLogRing* my_ring() {
+        struct Owner {
+            std::shared_ptr<ThreadLogRing> r;
+            ~Owner() { if(r) r->orphaned.store(true); }
+        };
+        thread_local Owner own;
+        if(!own.r) {
+            own.r = std::make_shared<ThreadLogRing>();
+            std::lock_guard<std::mutex> rl(reg_mu);
+            rings.push_back(own.r);
+        }
+        return own.r.get();
+    }
+    LogSlot* reserve() {
+        ThreadLogRing* r = my_ring();
+        uint64_t h = r->head.load(std::memory_order_relaxed);
+        if(h - r->tail.load(std::memory_order_acquire) >= ThreadLogRing::CAP) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        return &r->slots[h & (ThreadLogRing::CAP - 1)];
+    }
+    static void fill(LogSlot* s, LogLevel lv, const char* mod, size_t len) {
+        struct timespec ts; clock_gettime(CLOCK_REALTIME, &ts);
+        s->ts_us = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+        s->level = lv;
+        s->len   = (uint16_t)len;
+        snprintf(s->module, sizeof(s->module), "%s", mod);
+    }
+    void commit() {
+        ThreadLogRing* r = my_ring();
+        r->head.store(r->head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        if(!async.load(std::memory_order_relaxed)) drain();
+    }
 };
 
 // Global log buffer — defined in server.cc
 extern LogBuffer g_log;
 
-// Logging macros
+// Logging macros — level is checked before the arguments are even evaluated
 #define NW_LOG(level, mod, fmt, ...) do { \
-    char _buf[512]; \
-    snprintf(_buf, sizeof(_buf), fmt, ##__VA_ARGS__); \
-    fprintf(stderr, "[%s][%s] %s\n", \
-        level==LogLevel::ERR?"ERROR":level==LogLevel::WARN?"WARN":level==LogLevel::INFO?"INFO":"DEBUG", \
-        mod, _buf); \
-    g_log.push(level, mod, _buf); \
+    if(g_log.enabled(level)) g_log.logf(level, mod, fmt, ##__VA_ARGS__); \
 } while(0)
 
 #define NW_INFO(mod,  fmt, ...) NW_LOG(LogLevel::INFO,  mod, fmt, ##__VA_ARGS__)
 #define NW_WARN(mod,  fmt, ...) NW_LOG(LogLevel::WARN,  mod, fmt, ##__VA_ARGS__)
 #define NW_ERROR(mod, fmt, ...) NW_LOG(LogLevel::ERR,   mod, fmt, ##__VA_ARGS__)
+// Release builds (NW_LOG_STRIP_DEBUG, see CMakeLists.txt) compile DEBUG call
+// sites away; the format string is still type-checked.
+#if defined(NW_LOG_STRIP_DEBUG)
+#define NW_DEBUG(mod, fmt, ...) do { if(false) g_log.logf(LogLevel::DEBUG, mod, fmt, ##__VA_ARGS__); } while(0)
+#else
 #define NW_DEBUG(mod, fmt, ...) NW_LOG(LogLevel::DEBUG, mod, fmt, ##__VA_ARGS__)
+#endif
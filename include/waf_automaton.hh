@@ -0,0 +1,680 @@
+#pragma once
+// ── WafAutomaton — linear-time matcher for the built-in WAF rules ───────────
+// Replaces std::regex (backtracking: one regex_search per pattern, each one
+// retried at every input offset, exponential on bad inputs) with:
+//
+//   - WafPattern parser: the ECMAScript subset the rules use — literals and
+//     escapes, classes [..] / [^..] with ranges, \d \w \s \D \W \S, `.`,
+//     groups ( ) / (?: ), |, * + ? {n} {n,} {n,m} (greedy or lazy), ^ $ \b \B.
+//     Case-insensitive (ASCII, as std::regex::icase in the "C" locale).
+//     Anything else (backreferences, lookaround) is a compile error.
+//   - WafProg: one Thompson NFA holding every pattern of one input kind
+//     behind an unanchored root; bytes are folded into equivalence classes.
+//   - WafDfa: lazy DFA over WafProg — NFA state sets are built on demand and
+//     cached, so one pass over the input reports every pattern that matches
+//     anywhere in it. Caches are per thread (the NFA is shared, read-only)
+//     and flushed when they reach WafDfa::MAX_STATES. An input that comes
+//     in pieces (a request body) is fed through a WafDfaCursor, which
+//     carries the state from one piece to the next.
+//   - waf_pike_find(): Pike VM for a single pattern, giving the leftmost-first
+//     match boundaries — the same substring std::regex_search reports. Used
+//     only for the pattern that decides the verdict (event detail).
+//
+// Time is O(input × program) in the worst case, O(input) once the DFA is
+// warm; there is no backtracking.
+
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <climits>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+static constexpr int WAF_MAX_PATTERNS = 256;   // per WafProg
+using WafPatternMask = std::bitset<WAF_MAX_PATTERNS>;
+using WafByteSet     = std::bitset<256>;
+
+struct WafPatternError : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+inline bool waf_is_word(unsigned char c) {
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+// ── Parser → AST ─────────────────────────────────────────────────────────────
+struct WafNode {
+    enum Kind : uint8_t { Set, Cat, Alt, Rep, Bol, Eol, WordB, NotWordB } kind{Cat};
+    WafByteSet           set;          // Set
+    std::vector<WafNode> kids;         // Cat, Alt, Rep (one kid)
+    int                  min{0}, max{-1};   // Rep; max -1 = unbounded
+    bool                 greedy{true};
+};
+
+class WafPattern {
+public:
+    static WafNode parse(std::string_view re, bool icase) {
+        WafPattern p(re, icase);
+        WafNode n = p.alt();
+        if(p.i_ != re.size()) p.fail("unmatched )");
+        return n;
+    }
+
+private:
+    WafPattern(std::string_view re, bool icase) : re_(re), icase_(icase) {}
+
+    [[noreturn]] void fail(const char* what) const {
+        throw WafPatternError(std::string(what) + " at offset " + std::to_string(i_));
+    }
+    bool more() const { return i_ < re_.size(); }
+    char peek() const { return re_[i_]; }
+
+    static WafByteSet word_set() {
+        WafByteSet s;
+        for(int c = 0; c < 256; c++) if(waf_is_word((unsigned char)c)) s.set(c);
+        return s;
+    }
+    static WafByteSet digit_set() {
+        WafByteSet s;
+        for(int c = '0'; c <= '9'; c++) s.set(c);
+        return s;
+    }
+    static WafByteSet space_set() {
+        WafByteSet s;
+        for(char c : {' ', '\t', '\n', '\v', '\f', '\r'}) s.set((unsigned char)c);
+        return s;
+    }
+    void add_char(WafByteSet& s, unsigned char c) const {
+        s.set(c);
+        if(icase_) {
+            if(c >= 'a' && c <= 'z') s.set(c - 32);
+            else if(c >= 'A' && c <= 'Z') s.set(c + 32);
+        }
+    }
+
+    WafNode alt() {
+        WafNode first = cat();
+        if(!more() || peek() != '|') return first;
+        WafNode n; n.kind = WafNode::Alt;
+        n.kids.push_back(std::move(first));
+        while(more() && peek() == '|') { i_++; n.kids.push_back(cat()); }
+        return n;
+    }
+
+    WafNode cat() {
+        WafNode n; n.kind = WafNode::Cat;
+        while(more() && peek() != '|' && peek() != ')') n.kids.push_back(repeat());
+        return n;
+    }
+
+    WafNode repeat() {
+        WafNode a = atom();
+        while(more()) {
+            int mn, mx;
+            char c = peek();
+            if(c == '*')      { mn = 0; mx = -1; i_++; }
+            else if(c == '+') { mn = 1; mx = -1; i_++; }
+            else if(c == '?') { mn = 0; mx = 1;  i_++; }
+            else if(c == '{') { i_++; braces(mn, mx); }
+            else break;
+            if(a.kind == WafNode::Bol || a.kind == WafNode::Eol ||
+               a.kind == WafNode::WordB || a.kind == WafNode::NotWordB)
+                fail("quantified assertion");
+            WafNode r; r.kind = WafNode::Rep; r.min = mn; r.max = mx;
+            if(more() && peek() == '?') { r.greedy = false; i_++; }
+            r.kids.push_back(std::move(a));
+            a = std::move(r);
+        }
+        return a;
+    }
+
+    int number() {
+        if(!more() || peek() < '0' || peek() > '9') fail("bad {} quantifier");
+        int v = 0;
+        while(more() && peek() >= '0' && peek() <= '9') {
+            v = v * 10 + (peek() - '0'); i_++;
+            if(v > 1000) fail("{} count too large");
+        }
+        return v;
+    }
+    void braces(int& mn, int& mx) {
+        mn = number(); mx = mn;
+        if(more() && peek() == ',') {
+            i_++;
+            mx = (more() && peek() == '}') ? -1 : number();
+        }
+        if(!more() || peek() != '}') fail("bad {} quantifier");
+        i_++;
+        if(mx != -1 && mx < mn) fail("{n,m} with m < n");
+    }
+
+    WafNode atom() {
+        WafNode n;
+        char c = re_[i_++];
+        switch(c) {
+        case '(': {
+            if(i_ + 1 < re_.size() && peek() == '?') {
+                if(re_[i_ + 1] != ':') fail("lookaround not supported");
+                i_ += 2;
+            }
+            n = alt();
+            if(!more() || peek() != ')') fail("missing )");
+            i_++;
+            return n;
+        }
+        case ')': fail("unmatched )");
+        case '*': case '+': case '?': case '{': fail("nothing to repeat");
+        case '[': return bracket();
+        case '^': n.kind = WafNode::Bol; return n;
+        case '$': n.kind = WafNode::Eol; return n;
+        case '.':
+            n.kind = WafNode::Set;
+            n.set.set(); n.set.reset('\n'); n.set.reset('\r');
+            return n;
+        case '\\': {
+            if(!more()) fail("trailing backslash");
+            char e = re_[i_++];
+            if(e == 'b') { n.kind = WafNode::WordB; return n; }
+            if(e == 'B') { n.kind = WafNode::NotWordB; return n; }
+            n.kind = WafNode::Set;
+            if(!class_escape(e, n.set)) add_char(n.set, (unsigned char)char_escape(e));
+            return n;
+        }
+        default:
+            n.kind = WafNode::Set;
+            add_char(n.set, (unsigned char)c);
+            return n;
+        }
+    }
+
+    // \d \w \s and negations; false if `e` is not one of them
+    bool class_escape(char e, WafByteSet& s) const {
+        switch(e) {
+        case 'd': s |= digit_set();  return true;
+        case 'D': s |= ~digit_set(); return true;
+        case 'w': s |= word_set();   return true;
+        case 'W': s |= ~word_set();  return true;
+        case 's': s |= space_set();  return true;
+        case 'S': s |= ~space_set(); return true;
+        default:  return false;
+        }
+    }
+    char char_escape(char e) const {
+        switch(e) {
+        case 'n': return '\n';
+        case 'r': return '\r';
+        case 't': return '\t';
+        case 'f': return '\f';
+        case 'v': return '\v';
+        case '0': return '\0';
+        default:
+            if(e >= '1' && e <= '9') fail("backreferences not supported");
+            if(waf_is_word((unsigned char)e)) fail("unknown escape");
+            return e;   // identity escape: \. \/ \$ \# ...
+        }
+    }
+
+    WafNode bracket() {
+        WafNode n; n.kind = WafNode::Set;
+        bool neg = more() && peek() == '^';
+        if(neg) i_++;
+        WafByteSet s;
+        while(true) {
+            if(!more()) fail("missing ]");
+            char c = re_[i_++];
+            if(c == ']') break;
+            int lo;
+            if(c == '\\') {
+                if(!more()) fail("trailing backslash");
+                char e = re_[i_++];
+                if(class_escape(e, s)) continue;
+                lo = (unsigned char)(e == 'b' ? '\b' : char_escape(e));
+            } else {
+                lo = (unsigned char)c;
+            }
+            if(i_ + 1 < re_.size() && peek() == '-' && re_[i_ + 1] != ']') {
+                i_++;
+                char h = re_[i_++];
+                int hi;
+                if(h == '\\') {
+                    if(!more()) fail("trailing backslash");
+                    char e = re_[i_++];
+                    WafByteSet dummy;
+                    if(class_escape(e, dummy)) fail("class escape as range end");
+                    hi = (unsigned char)(e == 'b' ? '\b' : char_escape(e));
+                } else {
+                    hi = (unsigned char)h;
+                }
+                if(hi < lo) fail("range out of order");
+                for(int x = lo; x <= hi; x++) add_char(s, (unsigned char)x);
+            } else {
+                add_char(s, (unsigned char)lo);
+            }
+        }
+        n.set = neg ? ~s : s;
+        return n;
+    }
+
+    std::string_view re_;
+    bool             icase_;
+    size_t           i_{0};
+};
+
+// ── Program ──────────────────────────────────────────────────────────────────
+struct WafInst {
+    enum Op : uint8_t { Byte, Split, Jmp, Assert, Match } op;
+    uint8_t assert_kind{0};   // WafNode::Bol / Eol / WordB / NotWordB
+    int32_t x{0};             // next pc; Match: pattern id
+    int32_t y{0};             // Split: second (lower-priority) pc; Byte: set index
+};
+
+struct WafProg {
+    std::vector<WafInst>    code;
+    std::vector<WafByteSet> sets;
+    std::vector<int32_t>    starts;        // pattern id → first pc
+    int32_t                 root{-1};      // unanchored fan-out to every start
+    uint8_t                 byte_class[256]{};
+    int                     n_classes{0};
+    uint64_t                id{0};         // unique, keys the per-thread DFA caches
+
+    int patterns() const { return (int)starts.size(); }
+
+    // Returns the pattern id; throws WafPatternError
+    int add(std::string_view re, bool icase) { return add(WafPattern::parse(re, icase)); }
+    int add(const WafNode& ast) {
+        if(patterns() >= WAF_MAX_PATTERNS) throw WafPatternError("too many patterns");
+        int pid = patterns();
+        size_t mark = code.size(), sets_mark = sets.size();
+        try {
+            starts.push_back((int32_t)code.size());
+            emit(ast);
+            code.push_back({WafInst::Match, 0, pid, 0});
+            if(code.size() > 200000) throw WafPatternError("program too large");
+        } catch(...) {
+            code.resize(mark); sets.resize(sets_mark); starts.resize(pid);
+            throw;
+        }
+        return pid;
+    }
+
+    // After the last add(): root fan-out and byte classes
+    void finish() {
+        static std::atomic<uint64_t> next_id{1};
+        id = next_id.fetch_add(1, std::memory_order_relaxed);
+        int n = patterns();
+        root = n ? (int32_t)code.size() : -1;
+        for(int p = 0; p < n; p++) {
+            int32_t here = (int32_t)code.size();
+            if(p + 1 < n) code.push_back({WafInst::Split, 0, starts[p], here + 1});
+            else          code.push_back({WafInst::Jmp,   0, starts[p], 0});
+        }
+        // Equivalence classes: bytes no set (and not \b) tells apart
+        std::vector<std::string> sig(256);
+        for(int c = 0; c < 256; c++) {
+            sig[c].reserve(sets.size() + 1);
+            sig[c] += waf_is_word((unsigned char)c) ? '1' : '0';
+            for(auto& s : sets) sig[c] += s.test(c) ? '1' : '0';
+        }
+        std::unordered_map<std::string, int> ids;
+        n_classes = 0;
+        for(int c = 0; c < 256; c++) {
+            auto [it, fresh] = ids.emplace(sig[c], n_classes);
+            if(fresh) n_classes++;
+            byte_class[c] = (uint8_t)it->second;
+        }
+    }
+
+private:
+    int32_t set_index(const WafByteSet& s) {
+        for(size_t i = 0; i < sets.size(); i++) if(sets[i] == s) return (int32_t)i;
+        sets.push_back(s);
+        return (int32_t)sets.size() - 1;
+    }
+    int32_t pc() const { return (int32_t)code.size(); }
+
+    // Sequential codegen: falling off the end of a fragment continues at the
+    // next instruction. Priority (leftmost-first): Split.x before Split.y.
+    void emit(const WafNode& n) {
+        switch(n.kind) {
+        case WafNode::Set:
+            code.push_back({WafInst::Byte, 0, pc() + 1, set_index(n.set)});
+            break;
+        case WafNode::Cat:
+            for(auto& k : n.kids) emit(k);
+            break;
+        case WafNode::Alt: {
+            std::vector<size_t> jumps;
+            for(size_t i = 0; i < n.kids.size(); i++) {
+                size_t split = code.size();
+                bool last = i + 1 == n.kids.size();
+                if(!last) code.push_back({WafInst::Split, 0, pc() + 1, 0});
+                emit(n.kids[i]);
+                if(!last) {
+                    jumps.push_back(code.size());
+                    code.push_back({WafInst::Jmp, 0, 0, 0});
+                    code[split].y = pc();
+                }
+            }
+            for(size_t j : jumps) code[j].x = pc();
+            break;
+        }
+        case WafNode::Rep: {
+            const WafNode& body = n.kids[0];
+            for(int i = 0; i < n.min; i++) emit(body);
+            if(n.max == -1) {
+                // L: split body, end ; body ; jmp L
+                int32_t loop = pc();
+                code.push_back({WafInst::Split, 0, 0, 0});
+                emit(body);
+                code.push_back({WafInst::Jmp, 0, loop, 0});
+                set_split(loop, loop + 1, pc(), n.greedy);
+            } else {
+                // nested optionals: x{0,3} = (x(x(x)?)?)? — every skip ends the run
+                std::vector<int32_t> splits;
+                for(int i = n.min; i < n.max; i++) {
+                    splits.push_back(pc());
+                    code.push_back({WafInst::Split, 0, 0, 0});
+                    emit(body);
+                }
+                for(int32_t s : splits) set_split(s, s + 1, pc(), n.greedy);
+            }
+            break;
+        }
+        case WafNode::Bol: case WafNode::Eol: case WafNode::WordB: case WafNode::NotWordB:
+            code.push_back({WafInst::Assert, (uint8_t)n.kind, pc() + 1, 0});
+            break;
+        }
+    }
+    void set_split(int32_t at, int32_t take, int32_t skip, bool greedy) {
+        code[at].x = greedy ? take : skip;
+        code[at].y = greedy ? skip : take;
+    }
+};
+
+// Assertion at a position: prev/next are -1 at the ends of the input
+inline bool waf_assert(uint8_t kind, int prev, int next) {
+    bool pw = prev >= 0 && waf_is_word((unsigned char)prev);
+    bool nw = next >= 0 && waf_is_word((unsigned char)next);
+    switch(kind) {
+    case WafNode::Bol:      return prev < 0;
+    case WafNode::Eol:      return next < 0;
+    case WafNode::WordB:    return pw != nw;
+    case WafNode::NotWordB: return pw == nw;
+    default:                return false;
+    }
+}
+
+// ── Lazy DFA ─────────────────────────────────────────────────────────────────
+// Global counters over all threads' caches (/np_waf_regex, /np_memory)
+struct WafDfaStats {
+    std::atomic<int64_t>  states{0};
+    std::atomic<int64_t>  bytes{0};
+    std::atomic<uint64_t> flushes{0};
+};
+inline WafDfaStats g_waf_dfa_stats;
+
+// Where an unfinished scan stopped. The state's NFA set is kept as well as
+// its id, so the scan can go on after the cache was flushed (ids renumbered)
+// or on another thread's DFA for the same program.
+struct WafDfaCursor {
+    uint64_t             prog_id{0};
+    uint64_t             epoch{0};     // WafDfa cache `st` belongs to
+    int32_t              st{-1};       // -1 = nothing fed yet
+    std::vector<int32_t> core;
+    uint8_t              flags{0};
+    WafPatternMask       found;        // patterns matched so far
+};
+
+class WafDfa {
+public:
+    static constexpr size_t MAX_STATES = 4096;
+
+    explicit WafDfa(const WafProg& p)
+        : prog_(p), prog_id_(p.id), stride_(p.n_classes + 1),
+          mark_(p.code.size(), 0), in_next_(p.code.size(), 0), epoch_(new_epoch()) {}
+    ~WafDfa() { account(-(int64_t)states_.size(), -(int64_t)mem_); }
+    WafDfa(const WafDfa&) = delete;
+    WafDfa& operator=(const WafDfa&) = delete;
+
+    uint64_t prog_id() const { return prog_id_; }
+
+    // Every pattern that matches somewhere in `s`
+    WafPatternMask scan(std::string_view s) {
+        WafPatternMask found;
+        if(prog_.patterns() == 0) return found;
+        end(run(start(), s, found), found);
+        return found;
+    }
+
+    // scan() in pieces: `s` continues the input of `c`, matches collect in
+    // c.found; finish() is the end of the input ($, \b at the very end)
+    void feed(WafDfaCursor& c, std::string_view s) {
+        if(prog_.patterns() == 0 || s.empty()) return;
+        save(c, run(resume(c), s, c.found));
+    }
+    const WafPatternMask& finish(WafDfaCursor& c) {
+        if(prog_.patterns() == 0) return c.found;
+        end(resume(c), c.found);
+        c.st = -1;
+        return c.found;
+    }
+
+private:
+    int32_t start() {
+        if(start_ < 0) start_ = intern({prog_.root}, FL_AT_START);
+        return start_;
+    }
+
+    int32_t run(int32_t st, std::string_view s, WafPatternMask& found) {
+        for(unsigned char b : s) {
+            int cls = prog_.byte_class[b];
+            size_t t = (size_t)st * stride_ + cls;
+            int32_t nx = next_[t];
+            if(nx < 0) { nx = step(st, cls, b); t = (size_t)st * stride_ + cls; }   // may renumber st
+            if(emit_[t]) found |= match_sets_[emit_[t]];
+            st = nx;
+        }
+        return st;
+    }
+
+    void end(int32_t st, WafPatternMask& found) {
+        size_t t = (size_t)st * stride_ + prog_.n_classes;
+        if(next_[t] < 0) { step(st, prog_.n_classes, -1); t = (size_t)st * stride_ + prog_.n_classes; }
+        if(emit_[t]) found |= match_sets_[emit_[t]];
+    }
+
+    // The cursor's state in this cache: same id while nothing was flushed,
+    // else rebuilt from its NFA set. A cursor of another program (the rules
+    // were recompiled) starts over.
+    int32_t resume(WafDfaCursor& c) {
+        if(c.st < 0 || c.prog_id != prog_id_) {
+            c.prog_id = prog_id_;
+            return start();
+        }
+        if(c.epoch == epoch_) return c.st;
+        return intern(c.core, c.flags);
+    }
+    void save(WafDfaCursor& c, int32_t st) {
+        c.st    = st;
+        c.epoch = epoch_;
+        c.core  = states_[st].core;
+        c.flags = states_[st].flags;
+    }
+    static uint64_t new_epoch() {
+        static std::atomic<uint64_t> next{1};
+        return next.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static constexpr uint8_t FL_PREV_WORD = 1, FL_AT_START = 2;
+
+    struct State { std::vector<int32_t> core; uint8_t flags; };
+
+    // Transition of `st` on class `cls` (byte `b`, -1 = end of input). A full
+    // cache is flushed first; `st` is then re-added and gets a new id.
+    int32_t step(int32_t& st, int cls, int b) {
+        uint8_t flags = states_[st].flags;
+        int prev = (flags & FL_AT_START) ? -1 : ((flags & FL_PREV_WORD) ? 'a' : ' ');
+        WafPatternMask matched;
+        std::vector<int32_t> next_core;
+        gen_++;
+        stack_.assign(states_[st].core.begin(), states_[st].core.end());
+        while(!stack_.empty()) {
+            int32_t pc = stack_.back(); stack_.pop_back();
+            if(mark_[pc] == gen_) continue;
+            mark_[pc] = gen_;
+            const WafInst& in = prog_.code[pc];
+            switch(in.op) {
+            case WafInst::Byte:
+                if(b >= 0 && prog_.sets[in.y].test((unsigned char)b) && in_next_[in.x] != gen_) {
+                    in_next_[in.x] = gen_;
+                    next_core.push_back(in.x);
+                }
+                break;
+            case WafInst::Split:  stack_.push_back(in.y); stack_.push_back(in.x); break;
+            case WafInst::Jmp:    stack_.push_back(in.x); break;
+            case WafInst::Assert: if(waf_assert(in.assert_kind, prev, b)) stack_.push_back(in.x); break;
+            case WafInst::Match:  matched.set(in.x); break;
+            }
+        }
+        int32_t emit = 0;
+        if(matched.any()) {
+            auto it = std::find(match_sets_.begin() + 1, match_sets_.end(), matched);
+            emit = (int32_t)(it - match_sets_.begin());
+            if(it == match_sets_.end()) match_sets_.push_back(matched);
+        }
+        int32_t to = -1;
+        if(b >= 0) {
+            if(in_next_[prog_.root] != gen_) next_core.push_back(prog_.root);   // unanchored
+            std::sort(next_core.begin(), next_core.end());
+            uint8_t nf = waf_is_word((unsigned char)b) ? FL_PREV_WORD : 0;
+            if(states_.size() >= MAX_STATES) {
+                // Flush; keep `st` (the caller indexes it) and restart from it
+                State keep = std::move(states_[st]);
+                flush();
+                st = intern(std::move(keep.core), keep.flags);
+            }
+            to = intern(std::move(next_core), nf);
+        }
+        size_t t = (size_t)st * stride_ + cls;
+        next_[t] = to < 0 ? 0 : to;
+        emit_[t] = emit;
+        return to;
+    }
+
+    int32_t intern(std::vector<int32_t> core, uint8_t flags) {
+        std::string key(reinterpret_cast<const char*>(core.data()), core.size() * sizeof(int32_t));
+        key += (char)flags;
+        auto it = index_.find(key);
+        if(it != index_.end()) return it->second;
+        int32_t id = (int32_t)states_.size();
+        size_t sz = key.size() * 2 + stride_ * 8 + sizeof(State) + 64;
+        states_.push_back({std::move(core), flags});
+        next_.resize(next_.size() + stride_, -1);
+        emit_.resize(emit_.size() + stride_, 0);
+        index_.emplace(std::move(key), id);
+        mem_ += sz;
+        account(1, (int64_t)sz);
+        return id;
+    }
+
+    void flush() {
+        account(-(int64_t)states_.size(), -(int64_t)mem_);
+        g_waf_dfa_stats.flushes.fetch_add(1, std::memory_order_relaxed);
+        states_.clear(); next_.clear(); emit_.clear(); index_.clear();
+        mem_ = 0; start_ = -1; epoch_ = new_epoch();
+    }
+    static void account(int64_t states, int64_t bytes) {
+        g_waf_dfa_stats.states.fetch_add(states, std::memory_order_relaxed);
+        g_waf_dfa_stats.bytes.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    const WafProg&                 prog_;
+    uint64_t                       prog_id_;
+    size_t                         stride_;          // classes + end of input
+    std::vector<State>             states_;
+    std::vector<int32_t>           next_;            // state × class → state (-1: not built)
+    std::vector<int32_t>           emit_;            // state × class → match_sets_ index
+    std::vector<WafPatternMask>    match_sets_{WafPatternMask{}};
+    std::unordered_map<std::string, int32_t> index_;
+    int32_t                        start_{-1};
+    size_t                         mem_{0};
+    std::vector<uint32_t>          mark_, in_next_;
+    std::vector<int32_t>           stack_;
+    uint32_t                       gen_{0};
+    uint64_t                       epoch_;           // new ids after every flush
+};
+
+// This thread's DFA for `p` (the NFA is shared; DFA caches are not)
+inline WafDfa& waf_dfa_for(const WafProg& p) {
+    thread_local std::vector<std::unique_ptr<WafDfa>> cache;
+    for(auto& d : cache) if(d->prog_id() == p.id) return *d;
+    if(cache.size() >= 8) cache.erase(cache.begin());   // programs of dead engines
+    cache.push_back(std::make_unique<WafDfa>(p));
+    return *cache.back();
+}
+
+// ── Pike VM ──────────────────────────────────────────────────────────────────
+// Leftmost-first match of pattern `pid` in `s`: {begin, end}, or {-1, -1}
+inline std::pair<long, long> waf_pike_find(const WafProg& p, int pid, std::string_view s) {
+    struct Thread { int32_t pc; long start; };
+    // Scratch reused by this thread's calls; marks are generation-stamped
+    struct Scratch {
+        std::vector<Thread>   clist, nlist;
+        std::vector<uint32_t> cmark, nmark;
+        std::vector<int32_t>  stack;
+        uint32_t              gen{0};
+    };
+    thread_local Scratch sc;
+    if(sc.cmark.size() < p.code.size() || sc.gen > UINT32_MAX - 2 * (uint32_t)s.size() - 4) {
+        sc.cmark.assign(std::max(sc.cmark.size(), p.code.size()), 0);
+        sc.nmark.assign(sc.cmark.size(), 0);
+        sc.gen = 0;
+    }
+    auto& clist = sc.clist; auto& nlist = sc.nlist;
+    auto& cmark = sc.cmark; auto& nmark = sc.nmark;
+    auto& stack = sc.stack; auto& gen   = sc.gen;
+    clist.clear();
+    uint32_t cgen = ++gen, ngen;
+    const long n = (long)s.size();
+
+    // Follow Split/Jmp/Assert from pc in priority order; Byte and Match land in `list`
+    auto add = [&](std::vector<Thread>& list, std::vector<uint32_t>& mark, uint32_t gen,
+                   int32_t pc0, long start, long pos) {
+        int prev = pos > 0 ? (unsigned char)s[pos - 1] : -1;
+        int next = pos < n ? (unsigned char)s[pos]     : -1;
+        stack.assign(1, pc0);
+        while(!stack.empty()) {
+            int32_t pc = stack.back(); stack.pop_back();
+            if(mark[pc] == gen) continue;
+            mark[pc] = gen;
+            const WafInst& in = p.code[pc];
+            switch(in.op) {
+            case WafInst::Split:  stack.push_back(in.y); stack.push_back(in.x); break;
+            case WafInst::Jmp:    stack.push_back(in.x); break;
+            case WafInst::Assert: if(waf_assert(in.assert_kind, prev, next)) stack.push_back(in.x); break;
+            default:              list.push_back({pc, start}); break;
+            }
+        }
+    };
+
+    std::pair<long, long> best{-1, -1};
+    for(long i = 0; i <= n; i++) {
+        if(best.first < 0) add(clist, cmark, cgen, p.starts[pid], i, i);   // lowest priority
+        else if(clist.empty()) break;
+        nlist.clear(); ngen = ++gen;
+        for(const Thread& t : clist) {
+            const WafInst& in = p.code[t.pc];
+            if(in.op == WafInst::Match) { best = {t.start, i}; break; }   // cut lower priority
+            if(i < n && p.sets[in.y].test((unsigned char)s[i]))
+                add(nlist, nmark, ngen, in.x, t.start, i + 1);
+        }
+        std::swap(clist, nlist); std::swap(cmark, nmark); std::swap(cgen, ngen);
+    }
+    return best;
+}
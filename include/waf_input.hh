@@ -0,0 +1,175 @@
+#pragma once
+// ── WafInput — one normalization pass per request (WAF, AutoBan, logs) ──────
+// dispatch() used to rebuild every header into a string for the regex WAF,
+// which then concatenated path + query + body into a target, URL-decoded a
+// second copy and searched the header dump for "User-Agent:"; AutoBan
+// lower-cased its own copies of the path and the UA on top of that.
+//
+// WafNormalizer does all of it once, into one buffer it keeps between
+// requests (one per worker — no allocation once it has grown to the
+// largest request seen), and hands out views:
+//
+//   target      "path query body " percent-decoded, '+' → ' ' — the input
+//               of the URI rules; path / query / body are its segments
+//   path_lower  raw path, ASCII-folded   (AutoBan scan paths)
+//   ua_lower    User-Agent, ASCII-folded (AutoBan bad UAs)
+//   raw_*, ua   the request's own strings (event log, BadUA rules)
+//   key         everything the WAF verdict depends on — target, folded UA
+//               (the rules ignore case), their lengths — in one run
+//               (verdict cache key)
+//
+// plus flags for what decoding ran into: a %XX left after one decode
+// (double encoding — %252e), NUL bytes, overlong UTF-8 (%c0%af = '/'),
+// stray '%'. Case folding of `target` is left to the automaton, whose byte
+// classes already fold ASCII (and the matched text stays readable).
+//
+// Views point into the normalizer's buffer and the request: valid until
+// the next run() on the same normalizer.
+//
+// The regex WAF leaves the body out of `target` (input_parts()) and decodes
+// it piece by piece as it arrives — waf_url_decode() with last = false
+// stops before a %XX cut by the end of a piece.
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+enum WafInputFlag : uint8_t {
+    WAF_IN_DOUBLE_ENC = 1 << 0,   // decoding produced a valid %XX again
+    WAF_IN_NUL        = 1 << 1,   // NUL byte (%00 or raw)
+    WAF_IN_OVERLONG   = 1 << 2,   // overlong UTF-8 sequence (C0/C1, E0 80-9F, F0 80-8F)
+    WAF_IN_BAD_PCT    = 1 << 3,   // '%' without two hex digits
+};
+static constexpr int WAF_IN_FLAG_COUNT = 4;
+
+inline const char* waf_input_flag_name(int bit) {
+    static const char* names[WAF_IN_FLAG_COUNT] = {"double_encoded", "nul", "overlong_utf8", "bad_percent"};
+    return bit >= 0 && bit < WAF_IN_FLAG_COUNT ? names[bit] : "?";
+}
+
+inline int waf_hexval(unsigned char c) {
+    if(c >= '0' && c <= '9') return c - '0';
+    c |= 0x20;
+    return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+// Flags for bytes already decoded (NUL, overlong UTF-8)
+inline void waf_scan_bytes(std::string_view d, uint8_t& flags) {
+    for(size_t i = 0; i < d.size(); i++) {
+        unsigned char c = (unsigned char)d[i];
+        if(c < 0xC0) { if(!c) flags |= WAF_IN_NUL; continue; }
+        unsigned char n = i + 1 < d.size() ? (unsigned char)d[i + 1] : 0;
+        if(c == 0xC0 || c == 0xC1 ||
+           (c == 0xE0 && n >= 0x80 && n < 0xA0) ||
+           (c == 0xF0 && n >= 0x80 && n < 0x90))
+            flags |= WAF_IN_OVERLONG;
+    }
+}
+
+// %XX → byte, '+' → ' ', appended to `out`; plain runs are copied in one go.
+// Returns the bytes of `s` consumed: all of them when `last`, otherwise a
+// '%' in the final two bytes is left for the next piece.
+inline size_t waf_url_decode(std::string_view s, std::string& out, uint8_t& flags, bool last = true) {
+    size_t start = out.size(), i = 0;
+    while(i < s.size()) {
+        size_t j = i;
+        while(j < s.size() && s[j] != '%' && s[j] != '+') j++;
+        out.append(s.data() + i, j - i);
+        i = j;
+        if(j == s.size()) break;
+        if(s[j] == '+') { out += ' '; i++; continue; }
+        if(!last && j + 2 >= s.size()) break;   // %X cut off: next piece
+        i = j + 1;
+        int hi = j + 2 < s.size() ? waf_hexval(s[j + 1]) : -1;
+        int lo = hi >= 0 ? waf_hexval(s[j + 2]) : -1;
+        if(lo < 0) { flags |= WAF_IN_BAD_PCT; out += '%'; continue; }
+        char c = (char)(hi << 4 | lo);
+        i = j + 3;
+        // %25 followed by two hex digits decodes to another %XX
+        if(c == '%' && i + 1 < s.size() && waf_hexval(s[i]) >= 0 && waf_hexval(s[i + 1]) >= 0)
+            flags |= WAF_IN_DOUBLE_ENC;
+        out += c;
+    }
+    waf_scan_bytes(std::string_view(out).substr(start), flags);
+    return i;
+}
+
+struct WafInput {
+    std::string_view raw_path, raw_query, ua;
+    std::string_view target, path, query, body;
+    std::string_view path_lower, ua_lower;
+    std::string_view key;
+    uint8_t          flags{0};
+};
+
+// Which parts go into `target` (WafRegexEngine::Config)
+struct WafInputParts {
+    bool   path{true}, query{true}, body{true};
+    size_t max_body{32768};
+};
+
+class WafNormalizer {
+public:
+    const WafInput& run(std::string_view path, std::string_view query,
+                        std::string_view body, std::string_view ua,
+                        const WafInputParts& parts = {}) {
+        buf_.clear();
+        uint8_t flags = 0;
+        // Offsets first: the views are taken once the buffer stopped growing
+        Seg sp = segment(parts.path, path, flags);
+        Seg sq = segment(parts.query, query, flags);
+        Seg sb = segment(parts.body && !body.empty(), body.substr(0, parts.max_body), flags);
+        size_t t1 = buf_.size();
+        Seg ul{buf_.size(), 0}; fold(ua); ul.end = buf_.size();
+        for(size_t len : {t1, ul.end - ul.begin}) {
+            uint32_t l = (uint32_t)len;
+            buf_.append(reinterpret_cast<const char*>(&l), sizeof(l));
+        }
+        size_t k1 = buf_.size();
+        Seg pl{buf_.size(), 0}; fold(path); pl.end = buf_.size();
+
+        std::string_view b(buf_);
+        in_.raw_path   = path;
+        in_.raw_query  = query;
+        in_.ua         = ua;
+        in_.target     = b.substr(0, t1);
+        in_.path       = sp.view(b);
+        in_.query      = sq.view(b);
+        in_.body       = sb.view(b);
+        in_.path_lower = pl.view(b);
+        in_.ua_lower   = ul.view(b);
+        in_.key        = b.substr(0, k1);
+        in_.flags      = flags;
+        return in_;
+    }
+
+    const WafInput& input() const { return in_; }
+    size_t capacity() const { return buf_.capacity(); }
+
+private:
+    struct Seg {
+        size_t begin, end;
+        std::string_view view(std::string_view b) const { return b.substr(begin, end - begin); }
+    };
+
+    // Decoded part of `target` and its separating space (when enabled)
+    Seg segment(bool on, std::string_view s, uint8_t& flags) {
+        Seg g{buf_.size(), buf_.size()};
+        if(!on) return g;
+        waf_url_decode(s, buf_, flags);
+        g.end = buf_.size();
+        buf_ += ' ';
+        return g;
+    }
+
+    void fold(std::string_view s) {
+        size_t start = buf_.size();
+        buf_.append(s);
+        for(size_t i = start; i < buf_.size(); i++)
+            if(buf_[i] >= 'A' && buf_[i] <= 'Z') buf_[i] += 32;
+    }
+
+    std::string buf_;
+    WafInput    in_;
+};
@@ -0,0 +1,380 @@
+#pragma once
+// ── WafPrefilter — required literals in front of the WAF automaton ──────────
+// Most rules cannot match without one of a few literals ("union", "<",
+// "wp-", "/etc/", "javascript"...). At compile time every pattern's AST
+// yields a factor set: strings of which any match must contain at least one
+// (RE2-style prefilter: exact sets through concatenation / alternation, the
+// best necessary set where they stop being exact). All factor sets of one
+// input go into one case-insensitive Aho-Corasick automaton.
+//
+// Per request the AC pass returns the candidate patterns — those whose
+// factor occurs, plus the few with no usable factor. No candidate: the
+// automaton is skipped. While the AC sits in its root state, bytes that
+// cannot start a factor are skipped 16 at a time (shufti, SSSE3, picked at
+// run time; scalar elsewhere).
+
+#include "waf_automaton.hh"
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define WAF_SHUFTI 1
+#endif
+
+class WafPrefilter {
+public:
+    static constexpr size_t MAX_EXACT = 64;   // strings in an exact set
+    static constexpr size_t MAX_ANY   = 128;  // strings in a necessary set
+    static constexpr size_t MAX_SET   = 6;    // bytes of a class kept as literals (\s)
+
+    // Factor set of pattern `pid` (ids as in the WafProg); empty = unfilterable
+    void add(int pid, const WafNode& ast) {
+        if((int)factors_.size() <= pid) factors_.resize(pid + 1);
+        Info in = info(ast);
+        bool usable = !in.set.empty() &&
+            std::none_of(in.set.begin(), in.set.end(), [](const std::string& s) { return s.empty(); });
+        if(usable) factors_[pid] = std::move(in.set);
+        else       always_.set(pid);
+    }
+
+    void finish() {
+        trie_.assign(1, Node{});
+        masks_.assign(1, WafPatternMask{});
+        std::memset(first_, 0, sizeof(first_));
+        // Alphabet: folded bytes that occur in some factor; the rest is class 0.
+        // Bytes that stand in for each other everywhere (the \s in "or\s+"
+        // gives "or ", "or\t"... for the same pattern) share a class, so
+        // such variants share trie states
+        std::vector<std::vector<std::string>> sig(256);   // (pattern, offset, rest) per byte
+        for(int pid = 0; pid < (int)factors_.size(); pid++) {
+            for(auto& f : factors_[pid]) for(size_t i = 0; i < f.size(); i++) {
+                sig[(unsigned char)f[i]].push_back(std::to_string(pid) + ':' + std::to_string(i) + ':' +
+                                                   f.substr(0, i) + f.substr(i + 1));
+            }
+        }
+        for(auto& g : sig) dedupe(g);
+        std::memset(cls_, 0, sizeof(cls_));
+        n_cls_ = 1;
+        std::vector<std::pair<std::vector<std::string>, int>> seen;
+        for(int c = 0; c < 256; c++) {
+            if(sig[c].empty()) continue;
+            auto it = std::find_if(seen.begin(), seen.end(), [&](auto& e) { return e.first == sig[c]; });
+            if(it != seen.end()) { cls_[c] = (uint16_t)it->second; continue; }
+            cls_[c] = (uint16_t)n_cls_;
+            seen.emplace_back(std::move(sig[c]), n_cls_++);
+        }
+        for(int c = 'A'; c <= 'Z'; c++) cls_[c] = cls_[c + 32];
+        // Trie
+        std::vector<WafPatternMask> term(1);
+        for(int pid = 0; pid < (int)factors_.size(); pid++) {
+            for(auto& f : factors_[pid]) {
+                int st = 0;
+                for(unsigned char c : f) {
+                    int k = cls_[c];
+                    int nx = -1;
+                    for(auto& [kc, to] : trie_[st].kids) if(kc == k) { nx = to; break; }
+                    if(nx < 0) {
+                        nx = (int)trie_.size();
+                        trie_[st].kids.push_back({k, nx});
+                        trie_.push_back(Node{});
+                        term.emplace_back();
+                    }
+                    st = nx;
+                }
+                term[st].set(pid);
+                unsigned char c0 = (unsigned char)f[0];
+                first_[c0] = 1;
+                if(c0 >= 'a' && c0 <= 'z') first_[c0 - 32] = 1;
+            }
+        }
+        // BFS: failure links, full transition table, outputs merged along links
+        size_t n = trie_.size();
+        std::vector<int32_t> delta(n * n_cls_, 0);
+        std::vector<int> fail(n, 0), order;
+        order.reserve(n);
+        for(auto& [k, to] : trie_[0].kids) { delta[k] = to; order.push_back(to); }
+        for(size_t q = 0; q < order.size(); q++) {
+            int st = order[q];
+            term[st] |= term[fail[st]];
+            for(int k = 0; k < n_cls_; k++) delta[st * n_cls_ + k] = delta[fail[st] * n_cls_ + k];
+            for(auto& [k, to] : trie_[st].kids) {
+                fail[to] = delta[fail[st] * n_cls_ + k];
+                delta[st * n_cls_ + k] = to;
+                order.push_back(to);
+            }
+        }
+        // Row per state: next-row offsets (premultiplied, no multiply in the
+        // scan loop) and one extra column with the masks_ index (0 = none)
+        int w = n_cls_ + 1;
+        table_.assign(n * w, 0);
+        for(size_t st = 0; st < n; st++) {
+            for(int k = 0; k < n_cls_; k++) table_[st * w + k] = delta[st * n_cls_ + k] * w;
+            if(term[st].none()) continue;
+            auto it = std::find(masks_.begin() + 1, masks_.end(), term[st]);
+            table_[st * w + n_cls_] = (int32_t)(it - masks_.begin());
+            if(it == masks_.end()) masks_.push_back(term[st]);
+        }
+        n_states_ = n;
+        trie_.clear(); trie_.shrink_to_fit();
+        build_shufti();
+    }
+
+    // Patterns that may match somewhere in `s`
+    WafPatternMask candidates(std::string_view s) const {
+        WafPatternMask m = always_;
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(s.data());
+        size_t n = s.size(), i = 0;
+        const int32_t* t = table_.data();
+        const int out = n_cls_;
+        int32_t row = 0;
+        while(i < n) {
+            if(row == 0) {
+                i = skip(p, i, n);
+                if(i >= n) break;
+            }
+            row = t[row + cls_[p[i++]]];
+            if(int32_t o = t[row + out]) m |= masks_[o];
+        }
+        return m;
+    }
+
+    const WafPatternMask&                  always()  const { return always_; }
+    const std::vector<std::string>&        factors(int pid) const {
+        static const std::vector<std::string> none;
+        return pid < (int)factors_.size() ? factors_[pid] : none;
+    }
+    size_t states() const { return n_states_; }
+    size_t mem_bytes() const {
+        size_t b = table_.capacity() * sizeof(int32_t)
+                 + masks_.capacity() * sizeof(WafPatternMask);
+        for(auto& fs : factors_) for(auto& f : fs) b += f.capacity() + sizeof(std::string);
+        return b;
+    }
+
+private:
+    // ── Factor extraction ────────────────────────────────────────────────────
+    // exact: the node matches exactly one of `set`. Otherwise every match
+    // contains one of `set`; empty = nothing known.
+    struct Info { bool exact{false}; std::vector<std::string> set; };
+
+    static Info exact(std::vector<std::string> s) { return {true, std::move(s)}; }
+    static Info any() { return {}; }
+
+    static void dedupe(std::vector<std::string>& v) {
+        std::sort(v.begin(), v.end());
+        v.erase(std::unique(v.begin(), v.end()), v.end());
+    }
+    // Necessary-set quality: the weakest string decides. Letters and
+    // digits are common in benign traffic, punctuation counts double
+    static int score(const Info& in) {
+        if(in.set.empty()) return -1;
+        int mn = INT32_MAX;
+        for(auto& s : in.set) {
+            int w = 0;
+            for(unsigned char c : s) w += isalnum(c) ? 1 : 2;
+            mn = std::min(mn, w);
+        }
+        return mn * 128 - (int)std::min<size_t>(in.set.size(), 127);
+    }
+    static Info as_match(Info in) { in.exact = false; return in; }
+    static std::vector<std::string> cross(const std::vector<std::string>& a,
+                                          const std::vector<std::string>& b) {
+        std::vector<std::string> r;
+        for(auto& x : a) for(auto& y : b) r.push_back(x + y);
+        dedupe(r);
+        return r;
+    }
+
+    // A run of exact kids multiplies out; `closed` collects strings that
+    // x+ (and x* when bridging) cut off while the run goes on without them
+    Info cat(const WafNode& n, bool bridge) const {
+        std::vector<std::string> cur{""}, closed;
+        std::vector<Info> cands;
+        bool all_exact = true;
+        auto flush = [&] {
+            std::vector<std::string> u = closed;
+            u.insert(u.end(), cur.begin(), cur.end());
+            dedupe(u);
+            cands.push_back({false, std::move(u)});
+            closed.clear();
+            cur = {""};
+        };
+        for(auto& k : n.kids) {
+            if(k.kind == WafNode::Rep && !(k.min == 1 && k.max == 1) && (k.min >= 1 || k.max != 1)) {
+                Info once = info(k.kids[0]);
+                bool room = once.exact && cur.size() * once.set.size() <= MAX_EXACT &&
+                            closed.size() + cur.size() * once.set.size() <= MAX_ANY;
+                if(k.min >= 1 && room) {
+                    // x+ : the first copy ends what came before, the
+                    // last one starts what follows ("or\s+" → "or ")
+                    all_exact = false;
+                    auto first = cross(cur, once.set);
+                    closed.insert(closed.end(), first.begin(), first.end());
+                    cur.clear();
+                    flush();
+                    cur = std::move(once.set);
+                    continue;
+                }
+                if(k.min == 0 && bridge && cur != std::vector<std::string>{""}) {
+                    // x* : either no copy (the run goes on) or the
+                    // first copy right after it ("[;|]\s*ls" → ";ls", "; ")
+                    all_exact = false;
+                    if(!room) { flush(); continue; }
+                    auto first = cross(cur, once.set);
+                    closed.insert(closed.end(), first.begin(), first.end());
+                    continue;
+                }
+            }
+            Info ki = info(k);
+            if(ki.exact && cur.size() * ki.set.size() <= MAX_EXACT &&
+               closed.size() + cur.size() * ki.set.size() <= MAX_ANY) {
+                cur = cross(cur, ki.set);
+                continue;
+            }
+            all_exact = false;
+            flush();
+            if(ki.exact) cur = std::move(ki.set);
+            else cands.push_back(as_match(std::move(ki)));
+        }
+        if(all_exact) return exact(std::move(cur));
+        flush();
+        return *std::max_element(cands.begin(), cands.end(),
+            [](const Info& a, const Info& b) { return score(a) < score(b); });
+    }
+
+    Info info(const WafNode& n) const {
+        switch(n.kind) {
+        case WafNode::Set: {
+            std::vector<std::string> s;
+            for(int c = 0; c < 256 && s.size() <= MAX_SET; c++) {
+                if(!n.set.test(c)) continue;
+                char f = (c >= 'A' && c <= 'Z') ? (char)(c + 32) : (char)c;
+                if(std::find(s.begin(), s.end(), std::string(1, f)) == s.end()) s.emplace_back(1, f);
+            }
+            return s.size() <= MAX_SET ? exact(std::move(s)) : any();
+        }
+        case WafNode::Bol: case WafNode::Eol: case WafNode::WordB: case WafNode::NotWordB:
+            return exact({""});
+        case WafNode::Cat: {
+            // x* either ends the run or bridges it (below); both are valid,
+            // keep the better set
+            Info a = cat(n, false), b = cat(n, true);
+            if(a.exact) return a;
+            return score(b) > score(a) ? b : a;
+        }
+
+        case WafNode::Alt: {
+            std::vector<Info> kids;
+            bool all_exact = true;
+            size_t total = 0;
+            for(auto& k : n.kids) {
+                kids.push_back(info(k));
+                all_exact &= kids.back().exact;
+                total += kids.back().set.size();
+                if(kids.back().set.empty()) return any();   // that branch tells nothing
+            }
+            std::vector<std::string> u;
+            for(auto& k : kids) u.insert(u.end(), k.set.begin(), k.set.end());
+            dedupe(u);
+            if(all_exact && u.size() <= MAX_EXACT) return exact(std::move(u));
+            if(total > MAX_ANY) return any();
+            return {false, std::move(u)};
+        }
+        case WafNode::Rep: {
+            Info ki = info(n.kids[0]);
+            if(n.min == 0) {
+                if(n.max == 1 && ki.exact && ki.set.size() < MAX_EXACT) {
+                    ki.set.push_back("");
+                    dedupe(ki.set);
+                    return ki;
+                }
+                return any();
+            }
+            if(n.min == 1 && n.max == 1) return ki;
+            return as_match(std::move(ki));   // at least one copy
+        }
+        }
+        return any();
+    }
+
+    // ── Root-state skip ──────────────────────────────────────────────────────
+    size_t skip(const unsigned char* p, size_t i, size_t n) const {
+#ifdef WAF_SHUFTI
+        if(shufti_ok_ && has_ssse3()) {
+            while(n - i >= 16) {
+                i = shufti_find(p, i, n, shufti_lo_, shufti_hi_);
+                if(n - i < 16) break;
+                if(first_[p[i]]) return i;
+                i++;   // bucket shared with other bytes: false positive
+            }
+        }
+#endif
+        while(i < n && !first_[p[i]]) i++;
+        return i;
+    }
+
+#ifdef WAF_SHUFTI
+    static bool has_ssse3() {
+        static const bool yes = __builtin_cpu_supports("ssse3");
+        return yes;
+    }
+    // First offset >= i whose 16-byte block lane passes the nibble tables,
+    // or the start of the last partial block
+    __attribute__((target("ssse3")))
+    static size_t shufti_find(const unsigned char* p, size_t i, size_t n,
+                              const uint8_t* lo_t, const uint8_t* hi_t) {
+        const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lo_t));
+        const __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hi_t));
+        const __m128i nib = _mm_set1_epi8(0x0f);
+        for(; n - i >= 16; i += 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+            __m128i a = _mm_shuffle_epi8(lo, _mm_and_si128(v, nib));
+            __m128i b = _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi16(v, 4), nib));
+            int none = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(a, b), _mm_setzero_si128()));
+            if(none != 0xffff) return i + __builtin_ctz(~none & 0xffff);
+        }
+        return i;
+    }
+#endif
+
+    // Byte b passes iff lo[b & 15] & hi[b >> 4]: high nibbles with the same
+    // set of low nibbles share one of 8 bucket bits (extra groups are merged
+    // into the last bucket — a superset, re-checked against first_)
+    void build_shufti() {
+        std::memset(shufti_lo_, 0, sizeof(shufti_lo_));
+        std::memset(shufti_hi_, 0, sizeof(shufti_hi_));
+        std::vector<uint16_t> groups;
+        for(int h = 0; h < 16; h++) {
+            uint16_t lows = 0;
+            for(int l = 0; l < 16; l++) if(first_[h << 4 | l]) lows |= (uint16_t)(1u << l);
+            if(!lows) continue;
+            size_t g = std::find(groups.begin(), groups.end(), lows) - groups.begin();
+            if(g == groups.size()) groups.push_back(lows);
+            int bucket = (int)std::min<size_t>(g, 7);
+            shufti_hi_[h] |= (uint8_t)(1u << bucket);
+            for(int l = 0; l < 16; l++) if(lows >> l & 1) shufti_lo_[l] |= (uint8_t)(1u << bucket);
+        }
+        // Worth it only when most bytes cannot start a factor
+        int starters = 0;
+        for(int c = 0; c < 256; c++) starters += first_[c];
+        shufti_ok_ = starters > 0 && starters < 128;
+    }
+
+    struct Node { std::vector<std::pair<int, int>> kids; };   // class → state (build only)
+
+    std::vector<std::vector<std::string>> factors_;
+    WafPatternMask              always_;
+    std::vector<Node>           trie_;
+    std::vector<int32_t>        table_;       // state × (class + output) → row offset
+    size_t                      n_states_{0};
+    std::vector<WafPatternMask> masks_;
+    uint16_t                    cls_[256]{};  // folded byte → class (0: in no factor)
+    int                         n_cls_{1};
+    uint8_t                     first_[256]{};
+    uint8_t                     shufti_lo_[16]{}, shufti_hi_[16]{};
+    bool                        shufti_ok_{false};
+};
@@ -1,15 +1,26 @@
 #pragma once
 // ── WafRegex — lightweight built-in WAF layer ────────────────────────────────
-// No external dependencies. Uses <regex> (C++11) for SQLi, XSS, path
-// traversal, command injection, SSRF, and common web exploit patterns.
+// No external dependencies. Regex rules for SQLi, XSS, path traversal,
+// command injection, SSRF, and common web exploit patterns.
 // Complements ModSecurity — always active, zero install overhead.
 //
-// Design: patterns compiled once at startup, checked per-request on
-// path + query + body (combined). Ban on first match → immediate 403.
-
+// Design: patterns compiled once at startup into one automaton per input
+// (waf_automaton.hh: path + query combined, and the User-Agent);
+// a request is a single linear pass over each. A literal prefilter
+// (waf_prefilter.hh) runs first and skips the automaton when no rule's
+// required literal occurs. Ban on first match → 403.
+//
+// The body is not part of that input: it goes through the URI automaton on
+// its own, chunk by chunk as it arrives (WafBodyScan), so it is inspected
+// whole, whatever its size, and a match can stop the request before the
+// rest of the body is read.
+
+#include "waf_automaton.hh"
+#include "waf_prefilter.hh"
+#include "waf_input.hh"
+#include "waf_verdict_cache.hh"
 #include <string>
 #include <vector>
-#include <regex>
 #include <deque>
 #include <mutex>
 #include <atomic>
@@ -26,6 +37,23 @@ struct WafRegexEvent {
     std::string category;
     std::string matched;    // which pattern matched (truncated)
     std::string detail;     // matched substring
+    uint8_t     flags{0};   // WafInputFlag seen while normalizing
+};
+
+// One request body under inspection: decoder carry-over and automaton
+// state between chunks (WafRegexEngine::body_feed / body_end)
+struct WafBodyScan {
+    WafDfaCursor   dfa;
+    std::string    pend;        // "%" / "%X" cut off at the end of a chunk
+    std::string    tail;        // last decoded bytes — event detail of a match across chunks
+    uint64_t       fed{0};      // raw body bytes consumed
+    uint8_t        flags{0};    // WafInputFlag seen while decoding
+    bool           done{false}; // end of the body reached
+    WafPatternMask hit;         // URI patterns matched in the body
+    std::string    detail;      // matched text of the first of them (rule order)
+    bool           cut{false};  // caller ended the request at the match (rest unread)
+
+    bool matched() const { return hit.any(); }
 };
 
 struct WafRegexEngine {
@@ -37,7 +65,6 @@ struct WafRegexEngine {
         bool check_query   = true;
         bool check_body    = true;
         bool check_headers = false;  // expensive, off by default
-        size_t max_body_check = 32768; // only check first 32KB of body
     } cfg;
 
     std::function<void(const std::string& ip, const std::string& reason)> on_block;
@@ -46,22 +73,52 @@ struct WafRegexEngine {
     std::atomic<uint64_t> total_blocked{0};
     std::atomic<uint64_t> total_detected{0};
 
+    // Prefilter pass-through: inputs scanned / handed to the automaton, and
+    // per category and per pattern how often a literal let it through
+    // (passed) and how often the automaton then confirmed it (matched)
+    static constexpr int MAX_CATEGORIES = 16;
+    std::atomic<uint64_t> pf_scanned{0};
+    std::atomic<uint64_t> pf_passed{0};
+    std::atomic<uint64_t> pf_cat_passed[MAX_CATEGORIES]{};
+    std::atomic<uint64_t> pf_cat_matched[MAX_CATEGORIES]{};
+    // Checked inputs per normalization finding (WafInputFlag bit)
+    std::atomic<uint64_t> input_flags[WAF_IN_FLAG_COUNT]{};
+
+    // Verdict caches (one per worker): lookups answered / sent to the engine.
+    // `generation` tags their entries — bumped on compile() and config changes
+    std::atomic<uint64_t> vc_hits{0};
+    std::atomic<uint64_t> vc_misses{0};
+    std::atomic<uint64_t> generation{1};
+    void config_changed() { generation.fetch_add(1, std::memory_order_release); }
+
+    // Bodies inspected, their bytes, those fed while still arriving, and
+    // matches found while the body was still arriving
+    std::atomic<uint64_t> body_checked{0};
+    std::atomic<uint64_t> body_bytes{0};
+    std::atomic<uint64_t> body_streamed{0};
+    std::atomic<uint64_t> body_early{0};
+
     std::deque<WafRegexEvent> events;
     std::mutex                events_mu;
 
     // ── Pattern categories ───────────────────────────────────────────────────
+    enum Input { IN_URI, IN_UA, IN_COUNT };   // decoded path+query (and the body) / User-Agent
+
     struct PatternSet {
         std::string category;
-        std::vector<std::regex> patterns;
+        Input       input = IN_URI;
+        std::vector<int>         ids;  // pattern ids in progs[input]
         std::vector<std::string> raw;  // for display in panel
+        WafPatternMask           mask; // ids as a set
     };
 
     std::vector<PatternSet> pattern_sets;
+    WafProg                 progs[IN_COUNT];
+    WafPrefilter            prefilters[IN_COUNT];
     bool compiled = false;
 
     // ── Pattern definitions ──────────────────────────────────────────────────
     void compile() {
-        auto flag = std::regex::icase | std::regex::optimize;
 
         // ── SQL Injection ─────────────────────────────────────────────────────
         PatternSet sqli; sqli.category = "SQLi";
@@ -89,11 +146,7 @@ struct WafRegexEngine {
             // Subqueries in params
             R"(\(\s*select\s+\w+\s+from\s+\w+)",
         };
-        for(auto& r : sqli_raw) {
-            try { sqli.patterns.emplace_back(r, flag); sqli.raw.push_back(r); }
-            catch(const std::regex_error&) { /* invalid regex pattern - skip */ }
-        }
-        pattern_sets.push_back(std::move(sqli));
+        add_set(sqli, sqli_raw);
 
         // ── Cross-Site Scripting (XSS) ────────────────────────────────────────
         PatternSet xss; xss.category = "XSS";
@@ -125,11 +178,7 @@ struct WafRegexEngine {
             // Encoded script
             R"(%3c\s*script|%3cscript)",
         };
-        for(auto& r : xss_raw) {
-            try { xss.patterns.emplace_back(r, flag); xss.raw.push_back(r); }
-            catch(const std::regex_error&) { /* invalid regex pattern - skip */ }
-        }
-        pattern_sets.push_back(std::move(xss));
+        add_set(xss, xss_raw);
 
         // ── Path Traversal ────────────────────────────────────────────────────
         PatternSet pt; pt.category = "PathTraversal";
@@ -143,11 +192,7 @@ struct WafRegexEngine {
             R"(c:[/\\]windows[/\\])",
             R"(\\\\.\\(pipe|mailslot|physical))",     // Windows UNC
         };
-        for(auto& r : pt_raw) {
-            try { pt.patterns.emplace_back(r, flag); pt.raw.push_back(r); }
-            catch(const std::regex_error&) { /* invalid regex pattern - skip */ }
-        }
-        pattern_sets.push_back(std::move(pt));
+        add_set(pt, pt_raw);
 
         // ── Command Injection ─────────────────────────────────────────────────
         PatternSet ci; ci.category = "CmdInjection";
@@ -163,11 +208,7 @@ struct WafRegexEngine {
             R"(\b(system|passthru|proc_open|popen|shell_exec)\s*\()",
             R"(\b(base64_decode|gzinflate|str_rot13)\s*\([^)]*base64)",
         };
-        for(auto& r : ci_raw) {
-            try { ci.patterns.emplace_back(r, flag); ci.raw.push_back(r); }
-            catch(const std::regex_error&) { /* invalid regex pattern - skip */ }
-        }
-        pattern_sets.push_back(std::move(ci));
+        add_set(ci, ci_raw);
 
         // ── SSRF / Request Forgery ────────────────────────────────────────────
         PatternSet ssrf; ssrf.category = "SSRF";
@@ -182,11 +223,7 @@ struct WafRegexEngine {
             R"(https?://192\.168\.\d+\.\d+)",
             R"(https?://172\.(1[6-9]|2\d|3[01])\.\d+\.\d+)",
         };
-        for(auto& r : ssrf_raw) {
-            try { ssrf.patterns.emplace_back(r, flag); ssrf.raw.push_back(r); }
-            catch(const std::regex_error&) { /* invalid regex pattern - skip */ }
-        }
-        pattern_sets.push_back(std::move(ssrf));
+        add_set(ssrf, ssrf_raw);
 
         // ── XXE / XML injection ───────────────────────────────────────────────
         PatternSet xxe; xxe.category = "XXE";
@@ -196,11 +233,7 @@ struct WafRegexEngine {
             R"(SYSTEM\s+[\"']file://)",
             R"(\bxpath\b.*(//|@\w))",
         };
-        for(auto& r : xxe_raw) {
-            try { xxe.patterns.emplace_back(r, flag); xxe.raw.push_back(r); }
-            catch(const std::regex_error&) { /* invalid regex pattern - skip */ }
-        }
-        pattern_sets.push_back(std::move(xxe));
+        add_set(xxe, xxe_raw);
 
         // ── Scanner / Probe Detection ─────────────────────────────────────────
         // Typowe ścieżki skanerów WordPress, Joomla, phpMyAdmin, CVE scannerów
@@ -244,16 +277,10 @@ struct WafRegexEngine {
             R"([/\\](alfa|alfa1|alfa2|r57|c99|b374k|wso|priv8|indoxploit)\.(php|txt))",
             R"([/\\](shell|cmd|websh|backdoor|hack|hacked)\.(php|asp|jsp))",
         };
-        for(auto& r : scan_raw) {
-            try { scan.patterns.emplace_back(r, flag); scan.raw.push_back(r); }
-            catch(const std::exception& ex) {
-                NW_WARN("waf_regex", "ScanProbe pattern compile error: %s", ex.what());
-            }
-        }
-        pattern_sets.push_back(std::move(scan));
+        add_set(scan, scan_raw);
 
         // ── Bad User-Agent ────────────────────────────────────────────────────
-        PatternSet ua; ua.category = "BadUA";
+        PatternSet ua; ua.category = "BadUA"; ua.input = IN_UA;
         std::vector<std::string> ua_raw = {
             R"(\b(sqlmap|nikto|nmap|masscan|zap|burpsuite|acunetix|nessus)\b)",
             R"(\b(zgrab|gobuster|dirbuster|dirb|wfuzz|ffuf|feroxbuster)\b)",
@@ -263,15 +290,46 @@ struct WafRegexEngine {
             R"((wordpress|wp-) (scanner|attack|probe|hack))",
             R"(\b(bot|crawler|spider|scraper)\b.{0,30}\b(attack|scan|probe|hack)\b)",
         };
-        for(auto& r : ua_raw) {
-            try { ua.patterns.emplace_back(r, std::regex_constants::icase | std::regex_constants::optimize); ua.raw.push_back(r); }
-            catch(const std::exception& ex) {
-                NW_WARN("waf_regex", "BadUA pattern compile error: %s", ex.what());
-            }
-        }
-        pattern_sets.push_back(std::move(ua));
+        add_set(ua, ua_raw);
 
+        for(auto& p : progs) p.finish();
+        for(auto& f : prefilters) f.finish();
         compiled = true;
+        config_changed();
+    }
+
+    // Patterns that match somewhere in `s` (ids of progs[in]): the literal
+    // prefilter, then — if any rule is still possible — one automaton pass
+    WafPatternMask scan(Input in, std::string_view s) {
+        WafPatternMask cand = candidates(in, s);
+        return cand.none() ? cand : confirm(in, s, cand);
+    }
+
+    // The two halves of scan(): rules whose required literal occurs in `s`...
+    WafPatternMask candidates(Input in, std::string_view s) {
+        if(s.empty() || !progs[in].patterns()) return {};
+        pf_scanned.fetch_add(1, std::memory_order_relaxed);
+        WafPatternMask cand = prefilters[in].candidates(s);
+        if(cand.any()) pf_passed.fetch_add(1, std::memory_order_relaxed);
+        return cand;
+    }
+
+    // ...and which of them really match (the automaton pass)
+    WafPatternMask confirm(Input in, std::string_view s, const WafPatternMask& cand) {
+        if(cand.none()) return {};
+        WafPatternMask hit = waf_dfa_for(progs[in]).scan(s) & cand;
+        count_pass(in, cand, hit);
+        return hit;
+    }
+
+    // Pattern i of `ps` against `s`, as std::regex_search would report it:
+    // the leftmost match, alternatives and repeats in priority order
+    bool search(const PatternSet& ps, size_t i, std::string_view s,
+                std::string* matched = nullptr) const {
+        auto [b, e] = waf_pike_find(progs[ps.input], ps.ids[i], s);
+        if(b < 0) return false;
+        if(matched) matched->assign(s.data() + b, e - b);
+        return true;
     }
 
     // ── Check a request ───────────────────────────────────────────────────────
@@ -286,44 +344,138 @@ struct WafRegexEngine {
                std::string* out_detail   = nullptr)
     {
         if(!cfg.enabled || !compiled) return true;
-        total_checked.fetch_add(1, std::memory_order_relaxed);
-
-        // Build combined target string from enabled parts
-        std::string target;
-        target.reserve(path.size() + query.size() + 512);
-        if(cfg.check_path)  target += path + " ";
-        if(cfg.check_query) target += query + " ";
-        if(cfg.check_body && !body.empty())
-            target += body.substr(0, cfg.max_body_check) + " ";
-
-        // Extract User-Agent from raw_headers for BadUA matching (always)
-        std::string ua_str;
+        // User-Agent value from a raw header block (either spelling)
+        std::string_view ua;
         if(!raw_headers.empty()) {
             auto uap = raw_headers.find("User-Agent:");
             if(uap == std::string::npos) uap = raw_headers.find("user-agent:");
             if(uap != std::string::npos) {
-                auto end = raw_headers.find('\n', uap);
-                ua_str = raw_headers.substr(uap, end == std::string::npos ? 256 : end - uap);
+                ua = std::string_view(raw_headers).substr(uap + 11);
+                ua = ua.substr(0, std::min(ua.find_first_of("\r\n"), size_t(256)));
+                while(!ua.empty() && ua[0] == ' ') ua.remove_prefix(1);
+            }
+        }
+        WafNormalizer norm;
+        WafBodyScan   bs;
+        body_end(bs, body);
+        return check(ip, method, norm.run(path, query, body, ua, input_parts()),
+                     out_category, out_detail, nullptr, &bs);
+    }
+
+    // What the normalizer has to put into WafInput::target for this config
+    // (never the body — see body_feed())
+    WafInputParts input_parts() const {
+        return {cfg.check_path, cfg.check_query, false, 0};
+    }
+
+    // ── Request body, incremental ─────────────────────────────────────────────
+    // Raw body bytes from bs.fed on, as they arrive: percent-decoded and run
+    // through the URI automaton, state kept in `bs` — the scan's memory does
+    // not grow with the body (the caller still buffers the request). Stops
+    // at the first chunk with a match; body_blocked() tells the caller to
+    // answer now instead of reading the rest.
+    static constexpr size_t BODY_SLICE = 64 * 1024;   // decoded per step (thread scratch)
+    static constexpr size_t BODY_TAIL  = 128;
+
+    bool body_enabled() const { return cfg.enabled && compiled && cfg.check_body; }
+    bool body_blocked(const WafBodyScan& bs) const { return cfg.block_mode && bs.matched(); }
+
+    void body_feed(WafBodyScan& bs, std::string_view chunk) {
+        if(!body_enabled() || bs.done || bs.matched() || chunk.empty()) return;
+        if(bs.fed == 0) body_streamed.fetch_add(1, std::memory_order_relaxed);
+        if(body_raw(bs, chunk)) body_early.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Whole body known (dispatch): the part not fed yet, then the end of the
+    // input. A body that arrived in one piece takes the prefilter path like
+    // the target does.
+    void body_end(WafBodyScan& bs, std::string_view body) {
+        if(!body_enabled() || bs.done) return;
+        bs.done = true;
+        if(body.empty() && bs.fed == 0) return;
+        body_checked.fetch_add(1, std::memory_order_relaxed);
+        if(bs.matched()) return;
+        if(bs.fed == 0 && body.size() <= BODY_SLICE) {
+            body_bytes.fetch_add(body.size(), std::memory_order_relaxed);
+            bs.fed = body.size();
+            std::string& dec = body_scratch();
+            dec.clear();
+            waf_url_decode(body, dec, bs.flags);
+            bs.hit = scan(IN_URI, dec);
+            if(bs.matched()) body_detail(bs, dec);
+            return;
+        }
+        if(bs.fed < body.size() && body_raw(bs, body.substr(bs.fed))) return;
+        WafDfa& dfa = waf_dfa_for(progs[IN_URI]);
+        if(!bs.pend.empty()) {   // a stray '%' at the very end
+            std::string& dec = body_scratch();
+            dec.clear();
+            waf_url_decode(bs.pend, dec, bs.flags);
+            bs.pend.clear();
+            if(body_step(bs, dfa, dec)) return;
+        }
+        bs.hit = dfa.finish(bs.dfa);
+        if(bs.matched()) body_detail(bs, bs.tail);
+    }
+
+    // Request already normalized (dispatch(): the worker's WafNormalizer,
+    // run with input_parts()) — nothing is copied unless a rule matches.
+    // With `vcache`, an input allowed before under the same generation is
+    // allowed again without scanning. `body`: its inspection, finished by
+    // body_end() (or stopped early by a match)
+    bool check(const std::string& ip, std::string_view method, const WafInput& in,
+               std::string* out_category = nullptr,
+               std::string* out_detail   = nullptr,
+               WafVerdictCache* vcache   = nullptr,
+               const WafBodyScan* body   = nullptr)
+    {
+        if(!cfg.enabled || !compiled) return true;
+        total_checked.fetch_add(1, std::memory_order_relaxed);
+        uint8_t flags = in.flags | (body ? body->flags : 0);
+        for(int b = 0; b < WAF_IN_FLAG_COUNT; b++)
+            if(flags >> b & 1) input_flags[b].fetch_add(1, std::memory_order_relaxed);
+        WafPatternMask body_hit = body ? body->hit : WafPatternMask{};
+
+        // No rule's literal anywhere: allowed, cheaper than any cache lookup
+        WafPatternMask cand[IN_COUNT] = { candidates(IN_URI, in.target), candidates(IN_UA, in.ua) };
+        if(cand[IN_URI].none() && cand[IN_UA].none() && body_hit.none()) return true;
+
+        // Automaton needed — unless this exact input was allowed before (the
+        // cache covers the target and the UA; a body match always goes on)
+        uint64_t gen = generation.load(std::memory_order_acquire);
+        Hash128 digest;
+        bool cacheable = vcache && body_hit.none() && vcache->digest(in, digest);
+        if(cacheable) {
+            if(vcache->allowed(digest, gen)) {
+                vc_hits.fetch_add(1, std::memory_order_relaxed);
+                return true;
             }
+            vc_misses.fetch_add(1, std::memory_order_relaxed);
         }
 
-        // URL-decode target once for better pattern coverage
-        std::string decoded = url_decode(target);
+        // One pass per input finds every matching pattern; the first one in
+        // rule order decides, as when each regex was tried in turn
+        WafPatternMask hit[IN_COUNT] = { confirm(IN_URI, in.target, cand[IN_URI]),
+                                         confirm(IN_UA, in.ua, cand[IN_UA]) };
+        if(hit[IN_URI].none() && hit[IN_UA].none() && body_hit.none()) {
+            if(cacheable) vcache->put_allow(digest, gen);
+            return true;
+        }
 
         for(auto& ps : pattern_sets) {
             // BadUA uses User-Agent header only; others use path/query/body
-            const std::string& check_str = (ps.category == "BadUA")
-                ? ua_str
-                : decoded;
-            if(check_str.empty()) continue;
-            for(size_t i = 0; i < ps.patterns.size(); i++) {
-                std::smatch m;
-                if(std::regex_search(check_str, m, ps.patterns[i])) {
+            std::string_view check_str = ps.input == IN_UA ? in.ua : in.target;
+            for(size_t i = 0; i < ps.ids.size(); i++) {
+                bool in_target = hit[ps.input].test(ps.ids[i]);
+                if(in_target || (ps.input == IN_URI && body_hit.test(ps.ids[i]))) {
                     total_detected.fetch_add(1, std::memory_order_relaxed);
                     if(cfg.block_mode)
                         total_blocked.fetch_add(1, std::memory_order_relaxed);
 
-                    std::string matched_str = m.str().substr(0, 60);
+                    std::string matched_str;
+                    if(in_target) search(ps, i, check_str, &matched_str);
+                    else          matched_str = body->detail;
+                    matched_str.resize(std::min<size_t>(matched_str.size(), 60));
                     std::string cat = ps.category;
 
                     if(out_category) *out_category = cat;
@@ -335,9 +487,10 @@ struct WafRegexEngine {
                         WafRegexEvent ev;
                         ev.ts       = time(nullptr);
                         ev.ip       = ip;
-                        ev.method   = method;
-                        ev.uri      = path.substr(0, 150);
-                        if(!query.empty()) ev.uri += "?" + query.substr(0,50);
+                        ev.method   = std::string(method);
+                        ev.uri      = std::string(in.raw_path.substr(0, 150));
+                        if(!in.raw_query.empty()) ev.uri += "?" + std::string(in.raw_query.substr(0,50));
+                        ev.flags    = flags;
                         ev.category = cat;
                         ev.matched  = ps.raw.size() > i ? ps.raw[i].substr(0,60) : "?";
                         ev.detail   = matched_str;
@@ -377,6 +530,11 @@ struct WafRegexEngine {
             ",\"total_checked\":"  + std::to_string(total_checked.load()) +
             ",\"total_blocked\":"  + std::to_string(total_blocked.load()) +
             ",\"total_detected\":" + std::to_string(total_detected.load()) +
+            ",\"automaton\":" + automaton_json() +
+            ",\"prefilter\":" + prefilter_json() +
+            ",\"normalize\":" + normalize_json() +
+            ",\"verdict_cache\":" + verdict_cache_json() +
+            ",\"body\":" + body_json() +
             ",\"categories\":" + cats +
             ",\"events\":[";
 
@@ -386,12 +544,6 @@ struct WafRegexEngine {
             auto& e = events[i];
             char ts[32]; struct tm* tm = localtime(&e.ts);
             strftime(ts, sizeof(ts), "%Y-%m-%d %H:%M:%S", tm);
-            auto esc=[](std::string s){
-                std::string o; for(char c:s){
-                    if(c=='"') o+="\\\""; else if(c=='\\') o+="\\\\";
-                    else if(c<32) o+=" "; else o+=c;
-                } return o;
-            };
             if(!first) j += ",";
             first = false;
             j += "{\"ts\":\"" + std::string(ts) +
@@ -399,37 +551,213 @@ struct WafRegexEngine {
                  "\",\"method\":\""  + e.method +
                  "\",\"uri\":\""     + esc(e.uri) +
                  "\",\"cat\":\""     + e.category +
-                 "\",\"detail\":\""  + esc(e.detail) + "\"}";
+                 "\",\"detail\":\""  + esc(e.detail) +
+                 "\",\"flags\":"    + flags_json(e.flags) + "}";
         }
         j += "]}";
         return j;
     }
 
+    // Allow-verdict caches, all workers — consulted only for inputs the
+    // prefilter could not clear, so the ratio is over automaton-bound requests
+    std::string verdict_cache_json() const {
+        uint64_t h = vc_hits.load(), m = vc_misses.load();
+        char ratio[32]; snprintf(ratio, sizeof(ratio), "%.4f", h + m ? (double)h / (h + m) : 0.0);
+        return "{\"hits\":" + std::to_string(h) + ",\"misses\":" + std::to_string(m) +
+               ",\"hit_ratio\":" + ratio + ",\"generation\":" + std::to_string(generation.load()) +
+               ",\"slots_per_worker\":" + std::to_string(WafVerdictCache::SLOTS) + "}";
+    }
+
+    std::string body_json() const {
+        return "{\"checked\":" + std::to_string(body_checked.load()) +
+               ",\"bytes\":" + std::to_string(body_bytes.load()) +
+               ",\"streamed\":" + std::to_string(body_streamed.load()) +
+               ",\"matched_early\":" + std::to_string(body_early.load()) + "}";
+    }
+
+    // Inputs that tripped each normalization check
+    std::string normalize_json() const {
+        std::string j = "{";
+        for(int b = 0; b < WAF_IN_FLAG_COUNT; b++)
+            j += std::string(b ? "," : "") + "\"" + waf_input_flag_name(b) + "\":" +
+                 std::to_string(input_flags[b].load());
+        return j + "}";
+    }
+
+    static std::string flags_json(uint8_t flags) {
+        std::string j = "[";
+        for(int b = 0; b < WAF_IN_FLAG_COUNT; b++)
+            if(flags >> b & 1) j += std::string(j.size() > 1 ? "," : "") + "\"" + waf_input_flag_name(b) + "\"";
+        return j + "]";
+    }
+
+    // Pass-through of the literal prefilter: overall, per category (any of
+    // its patterns let through) and per pattern with its literals
+    std::string prefilter_json() const {
+        auto ratio = [](uint64_t part, uint64_t whole) {
+            char b[32]; snprintf(b, sizeof(b), "%.4f", whole ? (double)part / whole : 0.0);
+            return std::string(b);
+        };
+        uint64_t scanned = pf_scanned.load(), passed = pf_passed.load();
+        std::string j = "{\"scanned\":" + std::to_string(scanned) +
+            ",\"passed\":" + std::to_string(passed) +
+            ",\"pass_ratio\":" + ratio(passed, scanned) +
+            ",\"ac_states\":[" + std::to_string(prefilters[IN_URI].states()) + "," +
+                                 std::to_string(prefilters[IN_UA].states()) + "]" +
+            ",\"categories\":[";
+        for(size_t c = 0; c < pattern_sets.size() && c < MAX_CATEGORIES; c++) {
+            uint64_t p = pf_cat_passed[c].load(), m = pf_cat_matched[c].load();
+            if(c) j += ",";
+            j += "{\"cat\":\"" + pattern_sets[c].category + "\",\"passed\":" + std::to_string(p) +
+                 ",\"matched\":" + std::to_string(m) + ",\"confirm_ratio\":" + ratio(m, p) + "}";
+        }
+        j += "],\"patterns\":[";
+        bool first = true;
+        for(auto& ps : pattern_sets) {
+            for(size_t i = 0; i < ps.ids.size(); i++) {
+                int id = ps.ids[i];
+                if(!first) j += ",";
+                first = false;
+                j += "{\"cat\":\"" + ps.category + "\",\"pattern\":\"" + esc(ps.raw[i]) + "\",\"literals\":[";
+                auto& fs = prefilters[ps.input].factors(id);
+                for(size_t k = 0; k < fs.size(); k++) j += (k ? ",\"" : "\"") + esc(fs[k]) + "\"";
+                j += "],\"passed\":" + std::to_string(pf_pat_passed[ps.input][id].load()) +
+                     ",\"matched\":" + std::to_string(pf_pat_matched[ps.input][id].load()) + "}";
+            }
+        }
+        return j + "]}";
+    }
+
+    // Compiled programs (shared) and the lazy DFA caches (all threads)
+    std::string automaton_json() const {
+        size_t patterns = 0, insts = 0;
+        std::string classes;
+        for(auto& p : progs) {
+            patterns += p.patterns(); insts += p.code.size();
+            if(!classes.empty()) classes += ",";
+            classes += std::to_string(p.n_classes);
+        }
+        return "{\"patterns\":" + std::to_string(patterns) +
+               ",\"nfa_insts\":" + std::to_string(insts) +
+               ",\"byte_classes\":[" + classes + "]" +
+               ",\"dfa_states\":" + std::to_string(g_waf_dfa_stats.states.load()) +
+               ",\"dfa_bytes\":" + std::to_string(g_waf_dfa_stats.bytes.load()) +
+               ",\"dfa_flushes\":" + std::to_string(g_waf_dfa_stats.flushes.load()) + "}";
+    }
+
     void clear_events() {
         std::lock_guard<std::mutex> lk(events_mu);
         events.clear();
     }
 
 private:
-    // ── Simple URL decoder ────────────────────────────────────────────────────
-    static std::string url_decode(const std::string& s) {
-        std::string out;
-        out.reserve(s.size());
-        for(size_t i = 0; i < s.size(); i++) {
-            if(s[i]=='%' && i+2 < s.size() &&
-               isxdigit((unsigned char)s[i+1]) &&
-               isxdigit((unsigned char)s[i+2])) {
-                char hex[3] = {s[i+1], s[i+2], 0};
-                out += (char)strtol(hex, nullptr, 16);
-                i += 2;
-            } else if(s[i]=='+') {
-                out += ' ';
-            } else {
-                out += s[i];
+    static std::string esc(const std::string& s) {
+        std::string o; for(char c:s){
+            if(c=='"') o+="\\\""; else if(c=='\\') o+="\\\\";
+            else if((unsigned char)c<32){ char b[8]; snprintf(b,sizeof(b),"\\u%04x",c); o+=b; }
+            else o+=c;
+        } return o;
+    }
+
+    void add_set(PatternSet& ps, const std::vector<std::string>& raws) {
+        for(auto& r : raws) {
+            try {
+                WafNode ast = WafPattern::parse(r, true);
+                int id = progs[ps.input].add(ast);
+                prefilters[ps.input].add(id, ast);
+                ps.ids.push_back(id); ps.raw.push_back(r); ps.mask.set(id);
             }
+            catch(const std::exception& ex) {
+                NW_WARN("waf_regex", "%s pattern compile error: %s", ps.category.c_str(), ex.what());
+            }
+        }
+        pattern_sets.push_back(std::move(ps));
+    }
+
+    // Decoded body bytes for the automaton; one per thread, BODY_SLICE at most
+    static std::string& body_scratch() {
+        thread_local std::string s;
+        return s;
+    }
+
+    // Raw body bytes after bs.fed: decoded a slice at a time; true on a match
+    bool body_raw(WafBodyScan& bs, std::string_view chunk) {
+        body_bytes.fetch_add(chunk.size(), std::memory_order_relaxed);
+        bs.fed += chunk.size();
+        std::string& dec = body_scratch();
+        WafDfa& dfa = waf_dfa_for(progs[IN_URI]);
+        // A %XX cut by the previous chunk first, completed from this one
+        while(!bs.pend.empty() && !chunk.empty()) {
+            bs.pend += chunk[0];
+            chunk.remove_prefix(1);
+            if(bs.pend.size() == 3) {
+                dec.clear();
+                waf_url_decode(bs.pend, dec, bs.flags);
+                bs.pend.clear();
+                if(body_step(bs, dfa, dec)) return true;
+            }
+        }
+        while(!chunk.empty()) {
+            std::string_view piece = chunk.substr(0, BODY_SLICE);
+            dec.clear();
+            size_t used = waf_url_decode(piece, dec, bs.flags, false);
+            if(used < piece.size() && piece.size() == chunk.size()) {
+                bs.pend.assign(piece.substr(used));   // at most "%X"
+                used = piece.size();
+            }
+            chunk.remove_prefix(used);
+            if(body_step(bs, dfa, dec)) return true;
+        }
+        return false;
+    }
+
+    // Decoded `dec` continues the body: automaton step, tail for the detail.
+    // True once something matched
+    bool body_step(WafBodyScan& bs, WafDfa& dfa, std::string_view dec) {
+        dfa.feed(bs.dfa, dec);
+        if(bs.dfa.found.any()) {
+            bs.hit = bs.dfa.found;
+            std::string window = bs.tail;
+            window.append(dec);
+            body_detail(bs, window);
+            return true;
+        }
+        if(dec.size() >= BODY_TAIL) bs.tail.assign(dec.substr(dec.size() - BODY_TAIL));
+        else {
+            bs.tail.append(dec);
+            if(bs.tail.size() > BODY_TAIL) bs.tail.erase(0, bs.tail.size() - BODY_TAIL);
+        }
+        return false;
+    }
+
+    // Matched text of the first body pattern in rule order, from the decoded
+    // bytes around the match (a match longer than them leaves it empty)
+    void body_detail(WafBodyScan& bs, std::string_view window) {
+        for(auto& ps : pattern_sets) {
+            if(ps.input != IN_URI) continue;
+            for(size_t i = 0; i < ps.ids.size(); i++) {
+                if(!bs.hit.test(ps.ids[i])) continue;
+                search(ps, i, window, &bs.detail);
+                bs.detail.resize(std::min<size_t>(bs.detail.size(), 60));
+                return;
+            }
+        }
+    }
+
+    void count_pass(Input in, const WafPatternMask& cand, const WafPatternMask& hit) {
+        for(size_t c = 0; c < pattern_sets.size() && c < MAX_CATEGORIES; c++) {
+            auto& ps = pattern_sets[c];
+            if(ps.input != in) continue;
+            if((cand & ps.mask).any()) pf_cat_passed[c].fetch_add(1, std::memory_order_relaxed);
+            if((hit & ps.mask).any())  pf_cat_matched[c].fetch_add(1, std::memory_order_relaxed);
+        }
+        for(size_t id = cand._Find_first(); id < cand.size(); id = cand._Find_next(id)) {
+            pf_pat_passed[in][id].fetch_add(1, std::memory_order_relaxed);
+            if(hit.test(id)) pf_pat_matched[in][id].fetch_add(1, std::memory_order_relaxed);
         }
-        return out;
     }
+    std::atomic<uint64_t> pf_pat_passed[IN_COUNT][WAF_MAX_PATTERNS]{};
+    std::atomic<uint64_t> pf_pat_matched[IN_COUNT][WAF_MAX_PATTERNS]{};
 };
 
 // g_waf_regex defined once in server.cc
@@ -0,0 +1,60 @@
+#pragma once
+// ── WafVerdictCache — per-worker memo of "allowed" WAF verdicts ──────────────
+// Static assets and polling API calls send the same path + query + UA over
+// and over; the verdict for an identical normalized input (WafInput::key)
+// cannot change while the rules and the config stay the same.
+//
+// Direct-mapped table of SipHash-128 digests of the key, one random SipHash
+// key per cache (clients cannot aim for a collision with an entry). Only
+// allows are stored — a request that matches a rule always runs the full
+// engine, so its event and ban are recorded. Entries carry the engine's
+// generation: compile() or a config change via /np_waf_regex bumps it and
+// every worker's entries stop matching, without touching other threads.
+//
+// Loop thread only (one per Worker), no locking.
+
+#include "np_hash.hh"
+#include "waf_input.hh"
+#include <cstdint>
+#include <random>
+#include <vector>
+
+class WafVerdictCache {
+public:
+    static constexpr size_t SLOTS   = 4096;        // power of two
+    static constexpr size_t MAX_KEY = 8 * 1024;    // longer inputs (big bodies) are not cached
+
+    WafVerdictCache() : slots_(SLOTS) {
+        std::random_device rd;
+        key_.k0 = (uint64_t)rd() << 32 | rd();
+        key_.k1 = (uint64_t)rd() << 32 | rd();
+    }
+
+    // Digest of a normalized input; false = too long to be worth caching
+    bool digest(const WafInput& in, Hash128& out) const {
+        if(in.key.size() > MAX_KEY) return false;
+        out = siphash128(key_, in.key);
+        return true;
+    }
+
+    bool allowed(const Hash128& h, uint64_t gen) const {
+        const Slot& s = slots_[h.lo & (SLOTS - 1)];
+        return s.gen == gen && s.h == h;
+    }
+
+    void put_allow(const Hash128& h, uint64_t gen) {
+        Slot& s = slots_[h.lo & (SLOTS - 1)];
+        s.h   = h;
+        s.gen = gen;
+    }
+
+    size_t mem_bytes() const { return slots_.capacity() * sizeof(Slot); }
+
+private:
+    struct Slot {
+        Hash128  h;
+        uint64_t gen{0};   // 0 = empty (generations start at 1)
+    };
+    std::vector<Slot> slots_;
+    SipKey            key_;
+};
@@ -74,7 +74,11 @@ public:
         while((int)map_.size()>=max_) evict_lru();
 
         auto it=map_.find(key);
-        if(it!=map_.end()){lru_.erase(it->second);map_.erase(it);}
+        if(it!=map_.end()){
+            stats_.bytes_stored-=it->second->second.size;
+            mem_-=entry_mem(*it->second);
+            lru_.erase(it->second);map_.erase(it);
+        }
 
         CacheEntry e;
         e.key     =key;
@@ -96,6 +100,7 @@ public:
         map_[key]=lru_.begin();
         stats_.stores++;
         stats_.bytes_stored+=lru_.begin()->second.size;
+        mem_+=entry_mem(*lru_.begin());
         g_stat_cache_entries.store(map_.size(), std::memory_order_relaxed);
         return true;
     }
@@ -115,6 +120,8 @@ public:
         time_t now=time(nullptr);
         for(auto it=map_.begin();it!=map_.end();){
             if(it->second->second.expires<now){
+                stats_.bytes_stored-=it->second->second.size;
+                mem_-=entry_mem(*it->second);
                 lru_.erase(it->second);
                 it=map_.erase(it);
                 stats_.evictions++;
@@ -124,12 +131,15 @@ public:
 
     Stats stats() const { return stats_; }
     size_t size() const { return map_.size(); }
+    // Entries incl. keys, headers and list/hash nodes (maintained on put/evict)
+    MemUsage mem_usage() const { return {mem_ + map_.bucket_count()*sizeof(void*), map_.size()}; }
     int max_entries() const { return max_; }
 
     void flush() {
         lru_.clear();
         map_.clear();
         stats_ = Stats{};
+        mem_ = 0;
         g_stat_cache_entries.store(0, std::memory_order_relaxed);
     }
 
@@ -206,8 +216,17 @@ private:
     using LRU = std::list<std::pair<std::string,CacheEntry>>;
     using Map = std::unordered_map<std::string,LRU::iterator>;
 
+    static uint64_t entry_mem(const LRU::value_type& v){
+        const CacheEntry& e=v.second;
+        return sizeof(LRU::value_type)+2*sizeof(void*)            // list node
+             + sizeof(Map::value_type)+2*sizeof(void*)            // hash node
+             + 2*mem_heap(v.first) + mem_heap(e.key)              // key: list, map, entry
+             + mem_heap(e.serialized) + mem_heap(e.etag) + mem_heap(e.last_modified);
+    }
+
     void evict(Map::iterator it){
         stats_.bytes_stored -= it->second->second.size;
+        mem_ -= entry_mem(*it->second);
         lru_.erase(it->second); map_.erase(it); stats_.evictions++;
     }
     void evict_lru(){
@@ -219,4 +238,5 @@ private:
     Map   map_;
     int   max_,ttl_;
     Stats stats_;
+    uint64_t mem_{0};
 };
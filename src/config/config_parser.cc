@@ -167,7 +167,42 @@ static ServerConfig parse_server(P& p){
         else if(key=="keepalive_timeout"){srv.keepalive_timeout=pi(p.word(),65);}
         else if(key=="keepalive_requests"){srv.keepalive_requests=pi(p.word(),1000);}
         else if(key=="client_max_body_size"){srv.client_max_body=pi(p.word(),64*1024*1024);}
-        else if(key=="access_log"){srv.access_log=p.word();}
+        else if(key=="http2_max_concurrent_streams"){srv.http2_max_concurrent_streams=pi(p.word(),128);}
+        else if(key=="http2_initial_window_size"){srv.http2_initial_window_size=pi(p.word(),65535);}
+        else if(key=="http2_connection_window_size"){srv.http2_connection_window_size=pi(p.word(),1048576);}
+        else if(key=="access_log"){
+            srv.access_log=p.word();
+            srv.access_log_set=true;
+            while(p.at(Token::Word)){
+                auto f=p.eat().val;
+                if(f=="combined"||f=="json"||f=="binary") srv.access_log_format=f;
+                else if(f=="zstd")                 srv.access_log_zstd=3;
+                else if(f.rfind("zstd=",0)==0)     srv.access_log_zstd=std::clamp(pi(f.substr(5),3),1,19);
+                else if(f.rfind("buffer=",0)==0)   srv.access_log_buffer=std::max(64,pi(f.substr(7),4096));
+            }
+        }
+        else if(key=="capture"){
+            srv.capture=p.word();
+            srv.capture_set=true;
+            auto list=[](const std::string& v){
+                std::vector<std::string> out; size_t b=0;
+                while(b<=v.size()){
+                    size_t e=v.find(',',b); if(e==std::string::npos) e=v.size();
+                    if(e>b) out.push_back(v.substr(b,e-b));
+                    b=e+1;
+                }
+                return out;
+            };
+            while(p.at(Token::Word)){
+                auto f=p.eat().val;
+                if(f.rfind("sample=",0)==0)        srv.capture_sample=std::clamp(std::atof(f.c_str()+7),0.0,1.0);
+                else if(f.rfind("headers=",0)==0)  srv.capture_headers=list(f.substr(8));
+                else if(f.rfind("scrub=",0)==0)    srv.capture_scrub=list(f.substr(6));
+                else if(f=="zstd")                 srv.capture_zstd=3;
+                else if(f.rfind("zstd=",0)==0)     srv.capture_zstd=std::clamp(pi(f.substr(5),3),1,19);
+                else if(f.rfind("buffer=",0)==0)   srv.capture_buffer=std::max(64,pi(f.substr(7),4096));
+            }
+        }
         else if(key=="error_log"){srv.error_log=p.word();}
         else if(key=="location"){srv.locations.push_back(parse_location(p));continue;}
         else if(key=="error_page"){int code=pi(p.word(),404);std::string pg=p.word();srv.error_pages[code]=pg;}
@@ -230,6 +265,11 @@ std::shared_ptr<Config> parse_config(const std::string& path){
                     else                    up.strategy=LBStrategy::LeastConn;
                   }
                   else if(k=="sticky"){up.sticky_sessions=pb(p.word());}
+                  else if(k=="proto"){
+                    auto pv=p.word();
+                    up.proto=(pv=="h2"||pv=="http2")?UpstreamProto::H2:UpstreamProto::Http1;
+                  }
+                  else if(k=="h2_connections"){up.h2_connections=pi(p.word(),2);}
                   else if(k=="health_check"){
                     up.hc_enabled=true;
                     while(p.at(Token::Word)){
@@ -266,6 +306,12 @@ std::shared_ptr<Config> parse_config(const std::string& path){
         else if(key=="blacklist_file")      {cfg->blacklist_file=p.word();}
         else if(key=="waf_regex_check_body") {cfg->waf_regex_check_body =pb(p.word());}
         else if(key=="admin_tls_only") { cfg->admin_tls_only = pb(p.word()); }
+        else if(key=="metrics")        { cfg->metrics_enabled = pb(p.word()); }
+        else if(key=="metrics_allow")  { while(p.at(Token::Word)) cfg->metrics_allow.push_back(p.eat().val); }
+        else if(key=="metrics_token")  { cfg->metrics_token = p.word(); }
+        else if(key=="server_timing_allow") { while(p.at(Token::Word)) cfg->server_timing_allow.push_back(p.eat().val); }
+        else if(key=="slow_request_ms")     { cfg->slow_request_ms = std::max(0, pi(p.word(), 1000)); }
+        else if(key=="loop_stall_warn_ms")  { cfg->loop_stall_warn_ms = std::max(0, pi(p.word(), 500)); }
         // ACME config block
         else if(key=="acme"){
             p.expect(Token::LBrace);
@@ -0,0 +1,475 @@
+// access_log.cc — nas-web asynchronous access log writer
+// Provides:
+//   - per-worker single-producer rings of fixed-size records (no lock, no
+//     allocation on the request path; a full ring drops and counts)
+//   - one writer thread that drains all rings, formats the batch and hands
+//     it to the kernel with a single writev() (one iovec per worker segment)
+//   - formats: combined (Apache/nginx), json (one object per line),
+//     binary (compact length-prefixed records, see "Binary format" below)
+//   - optional zstd: every batch becomes an independent zstd frame, so the
+//     file stays a valid concatenated stream (`zstd -dc access.log`)
+//   - reopen on SIGUSR1 (logrotate postrotate) and on config reload
+//   - traffic capture (`capture` directive): a second AccessLog instance
+//     writing sampled request records (type 2) with selected, scrubbed
+//     headers into the same binary format — replayed by `nas-web-bench --replay`
+// Compiled as part of server.cc (single-TU build)
+
+#pragma once
+#include "../../include/np_types.hh"
+#include "../../include/np_config.hh"
+#include "../optimization/optimization.cc"
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <climits>
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// ── Record (one ring slot) ────────────────────────────────────────────────────
+// Strings are packed back to back in data[] and truncated to fit, so a slot
+// never owns heap memory and the producer is a handful of memcpy's.
+inline constexpr size_t  AL_SLOT_SIZE   = 512;
+inline constexpr uint8_t AL_REC_ACCESS  = 1;
+inline constexpr uint8_t AL_REC_CAPTURE = 2;
+
+struct AccessRecord {
+    int64_t  ts_us{};       // request start, unix time in µs
+    uint32_t dur_us{};      // request start → response queued
+    uint16_t status{};
+    uint8_t  method{};      // Method
+    uint8_t  version{};     // HttpVersion (10/11/20/30)
+    uint64_t bytes_out{};   // serialized response size
+    uint32_t bytes_in{};    // request body size
+    uint8_t  ip_len{}, host_len{};
+    uint16_t path_len{}, ua_len{}, ref_len{};
+    uint8_t  kind{AL_REC_ACCESS};
+    uint8_t  nhdr{};        // capture: headers packed in the `ua` area
+    char     data[AL_SLOT_SIZE - 40];  // ip | host | path[?query] | user-agent | referer
+
+    std::string_view ip()   const { return {data, ip_len}; }
+    std::string_view host() const { return {data + ip_len, host_len}; }
+    std::string_view path() const { return {data + ip_len + host_len, path_len}; }
+    std::string_view ua()   const { return {data + ip_len + host_len + path_len, ua_len}; }
+    std::string_view ref()  const { return {data + ip_len + host_len + path_len + ua_len, ref_len}; }
+    std::string_view hdrs() const { return ua(); }
+};
+static_assert(sizeof(AccessRecord) == AL_SLOT_SIZE, "AccessRecord must fill exactly one slot");
+
+// ── Binary format ─────────────────────────────────────────────────────────────
+// File:   "NWAL" u8 version(1) u8[3] reserved      — written once per new file
+// Record: u16 len (whole record incl. this field) u8 type u8 reserved
+//         i64 ts_us u32 dur_us u16 status u8 method u8 version
+//         u64 bytes_out u32 bytes_in
+//         u8 ip_len u8 host_len u16 path_len u16 ua_len u16 ref_len
+//         ip host path ua referer (raw bytes, no terminators)
+// All integers little-endian. Unknown record types must be skipped by len.
+//
+// Type 2 (capture) has the same layout: the reserved byte is the header
+// count, ip and referer are empty and the `ua` string holds the headers as
+// (u8 name_len, u16 value_len, name, value)*. Sensitive values are replaced
+// by CAPTURE_SCRUBBED; bytes_in is the request body size (body not stored).
+inline constexpr char     AL_BIN_MAGIC[4] = {'N','W','A','L'};
+inline constexpr uint8_t  AL_BIN_VERSION  = 1;
+inline constexpr size_t   AL_BIN_FIXED    = 4 + 8+4+2+1+1 + 8+4 + 1+1+2+2+2;
+inline constexpr std::string_view CAPTURE_SCRUBBED = "[scrubbed]";
+
+enum class AccessLogFormat { Combined, Json, Binary };
+
+inline bool access_log_format_parse(std::string_view s, AccessLogFormat& out) {
+    if(s == "combined") { out = AccessLogFormat::Combined; return true; }
+    if(s == "json")     { out = AccessLogFormat::Json;     return true; }
+    if(s == "binary")   { out = AccessLogFormat::Binary;   return true; }
+    return false;
+}
+
+// ── Per-worker SPSC ring ──────────────────────────────────────────────────────
+struct AccessRing {
+    alignas(64) std::atomic<uint64_t> head{0};     // next slot the worker fills
+    alignas(64) std::atomic<uint64_t> tail{0};     // next slot the writer reads
+    alignas(64) std::atomic<uint64_t> dropped{0};
+    std::unique_ptr<AccessRecord[]> slots;
+    uint64_t mask{0};
+
+    explicit AccessRing(size_t cap) : slots(new AccessRecord[cap]), mask(cap - 1) {}
+};
+
+// ── AccessLog ─────────────────────────────────────────────────────────────────
+class AccessLog {
+public:
+    struct Settings {
+        std::string     path;
+        AccessLogFormat format{AccessLogFormat::Combined};
+        int             zstd_level{0};   // 0 = plain
+        const char*     label{"access log"};
+        const char*     thread_name{"nw-accesslog"};
+    };
+
+    // Called once before the workers start; ring size cannot change later.
+    void start(int nworkers, size_t ring_records, Settings s) {
+        size_t cap = 64;
+        while(cap < ring_records && cap < (1u << 20)) cap <<= 1;
+        for(int i = 0; i < nworkers; i++) rings_.emplace_back(std::make_unique<AccessRing>(cap));
+        const char* tn = s.thread_name;
+        configure(std::move(s));
+        running_.store(true);
+        thread_ = std::thread([this, tn]{ pthread_setname_np(pthread_self(), tn); run(); });
+    }
+
+    // Drains what the workers already queued, then closes the file.
+    void stop() {
+        if(!running_.exchange(false)) return;
+        if(thread_.joinable()) thread_.join();
+    }
+
+    // New path/format/compression — applied by the writer thread before its
+    // next batch (config reload). Empty path or "off" disables logging.
+    void configure(Settings s) {
+        std::lock_guard<std::mutex> lk(cfg_mu_);
+        pending_ = std::move(s);
+        have_pending_.store(true, std::memory_order_release);
+    }
+
+    // Async-signal-safe: only flips a flag the writer polls.
+    void request_reopen() { reopen_.store(true, std::memory_order_relaxed); }
+
+    bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+    // Producer side — worker thread `wid` only. Returns nullptr (and counts
+    // a drop) when the ring is full; never blocks.
+    AccessRecord* begin(int wid) {
+        if(wid < 0 || wid >= (int)rings_.size()) return nullptr;
+        auto& r = *rings_[wid];
+        uint64_t h = r.head.load(std::memory_order_relaxed);
+        if(h - r.tail.load(std::memory_order_acquire) > r.mask) {
+            r.dropped.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        return &r.slots[h & r.mask];
+    }
+    void commit(int wid) {
+        auto& r = *rings_[wid];
+        r.head.store(r.head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    uint64_t written() const { return written_.load(std::memory_order_relaxed); }
+    uint64_t bytes()   const { return bytes_.load(std::memory_order_relaxed); }
+    uint64_t errors()  const { return errors_.load(std::memory_order_relaxed); }
+    uint64_t reopens() const { return reopens_.load(std::memory_order_relaxed); }
+    uint64_t dropped() const {
+        uint64_t n = 0;
+        for(auto& r : rings_) n += r->dropped.load(std::memory_order_relaxed);
+        return n;
+    }
+    // Records sitting in the rings right now (all workers)
+    uint64_t queued() const {
+        uint64_t n = 0;
+        for(auto& r : rings_)
+            n += r->head.load(std::memory_order_relaxed) - r->tail.load(std::memory_order_relaxed);
+        return n;
+    }
+    // Preallocated rings (fixed after start); objects = records queued
+    MemUsage mem_usage() const {
+        MemUsage m{0, queued()};
+        for(auto& r : rings_) m.bytes += sizeof(AccessRing) + (r->mask + 1) * sizeof(AccessRecord);
+        return m;
+    }
+    // Settings of the currently open file (published by the writer thread)
+    const char* format_name() const { return format_name((AccessLogFormat)fmt_pub_.load()); }
+    int zstd_level() const { return zstd_pub_.load(); }
+    static const char* format_name(AccessLogFormat f) {
+        switch(f) {
+        case AccessLogFormat::Json:   return "json";
+        case AccessLogFormat::Binary: return "binary";
+        default:                      return "combined";
+        }
+    }
+
+    ~AccessLog() { stop(); if(fd_ >= 0) close(fd_); }
+
+private:
+    static constexpr size_t BATCH_BYTES  = 1 << 20;   // flush at ~1 MB per batch
+    static constexpr int    IDLE_WAIT_MS = 50;
+
+    std::vector<std::unique_ptr<AccessRing>> rings_;
+    std::thread       thread_;
+    std::atomic<bool> running_{false}, enabled_{false}, reopen_{false}, have_pending_{false};
+    std::mutex        cfg_mu_;
+    Settings          pending_, cur_;     // cur_ is owned by the writer thread
+    int               fd_{-1};
+    std::atomic<uint64_t> written_{0}, bytes_{0}, errors_{0}, reopens_{0};
+    std::atomic<int>      fmt_pub_{0}, zstd_pub_{0};
+
+    // Cached "[18/Oct/2026:13:55:36 +0200]" for the combined format
+    time_t clf_sec_{-1};
+    char   clf_buf_[40]{};
+
+    void run() {
+        std::vector<std::string> segs(rings_.size());
+        for(;;) {
+            bool live = running_.load(std::memory_order_acquire);
+            if(have_pending_.exchange(false, std::memory_order_acquire)) {
+                std::lock_guard<std::mutex> lk(cfg_mu_);
+                cur_ = pending_;
+                reopen_.store(true);
+            }
+            if(reopen_.exchange(false)) open_file();
+
+            size_t total = 0;
+            bool more = false;
+            for(size_t i = 0; i < rings_.size(); i++) {
+                auto& r = *rings_[i];
+                auto& out = segs[i];
+                out.clear();
+                uint64_t t = r.tail.load(std::memory_order_relaxed);
+                uint64_t h = r.head.load(std::memory_order_acquire);
+                while(t != h && total + out.size() < BATCH_BYTES) {
+                    if(fd_ >= 0) format(r.slots[t & r.mask], out);
+                    t++;
+                    written_.fetch_add(fd_ >= 0, std::memory_order_relaxed);
+                }
+                r.tail.store(t, std::memory_order_release);
+                if(t != h) more = true;
+                total += out.size();
+            }
+            if(total) flush(segs, total);
+            if(!more) {
+                if(!live) break;
+                std::this_thread::sleep_for(std::chrono::milliseconds(IDLE_WAIT_MS));
+            }
+        }
+        if(fd_ >= 0) { close(fd_); fd_ = -1; }
+        enabled_.store(false);
+    }
+
+    void open_file() {
+        if(fd_ >= 0) { close(fd_); fd_ = -1; }
+        if(cur_.path.empty() || cur_.path == "off") { enabled_.store(false); return; }
+        fd_ = open(cur_.path.c_str(), O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC, 0640);
+        if(fd_ < 0) {
+            enabled_.store(false);
+            NW_WARN("accesslog", "Cannot open %s: %s — %s disabled", cur_.path.c_str(), strerror(errno), cur_.label);
+            return;
+        }
+        if(cur_.zstd_level > 0 && !opt::zstd_available())
+            NW_WARN("accesslog", "zstd requested but not compiled in — writing uncompressed");
+        // Binary files start with a header; appending to an existing file keeps its header.
+        if(cur_.format == AccessLogFormat::Binary && lseek(fd_, 0, SEEK_END) == 0) {
+            std::string hdr(AL_BIN_MAGIC, 4);
+            hdr += (char)AL_BIN_VERSION; hdr.append(3, '\0');
+            std::vector<std::string> one{std::move(hdr)};
+            flush(one, 8);
+        }
+        int zl = opt::zstd_available() ? cur_.zstd_level : 0;
+        fmt_pub_.store((int)cur_.format);
+        zstd_pub_.store(zl);
+        reopens_.fetch_add(1, std::memory_order_relaxed);
+        enabled_.store(true);
+        NW_INFO("accesslog", "Writing %s%s %s to %s", format_name(cur_.format),
+                zl > 0 ? "+zstd" : "", cur_.label, cur_.path.c_str());
+    }
+
+    void flush(std::vector<std::string>& segs, size_t total) {
+        if(fd_ < 0) return;
+        std::string frame;
+        struct iovec iov[IOV_MAX];
+        int n = 0;
+        if(cur_.zstd_level > 0 && opt::zstd_available()) {
+            std::string plain;
+            plain.reserve(total);
+            for(auto& s : segs) plain += s;
+            frame = opt::zstd_compress(plain, cur_.zstd_level);
+            if(frame.empty()) { errors_.fetch_add(1, std::memory_order_relaxed); return; }
+            iov[n++] = {frame.data(), frame.size()};
+        } else {
+            for(auto& s : segs)
+                if(!s.empty() && n < IOV_MAX) iov[n++] = {s.data(), s.size()};
+        }
+        // writev may be partial (disk full, signal) — advance and retry
+        struct iovec* v = iov;
+        while(n > 0) {
+            ssize_t w = writev(fd_, v, n);
+            if(w < 0) {
+                if(errno == EINTR) continue;
+                errors_.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            bytes_.fetch_add((uint64_t)w, std::memory_order_relaxed);
+            while(n > 0 && (size_t)w >= v->iov_len) { w -= (ssize_t)v->iov_len; v++; n--; }
+            if(n > 0) { v->iov_base = (char*)v->iov_base + w; v->iov_len -= (size_t)w; }
+        }
+    }
+
+    // ── Formatters ────────────────────────────────────────────────────────────
+    void format(const AccessRecord& r, std::string& out) {
+        switch(cur_.format) {
+        case AccessLogFormat::Json:   format_json(r, out);     break;
+        case AccessLogFormat::Binary: format_binary(r, out);   break;
+        default:                      format_combined(r, out); break;
+        }
+    }
+
+    // Quotes/backslashes/control bytes escaped; json=false uses nginx's \xHH style
+    static void esc(std::string& out, std::string_view s, bool json) {
+        static const char* hex = "0123456789abcdef";
+        for(unsigned char c : s) {
+            if(c == '"' || c == '\\') { out += '\\'; out += (char)c; }
+            else if(c < 0x20 || c == 0x7f) {
+                out += json ? "\\u00" : "\\x";
+                out += hex[c >> 4]; out += hex[c & 15];
+            }
+            else out += (char)c;
+        }
+    }
+
+    static std::string_view proto(uint8_t v) {
+        switch(v) {
+        case 10: return "HTTP/1.0";
+        case 20: return "HTTP/2.0";
+        case 30: return "HTTP/3.0";
+        default: return "HTTP/1.1";
+        }
+    }
+
+    void format_combined(const AccessRecord& r, std::string& out) {
+        time_t sec = (time_t)(r.ts_us / 1000000);
+        if(sec != clf_sec_) {
+            struct tm tm{}; localtime_r(&sec, &tm);
+            strftime(clf_buf_, sizeof(clf_buf_), "[%d/%b/%Y:%H:%M:%S %z]", &tm);
+            clf_sec_ = sec;
+        }
+        char num[64];
+        out += r.ip(); out += " - - "; out += clf_buf_; out += " \"";
+        out += method_str((Method)r.method); out += ' ';
+        esc(out, r.path(), false); out += ' '; out += proto(r.version); out += "\" ";
+        snprintf(num, sizeof(num), "%u %llu \"", r.status, (unsigned long long)r.bytes_out);
+        out += num;
+        if(r.ref_len) esc(out, r.ref(), false); else out += '-';
+        out += "\" \"";
+        if(r.ua_len) esc(out, r.ua(), false); else out += '-';
+        snprintf(num, sizeof(num), "\" %u.%03u\n", r.dur_us / 1000000, (r.dur_us / 1000) % 1000);
+        out += num;
+    }
+
+    void format_json(const AccessRecord& r, std::string& out) {
+        char num[96];
+        snprintf(num, sizeof(num), "{\"ts\":%lld.%06lld,\"ip\":\"",
+                 (long long)(r.ts_us / 1000000), (long long)(r.ts_us % 1000000));
+        out += num; esc(out, r.ip(), true);
+        out += "\",\"method\":\""; out += method_str((Method)r.method);
+        out += "\",\"host\":\"";   esc(out, r.host(), true);
+        out += "\",\"path\":\"";   esc(out, r.path(), true);
+        out += "\",\"proto\":\"";  out += proto(r.version);
+        snprintf(num, sizeof(num), "\",\"status\":%u,\"bytes_out\":%llu,\"bytes_in\":%u,\"dur_us\":%u,\"ua\":\"",
+                 r.status, (unsigned long long)r.bytes_out, r.bytes_in, r.dur_us);
+        out += num;               esc(out, r.ua(), true);
+        out += "\",\"referer\":\""; esc(out, r.ref(), true);
+        out += "\"}\n";
+    }
+
+    template<class T> static void put(std::string& out, T v) {
+        for(size_t i = 0; i < sizeof(T); i++) out += (char)((uint64_t)v >> (8 * i) & 0xff);
+    }
+
+    void format_binary(const AccessRecord& r, std::string& out) {
+        size_t strs = (size_t)r.ip_len + r.host_len + r.path_len + r.ua_len + r.ref_len;
+        put<uint16_t>(out, (uint16_t)(AL_BIN_FIXED + strs));
+        put<uint8_t>(out, r.kind); put<uint8_t>(out, r.nhdr);
+        put<int64_t>(out, r.ts_us); put<uint32_t>(out, r.dur_us);
+        put<uint16_t>(out, r.status); put<uint8_t>(out, r.method); put<uint8_t>(out, r.version);
+        put<uint64_t>(out, r.bytes_out); put<uint32_t>(out, r.bytes_in);
+        put<uint8_t>(out, r.ip_len); put<uint8_t>(out, r.host_len);
+        put<uint16_t>(out, r.path_len); put<uint16_t>(out, r.ua_len); put<uint16_t>(out, r.ref_len);
+        out.append(r.data, strs);
+    }
+};
+
+// ── Record builder (worker side) ──────────────────────────────────────────────
+// Fills the string area in priority order; whatever does not fit is cut.
+struct AccessRecordWriter {
+    AccessRecord& r;
+    size_t used{0};
+    size_t put(std::string_view s, size_t max) {
+        size_t n = std::min({s.size(), max, sizeof(r.data) - used});
+        memcpy(r.data + used, s.data(), n);
+        used += n;
+        return n;
+    }
+};
+
+// access_log directive of a server block → writer settings
+inline AccessLog::Settings access_log_settings(const ServerConfig& srv) {
+    AccessLog::Settings s;
+    s.path = srv.access_log;
+    if(!access_log_format_parse(srv.access_log_format, s.format))
+        s.format = AccessLogFormat::Combined;
+    s.zstd_level = srv.access_log_zstd;
+    return s;
+}
+
+static AccessLog g_access_log;
+
+// ── Traffic capture ───────────────────────────────────────────────────────────
+// Always dropped from capture values, on top of `capture ... scrub=`
+inline constexpr const char* CAPTURE_SCRUB_ALWAYS[] = {
+    "Authorization", "Proxy-Authorization", "Cookie", "X-Api-Key",
+    "X-Auth-Token", "X-Csrf-Token", "X-Xsrf-Token" };
+
+inline bool capture_scrubbed(std::string_view name, const std::vector<std::string>& extra) {
+    for(const char* s : CAPTURE_SCRUB_ALWAYS) if(ci_eq(name, s)) return true;
+    for(const auto& s : extra) if(ci_eq(name, s)) return true;
+    return false;
+}
+
+// One (u8 name_len, u16 value_len, name, value) entry; false if it does not fit
+inline bool capture_put_header(AccessRecordWriter& wr, std::string_view name, std::string_view val) {
+    if(name.size() > 255) return false;
+    val = val.substr(0, 1024);
+    if(wr.used + 3 + name.size() + val.size() > sizeof(wr.r.data)) return false;
+    uint8_t hdr[3] = {(uint8_t)name.size(), (uint8_t)(val.size() & 0xff), (uint8_t)(val.size() >> 8)};
+    wr.put({(const char*)hdr, 3}, 3);
+    wr.put(name, name.size());
+    wr.put(val, val.size());
+    return true;
+}
+
+inline AccessLog::Settings capture_settings(const ServerConfig& srv) {
+    AccessLog::Settings s;
+    s.path        = srv.capture;
+    s.format      = AccessLogFormat::Binary;
+    s.zstd_level  = srv.capture_zstd;
+    s.label       = "traffic capture";
+    s.thread_name = "nw-capture";
+    return s;
+}
+
+static AccessLog g_capture;
+
+// One writer each for the whole process: access_log / capture come from the
+// first server block. A later block that asks for something else would be
+// ignored silently — warn about it (startup and reload).
+inline void log_directives_check(const Config& cfg) {
+    if(cfg.servers.empty()) return;
+    const ServerConfig& s0 = cfg.servers[0];
+    for(size_t i = 1; i < cfg.servers.size(); i++) {
+        const ServerConfig& s = cfg.servers[i];
+        if(s.access_log_set &&
+           (s.access_log != s0.access_log || s.access_log_format != s0.access_log_format ||
+            s.access_log_zstd != s0.access_log_zstd || s.access_log_buffer != s0.access_log_buffer))
+            NW_WARN("accesslog", "server block %zu: access_log ignored — the first server block's "
+                    "access_log (%s) applies to all", i + 1, s0.access_log.c_str());
+        if(s.capture_set &&
+           (s.capture != s0.capture || s.capture_sample != s0.capture_sample ||
+            s.capture_headers != s0.capture_headers || s.capture_scrub != s0.capture_scrub ||
+            s.capture_zstd != s0.capture_zstd || s.capture_buffer != s0.capture_buffer))
+            NW_WARN("accesslog", "server block %zu: capture ignored — the first server block's "
+                    "capture (%s) applies to all", i + 1, s0.capture.c_str());
+    }
+}
@@ -0,0 +1,221 @@
+// latency_hist.cc — nas-web latency histograms (HDR-style, log-linear buckets)
+// Provides:
+//   - LatencyHist: 16 linear sub-buckets per power of two (≤6.25% error)
+//     from 1 µs to ~35 min; recorded by one worker thread with relaxed
+//     load+store (no lock, no read-modify-write)
+//   - LatencySeries: one histogram per worker for a named series
+//     ("all", "loc:/api", "up:10.0.0.2:3000") and metric (total/connect/ttfb)
+//   - LatencyRegistry: the stats thread merges every series once per second
+//     into cumulative percentiles plus a per-second history
+//   - status class counters (1xx..5xx) per series, for /metrics
+// Compiled as part of server.cc (single-TU build)
+
+#pragma once
+#include "../../include/np_mem.hh"
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+inline constexpr int LH_SUB_BITS   = 4;
+inline constexpr int LH_SUB        = 1 << LH_SUB_BITS;   // sub-buckets per magnitude
+inline constexpr int LH_MAGS       = 28;                 // up to 2^31 µs
+inline constexpr int LH_BUCKETS    = LH_MAGS * LH_SUB;
+inline constexpr int LH_MAX_WORKERS = 64;
+inline constexpr size_t LH_HISTORY = 300;                // per-second points kept (5 min)
+inline constexpr int LH_CLASSES    = 5;                  // 1xx..5xx
+
+// Values 0..15 map 1:1; above that the top 5 significant bits pick the bucket.
+inline int lh_bucket(uint64_t us) {
+    if(us < (uint64_t)LH_SUB) return (int)us;
+    int msb = 63 - __builtin_clzll(us);
+    int mag = msb - LH_SUB_BITS + 1;
+    if(mag >= LH_MAGS) return LH_BUCKETS - 1;
+    return mag * LH_SUB + (int)((us >> (msb - LH_SUB_BITS)) & (LH_SUB - 1));
+}
+// Midpoint of a bucket, µs
+inline uint64_t lh_value(int b) {
+    int mag = b / LH_SUB, sub = b % LH_SUB;
+    if(mag == 0) return (uint64_t)sub;
+    uint64_t width = 1ull << (mag - 1);
+    return ((uint64_t)(LH_SUB + sub) << (mag - 1)) + width / 2;
+}
+
+struct LatencyHist {
+    std::atomic<uint64_t> b[LH_BUCKETS]{};
+    std::atomic<uint64_t> count{0}, sum_us{0}, max_us{0};
+    std::atomic<uint64_t> cls[LH_CLASSES]{};
+
+    // Single writer (the owning worker) — readers may see a bucket one
+    // increment behind, never a torn value.
+    void record(uint64_t us, int status = 0) {
+        auto inc = [](std::atomic<uint64_t>& a, uint64_t v){
+            a.store(a.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+        };
+        inc(b[lh_bucket(us)], 1);
+        inc(count, 1);
+        inc(sum_us, us);
+        if(us > max_us.load(std::memory_order_relaxed)) max_us.store(us, std::memory_order_relaxed);
+        if(status >= 100 && status < 600) inc(cls[status / 100 - 1], 1);
+    }
+};
+
+// Plain (non-atomic) copy used by the stats thread for merging and deltas
+struct HistSnap {
+    uint64_t b[LH_BUCKETS]{};
+    uint64_t count{0}, sum_us{0}, max_us{0};
+    uint64_t cls[LH_CLASSES]{};
+
+    void add(const LatencyHist& h) {
+        for(int i = 0; i < LH_BUCKETS; i++) b[i] += h.b[i].load(std::memory_order_relaxed);
+        for(int i = 0; i < LH_CLASSES; i++) cls[i] += h.cls[i].load(std::memory_order_relaxed);
+        count  += h.count.load(std::memory_order_relaxed);
+        sum_us += h.sum_us.load(std::memory_order_relaxed);
+        uint64_t m = h.max_us.load(std::memory_order_relaxed);
+        if(m > max_us) max_us = m;
+    }
+    // this - older (cumulative → interval)
+    HistSnap delta(const HistSnap& older) const {
+        HistSnap d;
+        for(int i = 0; i < LH_BUCKETS; i++) d.b[i] = b[i] > older.b[i] ? b[i] - older.b[i] : 0;
+        d.count  = count  > older.count  ? count  - older.count  : 0;
+        d.sum_us = sum_us > older.sum_us ? sum_us - older.sum_us : 0;
+        return d;
+    }
+    uint64_t percentile(double q) const {
+        if(!count) return 0;
+        uint64_t want = (uint64_t)(q * (double)count + 0.5);
+        if(want < 1) want = 1;
+        uint64_t seen = 0;
+        for(int i = 0; i < LH_BUCKETS; i++) {
+            seen += b[i];
+            if(seen >= want) return lh_value(i);
+        }
+        return lh_value(LH_BUCKETS - 1);
+    }
+    uint64_t avg_us() const { return count ? sum_us / count : 0; }
+};
+
+// One second of a series
+struct LatencyPoint {
+    int64_t  ts;
+    uint64_t count, avg_us, p50, p90, p99, p999;
+};
+
+struct LatencySeries {
+    std::string name;     // "all" | "loc:<prefix>" | "up:<host>:<port>"
+    std::string metric;   // "total" | "connect" | "ttfb"
+    std::atomic<LatencyHist*> w[LH_MAX_WORKERS]{};
+
+    // Worker `wid` only — the histogram is created on first use.
+    // `status` (HTTP code) feeds the 1xx..5xx counters; 0 = not a response.
+    void record(int wid, int64_t us, int status = 0) {
+        if(wid < 0 || wid >= LH_MAX_WORKERS || us < 0) return;
+        LatencyHist* h = w[wid].load(std::memory_order_acquire);
+        if(!h) { h = new LatencyHist(); w[wid].store(h, std::memory_order_release); }
+        h->record((uint64_t)us, status);
+    }
+
+    // ── stats thread state (guarded by LatencyRegistry::mu) ─────────────────
+    HistSnap cum, prev;
+    std::deque<LatencyPoint> history;
+};
+
+class LatencyRegistry {
+public:
+    // Find-or-create; series live for the whole process (stable pointers)
+    LatencySeries* get(std::string_view name, std::string_view metric) {
+        std::lock_guard<std::mutex> lk(mu_);
+        for(auto& s : series_)
+            if(s.name == name && s.metric == metric) return &s;
+        auto& s = series_.emplace_back();
+        s.name = std::string(name);
+        s.metric = std::string(metric);
+        return &s;
+    }
+
+    // Stats thread, once per second: merge workers, derive the interval
+    // from the previous cumulative snapshot, append a history point.
+    // Returns the interval point of `all/total` (dashboard sample).
+    LatencyPoint tick(int64_t ts) {
+        std::lock_guard<std::mutex> lk(mu_);
+        LatencyPoint all{ts, 0, 0, 0, 0, 0, 0};
+        for(auto& s : series_) {
+            HistSnap now;
+            for(auto& slot : s.w)
+                if(auto* h = slot.load(std::memory_order_acquire)) now.add(*h);
+            HistSnap d = now.delta(s.prev);
+            s.prev = now;
+            s.cum  = now;
+            LatencyPoint p{ts, d.count, d.avg_us(), d.percentile(0.50), d.percentile(0.90),
+                           d.percentile(0.99), d.percentile(0.999)};
+            s.history.push_back(p);
+            if(s.history.size() > LH_HISTORY) s.history.pop_front();
+            if(s.name == "all" && s.metric == "total") all = p;
+        }
+        return all;
+    }
+
+    // {"series":[{name, metric, count, avg_us, max_us, p50_us.., history:[[ts,count,avg,p50,p90,p99,p999],..]}]}
+    std::string json(size_t history_points) {
+        std::lock_guard<std::mutex> lk(mu_);
+        std::string out = "{\"series\":[";
+        bool first = true;
+        char buf[320];
+        for(auto& s : series_) {
+            if(!first) out += ',';
+            first = false;
+            out += "{\"name\":\"";
+            for(char c : s.name) { if(c == '"' || c == '\\') out += '\\'; out += c; }
+            snprintf(buf, sizeof(buf),
+                "\",\"metric\":\"%s\",\"count\":%llu,\"avg_us\":%llu,\"max_us\":%llu,"
+                "\"p50_us\":%llu,\"p90_us\":%llu,\"p99_us\":%llu,\"p999_us\":%llu,\"history\":[",
+                s.metric.c_str(), (unsigned long long)s.cum.count,
+                (unsigned long long)s.cum.avg_us(), (unsigned long long)s.cum.max_us,
+                (unsigned long long)s.cum.percentile(0.50), (unsigned long long)s.cum.percentile(0.90),
+                (unsigned long long)s.cum.percentile(0.99), (unsigned long long)s.cum.percentile(0.999));
+            out += buf;
+            size_t skip = s.history.size() > history_points ? s.history.size() - history_points : 0;
+            for(size_t i = skip; i < s.history.size(); i++) {
+                auto& p = s.history[i];
+                snprintf(buf, sizeof(buf), "%s[%lld,%llu,%llu,%llu,%llu,%llu,%llu]",
+                         i == skip ? "" : ",", (long long)p.ts, (unsigned long long)p.count,
+                         (unsigned long long)p.avg_us, (unsigned long long)p.p50,
+                         (unsigned long long)p.p90, (unsigned long long)p.p99,
+                         (unsigned long long)p.p999);
+                out += buf;
+            }
+            out += "]}";
+        }
+        out += "]}";
+        return out;
+    }
+
+    // /np_memory: series + per-worker histograms + history points
+    MemUsage mem_usage() {
+        std::lock_guard<std::mutex> lk(mu_);
+        MemUsage m{mem_deque(series_), series_.size()};
+        for(auto& s : series_) {
+            m.bytes += mem_heap(s.name) + mem_heap(s.metric) + mem_deque(s.history);
+            for(auto& slot : s.w)
+                if(slot.load(std::memory_order_acquire)) m.bytes += sizeof(LatencyHist);
+        }
+        return m;
+    }
+
+    // Read-only walk over the merged (cum) state of every series, as of the
+    // last tick(); `f(const LatencySeries&)` runs under the registry lock.
+    template<class F> void visit(F&& f) {
+        std::lock_guard<std::mutex> lk(mu_);
+        for(auto& s : series_) f(static_cast<const LatencySeries&>(s));
+    }
+
+private:
+    std::mutex                mu_;
+    std::deque<LatencySeries> series_;   // deque: pointers handed out stay valid
+};
+
+static LatencyRegistry g_latency;
@@ -0,0 +1,85 @@
+// mem_stats.cc — nas-web per-subsystem memory accounting (GET /np_memory)
+// Provides:
+//   - MemRegistry: named components, each a callback returning the owner's
+//     MemUsage (np_mem.hh); registered once at startup, evaluated only when
+//     /np_memory or /metrics asks — nothing on the request path
+//   - ProcMem: process RSS / high-water mark from /proc/self/status and the
+//     glibc allocator view (mallinfo2: arena, mmap'd, in use, free)
+// Compiled as part of server.cc (single-TU build)
+
+#pragma once
+#include "../../include/np_mem.hh"
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <malloc.h>
+
+using MemCollect = std::function<MemUsage()>;
+
+class MemRegistry {
+public:
+    static constexpr int MAX_COMPONENTS = 32;
+
+    // Startup only (before workers run) — components are never removed
+    bool add(const char* name, const char* desc, MemCollect fn) {
+        int n = n_.load(std::memory_order_relaxed);
+        if(n >= MAX_COMPONENTS) return false;
+        comp_[n] = Component{name, desc, std::move(fn)};
+        n_.store(n + 1, std::memory_order_release);
+        return true;
+    }
+
+    // f(name, desc, usage) for every component, in registration order
+    template<class F> void each(F&& f) const {
+        int n = n_.load(std::memory_order_acquire);
+        for(int i = 0; i < n; i++) f(comp_[i].name, comp_[i].desc, comp_[i].fn());
+    }
+
+private:
+    struct Component { const char* name; const char* desc; MemCollect fn; };
+    Component        comp_[MAX_COMPONENTS]{};
+    std::atomic<int> n_{0};
+};
+
+static MemRegistry g_memory;
+
+struct ProcMem {
+    uint64_t rss{0}, rss_peak{0}, rss_anon{0}, rss_file{0}, vsize{0};  // bytes
+    uint64_t heap_arena{0};   // sbrk'd main arena + other arenas
+    uint64_t heap_mmap{0};    // chunks served by mmap (large allocations)
+    uint64_t heap_used{0};    // allocated and not freed
+    uint64_t heap_free{0};    // free chunks kept by the allocator (fragmentation)
+    uint64_t heap_top{0};     // releasable from the top of the main arena
+    bool     have_mallinfo{false};
+
+    static ProcMem read() {
+        ProcMem m;
+        if(FILE* fp = fopen("/proc/self/status", "r")) {
+            char line[256];
+            while(fgets(line, sizeof(line), fp)) {
+                unsigned long long kb = 0;
+                if     (sscanf(line, "VmRSS: %llu",   &kb) == 1) m.rss      = kb * 1024;
+                else if(sscanf(line, "VmHWM: %llu",   &kb) == 1) m.rss_peak = kb * 1024;
+                else if(sscanf(line, "RssAnon: %llu", &kb) == 1) m.rss_anon = kb * 1024;
+                else if(sscanf(line, "RssFile: %llu", &kb) == 1) m.rss_file = kb * 1024;
+                else if(sscanf(line, "VmSize: %llu",  &kb) == 1) m.vsize    = kb * 1024;
+            }
+            fclose(fp);
+        }
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+        struct mallinfo2 mi = mallinfo2();
+        m.heap_arena = mi.arena;    m.heap_mmap = mi.hblkhd;
+        m.heap_used  = mi.uordblks; m.heap_free = mi.fordblks;
+        m.heap_top   = mi.keepcost; m.have_mallinfo = true;
+#elif defined(__GLIBC__)
+        struct mallinfo mi = mallinfo();   // int fields — wrap past 2 GB
+        m.heap_arena = (unsigned)mi.arena;    m.heap_mmap = (unsigned)mi.hblkhd;
+        m.heap_used  = (unsigned)mi.uordblks; m.heap_free = (unsigned)mi.fordblks;
+        m.heap_top   = (unsigned)mi.keepcost; m.have_mallinfo = true;
+#endif
+        return m;
+    }
+};
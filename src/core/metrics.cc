@@ -0,0 +1,190 @@
+// metrics.cc — nas-web /metrics (OpenMetrics 1.0 text exposition)
+// Provides:
+//   - MetricFamily: name/type/help + a collect callback, registered once at
+//     startup into a fixed-size table (no registration on the scrape path)
+//   - MetricsWriter: formats samples with snprintf on the stack and appends
+//     to the scraping thread's reusable buffer — after the first scrape a
+//     render does no heap allocation per metric
+//   - histogram export of LatencyHist snapshots as cumulative `le` buckets
+// Compiled as part of server.cc (single-TU build)
+
+#pragma once
+#include "latency_hist.cc"
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+
+struct MetricLabel {
+    const char*      key;
+    std::string_view val;
+};
+
+struct MetricFamily;
+
+class MetricsWriter {
+public:
+    explicit MetricsWriter(std::string& out) : out_(out) {}
+
+    // `suffix` is appended to the family name: "_total", "_bucket", "" ...
+    void sample(const MetricFamily& f, const char* suffix,
+                std::initializer_list<MetricLabel> labels, uint64_t v);
+    void sample(const MetricFamily& f, const char* suffix,
+                std::initializer_list<MetricLabel> labels, double v);
+
+    // Counter: <name>_total
+    void counter(const MetricFamily& f, uint64_t v, std::initializer_list<MetricLabel> labels = {}) {
+        sample(f, "_total", labels, v);
+    }
+    void gauge(const MetricFamily& f, uint64_t v, std::initializer_list<MetricLabel> labels = {}) {
+        sample(f, "", labels, v);
+    }
+    void gauge(const MetricFamily& f, double v, std::initializer_list<MetricLabel> labels = {}) {
+        sample(f, "", labels, v);
+    }
+    // Histogram in seconds from a merged µs snapshot: _bucket{le=..}, _count, _sum
+    void histogram(const MetricFamily& f, const HistSnap& h,
+                   std::initializer_list<MetricLabel> labels = {});
+
+private:
+    void head(const MetricFamily& f, const char* suffix,
+              std::initializer_list<MetricLabel> labels, const MetricLabel* extra);
+    void put_escaped(std::string_view v) {
+        for(char c : v) {
+            if(c == '\\')      out_ += "\\\\";
+            else if(c == '"')  out_ += "\\\"";
+            else if(c == '\n') out_ += "\\n";
+            else               out_ += c;
+        }
+    }
+    std::string& out_;
+};
+
+using MetricCollect = void (*)(MetricsWriter&, const MetricFamily&);
+
+struct MetricFamily {
+    const char*   name{nullptr};   // without _total
+    const char*   type{nullptr};   // counter | gauge | histogram | info
+    const char*   help{nullptr};
+    MetricCollect collect{nullptr};
+};
+
+inline void MetricsWriter::head(const MetricFamily& f, const char* suffix,
+                                std::initializer_list<MetricLabel> labels, const MetricLabel* extra) {
+    out_ += f.name;
+    out_ += suffix;
+    if(labels.size() == 0 && !extra) return;
+    out_ += '{';
+    bool first = true;
+    auto put = [&](const MetricLabel& l) {
+        if(!first) out_ += ',';
+        first = false;
+        out_ += l.key;
+        out_ += "=\"";
+        put_escaped(l.val);
+        out_ += '"';
+    };
+    for(auto& l : labels) put(l);
+    if(extra) put(*extra);
+    out_ += '}';
+}
+
+inline void MetricsWriter::sample(const MetricFamily& f, const char* suffix,
+                                  std::initializer_list<MetricLabel> labels, uint64_t v) {
+    head(f, suffix, labels, nullptr);
+    char buf[32];
+    int n = snprintf(buf, sizeof(buf), " %llu\n", (unsigned long long)v);
+    out_.append(buf, (size_t)n);
+}
+
+inline void MetricsWriter::sample(const MetricFamily& f, const char* suffix,
+                                  std::initializer_list<MetricLabel> labels, double v) {
+    head(f, suffix, labels, nullptr);
+    char buf[40];
+    int n = snprintf(buf, sizeof(buf), " %.9g\n", v);
+    out_.append(buf, (size_t)n);
+}
+
+// Bucket bounds, µs, and their `le` labels in seconds. Counts are taken at
+// bucket midpoints, so a bound is exact to the histogram's ≤6.25% precision.
+inline constexpr uint64_t MX_LE_US[] = {
+    500, 1000, 2500, 5000, 10000, 25000, 50000, 100000,
+    250000, 500000, 1000000, 2500000, 5000000, 10000000 };
+inline constexpr const char* MX_LE_STR[] = {
+    "0.0005", "0.001", "0.0025", "0.005", "0.01", "0.025", "0.05", "0.1",
+    "0.25", "0.5", "1.0", "2.5", "5.0", "10.0" };
+inline constexpr int MX_LE_N = (int)(sizeof(MX_LE_US) / sizeof(MX_LE_US[0]));
+
+inline void MetricsWriter::histogram(const MetricFamily& f, const HistSnap& h,
+                                     std::initializer_list<MetricLabel> labels) {
+    char buf[40];
+    uint64_t seen = 0;
+    int i = 0;
+    for(int le = 0; le <= MX_LE_N; le++) {
+        if(le < MX_LE_N) {
+            for(; i < LH_BUCKETS && lh_value(i) <= MX_LE_US[le]; i++) seen += h.b[i];
+        } else {
+            seen = h.count;   // +Inf
+        }
+        MetricLabel l{"le", le < MX_LE_N ? MX_LE_STR[le] : "+Inf"};
+        head(f, "_bucket", labels, &l);
+        int n = snprintf(buf, sizeof(buf), " %llu\n", (unsigned long long)seen);
+        out_.append(buf, (size_t)n);
+    }
+    sample(f, "_count", labels, h.count);
+    sample(f, "_sum", labels, (double)h.sum_us / 1e6);
+}
+
+class MetricsRegistry {
+public:
+    static constexpr int MAX_FAMILIES = 96;
+
+    // Startup only (before workers run) — families are never removed
+    bool add(const char* name, const char* type, const char* help, MetricCollect fn) {
+        int n = n_.load(std::memory_order_relaxed);
+        if(n >= MAX_FAMILIES) return false;
+        fam_[n] = MetricFamily{name, type, help, fn};
+        n_.store(n + 1, std::memory_order_release);
+        return true;
+    }
+
+    // One pass over every family into the calling thread's buffer.
+    // The returned reference stays valid until the next render() on this thread.
+    const std::string& render() {
+        thread_local std::string buf;
+        buf.clear();
+        if(buf.capacity() < hint_.load(std::memory_order_relaxed))
+            buf.reserve(hint_.load(std::memory_order_relaxed));
+        MetricsWriter w(buf);
+        int n = n_.load(std::memory_order_acquire);
+        for(int i = 0; i < n; i++) {
+            const MetricFamily& f = fam_[i];
+            buf += "# TYPE "; buf += f.name; buf += ' '; buf += f.type; buf += '\n';
+            buf += "# HELP "; buf += f.name; buf += ' '; buf += f.help; buf += '\n';
+            f.collect(w, f);
+        }
+        buf += "# EOF\n";
+        // Next scrape on any thread starts with enough room
+        size_t want = buf.size() + buf.size() / 4;
+        if(want > hint_.load(std::memory_order_relaxed)) hint_.store(want, std::memory_order_relaxed);
+        scrapes_.fetch_add(1, std::memory_order_relaxed);
+        return buf;
+    }
+
+    int      families() const { return n_.load(std::memory_order_acquire); }
+    uint64_t scrapes()  const { return scrapes_.load(std::memory_order_relaxed); }
+
+private:
+    MetricFamily          fam_[MAX_FAMILIES]{};
+    std::atomic<int>      n_{0};
+    std::atomic<size_t>   hint_{16384};
+    std::atomic<uint64_t> scrapes_{0};
+};
+
+static MetricsRegistry g_metrics;
+
+static constexpr const char* METRICS_CONTENT_TYPE =
+    "application/openmetrics-text; version=1.0.0; charset=utf-8";
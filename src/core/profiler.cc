@@ -0,0 +1,334 @@
+// profiler.cc — nas-web built-in sampling CPU profiler
+// Provides:
+//   - Profiler: one CPU-time timer per thread of the process (timer_create
+//     on the thread's CPU clock, SIGEV_THREAD_ID → SIGPROF), so a busy thread
+//     is sampled at `hz` and an idle one not at all; the signal handler only
+//     stores backtrace() into a preallocated slot
+//   - collapsed-stack output ("thread;outer;...;inner count", heaviest
+//     first) for flamegraph.pl / inferno / speedscope; the root frame is the
+//     thread name (nw-worker-N, nw-stats, uv-threadpool, ...)
+//   - symbolization from the ELF .symtab of /proc/self/exe (static functions
+//     of the single TU included), dladdr() for shared libraries,
+//     "object+0xoffset" when neither knows the address
+//   - served by GET /np_profile?seconds=N&hz=H
+// Threads started after the profile began are not sampled.
+// Compiled as part of server.cc (single-TU build)
+
+#pragma once
+#include <cxxabi.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <elf.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <link.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+class Profiler {
+public:
+    static constexpr int    MAX_DEPTH   = 48;
+    static constexpr size_t MAX_SAMPLES = 1 << 16;   // ~26 MB while a profile runs
+
+    struct Result {
+        std::string collapsed;
+        size_t      samples{0}, dropped{0}, threads{0};
+    };
+
+    // Arms a timer on every current thread. false + reason if busy / failed.
+    bool start(int hz, int seconds, std::string& err) {
+        if(busy_.exchange(true)) { err = "a profile is already running"; return false; }
+        hz = std::clamp(hz, 1, 1000);
+        install_handler();
+        std::vector<pid_t> tids = list_threads();
+        size_t cap = std::min<size_t>(MAX_SAMPLES, (size_t)hz * (size_t)seconds * std::max<size_t>(tids.size(), 1));
+        samples_.reset(new Sample[cap]);
+        cap_ = cap;
+        next_.store(0, std::memory_order_relaxed);
+        dropped_.store(0, std::memory_order_relaxed);
+        names_.clear();
+        for(pid_t t : tids) names_[t] = thread_name(t);
+        void* warm[4];
+        backtrace(warm, 4);               // first call loads libgcc_s — not in the handler
+        g_active_ = this;
+        timespec iv{0, 1000000000L / hz};
+        for(pid_t t : tids) {
+            sigevent sev{};
+            sev.sigev_notify           = SIGEV_THREAD_ID;
+            sev.sigev_signo            = SIGPROF;
+            sev.sigev_notify_thread_id = t;
+            timer_t id;
+            // Per-thread CPU clock of another thread: MAKE_THREAD_CPUCLOCK(tid, CPUCLOCK_SCHED)
+            clockid_t clk = (clockid_t)((~(unsigned)t << 3) | 6);
+            if(timer_create(clk, &sev, &id) != 0) continue;   // thread exited meanwhile
+            itimerspec its{iv, iv};
+            timer_settime(id, 0, &its, nullptr);
+            timers_.push_back(id);
+        }
+        if(timers_.empty()) {
+            g_active_ = nullptr;
+            busy_.store(false);
+            err = std::string("timer_create failed: ") + strerror(errno);
+            return false;
+        }
+        return true;
+    }
+
+    // Disarms the timers and waits out handlers already running; a SIGPROF
+    // still pending finds g_active_ null. Samples stay until collapse()
+    void stop() {
+        for(timer_t id : timers_) timer_delete(id);
+        timers_.clear();
+        g_active_.store(nullptr);
+        while(in_handler_.load() != 0) sched_yield();
+    }
+
+    // Symbolize and fold the samples, then release the profiler
+    Result collapse() {
+        stop();   // no handler may write into samples_ from here on
+        Result r;
+        size_t n = std::min(next_.load(), cap_);
+        r.samples = n;
+        r.dropped = dropped_.load();
+        std::unordered_map<uintptr_t, std::string> sym;
+        std::unordered_map<std::string, size_t> folded;
+        std::unordered_map<pid_t, bool> seen;
+        std::string key;
+        for(size_t i = 0; i < n; i++) {
+            const Sample& s = samples_[i];
+            if(!s.depth) continue;
+            seen[s.tid] = true;
+            auto nm = names_.find(s.tid);
+            key = nm != names_.end() ? nm->second : "thread-" + std::to_string(s.tid);
+            // [0] handler, [1] signal trampoline, [2] interrupted pc, [3..] return addresses
+            for(int f = s.depth - 1; f >= SKIP; f--) {
+                uintptr_t pc = (uintptr_t)s.pc[f] - (f > SKIP ? 1 : 0);
+                auto it = sym.find(pc);
+                if(it == sym.end()) it = sym.emplace(pc, symbolize(pc)).first;
+                key += ';';
+                key += it->second;
+            }
+            folded[key]++;
+        }
+        r.threads = seen.size();
+        std::vector<std::pair<std::string, size_t>> rows(folded.begin(), folded.end());
+        std::sort(rows.begin(), rows.end(), [](auto& a, auto& b) { return a.second > b.second; });
+        for(auto& [stack, count] : rows) {
+            r.collapsed += stack;
+            r.collapsed += ' ';
+            r.collapsed += std::to_string(count);
+            r.collapsed += '\n';
+        }
+        samples_.reset();
+        cap_ = 0;
+        busy_.store(false);
+        return r;
+    }
+
+private:
+    struct Sample {
+        pid_t tid;
+        int   depth;
+        void* pc[MAX_DEPTH];
+    };
+    static constexpr int SKIP = 2;
+
+    struct ElfSym { uintptr_t addr; size_t size; std::string name; };
+
+    static inline std::atomic<Profiler*> g_active_{nullptr};
+    // Handlers between reading g_active_ and their last write. Raised before
+    // that read (both seq_cst): stop() either sees the count or the handler
+    // sees null
+    static inline std::atomic<int>       in_handler_{0};
+
+    // Async-signal context: no locks, no allocation
+    static void on_sigprof(int, siginfo_t*, void*) {
+        int saved = errno;
+        in_handler_.fetch_add(1);
+        Profiler* p = g_active_.load();
+        if(p) {
+            size_t i = p->next_.fetch_add(1, std::memory_order_relaxed);
+            if(i < p->cap_) {
+                Sample& s = p->samples_[i];
+                s.tid   = (pid_t)syscall(SYS_gettid);
+                s.depth = backtrace(s.pc, MAX_DEPTH);
+            } else {
+                p->dropped_.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        in_handler_.fetch_sub(1);
+        errno = saved;
+    }
+
+    // Stays installed: a SIGPROF still pending after stop() must not kill the process
+    static void install_handler() {
+        static std::once_flag once;
+        std::call_once(once, [] {
+            struct sigaction sa{};
+            sa.sa_sigaction = on_sigprof;
+            sa.sa_flags     = SA_SIGINFO | SA_RESTART;
+            sigemptyset(&sa.sa_mask);
+            sigaction(SIGPROF, &sa, nullptr);
+        });
+    }
+
+    static std::vector<pid_t> list_threads() {
+        std::vector<pid_t> out;
+        DIR* d = opendir("/proc/self/task");
+        if(!d) return out;
+        while(dirent* e = readdir(d))
+            if(e->d_name[0] != '.') out.push_back((pid_t)atoi(e->d_name));
+        closedir(d);
+        return out;
+    }
+
+    // comm of the thread; unnamed helper threads are libuv's threadpool
+    static std::string thread_name(pid_t tid) {
+        auto comm = [](const std::string& path) {
+            char buf[32] = {};
+            int fd = open(path.c_str(), O_RDONLY);
+            if(fd < 0) return std::string();
+            ssize_t n = read(fd, buf, sizeof(buf) - 1);
+            close(fd);
+            std::string s(buf, n > 0 ? (size_t)n : 0);
+            while(!s.empty() && (s.back() == '\n' || s.back() == ' ')) s.pop_back();
+            return s;
+        };
+        std::string name = comm("/proc/self/task/" + std::to_string(tid) + "/comm");
+        if(tid == getpid()) return "main";
+        if(name.empty() || name == comm("/proc/self/comm")) return "uv-threadpool";
+        for(auto& c : name) if(c == ';' || c == ' ') c = '_';
+        return name;
+    }
+
+    // .symtab (or .dynsym) functions of the executable, sorted by address
+    void load_exe_symbols() {
+        if(exe_loaded_) return;
+        exe_loaded_ = true;
+        dl_iterate_phdr([](dl_phdr_info* info, size_t, void* self) {
+            auto* p = static_cast<Profiler*>(self);           // first entry = executable
+            p->exe_base_ = info->dlpi_addr;
+            for(int i = 0; i < info->dlpi_phnum; i++)
+                if(info->dlpi_phdr[i].p_type == PT_LOAD)
+                    p->exe_ranges_.push_back({info->dlpi_addr + info->dlpi_phdr[i].p_vaddr,
+                                              info->dlpi_addr + info->dlpi_phdr[i].p_vaddr + info->dlpi_phdr[i].p_memsz});
+            return 1;
+        }, this);
+        int fd = open("/proc/self/exe", O_RDONLY | O_CLOEXEC);
+        if(fd < 0) return;
+        struct stat st{};
+        if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Elf64_Ehdr)) { close(fd); return; }
+        void* map = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if(map == MAP_FAILED) return;
+        const char* base = (const char*)map;
+        size_t      size = (size_t)st.st_size;
+        auto* eh = (const Elf64_Ehdr*)base;
+        if(memcmp(eh->e_ident, ELFMAG, SELFMAG) == 0 && eh->e_ident[EI_CLASS] == ELFCLASS64 &&
+           eh->e_shoff && eh->e_shoff + (size_t)eh->e_shnum * sizeof(Elf64_Shdr) <= size) {
+            auto* sh = (const Elf64_Shdr*)(base + eh->e_shoff);
+            for(uint32_t want : {(uint32_t)SHT_SYMTAB, (uint32_t)SHT_DYNSYM}) {
+                for(int i = 0; i < eh->e_shnum && exe_syms_.empty(); i++) {
+                    if(sh[i].sh_type != want || sh[i].sh_link >= eh->e_shnum) continue;
+                    const Elf64_Shdr& strs = sh[sh[i].sh_link];
+                    if(sh[i].sh_offset + sh[i].sh_size > size || strs.sh_offset + strs.sh_size > size) continue;
+                    auto* sy = (const Elf64_Sym*)(base + sh[i].sh_offset);
+                    size_t cnt = sh[i].sh_size / sizeof(Elf64_Sym);
+                    for(size_t k = 0; k < cnt; k++) {
+                        if(ELF64_ST_TYPE(sy[k].st_info) != STT_FUNC || !sy[k].st_value) continue;
+                        if(sy[k].st_name >= strs.sh_size) continue;
+                        exe_syms_.push_back({(uintptr_t)sy[k].st_value, (size_t)sy[k].st_size,
+                                             base + strs.sh_offset + sy[k].st_name});
+                    }
+                }
+                if(!exe_syms_.empty()) break;
+            }
+        }
+        munmap(map, size);
+        std::sort(exe_syms_.begin(), exe_syms_.end(), [](auto& a, auto& b) { return a.addr < b.addr; });
+    }
+
+    // Demangled, without the parameter list (overloads are rare on hot paths
+    // and the full signatures make stacks unreadable), std::string spelled short
+    static std::string demangle(const char* name) {
+        int st = 0;
+        char* d = abi::__cxa_demangle(name, nullptr, nullptr, &st);
+        std::string out = st == 0 && d ? d : name;
+        free(d);
+        if(out.size() > 6 && out.compare(out.size() - 6, 6, " const") == 0) out.resize(out.size() - 6);
+        if(!out.empty() && out.back() == ')') {
+            int depth = 0;
+            for(size_t i = out.size(); i-- > 0; ) {
+                if(out[i] == ')') depth++;
+                else if(out[i] == '(' && --depth == 0) { if(i) out.resize(i); break; }
+            }
+        }
+        static const std::string_view long_str =
+            "std::__cxx11::basic_string<char, std::char_traits<char>, std::allocator<char> >";
+        for(size_t p; (p = out.find(long_str)) != std::string::npos; ) out.replace(p, long_str.size(), "std::string");
+        for(auto& c : out) if(c == ';') c = ':';
+        return out;
+    }
+
+    std::string symbolize(uintptr_t pc) {
+        load_exe_symbols();
+        bool in_exe = false;
+        for(auto& [lo, hi] : exe_ranges_) if(pc >= lo && pc < hi) in_exe = true;
+        if(in_exe) {
+            uintptr_t rel = pc - exe_base_;
+            auto it = std::upper_bound(exe_syms_.begin(), exe_syms_.end(), rel,
+                                       [](uintptr_t v, const ElfSym& s) { return v < s.addr; });
+            if(it != exe_syms_.begin()) {
+                --it;
+                if(rel < it->addr + std::max<size_t>(it->size, 1)) return demangle(it->name.c_str());
+            }
+        }
+        Dl_info info{};
+        if(!in_exe && dladdr((void*)pc, &info) && info.dli_sname) return demangle(info.dli_sname);
+        // offset into the object, for addr2line
+        const char* obj = "nas-web";
+        uintptr_t   off = pc - exe_base_;
+        if(!in_exe && info.dli_fname && *info.dli_fname) {
+            const char* slash = strrchr(info.dli_fname, '/');
+            obj = slash ? slash + 1 : info.dli_fname;
+            off = pc - (uintptr_t)info.dli_fbase;
+        }
+        char buf[320];
+        snprintf(buf, sizeof(buf), "%s+0x%lx", obj, (unsigned long)off);
+        return buf;
+    }
+
+    std::atomic<bool>         busy_{false};
+    std::unique_ptr<Sample[]> samples_;
+    size_t                    cap_{0};
+    std::atomic<size_t>       next_{0}, dropped_{0};
+    std::vector<timer_t>      timers_;
+    std::unordered_map<pid_t, std::string> names_;
+    bool                      exe_loaded_{false};
+    uintptr_t                 exe_base_{0};
+    std::vector<std::pair<uintptr_t, uintptr_t>> exe_ranges_;
+    std::vector<ElfSym>       exe_syms_;
+};
+
+static Profiler g_profiler;
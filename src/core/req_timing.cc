@@ -0,0 +1,169 @@
+// req_timing.cc — nas-web per-request phase timing
+// Provides:
+//   - ReqTiming: monotonic laps at phase boundaries of one request
+//     (recv, parse, autoban, waf, ratelimit, lua, app, connect, ttfb,
+//     upstream, write) — a handful of now_us() calls, no allocation
+//   - Server-Timing header value for trusted clients
+//   - SlowLog: bounded ring of requests over `slow_request_ms`, with the
+//     full breakdown, served by GET /np_slow
+// Compiled as part of server.cc (single-TU build)
+
+#pragma once
+#include "../../include/np_types.hh"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+enum ReqPhase : uint8_t {
+    PH_RECV,       // first request byte → request complete (minus parse)
+    PH_PARSE,      // parse_request() calls
+    PH_AUTOBAN,
+    PH_WAF,        // built-in regex WAF (+ ModSecurity when compiled in)
+    PH_RATELIMIT,  // match_location + rate limiter
+    PH_LUA,        // middleware request phase (Lua / JS)
+    PH_APP,        // everything else on the loop: routing, static, cache, filters
+    PH_CONNECT,    // upstream acquire (TCP connect when not reused); h2: inside PH_UPSTREAM
+    PH_TTFB,       // upstream request sent → first response byte (inside PH_UPSTREAM)
+    PH_UPSTREAM,   // upstream acquired → response back on the loop
+    PH_WRITE,      // response handed to the socket → write completed
+    PH_COUNT
+};
+
+inline constexpr const char* REQ_PHASE_NAME[PH_COUNT] = {
+    "recv", "parse", "autoban", "waf", "ratelimit", "lua", "app",
+    "connect", "ttfb", "upstream", "write" };
+
+struct ReqTiming {
+    int64_t start_us{0};        // dispatch() entry; 0 = no request in flight
+    int64_t mark_us{0};         // last phase boundary
+    int32_t d[PH_COUNT]{};      // µs per phase
+    int     status{0};
+    bool    emit_header{false}; // Server-Timing for this client
+
+    void begin(int64_t now) {
+        start_us = mark_us = now;
+        for(auto& x : d) x = 0;
+        status = 0;
+        emit_header = false;
+    }
+    // Time since the previous boundary goes to `p`
+    void lap(ReqPhase p) {
+        if(!start_us) return;
+        int64_t now = now_us();
+        add(p, now - mark_us);
+        mark_us = now;
+    }
+    void add(ReqPhase p, int64_t us) {
+        if(us > 0) d[p] += (int32_t)std::min<int64_t>(us, INT32_MAX - d[p]);
+    }
+    // Time spent on the loop before the response (excludes PH_RECV/PH_WRITE)
+    int64_t elapsed_us(int64_t now) const { return start_us ? now - start_us : 0; }
+
+    // "recv;dur=0.120, waf;dur=0.031, ..., total;dur=1.402" — non-zero phases, ms
+    size_t server_timing(char* buf, size_t cap, int64_t now) const {
+        size_t n = 0;
+        for(int i = 0; i < PH_COUNT && n < cap; i++) {
+            if(!d[i] || i == PH_WRITE) continue;
+            int w = snprintf(buf + n, cap - n, "%s;dur=%.3f, ", REQ_PHASE_NAME[i], d[i] / 1000.0);
+            if(w < 0) break;
+            n += (size_t)w;
+        }
+        if(n < cap) {
+            int w = snprintf(buf + n, cap - n, "total;dur=%.3f",
+                             (elapsed_us(now) + d[PH_RECV] + d[PH_PARSE]) / 1000.0);
+            if(w > 0) n += (size_t)w;
+        }
+        return n < cap ? n : cap - 1;
+    }
+};
+
+struct SlowRequest {
+    int64_t     ts_ms;        // wall clock, request start
+    int64_t     total_us;
+    int         status;
+    int         worker;
+    std::string ip, method, host, path;
+    int32_t     d[PH_COUNT];
+};
+
+class SlowLog {
+public:
+    static constexpr size_t CAP = 256;
+
+    void set_threshold_ms(int ms) { threshold_us_.store(ms > 0 ? (int64_t)ms * 1000 : 0, std::memory_order_relaxed); }
+    int64_t threshold_us() const { return threshold_us_.load(std::memory_order_relaxed); }
+    bool is_slow(int64_t total_us) const {
+        int64_t t = threshold_us();
+        return t > 0 && total_us >= t;
+    }
+
+    void push(SlowRequest&& r) {
+        total_.fetch_add(1, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lk(mu_);
+        ring_.push_back(std::move(r));
+        if(ring_.size() > CAP) ring_.pop_front();
+    }
+    void clear() {
+        std::lock_guard<std::mutex> lk(mu_);
+        ring_.clear();
+    }
+
+    // {"threshold_ms":N,"total":N,"entries":[{..,"phases":{"recv":us,..}}]} — newest first
+    std::string json(size_t limit) {
+        std::lock_guard<std::mutex> lk(mu_);
+        char buf[256];
+        snprintf(buf, sizeof(buf), "{\"threshold_ms\":%lld,\"total\":%llu,\"entries\":[",
+                 (long long)(threshold_us() / 1000),
+                 (unsigned long long)total_.load(std::memory_order_relaxed));
+        std::string out = buf;
+        size_t shown = 0;
+        for(auto it = ring_.rbegin(); it != ring_.rend() && shown < limit; ++it, ++shown) {
+            const SlowRequest& r = *it;
+            if(shown) out += ',';
+            snprintf(buf, sizeof(buf),
+                     "{\"ts\":%lld,\"total_us\":%lld,\"status\":%d,\"worker\":%d,\"ip\":\"",
+                     (long long)r.ts_ms, (long long)r.total_us, r.status, r.worker);
+            out += buf;
+            json_escape(out, r.ip);     out += "\",\"method\":\"";
+            json_escape(out, r.method); out += "\",\"host\":\"";
+            json_escape(out, r.host);   out += "\",\"path\":\"";
+            json_escape(out, r.path);   out += "\",\"phases\":{";
+            for(int i = 0; i < PH_COUNT; i++) {
+                snprintf(buf, sizeof(buf), "%s\"%s\":%d", i ? "," : "", REQ_PHASE_NAME[i], r.d[i]);
+                out += buf;
+            }
+            out += "}}";
+        }
+        out += "]}";
+        return out;
+    }
+
+    MemUsage mem_usage() {
+        std::lock_guard<std::mutex> lk(mu_);
+        MemUsage m{mem_deque(ring_), ring_.size()};
+        for(auto& r : ring_)
+            m.bytes += mem_heap(r.ip) + mem_heap(r.method) + mem_heap(r.host) + mem_heap(r.path);
+        return m;
+    }
+
+private:
+    static void json_escape(std::string& out, std::string_view s) {
+        for(unsigned char c : s) {
+            if(c == '"' || c == '\\') { out += '\\'; out += (char)c; }
+            else if(c < 0x20) { char e[8]; snprintf(e, sizeof(e), "\\u%04x", c); out += e; }
+            else out += (char)c;
+        }
+    }
+
+    std::atomic<int64_t>    threshold_us_{1000000};
+    std::atomic<uint64_t>   total_{0};
+    std::mutex              mu_;
+    std::deque<SlowRequest> ring_;
+};
+
+static SlowLog g_slow;
@@ -1,6 +1,7 @@
 // server.cc — nodeproxy v2 main server
 #include "../../include/np_types.hh"
 #include "../../include/np_config.hh"
+#include "../../include/np_probes.hh"
 #include <uv.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
@@ -36,13 +37,20 @@ static std::atomic<uint64_t> g_stat_cache_entries{0};
 
 #include "../cache/cache.cc"
 #include "../security/ratelimit.cc"
+#include "latency_hist.cc"
+#include "metrics.cc"
+#include "req_timing.cc"
+#include "mem_stats.cc"
+#include "profiler.cc"
 #include "../proxy/upstream.cc"
 #include "../optimization/optimization.cc"
+#include "access_log.cc"
 #include "../static/static_handler.cc"
 #include "../config/config_parser.cc"
 #include "../scripting/middleware_pipeline.cc"
 #include "../http/h2_handler.cc"
 #include "../http/h3_handler.cc"
+#include "../proxy/upstream_h2.cc"
 #if defined(HAVE_ACME)
 #include "../tls/acme.cc"
 #else
@@ -72,8 +80,11 @@ static std::atomic<uint64_t> g_stat_err{0};
 static std::atomic<uint64_t> g_stat_req_prev{0};
 static std::atomic<uint64_t> g_stat_req_per_sec{0};
 static time_t                g_stat_last_sec = time(nullptr);
-static uint64_t              g_stat_latency_sum{0};   // ms sum for rolling avg
-static uint64_t              g_stat_latency_cnt{0};   // sample count
+// Every dispatched request, dispatch() → response queued (per worker, lock-free)
+static LatencySeries* const  g_lat_all = g_latency.get("all", "total");
+// TLS handshakes finished (ok) / aborted with an error (noisy drops included)
+static std::atomic<uint64_t> g_tls_hs_ok{0};
+static std::atomic<uint64_t> g_tls_hs_fail{0};
 
 static std::string g_config_path; // set in main(), used by /np_config endpoint
 
@@ -83,9 +94,44 @@ struct WorkerStats {
     std::atomic<uint64_t> err{0};
     std::atomic<uint64_t> cache_hit{0};
     std::atomic<uint64_t> active_conns{0};
+    // Published by the worker's 1 s stats timer (ResponseCache is loop-local)
+    std::atomic<uint64_t> cache_miss{0};
+    std::atomic<uint64_t> cache_evict{0};
+    std::atomic<uint64_t> cache_bytes{0};
+    std::atomic<uint64_t> cache_entries{0};
+    // Loop saturation, published by the same tick (see run_worker)
+    std::atomic<int64_t>  loop_lag_us{0};     // worst lag-probe drift in the last second
+    std::atomic<int64_t>  loop_lag_max_us{0}; // worst drift since start
+    std::atomic<uint32_t> loop_busy_pm{0};    // ‰ of the last second not spent idle in poll
+    std::atomic<uint32_t> loop_handles{0};    // active handles (sockets, timers, asyncs)
+    std::atomic<uint32_t> loop_reqs{0};       // in-flight libuv requests (writes, work)
+    std::atomic<uint64_t> loop_stalls{0};     // drifts over loop_stall_warn_ms
+    std::atomic<int32_t>  tp_queued{0};       // uv_queue_work() submitted, after_work not run yet
+    // Memory (/np_memory): Conn objects are counted live, the loop-local
+    // cache and rate limiter are published by the tick
+    std::atomic<int64_t>  conn_objs{0};       // Conn incl. HTTP/2 stream Conns and ones awaiting reap
+    std::atomic<uint64_t> cache_mem{0};
+    std::atomic<uint64_t> rl_mem{0};
+    std::atomic<uint64_t> rl_entries{0};
+    std::atomic<uint64_t> arena_mem{0};       // Worker::req_pool upstream blocks
+    std::atomic<uint64_t> waf_norm_mem{0};    // Worker::waf_norm buffer + waf_vcache table
 };
 static WorkerStats g_wstats[64];
 static int         g_wstats_count{0}; // set during startup
+static std::atomic<int> g_loop_stall_warn_ms{500}; // loop_stall_warn_ms; 0 = off
+
+// Threadpool depth: every uv_queue_work() from a worker goes through here,
+// +1 when submitted, -1 at the top of its after_work callback
+static inline void tp_submitted(int wid, int d) {
+    if(wid >= 0 && wid < 64) g_wstats[wid].tp_queued.fetch_add(d, std::memory_order_relaxed);
+}
+
+// uv_metrics_idle_time() — libuv >= 1.39; older builds report busy as 0
+#if UV_VERSION_HEX >= 0x012700
+#define NW_UV_IDLE_METRICS 1
+#else
+#define NW_UV_IDLE_METRICS 0
+#endif
 
 
 static std::mutex                         g_blacklist_mu;
@@ -174,11 +220,13 @@ static std::unordered_map<std::string,int>    g_conn_count;
 static int                                     g_max_conns_per_ip{32}; // default: 32 per IP
 
 // ── Active connections list (for admin panel) ─────────────────────────────
+struct TunnelBytes { std::atomic<uint64_t> up{0}, down{0}; };
 struct ActiveConn {
     std::string ip, method, path;
     int status{0};
     int64_t started_ms;
     std::string type; // "proxy","static","ws"
+    std::shared_ptr<TunnelBytes> tunnel;  // set while a WebSocket/Upgrade tunnel runs
 };
 static std::mutex                    g_active_mu;
 static std::unordered_map<void*,ActiveConn> g_active; // key=Conn*
@@ -202,6 +250,27 @@ struct UpstreamOverride {
 };
 static std::vector<UpstreamOverride>     g_upstream_overrides;
 
+// ── SSE subscribers (/np_logs/stream, /np_stats/stream) ─────────────────────
+enum : uint8_t { SSE_LOG = 1, SSE_STATS = 2 };
+struct SseEvent {
+    uint8_t     kind;
+    int         level;     // log level, 0 for stats
+    std::string frame;     // "event: ...\ndata: ...\n\n", shared by every client
+};
+struct SseState {
+    uint8_t  kinds{0};
+    int      min_level{0};
+    std::deque<std::shared_ptr<const SseEvent>> q;  // bounded, oldest dropped
+    uint64_t dropped{0};
+};
+static constexpr size_t SSE_INBOX_MAX  = 1024;        // per worker, between async wakeups
+static constexpr size_t SSE_CLIENT_MAX = 256;         // per client backlog
+static constexpr size_t SSE_WQ_MAX     = 256 * 1024;  // unsent bytes before a client counts as slow
+static std::mutex                        g_sse_mu;
+static std::vector<struct Worker*>       g_sse_workers; // workers accepting SSE events
+static std::atomic<int>                  g_sse_subs{0};
+static void sse_publish(uint8_t kind, int level, const char* event, const std::string& data);
+
 // ── Stats history ring buffer (for dashboard charts) ─────────────────────────
 struct StatSample {
     int64_t  ts;           // unix seconds
@@ -209,7 +278,11 @@ struct StatSample {
     uint64_t err_per_sec;
     uint64_t cache_hits;
     uint32_t active_conns;
-    uint32_t latency_avg_ms; // rolling average
+    uint32_t latency_avg_ms; // mean of this second's requests
+    uint64_t p50_us, p90_us, p99_us, p999_us;  // this second, all requests
+    uint32_t loop_lag_us;    // worst worker's lag-probe drift
+    uint16_t loop_busy_pm;   // busiest worker, ‰
+    uint16_t tp_queued;      // threadpool jobs in flight, all workers
 };
 static std::mutex              g_stats_hist_mu;
 static std::deque<StatSample>  g_stats_hist;   // 1 sample/s, max 3600 (1h)
@@ -239,13 +312,42 @@ static void stats_collector_tick(){
     s.err_per_sec    = eps;
     s.cache_hits     = g_stat_cache_hit.load();
     s.active_conns   = (uint32_t)g_active.size();
-    s.latency_avg_ms = 0;
+    LatencyPoint lp  = g_latency.tick(s.ts);
+    s.latency_avg_ms = (uint32_t)((lp.avg_us + 500) / 1000);
+    s.p50_us = lp.p50; s.p90_us = lp.p90; s.p99_us = lp.p99; s.p999_us = lp.p999;
+    {
+        int64_t lag = 0; uint32_t busy = 0; int32_t tp = 0;
+        for(int i = 0; i < g_wstats_count && i < 64; i++) {
+            lag  = std::max(lag,  g_wstats[i].loop_lag_us.load(std::memory_order_relaxed));
+            busy = std::max(busy, g_wstats[i].loop_busy_pm.load(std::memory_order_relaxed));
+            tp  += std::max(0, g_wstats[i].tp_queued.load(std::memory_order_relaxed));
+        }
+        s.loop_lag_us  = (uint32_t)std::min<int64_t>(lag, UINT32_MAX);
+        s.loop_busy_pm = (uint16_t)std::min<uint32_t>(busy, 1000);
+        s.tp_queued    = (uint16_t)std::min<int32_t>(tp, UINT16_MAX);
+    }
     {
         std::lock_guard lk(g_stats_hist_mu);
         g_stats_hist.push_back(s);
         if((int)g_stats_hist.size() > G_STATS_HIST_MAX)
             g_stats_hist.pop_front();
     }
+    if(g_sse_subs.load(std::memory_order_relaxed) > 0) {
+        char buf[384];
+        snprintf(buf, sizeof(buf),
+            "{\"ts\":%lld,\"rps\":%llu,\"eps\":%llu,\"cache\":%llu,\"conns\":%u,\"lat\":%u,"
+            "\"p50_us\":%llu,\"p90_us\":%llu,\"p99_us\":%llu,\"p999_us\":%llu,"
+            "\"loop_lag_us\":%u,\"loop_busy_pct\":%.1f,\"tp_queued\":%u,"
+            "\"requests\":%llu,\"errors\":%llu}",
+            (long long)s.ts, (unsigned long long)s.req_per_sec,
+            (unsigned long long)s.err_per_sec, (unsigned long long)s.cache_hits,
+            (unsigned)s.active_conns, (unsigned)s.latency_avg_ms,
+            (unsigned long long)s.p50_us, (unsigned long long)s.p90_us,
+            (unsigned long long)s.p99_us, (unsigned long long)s.p999_us,
+            (unsigned)s.loop_lag_us, s.loop_busy_pm / 10.0, (unsigned)s.tp_queued,
+            (unsigned long long)cur_req, (unsigned long long)cur_err);
+        sse_publish(SSE_STATS, 0, "stats", buf);
+    }
 }
 
 // ── Audit log ────────────────────────────────────────────────────────────────
@@ -266,17 +368,12 @@ static void audit(const std::string& ip, const std::string& action, const std::s
     NW_INFO("audit", "[%s] %s %s", ip.c_str(), action.c_str(), detail.c_str());
 }
 
-// ── SSE clients for live log streaming ───────────────────────────────────────
-static std::mutex                        g_sse_mu;
-static std::vector<struct Conn*>         g_sse_clients; // live /np_logs/stream connections
-
-
-
 // ── Worker ────────────────────────────────────────────────────────────────────
 struct Worker {
     int         id{};
     uv_loop_t*  loop{nullptr};
     uv_tcp_t    server_h{};   // primary (HTTP) handle
+    bool        server_h2c{false};   // its listen has http2 without ssl → h2c preface / Upgrade
     uv_tcp_t    tls_h{};      // secondary (HTTPS) handle — used if tls_fd >= 0
     int         tls_fd{-1};   // fd for TLS port, -1 if none
     uv_async_t  stop_async{};
@@ -287,12 +384,77 @@ struct Worker {
     std::unique_ptr<RateLimiter>        rl;
     std::unique_ptr<MiddlewarePipeline> mw;
     std::unique_ptr<UpstreamGroup>      upstream;
+    // upstream { proto h2; } — multiplexed backend connections, one set per pool
+    std::unordered_map<UpstreamPool*, std::unique_ptr<H2Upstream>> h2_up;
 
     uint64_t stat_req{}, stat_err{}, stat_cache_hit{};
+
+    // Per-request arenas (Conn::arena) take their blocks from this pool and
+    // hand them back on release — steady state needs no malloc. Loop thread
+    // only, hence unsynchronized. Blocks up to 64 KB are pooled (the default
+    // limit is below one arena block, which would go straight to malloc).
+    CountingResource                       req_heap;
+    std::pmr::unsynchronized_pool_resource req_pool{{0, 64 * 1024}, &req_heap};
+
+    // Decoded / folded request views for AutoBan and the regex WAF; its
+    // buffer is reused by every request on this loop
+    WafNormalizer   waf_norm;
+    WafVerdictCache waf_vcache;   // allowed inputs, tagged with g_waf_regex.generation
+
+    // <scripts_dir>/waf_custom.janet — own Janet VM, created on the loop thread;
+    // janet_cfg = the config it was loaded for (a reload swaps w->config)
+    opt::JanetWAF           janet;
+    std::shared_ptr<Config> janet_cfg;
+
+    // Location → latency series; rebuilt when the config pointer changes
+    // (holding the shared_ptr keeps the keyed LocationConfigs alive)
+    std::shared_ptr<Config>                                   lat_cfg;
+    std::unordered_map<const LocationConfig*, LatencySeries*> lat_loc;
+
+    // 1 s tick: loop-local stats published into g_wstats
+    uv_timer_t  stat_tick{};
+    uint64_t    idle_prev_ns{0};   // uv_metrics_idle_time() at the previous tick
+    int64_t     tick_prev_us{0};
+
+    // Lag probe: 100 ms timer, drift = how late it fired (loop blocked by
+    // synchronous work — file reads, SQLite, blocking connect())
+    uv_timer_t  lag_probe{};
+    int64_t     lag_due_us{0};
+    int64_t     lag_win_us{0};     // worst drift since the last stat_tick
+    int64_t     stall_logged_us{0};
+    uint64_t    stall_quiet{0};    // stalls not logged since then (rate limit)
+
+    // SSE: publishers queue into sse_inbox and wake the loop via sse_async
+    uv_async_t                   sse_async{};
+    uv_timer_t                   sse_ping{};
+    std::mutex                   sse_mu;
+    std::deque<std::shared_ptr<const SseEvent>> sse_inbox;
+    std::vector<struct Conn*>    sse_subs;      // loop thread only
+    std::atomic<int>             sse_count{0};  // sse_subs.size() for publishers
+
+    // Finished HTTP/2 stream Conns — freed on the next loop iteration, once
+    // dispatch() and its callers have unwound
+    uv_check_t              reap_h{};
+    std::vector<struct Conn*> reap;
 };
 
 // ── Connection ────────────────────────────────────────────────────────────────
+static constexpr size_t CONN_ARENA_FIRST = 4096;   // first arena block: a typical request's headers
+
 struct Conn {
+    explicit Conn(Worker* w)
+        : worker(w),
+          arena(CONN_ARENA_FIRST, w ? static_cast<std::pmr::memory_resource*>(&w->req_pool)
+                                    : std::pmr::new_delete_resource()) {
+        req.headers.reset(&arena);
+        if(w && w->id < 64) g_wstats[w->id].conn_objs.fetch_add(1, std::memory_order_relaxed);
+    }
+    ~Conn() {
+        if(worker && worker->id < 64) g_wstats[worker->id].conn_objs.fetch_sub(1, std::memory_order_relaxed);
+    }
+    Conn(const Conn&) = delete;
+    Conn& operator=(const Conn&) = delete;
+
     uv_tcp_t    client{};
     uv_timer_t  idle_timer{};      // fires when connection is idle too long
     bool        idle_timer_active{false};
@@ -309,17 +471,45 @@ struct Conn {
 
     char        rbuf[NP_BUF]{};
     size_t      rbuf_len{0};
+    size_t      req_consumed{0};   // rbuf bytes of the parsed request; later ones came in behind it
 
+    // Header names/values of the request in flight (declared before `req`,
+    // which must be destroyed first); released by conn_next_request()
+    std::pmr::monotonic_buffer_resource arena;
     Request     req{};
     bool        req_parsed{false};
+    WafBodyScan body_waf;          // regex WAF over the body while it arrives
     bool        is_sse{false};     // Server-Sent Events — keep connection open
+    std::unique_ptr<SseState> sse;
     std::string response_data;
     std::string client_ip;
     int         requests_served{0};
+    int64_t     req_start_us{0};   // steady clock, set when dispatch() starts
+    ReqTiming   tm;                // phase laps of the request in flight
+    int64_t     rx_start_us{0};    // first byte of the next request seen
+    int64_t     rx_parse_us{0};    // time inside parse_request() for it
+    LatencySeries* lat_loc{nullptr};  // matched location's histogram
     bool        is_ws{false};
 
     UpstreamPool* upstream_pool{nullptr};
     PoolConn*     upstream_conn{nullptr};
+    bool          closing{false};
+    // Upstream replies still owed to this Conn; it outlives uv_close until 0
+    int           pending_io{0};
+    bool          handle_closed{false};
+    struct Tunnel* tunnel{nullptr};     // WebSocket/Upgrade relay (is_ws)
+
+    // ── HTTP/2 (ALPN "h2") ───────────────────────────────────────────────────
+    // The TCP connection owns the nghttp2 session; every request stream gets
+    // its own lightweight Conn (no socket) so dispatch() works unchanged.
+    std::unique_ptr<H2Handler> h2;
+    bool                       h2_checked{false};  // ALPN inspected after handshake
+    bool                       h2c{false};         // accepted on a listener with h2c (Worker::server_h2c)
+    std::unordered_set<Conn*>  h2_streams;         // in-flight stream Conns
+    std::unordered_map<int32_t, WafBodyScan> h2_body_waf;   // bodies still arriving, per stream
+    bool                       is_h2_stream{false};
+    Conn*                      h2_parent{nullptr}; // nullptr once the TCP conn closed
+    int32_t                    h2_stream_id{0};
 };
 
 // ── ProxyJob (heap, lives across thread boundary) ─────────────────────────────
@@ -331,14 +521,28 @@ struct ProxyJob {
     PoolConn*   pool_conn{};
     std::string buf{};
     bool        ok{false};
+    int         wid{0};
+    int64_t     start_us{0};        // before acquire/send (worker thread)
+    int64_t     first_byte_us{0};   // first read() with data (threadpool)
+};
+
+// /np_profile: timer on the worker loop for the sampling window, then
+// symbolization in the threadpool
+struct ProfileJob {
+    uv_timer_t  timer{};
+    uv_work_t   work{};
+    Conn*       conn{};
+    Profiler::Result res;
 };
 
 // ── Forward declarations ──────────────────────────────────────────────────────
 static void close_conn(Conn*);
+static void tunnel_close(struct Tunnel*, bool close_client);
 static void write_response(Conn*, std::string);
 static void dispatch(Conn*);
 static void on_alloc(uv_handle_t*, size_t, uv_buf_t*);
 static void on_read(uv_stream_t*, ssize_t, const uv_buf_t*);
+static void tunnel_from_client(struct Tunnel*, const char*, size_t);
 
 // ── TLS ───────────────────────────────────────────────────────────────────────
 
@@ -348,16 +552,26 @@ static SSL_CTX* create_ssl_ctx(const ServerConfig& srv) {
     if(!ctx) return nullptr;
     SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
     SSL_CTX_set_options(ctx, SSL_OP_NO_SSLv2|SSL_OP_NO_SSLv3|SSL_OP_CIPHER_SERVER_PREFERENCE);
-    // ALPN: http/1.1 only — h2 not supported over TLS in this build
-    static const unsigned char alpn[] = "\x08http/1.1";
-    SSL_CTX_set_alpn_protos(ctx, alpn, sizeof(alpn)-1);
+    // ALPN: "h2" first when a listen has http2 (and nghttp2 is compiled in),
+    // otherwise http/1.1 only. arg != nullptr → h2 offered.
+    bool want_h2 = false;
+    for(auto& l : srv.listens) if(l.ssl && l.http2) want_h2 = true;
+    if(want_h2 && !H2_AVAILABLE) {
+        NW_WARN("tls", "listen ... http2 set but nghttp2 not compiled — HTTP/1.1 only");
+        want_h2 = false;
+    }
+    static const unsigned char alpn_h1[] = "\x08http/1.1";
+    static const unsigned char alpn_h2[] = "\x02h2\x08http/1.1";
+    SSL_CTX_set_alpn_protos(ctx, want_h2 ? alpn_h2 : alpn_h1,
+                            want_h2 ? sizeof(alpn_h2)-1 : sizeof(alpn_h1)-1);
     SSL_CTX_set_alpn_select_cb(ctx, [](SSL*, const unsigned char** out, unsigned char* outlen,
-        const unsigned char* in, unsigned int inlen, void*) -> int {
-        static const unsigned char pref[] = "\x08http/1.1";
+        const unsigned char* in, unsigned int inlen, void* arg) -> int {
+        const unsigned char* pref = arg ? alpn_h2 : alpn_h1;
+        unsigned int plen = arg ? sizeof(alpn_h2)-1 : sizeof(alpn_h1)-1;
         return SSL_select_next_proto((unsigned char**)out, outlen,
-            pref, sizeof(pref)-1, in, inlen) == OPENSSL_NPN_NEGOTIATED
+            pref, plen, in, inlen) == OPENSSL_NPN_NEGOTIATED
             ? SSL_TLSEXT_ERR_OK : SSL_TLSEXT_ERR_NOACK;
-    }, nullptr);
+    }, want_h2 ? (void*)alpn_h2 : nullptr);
     if(srv.ssl_cert.empty() || srv.ssl_key.empty()) {
         NW_WARN("tls", "No ssl_cert/ssl_key in config — TLS disabled");
         SSL_CTX_free(ctx); return nullptr;
@@ -407,6 +621,7 @@ static bool tls_on_raw_data(Conn* conn, const char* data, size_t len) {
         tls_flush_wbio(conn); // send any ServerHello etc.
         if(r == 1) {
             conn->tls_handshake_done = true;
+            g_tls_hs_ok.fetch_add(1, std::memory_order_relaxed);
             NW_DEBUG("tls", "Handshake complete: %s %s",
                 SSL_get_version(conn->ssl),
                 SSL_get_cipher(conn->ssl));
@@ -417,34 +632,39 @@ static bool tls_on_raw_data(Conn* conn, const char* data, size_t len) {
                 conn->tls_pending_write.clear();
                 tls_flush_wbio(conn);
             }
-            return true;
-        }
-        int err = SSL_get_error(conn->ssl, r);
-        if(err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)
-            return true; // handshake in progress
-        // SSL_ERROR_SSL (1) = client dropped connection or sent bad data — not a server error
-        if(err == SSL_ERROR_SSL || err == SSL_ERROR_SYSCALL) {
-            unsigned long ossl_err = ERR_peek_last_error();
-            int reason = ERR_GET_REASON(ossl_err);
-            // Suppress common "noisy" errors: unexpected EOF, unknown protocol, no shared cipher
-            if(reason == SSL_R_UNEXPECTED_EOF_WHILE_READING ||
-               reason == SSL_R_UNKNOWN_PROTOCOL ||
-               reason == SSL_R_NO_SHARED_CIPHER ||
-               reason == SSL_R_WRONG_VERSION_NUMBER ||
-               reason == 0) {
-                ERR_clear_error();
-                return false; // silent drop
+            // Fall through: application data (e.g. the h2 preface) may have
+            // arrived in the same segment as the client Finished
+        } else {
+            int err = SSL_get_error(conn->ssl, r);
+            if(err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)
+                return true; // handshake in progress
+            g_tls_hs_fail.fetch_add(1, std::memory_order_relaxed);
+            // SSL_ERROR_SSL (1) = client dropped connection or sent bad data — not a server error
+            if(err == SSL_ERROR_SSL || err == SSL_ERROR_SYSCALL) {
+                unsigned long ossl_err = ERR_peek_last_error();
+                int reason = ERR_GET_REASON(ossl_err);
+                // Suppress common "noisy" errors: unexpected EOF, unknown protocol, no shared cipher
+                if(reason == SSL_R_UNEXPECTED_EOF_WHILE_READING ||
+                   reason == SSL_R_UNKNOWN_PROTOCOL ||
+                   reason == SSL_R_NO_SHARED_CIPHER ||
+                   reason == SSL_R_WRONG_VERSION_NUMBER ||
+                   reason == 0) {
+                    ERR_clear_error();
+                    return false; // silent drop
+                }
             }
+            NW_WARN("tls", "Handshake failed: SSL error %d", err);
+            ERR_clear_error();
+            return false;
         }
-        NW_WARN("tls", "Handshake failed: SSL error %d", err);
-        ERR_clear_error();
-        return false;
     }
 
     // Handshake done — decrypt application data
     char plain[NP_BUF];
     int n;
     while((n = SSL_read(conn->ssl, plain, sizeof(plain))) > 0) {
+        // Upgrade tunnel: straight to the backend, no parsing
+        if(conn->tunnel) { tunnel_from_client(conn->tunnel, plain, (size_t)n); continue; }
         // Feed decrypted bytes into HTTP parser buffer
         size_t avail = sizeof(conn->rbuf) - conn->rbuf_len - 1;
         if((size_t)n > avail) { NW_WARN("tls","rbuf overflow"); return false; }
@@ -482,7 +702,42 @@ static void tls_write_plaintext(Conn* conn, const char* data, size_t len) {
 }
 
 // ── close_conn ────────────────────────────────────────────────────────────────
+static void h2_stream_release(Conn* sc);
+
+// Remove from the worker's SSE subscribers (socket or HTTP/2 stream)
+static void sse_unsubscribe(Conn* conn) {
+    if(!conn->is_sse || !conn->worker) return;
+    auto& subs = conn->worker->sse_subs;
+    subs.erase(std::remove(subs.begin(), subs.end(), conn), subs.end());
+    conn->worker->sse_count--;
+    g_sse_subs--;
+    conn->is_sse = false;
+}
+
 static void close_conn(Conn* conn) {
+    // HTTP/2 stream has no socket of its own — reset just this stream; the
+    // connection and its other streams go on (connection-level errors close
+    // the parent itself: h2_feed() failing, the socket going away)
+    if(conn->is_h2_stream) {
+        if(conn->closing) return;
+        Conn* parent = conn->h2_parent;
+        if(parent && !parent->closing && parent->h2)
+            parent->h2->reset_stream(conn->h2_stream_id);
+        h2_stream_release(conn);
+        return;
+    }
+    if(conn->closing) return;
+    conn->closing = true;
+    NW_PROBE2(conn__close, conn, conn->requests_served);
+    if(conn->tunnel) tunnel_close(conn->tunnel, false);
+    // Detach in-flight streams; they are reaped when their response arrives.
+    // SSE streams never get one — release them with the connection.
+    std::vector<Conn*> streams(conn->h2_streams.begin(), conn->h2_streams.end());
+    conn->h2_streams.clear();
+    for(Conn* sc : streams) {
+        sc->h2_parent = nullptr;
+        if(sc->is_sse) h2_stream_release(sc);
+    }
     // Stop idle timer before closing
     if(conn->idle_timer_active) {
         uv_timer_stop(&conn->idle_timer);
@@ -490,13 +745,7 @@ static void close_conn(Conn* conn) {
             uv_close((uv_handle_t*)&conn->idle_timer, nullptr);
         conn->idle_timer_active = false;
     }
-    // Remove from SSE clients if registered
-    if(conn->is_sse) {
-        std::lock_guard lk(g_sse_mu);
-        g_sse_clients.erase(
-            std::remove(g_sse_clients.begin(), g_sse_clients.end(), conn),
-            g_sse_clients.end());
-    }
+    sse_unsubscribe(conn);
     // ── Unregister active connection and save to history ──────────────────
     {
         std::lock_guard<std::mutex> lk(g_active_mu);
@@ -507,8 +756,10 @@ static void close_conn(Conn* conn) {
     if(!conn->client_ip.empty() && g_max_conns_per_ip > 0) {
         std::lock_guard<std::mutex> lk(g_connlimit_mu);
         auto it = g_conn_count.find(conn->client_ip);
-        if(it != g_conn_count.end() && it->second > 0)
-            it->second--;
+        if(it != g_conn_count.end()) {
+            if(it->second > 1) it->second--;
+            else g_conn_count.erase(it);   // no per-IP entry kept for every client ever seen
+        }
     }
     if(conn->ssl) {
         SSL_shutdown(conn->ssl);
@@ -519,10 +770,21 @@ static void close_conn(Conn* conn) {
         conn->wbio = nullptr;
     }
     uv_close((uv_handle_t*)&conn->client, [](uv_handle_t* h){
-        delete static_cast<Conn*>(h->data);
+        auto* c = static_cast<Conn*>(h->data);
+        c->handle_closed = true;
+        if(c->pending_io == 0) delete c;
     });
 }
 
+// An upstream reply arrived. Returns false when the client went away in the
+// meantime — the Conn is freed here once nothing else refers to it.
+static bool conn_io_done(Conn* conn) {
+    conn->pending_io--;
+    if(!conn->closing) return true;
+    if(conn->pending_io == 0 && conn->handle_closed) delete conn;
+    return false;
+}
+
 // ── Idle timeout helpers ──────────────────────────────────────────────────────
 // Start (or restart) idle timer — connection closed if no activity within ms
 static void conn_idle_start(Conn* conn, uint64_t ms) {
@@ -550,18 +812,54 @@ static void conn_idle_reset(Conn* conn, uint64_t ms) {
 }
 
 
-// ── write_response ────────────────────────────────────────────────────────────
-static void on_write_done(uv_write_t* req, int status) {
-    Conn* conn = static_cast<Conn*>(req->data);
-    free(req);
-    if(status < 0 || !conn->req.keep_alive) { close_conn(conn); return; }
-    // reset for next request
+// ── Request phase timing ──────────────────────────────────────────────────────
+// Called once the response left (or was handed to nghttp2): requests over
+// slow_request_ms go to the slow-request ring with their phase breakdown.
+static void req_timing_done(Conn* conn) {
+    ReqTiming& t = conn->tm;
+    if(!t.start_us) return;
+    int64_t total = t.elapsed_us(now_us()) + t.d[PH_RECV] + t.d[PH_PARSE];
+    t.start_us = 0;
+    if(!g_slow.is_slow(total)) return;
+    SlowRequest r;
+    r.ts_ms    = (int64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+                     std::chrono::system_clock::now().time_since_epoch()).count() - total / 1000;
+    r.total_us = total;
+    r.status   = t.status;
+    r.worker   = conn->worker ? conn->worker->id : -1;
+    r.ip       = conn->client_ip;
+    r.method   = std::string(method_str(conn->req.method));
+    r.host     = conn->req.host.substr(0, 128);
+    r.path     = conn->req.path.substr(0, 256);
+    std::copy(std::begin(t.d), std::end(t.d), r.d);
+    NW_INFO("slow", "%s %s %.*s → %d in %lld ms", r.ip.c_str(), r.method.c_str(),
+            (int)r.path.size(), r.path.data(), r.status, (long long)(total / 1000));
+    g_slow.push(std::move(r));
+}
+
+// Keep-alive: forget the finished request. Its headers are detached from the
+// arena first, then the whole request's arena memory goes back in one release.
+static void conn_next_request(Conn* conn) {
     conn->rbuf_len   = 0;
+    conn->req_consumed = 0;
     conn->req_parsed = false;
     conn->req        = Request{};
+    conn->body_waf   = WafBodyScan{};
+    conn->req.headers.reset(&conn->arena);
+    conn->arena.release();
     conn->response_data.clear();
     conn->upstream_conn = nullptr;
     conn->upstream_pool = nullptr;
+}
+
+// ── write_response ────────────────────────────────────────────────────────────
+static void on_write_done(uv_write_t* req, int status) {
+    Conn* conn = static_cast<Conn*>(req->data);
+    free(req);
+    conn->tm.lap(PH_WRITE);
+    req_timing_done(conn);
+    if(status < 0 || !conn->req.keep_alive) { close_conn(conn); return; }
+    conn_next_request(conn);
     // Restart idle timer — connection waiting for next keepalive request
     {
         uint64_t idle_ms = 65000;
@@ -569,30 +867,8 @@ static void on_write_done(uv_write_t* req, int status) {
             idle_ms = (uint64_t)conn->worker->config->servers[0].keepalive_timeout * 1000;
         conn_idle_reset(conn, idle_ms);
     }
-    uv_read_start((uv_stream_t*)&conn->client,
-        [](uv_handle_t* h, size_t, uv_buf_t* buf){
-            auto* c = static_cast<Conn*>(h->data);
-            buf->base = c->rbuf + c->rbuf_len;
-            buf->len  = sizeof(c->rbuf) - c->rbuf_len - 1;
-        },
-        [](uv_stream_t* s, ssize_t nread, const uv_buf_t*){
-            auto* c = static_cast<Conn*>(s->data);
-            if(nread <= 0) { close_conn(c); return; }
-            c->rbuf_len += (size_t)nread;
-            Request req;
-            auto [res, consumed] = parse_request(c->rbuf, c->rbuf_len, req);
-            if(res == ParseResult::Incomplete) return;
-            if(res != ParseResult::Complete) {
-                write_response(c, Response::make_error(res==ParseResult::TooLarge?413:400).serialize_h1());
-                return;
-            }
-            c->req = std::move(req);
-            c->req.client_ip = c->client_ip;
-            c->req.scheme    = c->ssl ? "https" : "http";
-            c->req_parsed    = true;
-            uv_read_stop(s);
-            dispatch(c);
-        });
+    // Same read path as the first request (handles Upgrade: h2c as well)
+    uv_read_start((uv_stream_t*)&conn->client, on_alloc, on_read);
 }
 
 static void update_conn_status(Conn* conn, int status, const std::string& type="") {
@@ -604,6 +880,107 @@ static void update_conn_status(Conn* conn, int status, const std::string& type="
     }
 }
 
+static void h2_stream_finish(Conn*);
+
+// ── Access log ────────────────────────────────────────────────────────────────
+// Copies the request summary into this worker's access-log ring; formatting
+// and I/O happen on the writer thread. Full ring → dropped, never blocks.
+
+// Fields shared by access-log and capture records, then host and path[?query]
+static AccessRecordWriter access_record_fill(AccessRecord* rec, Conn* conn, int status,
+                                             size_t bytes_out, bool with_ip) {
+    const Request& q = conn->req;
+    int64_t now = now_us();
+    int64_t dur = conn->req_start_us ? now - conn->req_start_us : 0;
+    rec->dur_us    = (uint32_t)std::min<int64_t>(dur, UINT32_MAX);
+    rec->ts_us     = std::chrono::duration_cast<std::chrono::microseconds>(
+                         std::chrono::system_clock::now().time_since_epoch()).count() - dur;
+    rec->status    = (uint16_t)status;
+    rec->method    = (uint8_t)q.method;
+    rec->version   = (uint8_t)q.version;
+    rec->bytes_out = bytes_out;
+    rec->bytes_in  = (uint32_t)std::min<size_t>(q.body.size(), UINT32_MAX);
+    AccessRecordWriter wr{*rec};
+    rec->ip_len   = with_ip ? (uint8_t)wr.put(conn->client_ip, 255) : 0;
+    rec->host_len = (uint8_t)wr.put(q.host, 255);
+    size_t pl = wr.put(q.path, 2048);
+    if(!q.query.empty() && pl == q.path.size()) {
+        pl += wr.put("?", 1);
+        pl += wr.put(q.query, 2048 - std::min<size_t>(pl, 2048));
+    }
+    rec->path_len = (uint16_t)pl;
+    return wr;
+}
+
+static void access_log_record(Conn* conn, int status, size_t bytes_out) {
+    int wid = conn->worker->id;
+    AccessRecord* rec = g_access_log.begin(wid);
+    if(!rec) return;
+    const Request& q = conn->req;
+    AccessRecordWriter wr = access_record_fill(rec, conn, status, bytes_out, true);
+    rec->kind     = AL_REC_ACCESS;
+    rec->nhdr     = 0;
+    rec->ua_len   = (uint16_t)wr.put(q.headers.get("User-Agent"), 512);
+    rec->ref_len  = (uint16_t)wr.put(q.headers.get("Referer"), 512);
+    g_access_log.commit(wid);
+}
+
+// Traffic capture: sampled records with the configured headers (sensitive
+// values scrubbed), no client address — for `nas-web-bench --replay`
+static void capture_record(Conn* conn, int status, size_t bytes_out) {
+    const ServerConfig& srv = conn->worker->config->servers[0];
+    if(srv.capture_sample < 1.0) {
+        thread_local uint64_t x = 0x9E3779B97F4A7C15ull ^ (uint64_t)now_us();
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        if((double)(x >> 11) * 0x1.0p-53 >= srv.capture_sample) return;
+    }
+    int wid = conn->worker->id;
+    AccessRecord* rec = g_capture.begin(wid);
+    if(!rec) return;
+    const Request& q = conn->req;
+    AccessRecordWriter wr = access_record_fill(rec, conn, status, bytes_out, false);
+    size_t start = wr.used;
+    uint8_t n = 0;
+    for(const auto& name : srv.capture_headers) {
+        auto v = q.headers.get(name);
+        if(v.empty() || n == 255) continue;
+        if(capture_put_header(wr, name, capture_scrubbed(name, srv.capture_scrub) ? CAPTURE_SCRUBBED : v)) n++;
+    }
+    rec->kind    = AL_REC_CAPTURE;
+    rec->nhdr    = n;
+    rec->ua_len  = (uint16_t)(wr.used - start);
+    rec->ref_len = 0;
+    g_capture.commit(wid);
+}
+
+// Latency series of a location ("loc:/api"), cached per worker
+static LatencySeries* location_series(Worker* w, const LocationConfig* loc) {
+    if(w->lat_cfg != w->config) { w->lat_loc.clear(); w->lat_cfg = w->config; }
+    auto& slot = w->lat_loc[loc];
+    if(!slot) slot = g_latency.get("loc:" + std::string(loc->exact ? "=" : "") + loc->prefix, "total");
+    return slot;
+}
+
+// waf_custom.janet of the worker's current config — loaded at startup and
+// again when a reload has swapped the config (always on the loop thread:
+// the VM is thread-local). A reload starts a fresh VM; a script that fails
+// to load leaves the hook off until the next reload.
+static void janet_waf_sync(Worker* w) {
+    if(w->janet_cfg == w->config) return;
+    w->janet_cfg = w->config;
+    if(!JANET_REAL) return;
+    w->janet.deinit();
+    if(w->config->scripts_dir.empty()) return;
+    std::string jpath = w->config->scripts_dir + "/waf_custom.janet";
+    if(access(jpath.c_str(), R_OK) != 0) return;
+    w->janet.init();
+    std::string err = w->janet.load_rules(jpath);
+    if(!err.empty()) {
+        NW_WARN("janet", "Worker %d: %s", w->id, err.c_str());
+        w->janet.deinit();
+    } else if(w->id == 0) NW_INFO("janet", "waf-check loaded from %s", jpath.c_str());
+}
+
 static void write_response(Conn* conn, std::string data) {
     conn->response_data = std::move(data);
     conn->requests_served++;
@@ -622,6 +999,33 @@ static void write_response(Conn* conn, std::string data) {
             if(sp != std::string::npos && sp+4 <= conn->response_data.size())
                 try { status_code = std::stoi(conn->response_data.substr(sp+1,3)); } catch(const std::exception&){}
         }
+        conn->tm.lap(PH_APP);
+        conn->tm.status = status_code;
+        if(conn->tm.emit_header && conn->tm.start_us) {
+            // Server-Timing after the status line (trusted clients only)
+            auto eol = conn->response_data.find("\r\n");
+            if(eol != std::string::npos) {
+                char hv[512];
+                size_t n = conn->tm.server_timing(hv, sizeof(hv), now_us());
+                std::string h = "\r\nServer-Timing: ";
+                h.append(hv, n);
+                conn->response_data.insert(eol, h);
+            }
+        }
+        if(conn->req_start_us) {
+            int64_t dur = now_us() - conn->req_start_us;
+            g_lat_all->record(w->id, dur, status_code);
+            if(conn->lat_loc) conn->lat_loc->record(w->id, dur, status_code);
+            NW_PROBE4(response__write, conn, status_code, conn->response_data.size(), dur);
+        } else {
+            NW_PROBE4(response__write, conn, status_code, conn->response_data.size(), (int64_t)0);
+        }
+        if(g_access_log.enabled())
+            access_log_record(conn, status_code, conn->response_data.size());
+        if(g_capture.enabled())
+            capture_record(conn, status_code, conn->response_data.size());
+        conn->req_start_us = 0;
+        conn->lat_loc      = nullptr;
         if(status_code != 401) {
             g_stat_req.fetch_add(1, std::memory_order_relaxed);
             if(status_code >= 400)
@@ -644,9 +1048,6 @@ static void write_response(Conn* conn, std::string data) {
                             rr.status = status_code;
                             rr.ts_ms = ac.started_ms;
                             rr.duration_ms = now_ms() - ac.started_ms;
-                            // Feed latency rolling average for dashboard
-                            g_stat_latency_sum += (uint64_t)rr.duration_ms;
-                            g_stat_latency_cnt++;
                             g_recent_reqs.push_back(std::move(rr));
                             if((int)g_recent_reqs.size() > G_RECENT_MAX) g_recent_reqs.pop_front();
                         }
@@ -662,17 +1063,17 @@ static void write_response(Conn* conn, std::string data) {
         }
     }
 
+    // HTTP/2 stream: hand the response to the connection's nghttp2 session
+    if(conn->is_h2_stream) { req_timing_done(conn); h2_stream_finish(conn); return; }
+
     if(conn->ssl) {
         // TLS path: encrypt via BIO bridge, on_write_done handled by tls_flush_wbio
         tls_write_plaintext(conn, conn->response_data.data(), conn->response_data.size());
+        conn->tm.lap(PH_WRITE);   // encrypt + queue; the socket write is async
+        req_timing_done(conn);
         // After sending, handle keep-alive reset manually
         if(conn->req.keep_alive) {
-            conn->rbuf_len   = 0;
-            conn->req_parsed = false;
-            conn->req        = Request{};
-            conn->response_data.clear();
-            conn->upstream_conn = nullptr;
-            conn->upstream_pool = nullptr;
+            conn_next_request(conn);
             uv_read_start((uv_stream_t*)&conn->client, on_alloc, on_read);
         } else {
             close_conn(conn);
@@ -687,13 +1088,1201 @@ static void write_response(Conn* conn, std::string data) {
     uv_write(wr, (uv_stream_t*)&conn->client, &buf, 1, on_write_done);
 }
 
+// ── HTTP/2 ────────────────────────────────────────────────────────────────────
+// One nghttp2 session per TCP connection (Conn::h2). Each complete request
+// stream becomes a socket-less Conn that runs through dispatch() like any
+// HTTP/1.1 request; write_response() routes its output back to the session.
+
+static H2Settings h2_settings_for(const Config& cfg) {
+    H2Settings st;
+    for(auto& srv : cfg.servers)
+        for(auto& l : srv.listens)
+            if(l.http2) {
+                st.max_concurrent_streams = (uint32_t)std::max(1, srv.http2_max_concurrent_streams);
+                st.initial_window_size    = (uint32_t)std::clamp(srv.http2_initial_window_size, 1, 0x7fffffff);
+                st.connection_window_size = (uint32_t)std::clamp(srv.http2_connection_window_size, 65535, 0x7fffffff);
+                st.max_request_body       = (size_t)std::max(0, srv.client_max_body);
+                return st;
+            }
+    return st;
+}
+
+// Unregister a stream Conn and queue it for deletion (Worker::reap)
+static void h2_stream_release(Conn* sc) {
+    if(sc->closing) return;
+    sc->closing = true;
+    sse_unsubscribe(sc);
+    {
+        std::lock_guard<std::mutex> lk(g_active_mu);
+        g_active.erase(sc);
+    }
+    if(sc->h2_parent) sc->h2_parent->h2_streams.erase(sc);
+    sc->h2_parent = nullptr;
+    if(sc->worker) sc->worker->reap.push_back(sc);
+    else delete sc;
+}
+
+// Response for a stream is ready — called from write_response()
+static void h2_stream_finish(Conn* sc) {
+    Conn* pc = sc->h2_parent;
+    if(pc && !pc->closing && pc->h2)
+        pc->h2->submit_serialized(sc->h2_stream_id, std::move(sc->response_data));
+    h2_stream_release(sc);
+}
+
+// ── Regex WAF over request bodies while they arrive ──────────────────────────
+// Paths dispatch() answers before the WAF (ACME, health checks, metrics, the
+// admin panel and API under /np_) are left to it — ending them early would
+// hand them a cut body. A prefix is enough: whatever is not streamed,
+// dispatch() still inspects in full.
+static bool waf_streams_body(std::string_view path) {
+    if(!g_waf_regex.body_enabled()) return false;
+    static constexpr std::string_view answered_first[] = {
+        "/np_", "/.well-known/acme-challenge/", "/apis/", "/health"};
+    for(auto p : answered_first)
+        if(path.substr(0, p.size()) == p) return false;
+    return true;
+}
+
+// Body bytes not seen yet → WAF. True = a rule matched in block mode: the
+// request ends here (bs.cut) and gets its 403 without the rest of the body
+static bool waf_body_chunk(WafBodyScan& bs, const Request& req, std::string_view body) {
+    if(bs.cut || body.size() <= bs.fed || !waf_streams_body(req.path)) return false;
+    g_waf_regex.body_feed(bs, body.substr(bs.fed));
+    bs.cut = g_waf_regex.body_blocked(bs);
+    return bs.cut;
+}
+
+// Complete request on a stream → new stream Conn → dispatch()
+static void h2_on_request(Conn* pc, Request req) {
+    auto* sc = new Conn(pc->worker);
+    sc->client_ip    = pc->client_ip;
+    sc->is_h2_stream = true;
+    sc->h2_parent    = pc;
+    sc->h2_stream_id = req.h2_stream_id;
+    sc->req          = std::move(req);
+    sc->req.client_ip  = pc->client_ip;
+    sc->req.scheme     = pc->ssl ? "https" : "http";
+    sc->req.keep_alive = true;
+    sc->req_parsed     = true;
+    auto bw = pc->h2_body_waf.find(sc->h2_stream_id);
+    if(bw != pc->h2_body_waf.end()) {
+        sc->body_waf = std::move(bw->second);
+        pc->h2_body_waf.erase(bw);
+    }
+    pc->h2_streams.insert(sc);
+    {
+        std::lock_guard<std::mutex> lk(g_active_mu);
+        g_active[sc] = {pc->client_ip, "?", "/", 0, now_ms(), "h2", nullptr};
+    }
+    NW_PROBE4(request__parsed, sc, method_str(sc->req.method).data(), sc->req.path.c_str(), (int64_t)0);
+    dispatch(sc);
+}
+
+// Plain TCP write of a copy of data (h2c frames, 101 response)
+static void conn_write_raw(Conn* conn, const char* data, size_t len) {
+    auto* wr = static_cast<uv_write_t*>(malloc(sizeof(uv_write_t)));
+    char* copy = static_cast<char*>(malloc(len));
+    memcpy(copy, data, len);
+    wr->data = copy;
+    uv_buf_t b = uv_buf_init(copy, (unsigned)len);
+    uv_write(wr, (uv_stream_t*)&conn->client, &b, 1,
+        [](uv_write_t* req, int){ free(req->data); free(req); });
+}
+
+// Attach an nghttp2 session to the connection (TLS or cleartext)
+static bool h2_attach(Conn* conn) {
+    if(!H2_AVAILABLE || !conn->worker || !conn->worker->config) return false;
+    conn->h2 = std::make_unique<H2Handler>(
+        h2_settings_for(*conn->worker->config),
+        [conn](const char* d, size_t n){
+            if(conn->closing) return;
+            if(conn->ssl) tls_write_plaintext(conn, d, n);
+            else          conn_write_raw(conn, d, n);
+        },
+        [conn](Request req){ h2_on_request(conn, std::move(req)); });
+    conn->h2->set_body_hooks(
+        [conn](int32_t id, const Request& req, std::string_view) {
+            if(!waf_streams_body(req.path)) return true;
+            return !waf_body_chunk(conn->h2_body_waf[id], req, req.body);
+        },
+        [conn](int32_t id){
+            conn->h2_body_waf.erase(id);
+            // An SSE stream ends only here (client RST / session teardown)
+            for(Conn* sc : conn->h2_streams)
+                if(sc->is_sse && sc->h2_stream_id == id) { h2_stream_release(sc); break; }
+        });
+    update_conn_status(conn, 0, "h2");
+    NW_DEBUG("h2", "HTTP/2 session for %s (%s)", conn->client_ip.c_str(),
+             conn->ssl ? "h2" : "h2c");
+    return true;
+}
+
+// After the TLS handshake: switch the connection to HTTP/2 if ALPN chose "h2"
+static void h2_start(Conn* conn) {
+    conn->h2_checked = true;
+    const unsigned char* proto = nullptr;
+    unsigned int plen = 0;
+    SSL_get0_alpn_selected(conn->ssl, &proto, &plen);
+    if(plen != 2 || memcmp(proto, "h2", 2) != 0) return;
+    h2_attach(conn);
+}
+
+// h2c prior knowledge: client opens with the connection preface.
+// Returns true once decided (h2 attached or plain HTTP/1.1); false = need more bytes.
+static bool h2c_check_preface(Conn* conn) {
+    static constexpr std::string_view PREFACE = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+    size_t n = std::min(conn->rbuf_len, PREFACE.size());
+    if(memcmp(conn->rbuf, PREFACE.data(), n) != 0) { conn->h2_checked = true; return true; }
+    if(n < PREFACE.size()) return false;
+    conn->h2_checked = true;
+    h2_attach(conn);
+    return true;
+}
+
+// h2c via "Upgrade: h2c" on a plain HTTP/1.1 request (RFC 7540 §3.2).
+// Sends 101, attaches the session and runs the request as stream 1.
+static bool h2c_try_upgrade(Conn* conn, Request& req, size_t consumed) {
+    auto up = req.headers.get("Upgrade");
+    auto hs = req.headers.get("HTTP2-Settings");
+    if(up.empty() || hs.empty() || !ci_eq(up, "h2c")) return false;
+    if(!req.body.empty()) return false;   // upgrade with a body — stay on HTTP/1.1
+    if(!h2_attach(conn)) return false;
+    if(!conn->h2->upgrade(hs, req)) { conn->h2.reset(); return false; }
+
+    static constexpr std::string_view SWITCH =
+        "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+    conn_write_raw(conn, SWITCH.data(), SWITCH.size());
+    conn->h2->flush();                    // server SETTINGS
+
+    // Bytes after the request (client preface, SETTINGS) belong to HTTP/2
+    size_t rest = conn->rbuf_len > consumed ? conn->rbuf_len - consumed : 0;
+    memmove(conn->rbuf, conn->rbuf + consumed, rest);
+    conn->rbuf_len = rest;
+
+    req.headers.remove("Upgrade");
+    req.headers.remove("HTTP2-Settings");
+    req.headers.remove("Connection");
+    req.is_h2        = true;
+    req.version      = HttpVersion::HTTP20;
+    req.h2_stream_id = 1;
+    h2_on_request(conn, std::move(req));
+    return true;
+}
+
+// Feed decrypted bytes to nghttp2. Returns false if the connection should close.
+static bool h2_feed(Conn* conn) {
+    int rv = conn->h2->receive((const uint8_t*)conn->rbuf, conn->rbuf_len);
+    conn->rbuf_len = 0;
+    if(conn->closing) return true;   // a stream already closed the connection
+    if(rv < 0 || !conn->h2->alive()) return false;
+    uint64_t idle_ms = 65000;
+    if(conn->worker && conn->worker->config && !conn->worker->config->servers.empty())
+        idle_ms = (uint64_t)conn->worker->config->servers[0].keepalive_timeout * 1000;
+    conn_idle_reset(conn, idle_ms);
+    return true;
+}
+
 // ── dispatch ──────────────────────────────────────────────────────────────────
+// ── Server-Sent Events ────────────────────────────────────────────────────────
+// Publishers (LogBuffer::push on any thread, the stats thread) only append a
+// shared frame to each interested worker's inbox and poke it with uv_async.
+// The worker then fans the frames out to its own subscribers. Each client has
+// a bounded backlog that drops the oldest events while its socket is slow, so
+// publishing never waits on a client.
+static void sse_publish(uint8_t kind, int level, const char* event, const std::string& data) {
+    if(g_sse_subs.load(std::memory_order_relaxed) <= 0) return;
+    auto ev = std::make_shared<SseEvent>();
+    ev->kind  = kind;
+    ev->level = level;
+    ev->frame.reserve(data.size() + 32);
+    ev->frame += "event: "; ev->frame += event;
+    ev->frame += "\ndata: "; ev->frame += data; ev->frame += "\n\n";
+    std::shared_ptr<const SseEvent> shared = std::move(ev);
+    std::lock_guard lk(g_sse_mu);
+    for(Worker* w : g_sse_workers) {
+        if(w->sse_count.load(std::memory_order_relaxed) <= 0) continue;
+        {
+            std::lock_guard lk2(w->sse_mu);
+            w->sse_inbox.push_back(shared);
+            if(w->sse_inbox.size() > SSE_INBOX_MAX) w->sse_inbox.pop_front();
+        }
+        uv_async_send(&w->sse_async);
+    }
+}
+
+// Write a client's backlog unless its socket still has too much unsent data
+static void sse_flush(Conn* c, const char* extra = nullptr) {
+    if(c->closing || !c->sse) return;
+    // HTTP/2: the parent's socket plus what flow control still holds back
+    Conn* sock = c->is_h2_stream ? c->h2_parent : c;
+    if(!sock || sock->closing || (c->is_h2_stream && !sock->h2)) return;
+    size_t pending = uv_stream_get_write_queue_size((uv_stream_t*)&sock->client);
+    if(c->is_h2_stream) pending += sock->h2->stream_backlog(c->h2_stream_id);
+    if(pending > SSE_WQ_MAX) return;
+    std::string out;
+    if(c->sse->dropped) {
+        out += ": dropped " + std::to_string(c->sse->dropped) + "\n\n";
+        c->sse->dropped = 0;
+    }
+    for(auto& ev : c->sse->q) out += ev->frame;
+    c->sse->q.clear();
+    if(extra) out += extra;
+    if(out.empty()) return;
+    if(c->is_h2_stream) sock->h2->stream_write(c->h2_stream_id, out);
+    else if(c->ssl)     tls_write_plaintext(c, out.data(), out.size());
+    else                conn_write_raw(c, out.data(), out.size());
+}
+
+// uv_async: move the inbox into every matching client backlog, then flush
+static void sse_deliver(uv_async_t* a) {
+    Worker* w = static_cast<Worker*>(a->data);
+    std::deque<std::shared_ptr<const SseEvent>> in;
+    {
+        std::lock_guard lk(w->sse_mu);
+        in.swap(w->sse_inbox);
+    }
+    std::vector<Conn*> subs = w->sse_subs;   // a failed write may close one
+    for(Conn* c : subs) {
+        if(c->closing || !c->sse) continue;
+        auto& st = *c->sse;
+        for(auto& ev : in) {
+            if(!(st.kinds & ev->kind)) continue;
+            if(ev->kind == SSE_LOG && ev->level < st.min_level) continue;
+            st.q.push_back(ev);
+            if(st.q.size() > SSE_CLIENT_MAX) { st.q.pop_front(); st.dropped++; }
+        }
+        sse_flush(c);
+    }
+}
+
+// GET /np_logs/stream, /np_stats/stream — turn the connection into a stream
+static void sse_subscribe(Conn* conn, uint8_t kinds, int min_level) {
+    Worker* w = conn->worker;
+    conn->is_sse = true;
+    conn->sse = std::make_unique<SseState>();
+    conn->sse->kinds     = kinds;
+    conn->sse->min_level = min_level;
+    conn->rbuf_len = 0;
+    if(conn->idle_timer_active) uv_timer_stop(&conn->idle_timer);
+    w->sse_subs.push_back(conn);
+    w->sse_count++;
+    g_sse_subs++;
+    update_conn_status(conn, 200, "sse");
+    // HTTP/2: open-ended response on the stream, events follow as DATA
+    if(conn->is_h2_stream) {
+        Response r; r.status = 200;
+        r.headers.set("Content-Type", "text/event-stream");
+        r.headers.set("Cache-Control", "no-cache");
+        r.headers.set("X-Accel-Buffering", "no");
+        r.body = "retry: 3000\n\n";
+        conn->h2_parent->h2->submit_stream(conn->h2_stream_id, std::move(r));
+        return;
+    }
+    static const char head[] =
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: text/event-stream\r\n"
+        "Cache-Control: no-cache\r\n"
+        "Connection: keep-alive\r\n"
+        "X-Accel-Buffering: no\r\n\r\n"
+        "retry: 3000\n\n";
+    if(conn->ssl) tls_write_plaintext(conn, head, sizeof(head) - 1);
+    else          conn_write_raw(conn, head, sizeof(head) - 1);
+    // Keep reading so a client disconnect closes the Conn (input is discarded)
+    uv_read_start((uv_stream_t*)&conn->client, on_alloc, on_read);
+}
+
+// ── Proxy reply ───────────────────────────────────────────────────────────────
+// Common tail for HTTP/1.1 (ProxyJob) and HTTP/2 upstream responses:
+// hop-by-hop cleanup, tracing headers, response middleware, cache store.
+static void proxy_reply(Conn* c, Response resp) {
+    resp.headers.remove("Connection");
+    resp.headers.remove("Transfer-Encoding");
+    resp.headers.set("Connection", c->req.keep_alive ? "keep-alive" : "close");
+    resp.headers.set("X-Proxy", "nas-web/" + std::string(NP_VERSION));
+    // X-Request-ID for tracing
+    static std::atomic<uint64_t> req_id{1};
+    char rid[32]; snprintf(rid, sizeof(rid), "%016llx", (unsigned long long)req_id.fetch_add(1));
+    resp.headers.set("X-Request-ID", rid);
+
+    Worker* w2 = c->worker;
+    if(w2 && w2->config && !w2->config->servers.empty()) {
+        const auto& srv2 = w2->config->servers[0];
+        auto* loc2 = w2->config->match_location(srv2, c->req.path);
+        if(loc2 && w2->mw && !loc2->middlewares.empty())
+            w2->mw->run_response(loc2->middlewares, c->req, resp);
+        for(auto& l : srv2.listens)
+            if(l.http3) { H3Handler::inject_alt_svc(resp, l.port); break; }
+        if(w2->cache && c->req.method == Method::GET) {
+            auto key  = ResponseCache::make_key(c->req);
+            auto* lc3 = w2->config->match_location(srv2, c->req.path);
+            bool do_cache = !lc3 || lc3->cache_max_age != -1;
+            if(do_cache && w2->config->module_cache) {
+                int ttl = lc3 && lc3->cache_max_age > 0 ? lc3->cache_max_age : 0;
+                w2->cache->put(key, resp, c->req, ttl);
+            }
+        }
+    }
+    update_conn_status(c, resp.status, "proxy");
+    write_response(c, resp.serialize_h1());
+    if(w2){ w2->stat_req++; g_stat_req.fetch_add(1,std::memory_order_relaxed); if(w2->id<64)g_wstats[w2->id].req.fetch_add(1,std::memory_order_relaxed); }
+}
+
+// upstream { proto h2; } — hand the request to the backend's multiplexed
+// connections; the reply comes back on this worker's loop
+static void proxy_h2(Conn* conn, UpstreamPool* up, const LocationConfig& loc) {
+    Worker* w = conn->worker;
+    auto& h2u = w->h2_up[up];
+    if(!h2u)
+        h2u = std::make_unique<H2Upstream>(w->loop, up,
+                  w->upstream->config().h2_connections, loc.proxy_connect_timeout, w->id);
+
+    H2UpRequest hr;
+    hr.method = std::string(method_str(conn->req.method));
+    hr.path   = conn->req.path;
+    if(!conn->req.query.empty()) { hr.path += '?'; hr.path += conn->req.query; }
+    auto host = conn->req.headers.get("Host");
+    hr.authority = host.empty() ? up->cfg.host + ":" + std::to_string(up->cfg.port)
+                                : std::string(host);
+    hr.headers   = conn->req.headers;
+    hr.body      = conn->req.body;
+    hr.timeout_s = loc.proxy_timeout;
+
+    conn->upstream_pool = up;
+    conn->pending_io++;
+    conn->tm.lap(PH_APP);
+    h2u->submit(std::move(hr), [conn, up, wid = w->id](bool ok, Response resp, const UpTiming& t){
+        if(t.ttfb_us >= 0)  up->lat_ttfb->record(wid, t.ttfb_us);
+        if(t.total_us >= 0) up->lat_total->record(wid, t.total_us);
+        if(!conn_io_done(conn)) return;
+        conn->upstream_pool = nullptr;
+        conn->tm.add(PH_CONNECT, t.connect_us);
+        conn->tm.add(PH_TTFB, t.ttfb_us);
+        conn->tm.lap(PH_UPSTREAM);
+        if(!ok) {
+            write_response(conn, resp.serialize_h1());
+            if(conn->worker) conn->worker->stat_err++;
+            return;
+        }
+        proxy_reply(conn, std::move(resp));
+    });
+}
+
+// ── WebSocket / Upgrade tunnel ────────────────────────────────────────────────
+// The upgrade request goes to a dedicated non-blocking backend socket. Once
+// the backend answers 101 both sockets are relayed on the worker loop until
+// either side closes or nothing moves for proxy_timeout seconds:
+//   • plain client — splice() through one pipe per direction, bytes never
+//     enter user space (client fd is dup()ed so it can be polled directly)
+//   • TLS client   — decrypted bytes arrive via on_read, leave via SSL_write
+// Any other status is read like a normal proxy reply and the client stays
+// keep-alive.
+#if defined(__linux__)
+#define NW_HAVE_SPLICE 1
+#else
+#define NW_HAVE_SPLICE 0
+#endif
+
+static constexpr size_t TUNNEL_HIWAT = 1 << 20;   // copy-mode backpressure
+
+struct Tunnel {
+    Conn*         conn{nullptr};      // nullptr once detached from the client
+    UpstreamPool* pool{nullptr};
+    int           up_fd{-1};
+    int           cl_fd{-1};          // dup of the client socket (splice mode)
+    uv_poll_t     up_poll{};
+    uv_poll_t     cl_poll{};
+    uv_timer_t    timer{};
+    int           handles{0};         // uv handles not yet closed
+    int           writes{0};          // client writes in flight (copy mode)
+    bool          splice_mode{false};
+    bool          connected{false};
+    bool          established{false}; // 101 relayed to the client
+    bool          cl_reading{false};
+    bool          closing{false};
+    int           status{0};
+    std::string   out_up;             // bytes waiting for the backend socket
+    std::string   out_cl;             // response head waiting for the client (splice mode)
+    std::string   head;               // backend response until it is relayed / parsed
+    int           pipe_up[2]{-1,-1};  // client → backend
+    int           pipe_dn[2]{-1,-1};  // backend → client
+    size_t        pend_up{0}, pend_dn{0};
+    size_t        cl_queued{0};
+    int64_t       started_ms{0}, last_ms{0};
+    int64_t       idle_ms{0}, connect_ms{0};
+    std::shared_ptr<TunnelBytes> bytes{std::make_shared<TunnelBytes>()};
+
+    ~Tunnel(){
+        if(up_fd >= 0) close(up_fd);
+        if(cl_fd >= 0) close(cl_fd);
+        for(int fd : {pipe_up[0], pipe_up[1], pipe_dn[0], pipe_dn[1]}) if(fd >= 0) close(fd);
+    }
+};
+
+static void tunnel_maybe_free(Tunnel* t) {
+    if(t->closing && t->handles == 0 && t->writes == 0) delete t;
+}
+
+static void tunnel_close(Tunnel* t, bool close_client) {
+    if(t->closing) return;
+    t->closing = true;
+    auto closed = [](uv_handle_t* h){
+        auto* tt = static_cast<Tunnel*>(h->data);
+        tt->handles--;
+        tunnel_maybe_free(tt);
+    };
+    if(t->up_poll.data) uv_close((uv_handle_t*)&t->up_poll, closed);
+    if(t->cl_poll.data) uv_close((uv_handle_t*)&t->cl_poll, closed);
+    uv_close((uv_handle_t*)&t->timer, closed);
+    t->pool->stats.active--;
+    t->pool->record(t->status > 0, now_ms() - t->started_ms);
+    if(Conn* c = t->conn) {
+        t->conn = nullptr;
+        c->tunnel = nullptr;
+        {
+            std::lock_guard<std::mutex> lk(g_active_mu);
+            auto it = g_active.find(c);
+            if(it != g_active.end()) it->second.tunnel.reset();
+        }
+        if(close_client && !c->closing) close_conn(c);
+        conn_io_done(c);
+    }
+    tunnel_maybe_free(t);
+}
+
+// Before the 101: give up and answer the client with an error page
+static void tunnel_fail(Tunnel* t, int status, const char* msg) {
+    Conn* c = t->conn;
+    if(!c || t->established) { tunnel_close(t, true); return; }
+    c->pending_io++;                 // keep c alive across tunnel_close
+    tunnel_close(t, false);
+    if(!conn_io_done(c)) return;
+    if(c->worker) c->worker->stat_err++;
+    write_response(c, Response::make_error(status, msg).serialize_h1());
+}
+
+// Recompute what each side waits for
+static void tunnel_on_up(uv_poll_t*, int, int);
+static void tunnel_on_cl(uv_poll_t*, int, int);
+static void tunnel_update(Tunnel* t) {
+    if(t->closing) return;
+    int up = 0;
+    if(!t->connected || !t->out_up.empty() || t->pend_up) up |= UV_WRITABLE;
+    if(t->connected && (t->established || t->out_up.empty())) {
+        bool room = t->splice_mode ? (t->pend_dn == 0 && t->out_cl.empty())
+                                   : t->cl_queued < TUNNEL_HIWAT;
+        if(!t->established || room) up |= UV_READABLE;
+    }
+    if(up) uv_poll_start(&t->up_poll, up, tunnel_on_up);
+    else   uv_poll_stop(&t->up_poll);
+    if(!t->established) return;
+    if(t->splice_mode) {
+        int cl = 0;
+        if(t->pend_up == 0 && t->out_up.empty()) cl |= UV_READABLE;
+        if(t->pend_dn || !t->out_cl.empty())     cl |= UV_WRITABLE;
+        if(cl) uv_poll_start(&t->cl_poll, cl, tunnel_on_cl);
+        else   uv_poll_stop(&t->cl_poll);
+    } else if(t->conn) {
+        bool want = t->out_up.size() < TUNNEL_HIWAT;
+        if(want && !t->cl_reading)
+            uv_read_start((uv_stream_t*)&t->conn->client, on_alloc, on_read);
+        else if(!want && t->cl_reading)
+            uv_read_stop((uv_stream_t*)&t->conn->client);
+        t->cl_reading = want;
+    }
+}
+
+// Non-blocking write of a pending buffer; false on a dead socket
+static bool tunnel_drain(int fd, std::string& buf) {
+    while(!buf.empty()) {
+        ssize_t n = ::write(fd, buf.data(), buf.size());
+        if(n < 0) return errno == EAGAIN || errno == EINTR;
+        buf.erase(0, (size_t)n);
+    }
+    return true;
+}
+
+#if NW_HAVE_SPLICE
+// src → pipe → dst without copying; false on EOF or a dead socket
+static bool tunnel_splice(int src, int pipefd[2], size_t& pend, int dst,
+                          bool may_read, std::atomic<uint64_t>& counter) {
+    for(int i = 0; i < 16; i++) {
+        if(pend == 0) {
+            if(!may_read) break;
+            ssize_t n = splice(src, nullptr, pipefd[1], nullptr, 1 << 16,
+                               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if(n == 0) return false;
+            if(n < 0) return errno == EAGAIN || errno == EINTR;
+            pend = (size_t)n;
+        }
+        ssize_t m = splice(pipefd[0], nullptr, dst, nullptr, pend,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if(m < 0) return errno == EAGAIN || errno == EINTR;
+        pend -= (size_t)m;
+        counter.fetch_add((uint64_t)m, std::memory_order_relaxed);
+        if(pend) break;   // destination full
+    }
+    return true;
+}
+#endif
+
+// Copy mode: queue plaintext for the client (TLS-encrypted when needed)
+struct TunnelWrite { uv_write_t w{}; Tunnel* t{}; std::string data; };
+static void tunnel_client_write(Tunnel* t, const char* data, size_t len) {
+    Conn* c = t->conn;
+    if(!c || c->closing) return;
+    auto send = [t, c](std::string chunk){
+        auto* tw = new TunnelWrite();
+        tw->t = t; tw->data = std::move(chunk);
+        t->writes++; t->cl_queued += tw->data.size();
+        uv_buf_t b = uv_buf_init(tw->data.data(), (unsigned)tw->data.size());
+        uv_write(&tw->w, (uv_stream_t*)&c->client, &b, 1, [](uv_write_t* w, int st){
+            auto* q = reinterpret_cast<TunnelWrite*>(w);
+            Tunnel* tt = q->t;
+            tt->writes--; tt->cl_queued -= q->data.size();
+            delete q;
+            if(tt->closing) { tunnel_maybe_free(tt); return; }
+            if(st < 0) { tunnel_close(tt, true); return; }
+            tunnel_update(tt);
+        });
+    };
+    if(!c->ssl) { send(std::string(data, len)); return; }
+    size_t off = 0;
+    while(off < len) {
+        int n = SSL_write(c->ssl, data + off, (int)(len - off));
+        if(n <= 0) { tunnel_close(t, true); return; }
+        off += (size_t)n;
+    }
+    char buf[16384]; int n;
+    while((n = BIO_read(c->wbio, buf, sizeof(buf))) > 0) send(std::string(buf, (size_t)n));
+}
+
+static void tunnel_from_client(Tunnel* t, const char* data, size_t len) {
+    if(t->closing || !len) return;
+    t->last_ms = now_ms();
+    t->bytes->up.fetch_add(len, std::memory_order_relaxed);
+    t->out_up.append(data, len);
+    if(!tunnel_drain(t->up_fd, t->out_up)) { tunnel_close(t, true); return; }
+    tunnel_update(t);
+}
+
+// 101 seen: relay the head, then switch both sides to relay mode
+static void tunnel_establish(Tunnel* t) {
+    Conn* c = t->conn;
+    t->established = true;
+    update_conn_status(c, 101, "ws");
+    {
+        std::lock_guard<std::mutex> lk(g_active_mu);
+        auto it = g_active.find(c);
+        if(it != g_active.end()) it->second.tunnel = t->bytes;
+    }
+    t->bytes->down.fetch_add(t->head.size(), std::memory_order_relaxed);
+#if NW_HAVE_SPLICE
+    if(t->splice_mode) {
+        uv_os_fd_t fd = -1;
+        uv_fileno((uv_handle_t*)&c->client, &fd);
+        if(fd >= 0 && (t->cl_fd = dup(fd)) >= 0 &&
+           pipe2(t->pipe_up, O_NONBLOCK | O_CLOEXEC) == 0 &&
+           pipe2(t->pipe_dn, O_NONBLOCK | O_CLOEXEC) == 0) {
+            uv_poll_init(c->worker->loop, &t->cl_poll, t->cl_fd);
+            t->cl_poll.data = t;
+            t->handles++;
+            t->out_cl = std::move(t->head);
+            if(!tunnel_drain(t->cl_fd, t->out_cl)) { tunnel_close(t, true); return; }
+            tunnel_update(t);
+            return;
+        }
+        t->splice_mode = false;   // no pipes/fd: fall back to copying
+    }
+#endif
+    c->rbuf_len = 0;
+    tunnel_client_write(t, t->head.data(), t->head.size());
+    t->head.clear();
+    tunnel_update(t);
+}
+
+// Backend answered something other than 101: finish it as a normal reply
+static void tunnel_reply(Tunnel* t) {
+    Conn* c = t->conn;
+    Response resp;
+    parse_response(t->head.data(), t->head.size(), resp);
+    c->pending_io++;
+    tunnel_close(t, false);
+    if(!conn_io_done(c)) return;
+    c->is_ws = false;
+    proxy_reply(c, std::move(resp));
+}
+
+static void tunnel_on_up(uv_poll_t* h, int status, int events) {
+    auto* t = static_cast<Tunnel*>(h->data);
+    if(t->closing) return;
+    if(status < 0) { tunnel_fail(t, 502, "Upstream error"); return; }
+    if(!t->connected) {
+        int err = 0; socklen_t el = sizeof(err);
+        getsockopt(t->up_fd, SOL_SOCKET, SO_ERROR, &err, &el);
+        if(err) {
+            NW_WARN("proxy", "Tunnel connect %s:%d failed: %s",
+                    t->pool->cfg.host.c_str(), t->pool->cfg.port, strerror(err));
+            t->pool->mark_fail();
+            tunnel_fail(t, 502, "Upstream connect failed");
+            return;
+        }
+        t->connected = true;
+    }
+    t->last_ms = now_ms();
+    if(events & UV_WRITABLE) {
+        if(!tunnel_drain(t->up_fd, t->out_up)) { tunnel_fail(t, 502, "Upstream write failed"); return; }
+#if NW_HAVE_SPLICE
+        if(t->splice_mode && t->established && t->out_up.empty() &&
+           !tunnel_splice(t->cl_fd, t->pipe_up, t->pend_up, t->up_fd, false, t->bytes->up)) {
+            tunnel_close(t, true); return;
+        }
+#endif
+    }
+    if(events & (UV_READABLE | UV_DISCONNECT)) {
+        if(!t->established) {
+            // Response head (and, for a non-101, the whole reply)
+            char buf[16384];
+            ssize_t n = ::read(t->up_fd, buf, sizeof(buf));
+            if(n < 0 && (errno == EAGAIN || errno == EINTR)) { tunnel_update(t); return; }
+            if(n > 0) t->head.append(buf, (size_t)n);
+            auto hend = t->head.find("\r\n\r\n");
+            if(hend == std::string::npos) {
+                if(n <= 0 || t->head.size() > 65536) tunnel_fail(t, 502, "Bad upstream response");
+                else tunnel_update(t);
+                return;
+            }
+            if(!t->status) sscanf(t->head.c_str(), "HTTP/%*s %d", &t->status);
+            if(t->status == 101) { tunnel_establish(t); return; }
+            Response probe;
+            auto [pr, used] = parse_response(t->head.data(), t->head.size(), probe);
+            bool sized = probe.headers.has("Content-Length");
+            if(n <= 0 || (sized && pr == ParseResult::Complete)) { tunnel_reply(t); return; }
+            tunnel_update(t);
+            return;
+        }
+#if NW_HAVE_SPLICE
+        if(t->splice_mode) {
+            if(!tunnel_splice(t->up_fd, t->pipe_dn, t->pend_dn, t->cl_fd, true, t->bytes->down)) {
+                tunnel_close(t, true); return;
+            }
+            tunnel_update(t);
+            return;
+        }
+#endif
+        char buf[65536];
+        for(int i = 0; i < 16 && t->cl_queued < TUNNEL_HIWAT; i++) {
+            ssize_t n = ::read(t->up_fd, buf, sizeof(buf));
+            if(n < 0 && (errno == EAGAIN || errno == EINTR)) break;
+            if(n <= 0) { tunnel_close(t, true); return; }
+            t->bytes->down.fetch_add((uint64_t)n, std::memory_order_relaxed);
+            tunnel_client_write(t, buf, (size_t)n);
+            if(t->closing) return;
+        }
+    }
+    tunnel_update(t);
+}
+
+#if NW_HAVE_SPLICE
+static void tunnel_on_cl(uv_poll_t* h, int status, int events) {
+    auto* t = static_cast<Tunnel*>(h->data);
+    if(t->closing) return;
+    if(status < 0) { tunnel_close(t, true); return; }
+    t->last_ms = now_ms();
+    if(events & UV_WRITABLE) {
+        if(!tunnel_drain(t->cl_fd, t->out_cl) ||
+           (t->out_cl.empty() &&
+            !tunnel_splice(t->up_fd, t->pipe_dn, t->pend_dn, t->cl_fd, false, t->bytes->down))) {
+            tunnel_close(t, true); return;
+        }
+    }
+    if(events & (UV_READABLE | UV_DISCONNECT)) {
+        if(!tunnel_splice(t->cl_fd, t->pipe_up, t->pend_up, t->up_fd, true, t->bytes->up)) {
+            tunnel_close(t, true); return;
+        }
+    }
+    tunnel_update(t);
+}
+#else
+static void tunnel_on_cl(uv_poll_t*, int, int) {}
+#endif
+
+static void tunnel_open(Conn* conn, UpstreamPool* up, const LocationConfig& loc, std::string fwd) {
+    Worker* w = conn->worker;
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0) {
+        write_response(conn, Response::make_error(502, "Upstream socket failed").serialize_h1());
+        return;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    struct sockaddr_in addr{}; addr.sin_family = AF_INET;
+    addr.sin_port = htons(up->cfg.port);
+    inet_pton(AF_INET, up->cfg.host.c_str(), &addr.sin_addr);
+    if(connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS) {
+        close(fd);
+        up->mark_fail();
+        write_response(conn, Response::make_error(502, "Upstream connect failed").serialize_h1());
+        return;
+    }
+
+    auto* t = new Tunnel();
+    t->conn        = conn;
+    t->pool        = up;
+    t->up_fd       = fd;
+    t->splice_mode = NW_HAVE_SPLICE && !conn->ssl;
+    t->out_up      = std::move(fwd);
+    // Client bytes read behind the Upgrade request (e.g. a first WebSocket
+    // frame sent with the handshake) follow it to the backend
+    if(conn->rbuf_len > conn->req_consumed) {
+        size_t extra = conn->rbuf_len - conn->req_consumed;
+        t->out_up.append(conn->rbuf + conn->req_consumed, extra);
+        t->bytes->up.fetch_add(extra, std::memory_order_relaxed);
+    }
+    conn->rbuf_len = 0;
+    t->started_ms  = t->last_ms = now_ms();
+    t->idle_ms     = (int64_t)std::max(1, loc.proxy_timeout) * 1000;
+    t->connect_ms  = (int64_t)std::max(1, loc.proxy_connect_timeout) * 1000;
+    up->stats.active++;
+    conn->tunnel = t;
+    conn->pending_io++;
+    // The tunnel's own timer replaces the keep-alive idle timer
+    if(conn->idle_timer_active) uv_timer_stop(&conn->idle_timer);
+
+    uv_poll_init(w->loop, &t->up_poll, fd);
+    t->up_poll.data = t;
+    uv_timer_init(w->loop, &t->timer);
+    t->timer.data = t;
+    t->handles = 2;
+    uv_timer_start(&t->timer, [](uv_timer_t* h){
+        auto* tt = static_cast<Tunnel*>(h->data);
+        int64_t idle = now_ms() - tt->last_ms;
+        if(!tt->connected && idle > tt->connect_ms)  tunnel_fail(tt, 504, "Upstream connect timeout");
+        else if(!tt->established && idle > tt->idle_ms) tunnel_fail(tt, 504, "Upstream timeout");
+        else if(idle > tt->idle_ms) {
+            NW_DEBUG("proxy", "Tunnel idle %llds — closing", (long long)(idle / 1000));
+            tunnel_close(tt, true);
+        }
+    }, 1000, 1000);
+    tunnel_update(t);
+}
+
+// ── /metrics families ─────────────────────────────────────────────────────────
+// Registered once in main(); every collector reads atomics or the merged
+// latency state of the last stats tick, so a scrape never blocks a worker.
+static const char* const MX_CLASS[LH_CLASSES] = {"1xx", "2xx", "3xx", "4xx", "5xx"};
+
+static int metrics_worker_count() {
+    int nw = g_wstats_count > 0 ? g_wstats_count : g_worker_count.load();
+    return std::min(std::max(nw, 1), 64);
+}
+
+// fn(i, "i") for every worker — the {"worker", id} label of per-worker families
+template<class F>
+static void metrics_each_worker(F&& fn) {
+    char id[12];
+    for(int i = 0, n = metrics_worker_count(); i < n; i++) {
+        snprintf(id, sizeof(id), "%d", i);
+        fn(i, (const char*)id);
+    }
+}
+
+// Per-backend totals over every worker's pool (pools of one backend share lat_total)
+struct MxBackend {
+    const LatencySeries* key;
+    uint64_t req, err;
+    int      active, st[3];
+};
+static int metrics_backends(MxBackend* out, int max) {
+    int n = 0;
+    for_each_upstream_pool([&](const UpstreamPool& p) {
+        int i = 0;
+        while(i < n && out[i].key != p.lat_total) i++;
+        if(i == n) {
+            if(n == max) return;
+            out[n++] = MxBackend{p.lat_total, 0, 0, 0, {0, 0, 0}};
+        }
+        out[i].req    += p.stats.req_total.load(std::memory_order_relaxed);
+        out[i].err    += p.stats.req_err.load(std::memory_order_relaxed);
+        out[i].active += p.stats.active.load(std::memory_order_relaxed);
+        out[i].st[(int)p.state.load(std::memory_order_relaxed)]++;
+    });
+    return n;
+}
+static std::string_view mx_backend_name(const LatencySeries* s) {
+    return std::string_view(s->name).substr(3);   // "up:host:port" → "host:port"
+}
+
+static void register_metrics() {
+    g_metrics.add("nasweb_build", "info", "nas-web build information",
+        [](MetricsWriter& m, const MetricFamily& f) {
+            m.sample(f, "_info", {{"version", NP_VERSION}}, (uint64_t)1);
+        });
+    g_metrics.add("nasweb_start_time_seconds", "gauge", "Process start time (unix seconds)",
+        [](MetricsWriter& m, const MetricFamily& f) { m.gauge(f, (uint64_t)g_start_time); });
+
+    // ── Requests ─────────────────────────────────────────────────────────────
+    g_metrics.add("nasweb_requests", "counter", "Responses sent, by status class",
+        [](MetricsWriter& m, const MetricFamily& f) {
+            g_latency.visit([&](const LatencySeries& s) {
+                if(s.name != "all") return;
+                for(int c = 0; c < LH_CLASSES; c++) m.counter(f, s.cum.cls[c], {{"class", MX_CLASS[c]}});
+            });
+        });
+    g_metrics.add("nasweb_request_duration_seconds", "histogram", "dispatch() to response queued",
+        [](MetricsWriter& m, const MetricFamily& f) {
+            m.histogram(f, g_lat_all->cum);
+        });
+    g_metrics.add("nasweb_location_requests", "counter", "Responses sent, by location and status class",
+        [](MetricsWriter& m, const MetricFamily& f) {
+            g_latency.visit([&](const LatencySeries& s) {
+                if(s.name.compare(0, 4, "loc:") != 0) return;
+                std::string_view loc = std::string_view(s.name).substr(4);
+                for(int c = 0; c < LH_CLASSES; c++)
+                    if(s.cum.cls[c]) m.counter(f, s.cum.cls[c], {{"location", loc}, {"class", MX_CLASS[c]}});
+            });
+        });
+    g_metrics.add("nasweb_location_request_duration_seconds", "histogram", "Request duration by location",
+        [](MetricsWriter& m, const MetricFamily& f) {
+            g_latency.visit([&](const LatencySeries& s) {
+                if(s.name.compare(0, 4, "loc:") != 0) return;
+                m.histogram(f, s.cum, {{"location", std::string_view(s.name).substr(4)}});
+            });
+        });
+    g_metrics.add("nasweb_connections", "gauge", "Open client connections",
+        [](MetricsWriter& m, const MetricFamily& f) {
+            size_t n;
+            { std::lock_guard<std::mutex> lk(g_active_mu); n = g_active.size(); }
+            m.gauge(f, (uint64_t)n);
+        });
+
+    // ── Workers ──────────────────────────────────────────────────────────────
+    // From the per-worker "all" histograms: every response, admin API included
+    g_metrics.add("nasweb_worker_requests", "counter", "Responses sent per worker, by status class",
+        [](MetricsWriter& m, const MetricFamily& f) {
+            metrics_each_worker([&](int i, const char* id) {
+                const LatencyHist* h = g_lat_all->w[i].load(std::memory_order_acquire);
+                if(!h) return;
+                for(int c = 0; c < LH_CLASSES; c++)
+                    m.counter(f, h->cls[c].load(std::memory_order_relaxed), {{"worker", id}, {"class", MX_CLASS[c]}});
+            });
+        });
+    g_metrics.add("nasweb_worker_loop_lag_seconds", "gauge", "Worst lag-probe drift of the worker's event loop in the last second",
+        [](MetricsWriter& m, const MetricFamily& f) {
+            metrics_each_worker([&](int i, const char* id) {
+                m.gauge(f, (double)g_wstats[i].loop_lag_us.load(std::memory_order_relaxed) / 1e6, {{"worker", id}});
+            });
+        });
+    g_metrics.add("nasweb_worker_loop_busy_ratio", "gauge", "Share of the last second the worker's loop was not idle in poll",
+        [](MetricsWriter& m, const MetricFamily& f) {
+            metrics_each_worker([&](int i, const char* id) {
+                m.gauge(f, g_wstats[i].loop_busy_pm.load(std::memory_order_relaxed) / 1000.0, {{"worker", id}});
+            });
+        });
+    g_metrics.add("nasweb_worker_loop_handles", "gauge", "Active libuv handles on the worker's loop",
+        [](MetricsWriter& m, const MetricFamily& f) {
+            metrics_each_worker([&](int i, const char* id) {
+                m.gauge(f, (double)g_wstats[i].loop_handles.load(std::memory_order_relaxed), {{"worker", id}});
+            });
+        });
+    g_metrics.add("nasweb_worker_threadpool_queued", "gauge", "Threadpool jobs submitted by the worker and not completed yet",
+        [](MetricsWriter& m, const MetricFamily& f) {
+            metrics_each_worker([&](int i, const char* id) {
+                m.gauge(f, (double)std::max(0, g_wstats[i].tp_queued.load(std::memory_order_relaxed)), {{"worker", id}});
+            });
+        });
+    g_metrics.add("nasweb_worker_loop_stalls", "counter", "Lag-probe drifts over loop_stall_warn_ms",
+        [](MetricsWriter& m, const MetricFamily& f) {
+            metrics_each_worker([&](int i, const char* id) {
+                m.counter(f, g_wstats[i].loop_stalls.load(std::memory_order_relaxed), {{"worker", id}});
+            });
+        });
+
+    // ── Cache (sum over workers) ─────────────────────────────────────────────
+    g_metrics.add("nasweb_cache_hits", "counter", "Responses served from the cache",
+        [](MetricsWriter& m, const MetricFamily& f) {
+            uint64_t v = 0;
+            for(int i = 0, n = metrics_worker_count(); i < n; i++) v += g_wstats[i].cache_hit.load(std::memory_order_relaxed);
+            m.counter(f, v);
+        });
+    g_metrics.add("nasweb_cache_misses", "counter", "Cache lookups that missed",
+        [](MetricsWriter& m, const MetricFamily& f) {
+            uint64_t v = 0;
+            for(int i = 0, n = metrics_worker_count(); i < n; i++) v += g_wstats[i].cache_miss.load(std::memory_order_relaxed);
+            m.counter(f, v);
+        });
+    g_metrics.add("nasweb_cache_evictions", "counter", "Entries evicted by LRU",
+        [](MetricsWriter& m, const MetricFamily& f) {
+            uint64_t v = 0;
+            for(int i = 0, n = metrics_worker_count(); i < n; i++) v += g_wstats[i].cache_evict.load(std::memory_order_relaxed);
+            m.counter(f, v);
+        });
+    g_metrics.add("nasweb_cache_bytes", "gauge", "Bytes held by cached responses",
+        [](MetricsWriter& m, const MetricFamily& f) {
+            uint64_t v = 0;
+            for(int i = 0, n = metrics_worker_count(); i < n; i++) v += g_wstats[i].cache_bytes.load(std::memory_order_relaxed);
+            m.gauge(f, v);
+        });
+    g_metrics.add("nasweb_cache_entries", "gauge", "Cached responses",
+        [](MetricsWriter& m, const MetricFamily& f) {
+            uint64_t v = 0;
+            for(int i = 0, n = metrics_worker_count(); i < n; i++) v += g_wstats[i].cache_entries.load(std::memory_order_relaxed);
+            m.gauge(f, v);
+        });
+
+    // ── Upstreams ────────────────────────────────────────────────────────────
+    g_metrics.add("nasweb_upstream_state", "gauge", "Worker pools per backend in each health state",
+        [](MetricsWriter& m, const MetricFamily& f) {
+            static const char* const names[3] = {"healthy", "degraded", "down"};
+            MxBackend b[64];
+            int n = metrics_backends(b, 64);
+            for(int i = 0; i < n; i++)
+                for(int s = 0; s < 3; s++)
+                    m.gauge(f, (uint64_t)b[i].st[s], {{"backend", mx_backend_name(b[i].key)}, {"state", names[s]}});
+        });
+    g_metrics.add("nasweb_upstream_requests", "counter", "Requests sent to a backend",
+        [](MetricsWriter& m, const MetricFamily& f) {
+            MxBackend b[64];
+            int n = metrics_backends(b, 64);
+            for(int i = 0; i < n; i++) m.counter(f, b[i].req, {{"backend", mx_backend_name(b[i].key)}});
+        });
+    g_metrics.add("nasweb_upstream_errors", "counter", "Failed backend exchanges",
+        [](MetricsWriter& m, const MetricFamily& f) {
+            MxBackend b[64];
+            int n = metrics_backends(b, 64);
+            for(int i = 0; i < n; i++) m.counter(f, b[i].err, {{"backend", mx_backend_name(b[i].key)}});
+        });
+    g_metrics.add("nasweb_upstream_active", "gauge", "Backend connections in use",
+        [](MetricsWriter& m, const MetricFamily& f) {
+            MxBackend b[64];
+            int n = metrics_backends(b, 64);
+            for(int i = 0; i < n; i++) m.gauge(f, (uint64_t)std::max(b[i].active, 0), {{"backend", mx_backend_name(b[i].key)}});
+        });
+    g_metrics.add("nasweb_upstream_duration_seconds", "histogram", "Backend connect / TTFB / total time",
+        [](MetricsWriter& m, const MetricFamily& f) {
+            g_latency.visit([&](const LatencySeries& s) {
+                if(s.name.compare(0, 3, "up:") != 0) return;
+                m.histogram(f, s.cum, {{"backend", mx_backend_name(&s)}, {"phase", s.metric}});
+            });
+        });
+    g_metrics.add("nasweb_upstream_h2_connections", "gauge", "Multiplexed HTTP/2 backend connections",
+        [](MetricsWriter& m, const MetricFamily& f) { m.gauge(f, (uint64_t)std::max(g_h2up_links.load(), 0)); });
+    g_metrics.add("nasweb_upstream_h2_goaway", "counter", "GOAWAY frames received from backends",
+        [](MetricsWriter& m, const MetricFamily& f) { m.counter(f, g_h2up_goaway.load()); });
+
+    // ── Security ─────────────────────────────────────────────────────────────
+    g_metrics.add("nasweb_waf_checked", "counter", "Requests inspected by the WAF",
+        [](MetricsWriter& m, const MetricFamily& f) {
+            m.counter(f, g_waf_regex.total_checked.load(), {{"engine", "regex"}});
+#ifdef WITH_MODSEC
+            m.counter(f, g_waf.total_checked.load(), {{"engine", "modsec"}});
+#endif
+        });
+    g_metrics.add("nasweb_waf_detected", "counter", "WAF rule matches",
+        [](MetricsWriter& m, const MetricFamily& f) {
+            m.counter(f, g_waf_regex.total_detected.load(), {{"engine", "regex"}});
+#ifdef WITH_MODSEC
+            m.counter(f, g_waf.total_detected.load(), {{"engine", "modsec"}});
+#endif
+        });
+    g_metrics.add("nasweb_waf_blocked", "counter", "Requests blocked by the WAF",
+        [](MetricsWriter& m, const MetricFamily& f) {
+            m.counter(f, g_waf_regex.total_blocked.load(), {{"engine", "regex"}});
+#ifdef WITH_MODSEC
+            m.counter(f, g_waf.total_blocked.load(), {{"engine", "modsec"}});
+#endif
+        });
+    g_metrics.add("nasweb_autoban_bans", "counter", "IPs banned by autoban",
+        [](MetricsWriter& m, const MetricFamily& f) { m.counter(f, g_autoban.total_banned.load()); });
+    g_metrics.add("nasweb_autoban_blocked", "counter", "Requests refused from banned IPs",
+        [](MetricsWriter& m, const MetricFamily& f) { m.counter(f, g_autoban.total_blocked.load()); });
+    g_metrics.add("nasweb_tls_handshakes", "counter", "TLS handshakes by result",
+        [](MetricsWriter& m, const MetricFamily& f) {
+            m.counter(f, g_tls_hs_ok.load(),   {{"result", "ok"}});
+            m.counter(f, g_tls_hs_fail.load(), {{"result", "failed"}});
+        });
+
+    // ── Access log ───────────────────────────────────────────────────────────
+    g_metrics.add("nasweb_access_log_records", "counter", "Access log records written",
+        [](MetricsWriter& m, const MetricFamily& f) { m.counter(f, g_access_log.written()); });
+    g_metrics.add("nasweb_access_log_dropped", "counter", "Access log records dropped (ring full)",
+        [](MetricsWriter& m, const MetricFamily& f) { m.counter(f, g_access_log.dropped()); });
+
+    // ── Memory (same components as /np_memory) ───────────────────────────────
+    g_metrics.add("nasweb_memory_bytes", "gauge", "Live bytes held per subsystem (estimated)",
+        [](MetricsWriter& m, const MetricFamily& f) {
+            g_memory.each([&](const char* name, const char*, const MemUsage& u) {
+                m.gauge(f, u.bytes, {{"component", name}});
+            });
+        });
+    g_metrics.add("nasweb_memory_objects", "gauge", "Live objects (entries, connections) per subsystem",
+        [](MetricsWriter& m, const MetricFamily& f) {
+            g_memory.each([&](const char* name, const char*, const MemUsage& u) {
+                m.gauge(f, u.objects, {{"component", name}});
+            });
+        });
+    g_metrics.add("nasweb_process_resident_memory_bytes", "gauge", "Process RSS",
+        [](MetricsWriter& m, const MetricFamily& f) { m.gauge(f, ProcMem::read().rss); });
+}
+
+// ── /np_memory components ─────────────────────────────────────────────────────
+// Each owner reports its own containers (under its own lock); loop-local ones
+// (cache, rate limiter) come from the values the worker tick published.
+static void register_memory() {
+    auto workers = [](auto pick) {
+        MemUsage m;
+        for(int i = 0; i < g_wstats_count && i < 64; i++) m += pick(g_wstats[i]);
+        return m;
+    };
+    g_memory.add("conns", "Conn objects (64 KB read buffer each; TLS/HTTP2 state excluded)", [workers]{
+        return workers([](const WorkerStats& ws) {
+            uint64_t n = (uint64_t)std::max<int64_t>(0, ws.conn_objs.load(std::memory_order_relaxed));
+            return MemUsage{n * sizeof(Conn), n};
+        });
+    });
+    g_memory.add("request_arena", "Per-worker pools behind the per-request header arenas", [workers]{
+        return workers([](const WorkerStats& ws) {
+            return MemUsage{ws.arena_mem.load(std::memory_order_relaxed), 1};
+        });
+    });
+    g_memory.add("waf_input", "Per-worker WAF normalization buffers and verdict caches", [workers]{
+        return workers([](const WorkerStats& ws) {
+            return MemUsage{ws.waf_norm_mem.load(std::memory_order_relaxed), 1};
+        });
+    });
+    g_memory.add("response_cache", "Cached responses, all workers", [workers]{
+        return workers([](const WorkerStats& ws) {
+            return MemUsage{ws.cache_mem.load(std::memory_order_relaxed), ws.cache_entries.load(std::memory_order_relaxed)};
+        });
+    });
+    g_memory.add("ratelimit", "Token buckets per IP, all workers (never expired)", [workers]{
+        return workers([](const WorkerStats& ws) {
+            return MemUsage{ws.rl_mem.load(std::memory_order_relaxed), ws.rl_entries.load(std::memory_order_relaxed)};
+        });
+    });
+    g_memory.add("autoban.ip_stats", "AutoBan sliding windows per IP", []{ return g_autoban.ip_stats_mem(); });
+    g_memory.add("autoban.recent_bans", "Last 200 ban events", []{
+        std::lock_guard<std::mutex> lk(g_autoban.mu_pub());
+        MemUsage m{mem_deque(g_autoban.recent_bans), g_autoban.recent_bans.size()};
+        for(auto& e : g_autoban.recent_bans)
+            m.bytes += mem_heap(e.ip) + mem_heap(e.reason) + mem_heap(e.detail);
+        return m;
+    });
+    g_memory.add("conn_per_ip", "Open connections per client IP (max_conns_per_ip)", []{
+        std::lock_guard<std::mutex> lk(g_connlimit_mu);
+        MemUsage m{mem_hash_nodes(g_conn_count), g_conn_count.size()};
+        for(auto& [ip, n] : g_conn_count) m.bytes += mem_heap(ip);
+        return m;
+    });
+    g_memory.add("active_conns", "Connection list for the admin panel", []{
+        std::lock_guard<std::mutex> lk(g_active_mu);
+        MemUsage m{mem_hash_nodes(g_active), g_active.size()};
+        for(auto& [k, a] : g_active)
+            m.bytes += mem_heap(a.ip) + mem_heap(a.method) + mem_heap(a.path) + mem_heap(a.type)
+                     + (a.tunnel ? sizeof(TunnelBytes) : 0);
+        return m;
+    });
+    g_memory.add("recent_requests", "Last completed requests (Connections tab)", []{
+        std::lock_guard<std::mutex> lk(g_recent_mu);
+        MemUsage m{mem_deque(g_recent_reqs), g_recent_reqs.size()};
+        for(auto& r : g_recent_reqs)
+            m.bytes += mem_heap(r.ip) + mem_heap(r.method) + mem_heap(r.path) + mem_heap(r.type);
+        return m;
+    });
+    g_memory.add("audit_log", "Admin audit entries", []{
+        std::lock_guard<std::mutex> lk(g_audit_mu);
+        MemUsage m{mem_deque(g_audit_log), g_audit_log.size()};
+        for(auto& a : g_audit_log)
+            m.bytes += mem_heap(a.admin_ip) + mem_heap(a.action) + mem_heap(a.detail);
+        return m;
+    });
+    g_memory.add("stats_history", "Per-second dashboard samples", []{
+        std::lock_guard<std::mutex> lk(g_stats_hist_mu);
+        return MemUsage{mem_deque(g_stats_hist), g_stats_hist.size()};
+    });
+    g_memory.add("log", "Log history + per-thread log rings", []{ return g_log.mem_usage(); });
+    g_memory.add("slow_log", "Slow-request ring (/np_slow)", []{ return g_slow.mem_usage(); });
+    g_memory.add("latency", "Latency series: per-worker histograms + history", []{ return g_latency.mem_usage(); });
+    g_memory.add("waf_regex.events", "Last regex WAF detections", []{
+        std::lock_guard<std::mutex> lk(g_waf_regex.events_mu);
+        MemUsage m{mem_deque(g_waf_regex.events), g_waf_regex.events.size()};
+        for(auto& e : g_waf_regex.events)
+            m.bytes += mem_heap(e.ip) + mem_heap(e.method) + mem_heap(e.uri) + mem_heap(e.category)
+                     + mem_heap(e.matched) + mem_heap(e.detail);
+        return m;
+    });
+    g_memory.add("waf_regex.automaton", "Regex WAF NFA programs, literal prefilters + lazy DFA caches, all threads (objects = DFA states)", []{
+        MemUsage m{0, (uint64_t)std::max<int64_t>(0, g_waf_dfa_stats.states.load(std::memory_order_relaxed))};
+        for(auto& p : g_waf_regex.progs)
+            m.bytes += p.code.capacity() * sizeof(WafInst) + p.sets.capacity() * sizeof(WafByteSet)
+                     + p.starts.capacity() * sizeof(int32_t);
+        for(auto& pf : g_waf_regex.prefilters) m.bytes += pf.mem_bytes();
+        m.bytes += (uint64_t)std::max<int64_t>(0, g_waf_dfa_stats.bytes.load(std::memory_order_relaxed));
+        return m;
+    });
+#ifdef WITH_MODSEC
+    g_memory.add("waf_modsec.events", "Last ModSecurity detections", []{
+        std::lock_guard<std::mutex> lk(g_waf.events_mu);
+        MemUsage m{mem_deque(g_waf.events), g_waf.events.size()};
+        for(auto& e : g_waf.events)
+            m.bytes += mem_heap(e.ip) + mem_heap(e.method) + mem_heap(e.uri) + mem_heap(e.rule_id)
+                     + mem_heap(e.message) + mem_heap(e.severity);
+        return m;
+    });
+#endif
+    g_memory.add("blacklist", "Blacklisted IPs", []{
+        std::lock_guard<std::mutex> lk(g_blacklist_mu);
+        MemUsage m{mem_hash_nodes(g_blacklist), g_blacklist.size()};
+        for(auto& ip : g_blacklist) m.bytes += mem_heap(ip);
+        return m;
+    });
+    g_memory.add("admin_fails", "Admin login failures per IP", []{
+        std::lock_guard<std::mutex> lk(g_admin_fails.mu);
+        MemUsage m{mem_hash_nodes(g_admin_fails.fails), g_admin_fails.fails.size()};
+        for(auto& [ip, e] : g_admin_fails.fails) m.bytes += mem_heap(ip);
+        return m;
+    });
+    g_memory.add("access_log", "Access log rings (objects = records queued)", []{ return g_access_log.mem_usage(); });
+    g_memory.add("capture", "Traffic capture rings (objects = records queued)", []{ return g_capture.mem_usage(); });
+}
+
+// /metrics has its own access control, independent of the admin login:
+// `metrics_token` (Authorization: Bearer) and/or `metrics_allow` prefixes;
+// with neither configured only loopback clients may scrape.
+static bool metrics_ip_allowed(const std::string& ip, const std::vector<std::string>& allow) {
+    if(allow.empty())
+        return ip.compare(0, 4, "127.") == 0 || ip == "::1" || ip.compare(0, 11, "::ffff:127.") == 0;
+    for(auto& p : allow)
+        if(ip.compare(0, p.size(), p) == 0) return true;
+    return false;
+}
+static bool metrics_allowed(const Conn* conn, const Config& cfg) {
+    if(cfg.metrics_token.empty())
+        return metrics_ip_allowed(conn->client_ip, cfg.metrics_allow);
+    auto auth = conn->req.headers.get("Authorization");
+    const std::string& tok = cfg.metrics_token;
+    if(auth.size() != 7 + tok.size() || auth.compare(0, 7, "Bearer ") != 0 ||
+       CRYPTO_memcmp(auth.data() + 7, tok.data(), tok.size()) != 0)
+        return false;
+    return cfg.metrics_allow.empty() || metrics_ip_allowed(conn->client_ip, cfg.metrics_allow);
+}
+
 static void dispatch(Conn* conn) {
+    conn->req_start_us = now_us();
+    conn->tm.begin(conn->req_start_us);
+    if(conn->rx_start_us) {
+        conn->tm.add(PH_PARSE, conn->rx_parse_us);
+        conn->tm.add(PH_RECV, conn->req_start_us - conn->rx_start_us - conn->rx_parse_us);
+        conn->rx_start_us = conn->rx_parse_us = 0;
+    }
     Worker* w = conn->worker;
     if(!w || !w->config || w->config->servers.empty()) {
         write_response(conn, Response::make_error(503).serialize_h1()); return;
     }
     const Config& cfg = *w->config;
+    if(!cfg.server_timing_allow.empty())
+        for(auto& p : cfg.server_timing_allow)
+            if(conn->client_ip.compare(0, p.size(), p) == 0) { conn->tm.emit_header = true; break; }
     // Virtual host routing — match by Host header
     const ServerConfig* srv_ptr = cfg.match_server(std::string(conn->req.host));
     if(!srv_ptr) {
@@ -786,6 +2375,18 @@ static void dispatch(Conn* conn) {
         r.body = body;
         write_response(conn, r.serialize_h1()); return;
     }
+    // /metrics — OpenMetrics text for Prometheus & co. (not an admin path:
+    // scrapers authenticate with metrics_allow / metrics_token instead).
+    // Anyone else falls through to the locations, so a proxied app's own
+    // /metrics still answers them.
+    if(rpath == "/metrics" && cfg.metrics_enabled && metrics_allowed(conn, cfg)) {
+        Response r; r.status = 200;
+        r.body = g_metrics.render();
+        r.headers.set("Content-Type",   METRICS_CONTENT_TYPE);
+        r.headers.set("Content-Length", std::to_string(r.body.size()));
+        r.headers.set("Cache-Control",  "no-store");
+        write_response(conn, r.serialize_h1()); return;
+    }
     // ── Admin endpoints — custom login page, NO browser popup ────────────────
 
 
@@ -853,7 +2454,10 @@ static void dispatch(Conn* conn) {
                rpath == "/np_config"     || rpath == "/np_logfile" ||
                rpath == "/np_acme"       || rpath == "/np_features"  ||
                rpath == "/np_stats"      || rpath == "/np_audit"      ||
+               rpath == "/np_slow"       || rpath == "/np_profile"   ||
+               rpath == "/np_memory"     ||
                rpath == "/np_acme_diag"  || rpath == "/np_logs/stream" ||
+               rpath == "/np_stats/stream" ||
                rpath == "/np_autoban" ||
                rpath == "/np_waf" ||
                rpath == "/np_waf_regex" ||
@@ -972,8 +2576,8 @@ static void dispatch(Conn* conn) {
 
         // Force Connection: close for all admin API endpoints
         // Prevents browser connection pool exhaustion (6-conn limit per host)
-        // SSE (/np_logs/stream) is exempt — it needs a persistent connection
-        if(rpath != "/np_logs/stream") {
+        // SSE streams are exempt — they need a persistent connection
+        if(rpath != "/np_logs/stream" && rpath != "/np_stats/stream") {
             conn->req.keep_alive = false;
         }
 
@@ -1070,11 +2674,34 @@ static void dispatch(Conn* conn) {
             "false"
 #endif
             );
+        // Access log writer: records written / dropped on full ring / I/O errors
+        std::string body(buf, strlen(buf) - 1);
+        snprintf(buf, sizeof(buf),
+            ",\"access_log\":{\"enabled\":%s,\"format\":\"%s\",\"zstd\":%d,"
+            "\"written\":%llu,\"dropped\":%llu,\"queued\":%llu,\"bytes\":%llu,"
+            "\"errors\":%llu,\"reopens\":%llu}}",
+            g_access_log.enabled() ? "true" : "false",
+            g_access_log.format_name(), g_access_log.zstd_level(),
+            (unsigned long long)g_access_log.written(),
+            (unsigned long long)g_access_log.dropped(),
+            (unsigned long long)g_access_log.queued(),
+            (unsigned long long)g_access_log.bytes(),
+            (unsigned long long)g_access_log.errors(),
+            (unsigned long long)g_access_log.reopens());
+        body += buf;
+        body.pop_back();
+        snprintf(buf, sizeof(buf),
+            ",\"capture\":{\"enabled\":%s,\"written\":%llu,\"dropped\":%llu,\"bytes\":%llu}}",
+            g_capture.enabled() ? "true" : "false",
+            (unsigned long long)g_capture.written(),
+            (unsigned long long)g_capture.dropped(),
+            (unsigned long long)g_capture.bytes());
+        body += buf;
         Response r; r.status = 200;
         r.headers.set("Content-Type",   "application/json");
-        r.headers.set("Content-Length", std::to_string(strlen(buf)));
+        r.headers.set("Content-Length", std::to_string(body.size()));
         r.headers.set("Cache-Control",  "no-store");
-        r.body = buf;
+        r.body = std::move(body);
         write_response(conn, r.serialize_h1()); return;
     }
 
@@ -1190,8 +2817,9 @@ static void dispatch(Conn* conn) {
         bool hc_on    = cfg2.module_lb_healthcheck;
         bool acme_on  = cfg2.module_acme;
         bool zstd_on  = opt::zstd_available();
-        bool janet_on = JANET_REAL != 0;
-        char buf[4096];
+        bool janet_c  = JANET_REAL != 0;
+        bool janet_on = janet_c && opt::g_janet_stats.loaded.load() > 0;
+        char buf[4608];
         snprintf(buf,sizeof(buf),
             "{\"modules\":["
             "{\"name\":\"Cache\",\"id\":\"cache\",\"enabled\":%s,\"toggleable\":true,\"icon\":\"cache\",\"version\":\"LRU\",\"note\":\"Odpowiedzi proxy i pliki statyczne w pamieci\"},"
@@ -1200,7 +2828,8 @@ static void dispatch(Conn* conn) {
             "{\"name\":\"zstd\",\"id\":\"zstd\",\"enabled\":%s,\"toggleable\":false,\"icon\":\"gzip\",\"version\":\"%s\",\"note\":\"%s\"},"
             "{\"name\":\"Lua 5.4\",\"id\":\"lua\",\"enabled\":%s,\"toggleable\":%s,\"icon\":\"lua\",\"version\":\"5.4\",\"note\":\"%s\"},"
             "{\"name\":\"QuickJS\",\"id\":\"js\",\"enabled\":%s,\"toggleable\":%s,\"icon\":\"js\",\"version\":\"2024\",\"note\":\"%s\"},"
-            "{\"name\":\"Janet WAF\",\"id\":\"janet\",\"enabled\":%s,\"toggleable\":false,\"icon\":\"js\",\"version\":\"%s\",\"note\":\"%s\"},"
+            "{\"name\":\"Janet WAF\",\"id\":\"janet\",\"enabled\":%s,\"toggleable\":false,\"icon\":\"js\",\"version\":\"%s\",\"note\":\"%s\","
+                "\"stats\":%s},"
             "{\"name\":\"Page Optimizer\",\"id\":\"optimizer\",\"enabled\":true,\"toggleable\":false,\"icon\":\"gzip\",\"version\":\"built-in\",\"note\":\"CSS minify, HTML rewrite (lazy-img, charset), WebP detection\"},"
             "{\"name\":\"TLS/SSL\",\"id\":\"tls\",\"enabled\":%s,\"toggleable\":false,\"icon\":\"tls\",\"version\":\"OpenSSL 3\",\"note\":\"%s\"},"
             "{\"name\":\"HTTP\\/2\",\"id\":\"h2\",\"enabled\":%s,\"toggleable\":false,\"icon\":\"h2\",\"version\":\"nghttp2\",\"note\":\"%s\"},"
@@ -1215,7 +2844,9 @@ static void dispatch(Conn* conn) {
             lua_on?"true":"false", lua_c?"true":"false", lua_c?"aktywny":"zainstaluj liblua5.4-dev",
             js_on?"true":"false",  qjs_c?"true":"false", qjs_c?"aktywny":"uruchom vendor/quickjs/fetch_quickjs.sh",
             janet_on?"true":"false", opt::janet_version_str(),
-            janet_on?"aktywny — reguły WAF w języku Janet (Lisp)":"uruchom vendor/janet/fetch_janet.sh i przebuduj",
+            janet_on?"aktywny — reguły WAF w języku Janet (Lisp)":
+            janet_c ?"brak waf-check w <scripts_dir>/waf_custom.janet":"uruchom vendor/janet/fetch_janet.sh i przebuduj",
+            opt::janet_stats_json().c_str(),
             tls_on?"true":"false",
             tls_on?"Aktywne - certyfikat zaladowany":"Brak certyfikatu - dodaj ssl_cert i ssl_key w configu serwera",
             h2_on?"true":"false", ng2_c?"aktywny":"zainstaluj libnghttp2-dev",
@@ -1293,10 +2924,17 @@ static void dispatch(Conn* conn) {
                 char buf[512];
                 snprintf(buf,sizeof(buf),
                     "{\"ip\":\"%s\",\"method\":\"%s\",\"path\":\"%s\","
-                    "\"age_ms\":%lld,\"type\":\"%s\",\"active\":true}",
+                    "\"age_ms\":%lld,\"type\":\"%s\",\"active\":true",
                     ac.ip.c_str(), ac.method.c_str(), ac.path.c_str(),
                     (long long)(now - ac.started_ms), ac.type.c_str());
                 json += buf; first = false;
+                if(ac.tunnel) {
+                    snprintf(buf,sizeof(buf),",\"tunnel\":{\"bytes_up\":%llu,\"bytes_down\":%llu}",
+                        (unsigned long long)ac.tunnel->up.load(std::memory_order_relaxed),
+                        (unsigned long long)ac.tunnel->down.load(std::memory_order_relaxed));
+                    json += buf;
+                }
+                json += "}";
             }
         }
         // Add recent completed requests (newest first, up to 100, max 5 min old)
@@ -1363,7 +3001,7 @@ static void dispatch(Conn* conn) {
         for(auto& up : cfg.upstreams) {
             for(auto& srv2 : up.servers) {
                 if(!first) json+=",";
-                json += "{\"name\":\""+up.name+"\",\"address\":\""+srv2.host+":"+std::to_string(srv2.port)+"\",\"enabled\":true,\"source\":\"config\"}";
+                json += "{\"name\":\""+up.name+"\",\"address\":\""+srv2.host+":"+std::to_string(srv2.port)+"\",\"enabled\":true,\"source\":\"config\",\"proto\":\""+std::string(up.proto==UpstreamProto::H2?"h2":"http/1.1")+"\"}";
                 first=false;
             }
         }
@@ -1375,7 +3013,10 @@ static void dispatch(Conn* conn) {
                 first=false;
             }
         }
-        json += "]}";
+        json += "],\"h2\":{\"connections\":"+std::to_string(g_h2up_links.load())+
+                ",\"streams\":"+std::to_string(g_h2up_streams.load())+
+                ",\"goaway\":"+std::to_string(g_h2up_goaway.load())+
+                ",\"retried\":"+std::to_string(g_h2up_retried.load())+"}}";
         Response r; r.status=200;
         r.headers.set("Content-Type","application/json");
         r.headers.set("Content-Length",std::to_string(json.size()));
@@ -1656,14 +3297,15 @@ static void dispatch(Conn* conn) {
         char fbuf[512]; if(g_config){
         snprintf(fbuf,sizeof(fbuf),
             "{\"cache\":%s,\"ratelimit\":%s,\"lua\":%s,\"js\":%s,"
-            "\"gzip\":%s,\"acme\":%s,\"healthcheck\":%s}",
+            "\"gzip\":%s,\"acme\":%s,\"healthcheck\":%s,\"janet\":%s}",
             g_config->module_cache?"true":"false",
             g_config->module_ratelimit?"true":"false",
             g_config->module_lua?"true":"false",
             g_config->module_js?"true":"false",
             g_config->module_gzip?"true":"false",
             g_config->module_acme?"true":"false",
-            g_config->module_lb_healthcheck?"true":"false");
+            g_config->module_lb_healthcheck?"true":"false",
+            opt::janet_stats_json().c_str());   // waf-check: per-call latency
         } else { snprintf(fbuf,sizeof(fbuf),"{}"); }
         std::string fj=fbuf;
         Response fr; fr.status=200;
@@ -1678,7 +3320,7 @@ static void dispatch(Conn* conn) {
         std::string json = "{\"workers\":[";
         for(int i = 0; i < nw && i < 64; i++) {
             if(i) json += ",";
-            char buf[256];
+            char buf[512];
             bool has_lua = false, has_qjs = false;
 #if defined(HAVE_LUA)
             has_lua = true;
@@ -1687,12 +3329,22 @@ static void dispatch(Conn* conn) {
             has_qjs = true;
 #endif
             snprintf(buf, sizeof(buf),
-                "{\"id\":%d,\"req\":%llu,\"err\":%llu,\"cache_hit\":%llu,"
+                "{\"id\":%d,\"req\":%llu,\"err\":%llu,\"cache_hit\":%llu,\"conns\":%llu,"
+                "\"loop_lag_us\":%lld,\"loop_lag_max_us\":%lld,\"loop_busy_pct\":%.1f,"
+                "\"handles\":%u,\"uv_reqs\":%u,\"tp_queued\":%d,\"stalls\":%llu,"
                 "\"lua\":%s,\"quickjs\":%s,\"tls\":%s}",
                 i,
                 (unsigned long long)g_wstats[i].req.load(),
                 (unsigned long long)g_wstats[i].err.load(),
                 (unsigned long long)g_wstats[i].cache_hit.load(),
+                (unsigned long long)g_wstats[i].active_conns.load(),
+                (long long)g_wstats[i].loop_lag_us.load(),
+                (long long)g_wstats[i].loop_lag_max_us.load(),
+                g_wstats[i].loop_busy_pm.load() / 10.0,
+                g_wstats[i].loop_handles.load(),
+                g_wstats[i].loop_reqs.load(),
+                std::max(0, g_wstats[i].tp_queued.load()),
+                (unsigned long long)g_wstats[i].loop_stalls.load(),
                 has_lua  ? "true" : "false",
                 has_qjs  ? "true" : "false",
                 (w->ssl_ctx != nullptr) ? "true" : "false");
@@ -1707,6 +3359,62 @@ static void dispatch(Conn* conn) {
         write_response(conn, r.serialize_h1()); return;
     }
 
+    // ── /np_memory — live bytes / objects per subsystem and per worker ──────
+    if(rpath == "/np_memory") {
+        ProcMem pm = ProcMem::read();
+        char buf[512];
+        snprintf(buf, sizeof(buf),
+            "{\"process\":{\"rss\":%llu,\"rss_peak\":%llu,\"rss_anon\":%llu,\"rss_file\":%llu,\"vsize\":%llu},",
+            (unsigned long long)pm.rss, (unsigned long long)pm.rss_peak, (unsigned long long)pm.rss_anon,
+            (unsigned long long)pm.rss_file, (unsigned long long)pm.vsize);
+        std::string json = buf;
+        if(pm.have_mallinfo) {
+            snprintf(buf, sizeof(buf),
+                "\"allocator\":{\"arena\":%llu,\"mmap\":%llu,\"in_use\":%llu,\"free\":%llu,\"releasable\":%llu},",
+                (unsigned long long)pm.heap_arena, (unsigned long long)pm.heap_mmap,
+                (unsigned long long)pm.heap_used, (unsigned long long)pm.heap_free,
+                (unsigned long long)pm.heap_top);
+            json += buf;
+        } else json += "\"allocator\":null,";
+        json += "\"components\":[";
+        MemUsage total;
+        bool first = true;
+        g_memory.each([&](const char* name, const char* desc, const MemUsage& u) {
+            snprintf(buf, sizeof(buf), "%s{\"name\":\"%s\",\"bytes\":%llu,\"objects\":%llu,\"desc\":\"%s\"}",
+                     first ? "" : ",", name, (unsigned long long)u.bytes, (unsigned long long)u.objects, desc);
+            json += buf;
+            first = false;
+            total += u;
+        });
+        // heap the allocator handed out that no component accounts for
+        uint64_t heap = pm.heap_used + pm.heap_mmap;
+        snprintf(buf, sizeof(buf), "],\"accounted\":{\"bytes\":%llu,\"objects\":%llu},\"unaccounted_heap\":%lld,\"workers\":[",
+                 (unsigned long long)total.bytes, (unsigned long long)total.objects,
+                 pm.have_mallinfo ? (long long)heap - (long long)total.bytes : -1LL);
+        json += buf;
+        for(int i = 0; i < g_wstats_count && i < 64; i++) {
+            auto& ws = g_wstats[i];
+            uint64_t nc = (uint64_t)std::max<int64_t>(0, ws.conn_objs.load());
+            snprintf(buf, sizeof(buf),
+                "%s{\"id\":%d,\"conns\":{\"bytes\":%llu,\"objects\":%llu},"
+                "\"response_cache\":{\"bytes\":%llu,\"objects\":%llu,\"payload\":%llu},"
+                "\"ratelimit\":{\"bytes\":%llu,\"objects\":%llu}}",
+                i ? "," : "", i,
+                (unsigned long long)(nc * sizeof(Conn)), (unsigned long long)nc,
+                (unsigned long long)ws.cache_mem.load(), (unsigned long long)ws.cache_entries.load(),
+                (unsigned long long)ws.cache_bytes.load(),
+                (unsigned long long)ws.rl_mem.load(), (unsigned long long)ws.rl_entries.load());
+            json += buf;
+        }
+        json += "]}";
+        Response r; r.status=200;
+        r.headers.set("Content-Type","application/json");
+        r.headers.set("Content-Length",std::to_string(json.size()));
+        r.headers.set("Cache-Control","no-store");
+        r.body=std::move(json);
+        write_response(conn, r.serialize_h1()); return;
+    }
+
     // ── DELETE /np_cache — flush all cache entries ──────────────────────────
     if(rpath == "/np_cache_flush" || (rpath == "/np_cache" && conn->req.method == Method::DELETE)) {
         // Flush this worker's cache
@@ -1800,6 +3508,16 @@ static void dispatch(Conn* conn) {
                 if(count < 1)    count = 1;
             }
         }
+        // ?series=1 — latency histograms per location / upstream backend
+        // (cumulative percentiles + last `count` seconds, max 300)
+        if(conn->req.query.find("series=1") != std::string::npos) {
+            std::string out = g_latency.json(count);
+            Response r; r.status=200;
+            r.headers.set("Content-Type","application/json");
+            r.headers.set("Content-Length",std::to_string(out.size()));
+            r.headers.set("Cache-Control","no-cache");
+            r.body=std::move(out); write_response(conn,r.serialize_h1()); return;
+        }
         std::string out="[";
         std::lock_guard lk(g_stats_hist_mu);
         size_t skip = g_stats_hist.size() > count ? g_stats_hist.size()-count : 0;
@@ -1808,12 +3526,17 @@ static void dispatch(Conn* conn) {
             auto& s=g_stats_hist[i];
             if(!first) out+=",";
             first=false;
-            char buf[160];
+            char buf[320];
             snprintf(buf,sizeof(buf),
-                "{\"ts\":%lld,\"rps\":%llu,\"eps\":%llu,\"cache\":%llu,\"conns\":%u,\"lat\":%u}",
+                "{\"ts\":%lld,\"rps\":%llu,\"eps\":%llu,\"cache\":%llu,\"conns\":%u,\"lat\":%u,"
+                "\"p50_us\":%llu,\"p90_us\":%llu,\"p99_us\":%llu,\"p999_us\":%llu,"
+                "\"loop_lag_us\":%u,\"loop_busy_pct\":%.1f,\"tp_queued\":%u}",
                 (long long)s.ts,(unsigned long long)s.req_per_sec,
                 (unsigned long long)s.err_per_sec,(unsigned long long)s.cache_hits,
-                (unsigned)s.active_conns,(unsigned)s.latency_avg_ms);
+                (unsigned)s.active_conns,(unsigned)s.latency_avg_ms,
+                (unsigned long long)s.p50_us,(unsigned long long)s.p90_us,
+                (unsigned long long)s.p99_us,(unsigned long long)s.p999_us,
+                (unsigned)s.loop_lag_us,s.loop_busy_pm/10.0,(unsigned)s.tp_queued);
             out+=buf;
         }
         out+="]";
@@ -1849,6 +3572,82 @@ static void dispatch(Conn* conn) {
         r.body=out; write_response(conn,r.serialize_h1()); return;
     }
 
+    // ── /np_slow — requests over slow_request_ms with phase breakdown ─────────
+    // GET ?limit=N (newest first, default 50), DELETE clears the ring
+    if(rpath == "/np_slow") {
+        if(conn->req.method == Method::DELETE) {
+            g_slow.clear();
+            audit(conn->client_ip, "slow_clear", "");
+        }
+        size_t limit = 50;
+        auto p = conn->req.query.find("limit=");
+        if(p != std::string::npos)
+            try { limit = std::min<size_t>(std::stoul(conn->req.query.substr(p+6)), SlowLog::CAP); } catch(const std::exception&) {}
+        std::string out = g_slow.json(limit);
+        Response r; r.status=200;
+        r.headers.set("Content-Type","application/json");
+        r.headers.set("Content-Length",std::to_string(out.size()));
+        r.headers.set("Cache-Control","no-cache");
+        r.body=std::move(out); write_response(conn,r.serialize_h1()); return;
+    }
+
+    // ── /np_profile — CPU sampling profile of all threads, collapsed stacks ──
+    // GET ?seconds=N (1..60, default 10) &hz=H (1..1000, default 99);
+    // feed the body to flamegraph.pl / inferno-flamegraph / speedscope
+    if(rpath == "/np_profile") {
+        int seconds = 10, hz = 99;
+        auto qnum = [&](const char* key, int& out) {
+            auto p = conn->req.query.find(key);
+            if(p != std::string::npos)
+                try { out = std::stoi(conn->req.query.substr(p + strlen(key))); } catch(const std::exception&) {}
+        };
+        qnum("seconds=", seconds);
+        qnum("hz=", hz);
+        seconds = std::clamp(seconds, 1, 60);
+        hz      = std::clamp(hz, 1, 1000);
+        std::string err;
+        if(!g_profiler.start(hz, seconds, err)) {
+            write_response(conn, Response::make_json_error(409, err).serialize_h1()); return;
+        }
+        audit(conn->client_ip, "profile", std::to_string(seconds) + "s @" + std::to_string(hz) + "Hz");
+        auto* job = new ProfileJob();
+        job->conn = conn;
+        conn->pending_io++;
+        uv_timer_init(w->loop, &job->timer);
+        job->timer.data = job;
+        job->work.data  = job;
+        uv_timer_start(&job->timer, [](uv_timer_t* t) {
+            auto* j = static_cast<ProfileJob*>(t->data);
+            g_profiler.stop();
+            tp_submitted(static_cast<Worker*>(t->loop->data)->id, +1);
+            uv_queue_work(t->loop, &j->work,
+                [](uv_work_t* req) {
+                    auto* pj = static_cast<ProfileJob*>(req->data);
+                    pj->res = g_profiler.collapse();
+                },
+                [](uv_work_t* req, int) {
+                    auto* pj = static_cast<ProfileJob*>(req->data);
+                    tp_submitted(static_cast<Worker*>(req->loop->data)->id, -1);
+                    Conn* c = pj->conn;
+                    if(conn_io_done(c)) {
+                        Response r; r.status = 200;
+                        r.headers.set("Content-Type",     "text/plain; charset=utf-8");
+                        r.headers.set("Content-Length",   std::to_string(pj->res.collapsed.size()));
+                        r.headers.set("Cache-Control",    "no-store");
+                        r.headers.set("X-Profile-Samples", std::to_string(pj->res.samples));
+                        r.headers.set("X-Profile-Dropped", std::to_string(pj->res.dropped));
+                        r.headers.set("X-Profile-Threads", std::to_string(pj->res.threads));
+                        r.body = std::move(pj->res.collapsed);
+                        write_response(c, r.serialize_h1());
+                    }
+                    uv_close((uv_handle_t*)&pj->timer, [](uv_handle_t* h) {
+                        delete static_cast<ProfileJob*>(h->data);
+                    });
+                });
+        }, (uint64_t)seconds * 1000, 0);
+        return;
+    }
+
     // ── /np_acme_diag — port 80 reachability check ────────────────────────────
     if(rpath == "/np_acme_diag") {
         // Tries to connect to external IP:80 to verify port is open
@@ -1916,6 +3715,7 @@ static void dispatch(Conn* conn) {
             int en = fb("enabled");   if(en>=0) g_waf_regex.cfg.enabled=en;
             int bm = fb("block_mode"); if(bm>=0) g_waf_regex.cfg.block_mode=bm;
             int cb = fb("check_body"); if(cb>=0) g_waf_regex.cfg.check_body=cb;
+            if(en>=0 || bm>=0 || cb>=0) g_waf_regex.config_changed();   // drop cached verdicts
             int cl = fb("clear");
             if(cl==1){ g_waf_regex.clear_events(); audit(conn->client_ip,"waf_regex_clear",""); }
         }
@@ -2010,12 +3810,19 @@ static void dispatch(Conn* conn) {
         r.body=j; write_response(conn,r.serialize_h1()); return;
     }
 
-    // /np_logs/stream — disabled (SSE causes connection slot starvation on HTTP/1.1)
-    // Use /np_logs?since=<ts>&limit=50 polling instead
-    if(rpath == "/np_logs/stream") {
-        Response r; r.status=204;
-        r.headers.set("Content-Length","0");
-        write_response(conn, r.serialize_h1()); return;
+    // /np_logs/stream, /np_stats/stream — Server-Sent Events (one stream
+    // instead of polling /np_logs + /np_stats). ?level= filters log events.
+    // On HTTP/2 the stream itself stays open (H2Handler::submit_stream).
+    if(rpath == "/np_logs/stream" || rpath == "/np_stats/stream") {
+        if(conn->is_h2_stream && (!conn->h2_parent || conn->h2_parent->closing ||
+                                  !conn->h2_parent->h2)) {
+            close_conn(conn); return;
+        }
+        int min_lv = 1;
+        auto lp = conn->req.query.find("level=");
+        if(lp != std::string::npos) min_lv = atoi(conn->req.query.c_str() + lp + 6);
+        sse_subscribe(conn, rpath == "/np_logs/stream" ? SSE_LOG : SSE_STATS, min_lv);
+        return;
     }
 
     // ── /np_db — SQLite database info, backup, vacuum ───────────────────────────
@@ -2128,11 +3935,19 @@ static void dispatch(Conn* conn) {
         }
     }
 
+    // ── Normalizacja raz na request (bufor workera) — AutoBan, regex WAF
+    //    i sprawdzenie 404 czytają z niej widoki, bez kopii ──────────────────
+    conn->tm.lap(PH_APP);
+    const WafInput& win = w->waf_norm.run(conn->req.path, conn->req.query, conn->req.body,
+                                          conn->req.headers.get("User-Agent"),
+                                          g_waf_regex.input_parts());
+
     // ── AutoBan pre-request check (ZAWSZE przed WAF — zlicza scan_hits) ───────
     {
-        auto ua  = std::string(conn->req.headers.get("User-Agent"));
-        auto verdict = g_autoban.check(conn->client_ip, conn->req.path, ua, 0);
+        auto verdict = g_autoban.check(conn->client_ip, win, 0);
+        conn->tm.lap(PH_AUTOBAN);
         if(verdict == AutoBan::Verdict::Ban) {
+            NW_PROBE2(autoban__ban, conn, conn->client_ip.c_str());
             {
                 std::lock_guard<std::mutex> lk(g_blacklist_mu);
                 g_blacklist.insert(conn->client_ip);
@@ -2144,21 +3959,22 @@ static void dispatch(Conn* conn) {
     }
 
     // ── Built-in regex WAF check (PRZED match_location — blokuje też 404-bound scans) ──
-    if(g_waf_regex.cfg.enabled && g_waf_regex.compiled){
+    //    Body: dokończenie skanu zaczętego w on_read / h2 (albo cały naraz);
+    //    request ucięty po trafieniu (body_waf.cut) nie idzie dalej nigdy
+    if((g_waf_regex.cfg.enabled && g_waf_regex.compiled) || conn->body_waf.cut){
         std::string waf_cat, waf_detail;
-        std::string raw_hdrs;
-        for(auto& h : conn->req.headers.items)
-            raw_hdrs += std::string(h.first) + ": " + std::string(h.second) + "\r\n";
+        g_waf_regex.body_end(conn->body_waf, conn->req.body);
         bool allowed = g_waf_regex.check(
             conn->client_ip,
-            std::string(method_str(conn->req.method)),
-            conn->req.path,
-            conn->req.query,
-            conn->req.body,
-            raw_hdrs,
-            &waf_cat, &waf_detail
+            method_str(conn->req.method),
+            win,
+            &waf_cat, &waf_detail,
+            &w->waf_vcache,
+            &conn->body_waf
         );
-        if(!allowed){
+        conn->tm.lap(PH_WAF);
+        if(!allowed || conn->body_waf.cut){
+            NW_PROBE4(waf__block, conn, conn->client_ip.c_str(), "regex", waf_cat.c_str());
             auto r = Response::make_json_error(403,
                 "Blocked by WAF: " + waf_cat + " — " + waf_detail);
             write_response(conn, r.serialize_h1()); return;
@@ -2184,7 +4000,9 @@ static void dispatch(Conn* conn) {
             conn->req.body,
             &waf_status, &waf_rule
         );
+        conn->tm.lap(PH_WAF);
         if(!allowed){
+            NW_PROBE4(waf__block, conn, conn->client_ip.c_str(), "modsec", waf_rule.c_str());
             std::string msg = "WAF: blocked by rule " + waf_rule;
             auto r = Response::make_json_error(waf_status, msg);
             write_response(conn, r.serialize_h1()); return;
@@ -2192,14 +4010,28 @@ static void dispatch(Conn* conn) {
     }
 #endif
 
+    // ── Janet WAF hook — (waf-check ip uri method ua), VM tego workera ────────
+    janet_waf_sync(w);   // po reloadzie: skrypt z nowego configu
+    if(w->janet.ready()){
+        int jv = w->janet.eval_request(conn->client_ip, conn->req.path, conn->req.query,
+                                       method_str(conn->req.method),
+                                       conn->req.headers.get("User-Agent"));
+        conn->tm.lap(PH_WAF);
+        if(jv){
+            NW_PROBE4(waf__block, conn, conn->client_ip.c_str(), "janet", "waf-check");
+            auto r = Response::make_json_error(403, "Blocked by Janet WAF rule");
+            write_response(conn, r.serialize_h1()); return;
+        }
+    }
+
     // ── match_location (po WAF — skanery na nieistniejące ścieżki też blokowane) ──
     const LocationConfig* loc = cfg.match_location(srv, conn->req.path);
+    if(loc) conn->lat_loc = location_series(w, loc);
     if(!loc) {
         bool api = conn->req.path.substr(0,4) == "/api";
         auto r = api ? Response::make_json_error(404,"Not found: "+conn->req.path)
                      : Response::make_error(404);
-        g_autoban.check(conn->client_ip, conn->req.path,
-            std::string(conn->req.headers.get("User-Agent")), 404);
+        g_autoban.check(conn->client_ip, win, 404);
         write_response(conn, r.serialize_h1()); return;
     }
 
@@ -2210,7 +4042,10 @@ static void dispatch(Conn* conn) {
         std::string rl_key = conn->client_ip;
         if(!loc->prefix.empty() && loc->prefix != "/") rl_key += "|" + loc->prefix;
         int64_t retry_after = 0;
-        if(w->rl->check(rl_key, &retry_after)) {
+        bool limited = w->rl->check(rl_key, &retry_after);
+        conn->tm.lap(PH_RATELIMIT);
+        if(limited) {
+            NW_PROBE3(ratelimit__reject, conn, conn->client_ip.c_str(), loc->prefix.c_str());
             bool api2 = conn->req.path.substr(0,4) == "/api";
             auto r = api2 ? Response::make_json_error(429,"Rate limit exceeded")
                           : Response::make_error(429,"Rate limit exceeded");
@@ -2227,6 +4062,7 @@ static void dispatch(Conn* conn) {
     // ── Middleware — request phase ────────────────────────────────────────────
     if(w->mw && !loc->middlewares.empty() && (w->config->module_lua || w->config->module_js)) {
         auto blocked = w->mw->run_request(loc->middlewares, conn->req);
+        conn->tm.lap(PH_LUA);
         if(blocked) { write_response(conn, blocked->serialize_h1()); return; }
     }
 
@@ -2240,6 +4076,7 @@ static void dispatch(Conn* conn) {
             auto key = ResponseCache::make_key(conn->req);
             if(auto* e = w->cache->get(key)) {
                 if(w->cache->check_conditional(*e, conn->req)) {
+                    NW_PROBE3(cache__hit, conn, conn->req.path.c_str(), 1);
                     Response r; r.status = 304;
                     if(!e->etag.empty()) r.headers.set("ETag", e->etag);
                     write_response(conn, r.serialize_h1());
@@ -2248,14 +4085,17 @@ static void dispatch(Conn* conn) {
                     if(w->id<64) g_wstats[w->id].cache_hit.fetch_add(1,std::memory_order_relaxed);
                     return;
                 }
+                NW_PROBE3(cache__hit, conn, conn->req.path.c_str(), 0);
                 write_response(conn, e->serialized);
                 w->stat_cache_hit++;
                 g_stat_cache_hit.fetch_add(1, std::memory_order_relaxed);
                 if(w->id<64) g_wstats[w->id].cache_hit.fetch_add(1,std::memory_order_relaxed);
                 return;
             }
+            NW_PROBE2(cache__miss, conn, conn->req.path.c_str());
         }
 
+        NW_PROBE2(request__static, conn, conn->req.path.c_str());
         StaticConfig scfg;
         scfg.root = loc->root; scfg.gzip = loc->gzip && w->config->module_gzip; scfg.etag = loc->etag;
         scfg.cache_max_age = loc->cache_max_age; scfg.autoindex = loc->autoindex;
@@ -2296,6 +4136,7 @@ static void dispatch(Conn* conn) {
         auto key = ResponseCache::make_key(conn->req);
         if(auto* e = w->cache->get(key)) {
             if(w->cache->check_conditional(*e, conn->req)) {
+                NW_PROBE3(cache__hit, conn, conn->req.path.c_str(), 1);
                 Response r; r.status = 304;
                 if(!e->etag.empty()) r.headers.set("ETag", e->etag);
                 write_response(conn, r.serialize_h1());
@@ -2304,6 +4145,7 @@ static void dispatch(Conn* conn) {
                 if(w->id<64)g_wstats[w->id].cache_hit.fetch_add(1,std::memory_order_relaxed);
                 return;
             }
+            NW_PROBE3(cache__hit, conn, conn->req.path.c_str(), 0);
             write_response(conn, e->serialized);
             w->stat_cache_hit++;
             g_stat_cache_hit.fetch_add(1, std::memory_order_relaxed);
@@ -2311,6 +4153,7 @@ static void dispatch(Conn* conn) {
             return;
         }
         // miss already counted in cache->get()
+        NW_PROBE2(cache__miss, conn, conn->req.path.c_str());
     }
 
     // ── Proxy ─────────────────────────────────────────────────────────────────
@@ -2321,22 +4164,21 @@ static void dispatch(Conn* conn) {
     if(!up) {
         { NW_WARN("proxy", "All upstreams down for %.*s", (int)conn->req.path.size(), conn->req.path.data()); bool a=conn->req.path.substr(0,4)=="/api"; write_response(conn,(a?Response::make_json_error(502,"All upstreams down"):Response::make_error(502,"All upstreams down")).serialize_h1()); w->stat_err++; return; }
     }
-    PoolConn* upc = up->acquire();
-    if(!upc) {
-        { bool a=conn->req.path.substr(0,4)=="/api"; write_response(conn,(a?Response::make_json_error(502,"Pool exhausted"):Response::make_error(502,"Pool exhausted")).serialize_h1()); return; }
-    }
-
-    conn->is_ws = loc->websocket && conn->req.is_websocket;
+    NW_PROBE4(request__proxy, conn, up->cfg.host.c_str(), up->cfg.port, conn->req.path.c_str());
+    conn->is_ws = loc->websocket && conn->req.is_websocket && !conn->is_h2_stream;
+    bool use_h2 = w->upstream->config().proto == UpstreamProto::H2 && !conn->is_ws;
 
     // Proxy headers
     conn->req.headers.set("X-Forwarded-For",  conn->client_ip);
     conn->req.headers.set("X-Real-IP",         conn->client_ip);
     conn->req.headers.set("X-Forwarded-Proto", conn->req.scheme);
     conn->req.headers.remove("Connection");
-    conn->req.headers.set("Connection", conn->is_ws ? "Upgrade" : "close");
+    if(!use_h2) conn->req.headers.set("Connection", conn->is_ws ? "Upgrade" : "close");
     for(auto&[k,v] : loc->add_headers)  conn->req.headers.set(k,v);
     for(auto& h    : loc->hide_headers) conn->req.headers.remove(h);
 
+    if(use_h2) { proxy_h2(conn, up, *loc); return; }
+
     // Serialise forwarded request
     std::string fwd;
     fwd.reserve(1024 + conn->req.body.size());
@@ -2348,6 +4190,18 @@ static void dispatch(Conn* conn) {
     fwd += "\r\n";
     if(!conn->req.body.empty()) fwd += conn->req.body;
 
+    if(conn->is_ws) { tunnel_open(conn, up, *loc, std::move(fwd)); return; }
+
+    conn->tm.lap(PH_APP);
+    PoolConn* upc = up->acquire();
+    conn->tm.lap(PH_CONNECT);
+    NW_PROBE4(upstream__acquire, conn, up->cfg.host.c_str(), up->cfg.port, upc ? upc->connect_us : (int64_t)-2);
+    int64_t t_send = now_us();
+    if(upc && upc->connect_us >= 0) up->lat_connect->record(w->id, upc->connect_us);
+    if(!upc) {
+        { bool a=conn->req.path.substr(0,4)=="/api"; write_response(conn,(a?Response::make_json_error(502,"Pool exhausted"):Response::make_error(502,"Pool exhausted")).serialize_h1()); return; }
+    }
+
     // Set blocking before send+recv
     { int fl = fcntl(upc->fd, F_GETFL, 0); fcntl(upc->fd, F_SETFL, fl & ~O_NONBLOCK); }
 
@@ -2368,24 +4222,38 @@ static void dispatch(Conn* conn) {
     job->up_fd     = upc->fd;
     job->pool      = up;
     job->pool_conn = upc;
+    job->wid       = w->id;
+    job->start_us  = t_send;
     job->buf.reserve(65536);
+    conn->pending_io++;
 
+    tp_submitted(w->id, +1);
     uv_queue_work(w->loop, &job->work,
         [](uv_work_t* req) {
             auto* j = static_cast<ProxyJob*>(req->data);
             char tmp[32768];
             ssize_t n;
-            while((n = ::read(j->up_fd, tmp, sizeof(tmp))) > 0)
+            while((n = ::read(j->up_fd, tmp, sizeof(tmp))) > 0) {
+                if(j->buf.empty()) j->first_byte_us = now_us();
                 j->buf.append(tmp, (size_t)n);
+            }
             j->ok = !j->buf.empty();
         },
         [](uv_work_t* req, int) {
             auto* j = static_cast<ProxyJob*>(req->data);
             Conn* c = j->conn;
+            tp_submitted(j->wid, -1);
 
             j->pool->release(j->pool_conn, j->ok);
+            if(j->ok) {
+                j->pool->lat_ttfb->record(j->wid, j->first_byte_us - j->start_us);
+                j->pool->lat_total->record(j->wid, now_us() - j->start_us);
+            }
+            if(!conn_io_done(c)) { delete j; return; }
             c->upstream_conn = nullptr;
             c->upstream_pool = nullptr;
+            if(j->ok) c->tm.add(PH_TTFB, j->first_byte_us - j->start_us);
+            c->tm.lap(PH_UPSTREAM);
 
             if(!j->ok) {
                 delete j;
@@ -2396,37 +4264,7 @@ static void dispatch(Conn* conn) {
             Response resp;
             parse_response(j->buf.data(), j->buf.size(), resp);
             delete j;
-
-            resp.headers.remove("Connection");
-            resp.headers.remove("Transfer-Encoding");
-            resp.headers.set("Connection", c->req.keep_alive ? "keep-alive" : "close");
-            resp.headers.set("X-Proxy", "nas-web/" + std::string(NP_VERSION));
-            // X-Request-ID for tracing
-            static std::atomic<uint64_t> req_id{1};
-            char rid[32]; snprintf(rid, sizeof(rid), "%016llx", (unsigned long long)req_id.fetch_add(1));
-            resp.headers.set("X-Request-ID", rid);
-
-            Worker* w2 = c->worker;
-            if(w2 && w2->config && !w2->config->servers.empty()) {
-                const auto& srv2 = w2->config->servers[0];
-                auto* loc2 = w2->config->match_location(srv2, c->req.path);
-                if(loc2 && w2->mw && !loc2->middlewares.empty())
-                    w2->mw->run_response(loc2->middlewares, c->req, resp);
-                for(auto& l : srv2.listens)
-                    if(l.http3) { H3Handler::inject_alt_svc(resp, l.port); break; }
-                if(w2->cache && c->req.method == Method::GET) {
-                    auto key  = ResponseCache::make_key(c->req);
-                    auto* lc3 = w2->config->match_location(srv2, c->req.path);
-                    bool do_cache = !lc3 || lc3->cache_max_age != -1;
-                    if(do_cache && w2->config->module_cache) {
-                        int ttl = lc3 && lc3->cache_max_age > 0 ? lc3->cache_max_age : 0;
-                        w2->cache->put(key, resp, c->req, ttl);
-                    }
-                }
-            }
-            update_conn_status(c, resp.status, "proxy");
-            write_response(c, resp.serialize_h1());
-            if(w2){ w2->stat_req++; g_stat_req.fetch_add(1,std::memory_order_relaxed); if(w2->id<64)g_wstats[w2->id].req.fetch_add(1,std::memory_order_relaxed); }
+            proxy_reply(c, std::move(resp));
         }
     );
 }
@@ -2457,26 +4295,80 @@ static void on_read(uv_stream_t* s, ssize_t nread, const uv_buf_t*) {
             close_conn(conn); return;
         }
         if(!conn->tls_handshake_done) return; // still handshaking
+        if(!conn->h2_checked && !conn->tunnel) h2_start(conn);
         // tls_on_raw_data filled conn->rbuf[0..rbuf_len] with decrypted data
     } else {
         conn->rbuf_len += (size_t)nread;
     }
 
+    // Established tunnel without splice (TLS client): relay what arrived
+    if(conn->tunnel) {
+        size_t n = conn->rbuf_len;
+        conn->rbuf_len = 0;
+        tunnel_from_client(conn->tunnel, conn->rbuf, n);
+        return;
+    }
+
+    if(!conn->ssl) {
+        // Cleartext listener with http2: look for the h2c preface first
+        if(conn->h2c && !conn->h2_checked && !conn->h2 && !conn->req_parsed)
+            if(!h2c_check_preface(conn)) return;
+    }
+
+    if(conn->h2) {
+        if(!h2_feed(conn)) close_conn(conn);
+        return;
+    }
+
+    // SSE stream: nothing to read from the client, only EOF matters
+    if(conn->is_sse) { conn->rbuf_len = 0; return; }
+
     if(conn->req_parsed) return;
 
     Request req;
+    req.headers.reset(&conn->arena);   // same resource as conn->req → the move below keeps the buffers
+    int64_t t_parse = now_us();
+    if(!conn->rx_start_us) conn->rx_start_us = t_parse;
     auto [result, consumed] = parse_request(conn->rbuf, conn->rbuf_len, req);
-    if(result == ParseResult::Incomplete) return;
-    if(result != ParseResult::Complete) {
+    conn->rx_parse_us += now_us() - t_parse;
+    auto start_request = [&]{
+        conn->req = std::move(req);
+        conn->req.client_ip = conn->client_ip;
+        conn->req.scheme    = conn->ssl ? "https" : "http";
+        conn->req_parsed    = true;
+        NW_PROBE4(request__parsed, conn, method_str(conn->req.method).data(), conn->req.path.c_str(), conn->rx_parse_us);
+        uv_read_stop(s);
+        dispatch(conn);
+    };
+    if(result == ParseResult::Incomplete) {
+        // Body still arriving (consumed = where it starts): the regex WAF
+        // reads it now. A match ends the request — dispatched straight to its
+        // 403 with the body so far; the rest is never read nor forwarded
+        std::string_view part(conn->rbuf + consumed, conn->rbuf_len - consumed);
+        if(consumed && waf_body_chunk(conn->body_waf, req, part)) {
+            req.body.assign(part);
+            req.keep_alive = false;
+            start_request();
+            return;
+        }
+        // re-parsed from scratch on the next read — don't let retries pile up
+        req.headers.reset(&conn->arena);
+        conn->arena.release();
+        return;
+    }
+    else if(result != ParseResult::Complete) {
         write_response(conn, Response::make_error(result==ParseResult::TooLarge?413:400).serialize_h1());
         return;
     }
-    conn->req = std::move(req);
-    conn->req.client_ip = conn->client_ip;
-    conn->req.scheme    = conn->ssl ? "https" : "http";
-    conn->req_parsed    = true;
-    uv_read_stop(s);
-    dispatch(conn);
+    if(!conn->ssl && conn->h2c && !conn->h2) {
+        req.client_ip = conn->client_ip;
+        if(h2c_try_upgrade(conn, req, consumed)) {
+            if(conn->rbuf_len && !conn->closing && !h2_feed(conn)) close_conn(conn);
+            return;
+        }
+    }
+    conn->req_consumed = consumed;
+    start_request();
 }
 
 // ── on_connection ─────────────────────────────────────────────────────────────
@@ -2485,9 +4377,9 @@ static void on_connection(uv_stream_t* server, int status) {
     Worker* w = static_cast<Worker*>(server->loop->data);
     // Determine if this connection arrived on the TLS handle
     bool is_tls = (server == (uv_stream_t*)&w->tls_h) && (w->ssl_ctx != nullptr);
+    bool h2c    = (server == (uv_stream_t*)&w->server_h) && w->server_h2c;
 
-    auto* conn   = new Conn();
-    conn->worker = w;
+    auto* conn   = new Conn(w);
     uv_tcp_init(server->loop, &conn->client);
     conn->client.data = conn;
 
@@ -2504,6 +4396,8 @@ static void on_connection(uv_stream_t* server, int status) {
     else
         inet_ntop(AF_INET6, &reinterpret_cast<sockaddr_in6*>(&addr)->sin6_addr, ip, sizeof(ip));
     conn->client_ip = ip;
+    NW_PROBE4(conn__accept, conn, w->id, ip, (int)is_tls);
+    conn->h2c = h2c;
 
     uv_tcp_nodelay(&conn->client, 1);
     uv_tcp_keepalive(&conn->client, 1, 60);
@@ -2533,7 +4427,7 @@ static void on_connection(uv_stream_t* server, int status) {
     }
     {
         std::lock_guard<std::mutex> lk(g_active_mu);
-        g_active[conn] = {conn->client_ip, "?", "/", 0, now_ms(), "pending"};
+        g_active[conn] = {conn->client_ip, "?", "/", 0, now_ms(), "pending", nullptr};
     }
     // Start idle timeout — close connection if no request arrives within keepalive_timeout
     {
@@ -2578,8 +4472,16 @@ static int make_server_socket(uint16_t port) {
 
 // ── run_worker (called in new thread) ────────────────────────────────────────
 static void run_worker(Worker* w, int wfd, std::atomic<int>& ready) {
+    {
+        char tn[16];
+        snprintf(tn, sizeof(tn), "nw-worker-%d", w->id);
+        pthread_setname_np(pthread_self(), tn);   // /np_profile, top -H
+    }
     w->loop = uv_loop_new();
     w->loop->data = w;
+#if NW_UV_IDLE_METRICS
+    uv_loop_configure(w->loop, UV_METRICS_IDLE_TIME);   // busy share in /np_workers
+#endif
 
     uv_tcp_init(w->loop, &w->server_h);
     uv_tcp_open(&w->server_h, wfd);
@@ -2595,8 +4497,108 @@ static void run_worker(Worker* w, int wfd, std::atomic<int>& ready) {
         NW_DEBUG("tls", "Worker %d: TLS handle listening", w->id);
     }
 
+    // Free finished HTTP/2 stream Conns once per loop iteration
+    uv_check_init(w->loop, &w->reap_h);
+    w->reap_h.data = w;
+    uv_check_start(&w->reap_h, [](uv_check_t* h){
+        Worker* wk = static_cast<Worker*>(h->data);
+        if(wk->reap.empty()) return;
+        std::vector<Conn*> dead;
+        dead.swap(wk->reap);
+        for(Conn* c : dead) {
+            if(c->pending_io > 0) c->handle_closed = true;  // conn_io_done frees it
+            else delete c;
+        }
+    });
+
+    // SSE fan-out: wakeups from sse_publish(), keep-alive comment every 15s
+    uv_async_init(w->loop, &w->sse_async, sse_deliver);
+    w->sse_async.data = w;
+    uv_timer_init(w->loop, &w->sse_ping);
+    w->sse_ping.data = w;
+    uv_timer_start(&w->sse_ping, [](uv_timer_t* t){
+        Worker* wk = static_cast<Worker*>(t->data);
+        std::vector<Conn*> subs = wk->sse_subs;
+        for(Conn* c : subs) sse_flush(c, ": ping\n\n");
+    }, 15000, 15000);
+    {
+        std::lock_guard lk(g_sse_mu);
+        g_sse_workers.push_back(w);
+    }
+
+    // Lag probe — a 100 ms timer that fires late by exactly as long as the
+    // loop was stuck; the worst drift per second goes to g_wstats, drifts over
+    // loop_stall_warn_ms are counted and logged (at most once per 10 s)
+    uv_timer_init(w->loop, &w->lag_probe);
+    w->lag_probe.data = w;
+    uv_timer_start(&w->lag_probe, [](uv_timer_t* t){
+        Worker* wk = static_cast<Worker*>(t->data);
+        int64_t now   = now_us();
+        // first firing only sets the baseline (startup work before uv_run)
+        int64_t drift = wk->lag_due_us ? std::max<int64_t>(0, now - wk->lag_due_us) : 0;
+        wk->lag_due_us = now + 100000;
+        if(drift > wk->lag_win_us) wk->lag_win_us = drift;
+        int stall_ms = g_loop_stall_warn_ms.load(std::memory_order_relaxed);
+        if(stall_ms <= 0 || drift < (int64_t)stall_ms * 1000 || wk->id >= 64) return;
+        g_wstats[wk->id].loop_stalls.fetch_add(1, std::memory_order_relaxed);
+        if(now - wk->stall_logged_us < 10000000) { wk->stall_quiet++; return; }
+        NW_WARN("worker", "Worker %d: event loop stalled %.1f ms (loop_stall_warn_ms %d, %llu more since last warning)",
+                wk->id, drift / 1000.0, stall_ms, (unsigned long long)wk->stall_quiet);
+        wk->stall_logged_us = now;
+        wk->stall_quiet     = 0;
+    }, 100, 100);
+
+    // Stats tick — loop saturation + cache counters, copied out because the
+    // loop and ResponseCache are touched by this thread only
+    uv_timer_init(w->loop, &w->stat_tick);
+    w->stat_tick.data = w;
+    w->tick_prev_us = now_us();
+    uv_timer_start(&w->stat_tick, [](uv_timer_t* t){
+        Worker* wk = static_cast<Worker*>(t->data);
+        if(wk->id >= 64) return;
+        auto& ws = g_wstats[wk->id];
+        int64_t now = now_us();
+        ws.loop_lag_us.store(wk->lag_win_us, std::memory_order_relaxed);
+        if(wk->lag_win_us > ws.loop_lag_max_us.load(std::memory_order_relaxed))
+            ws.loop_lag_max_us.store(wk->lag_win_us, std::memory_order_relaxed);
+        wk->lag_win_us = 0;
+#if NW_UV_IDLE_METRICS
+        uint64_t idle = uv_metrics_idle_time(wk->loop);
+        int64_t  wall = now - wk->tick_prev_us;
+        int64_t  idle_us = (int64_t)((idle - wk->idle_prev_ns) / 1000);
+        if(wall > 0)
+            ws.loop_busy_pm.store((uint32_t)std::clamp<int64_t>((wall - idle_us) * 1000 / wall, 0, 1000),
+                                  std::memory_order_relaxed);
+        wk->idle_prev_ns = idle;
+#endif
+        wk->tick_prev_us = now;
+        ws.loop_handles.store(wk->loop->active_handles, std::memory_order_relaxed);
+        ws.loop_reqs.store(wk->loop->active_reqs.count, std::memory_order_relaxed);
+        ws.arena_mem.store(wk->req_heap.bytes(), std::memory_order_relaxed);
+        ws.waf_norm_mem.store(wk->waf_norm.capacity() + wk->waf_vcache.mem_bytes(), std::memory_order_relaxed);
+        if(wk->rl) {
+            MemUsage rm = wk->rl->mem_usage();
+            ws.rl_mem.store(rm.bytes, std::memory_order_relaxed);
+            ws.rl_entries.store(rm.objects, std::memory_order_relaxed);
+        }
+        if(wk->cache) {
+            ws.cache_mem.store(wk->cache->mem_usage().bytes, std::memory_order_relaxed);
+            auto cs = wk->cache->stats();
+            ws.cache_miss.store(cs.misses, std::memory_order_relaxed);
+            ws.cache_evict.store(cs.evictions, std::memory_order_relaxed);
+            ws.cache_bytes.store(cs.bytes_stored, std::memory_order_relaxed);
+            ws.cache_entries.store(wk->cache->size(), std::memory_order_relaxed);
+        }
+    }, 1000, 1000);
+
     uv_async_init(w->loop, &w->stop_async, [](uv_async_t* a){
         Worker* wk = static_cast<Worker*>(a->data);
+        {
+            // No more uv_async_send() into a handle that is about to close
+            std::lock_guard lk(g_sse_mu);
+            g_sse_workers.erase(std::remove(g_sse_workers.begin(), g_sse_workers.end(), wk),
+                                g_sse_workers.end());
+        }
         // Close all active handles so uv_run() can exit cleanly
         uv_walk(wk->loop, [](uv_handle_t* h, void*){
             if(!uv_is_closing(h)) uv_close(h, nullptr);
@@ -2604,6 +4606,9 @@ static void run_worker(Worker* w, int wfd, std::atomic<int>& ready) {
     });
     w->stop_async.data = w;
 
+    // Janet WAF hook — the VM is thread-local, so it is set up here
+    janet_waf_sync(w);
+
     NW_INFO("worker", "Worker %d ready  (V8:%s Lua:%s Scripts:%d)", w->id, JS_RUNTIME, LUA_RUNTIME, w->mw->loaded_count());
     if(w->id < 64) { g_wstats[w->id].req = 0; g_wstats[w->id].err = 0; g_wstats[w->id].cache_hit = 0; }
     ready.fetch_add(1);
@@ -2615,6 +4620,7 @@ static void run_worker(Worker* w, int wfd, std::atomic<int>& ready) {
     uv_loop_close(w->loop);
     uv_loop_delete(w->loop);
     w->loop = nullptr;
+    w->janet.deinit();
     if(w->ssl_ctx) { SSL_CTX_free(w->ssl_ctx); w->ssl_ctx = nullptr; }
     close(wfd);
 }
@@ -2623,6 +4629,7 @@ static void run_worker(Worker* w, int wfd, std::atomic<int>& ready) {
 int main(int argc, char** argv) {
     signal(SIGPIPE, SIG_IGN);
     signal(SIGHUP,  [](int){ g_reload.store(true); });
+    signal(SIGUSR1, [](int){ g_access_log.request_reopen(); });  // logrotate
     signal(SIGTERM, [](int){ g_running.store(false); });
     signal(SIGINT,  [](int){ g_running.store(false); });
 
@@ -2753,6 +4760,18 @@ int main(int argc, char** argv) {
     if(g_config->servers.empty()) {
         NW_ERROR("config", "No server blocks defined"); return 1;
     }
+    // log_level from config; from here on a background thread drains the
+    // per-thread log rings to stderr / history / SSE
+    g_log.min_level.store(LogBuffer::level_from(g_config->log_level));
+    g_slow.set_threshold_ms(g_config->slow_request_ms);
+    g_loop_stall_warn_ms.store(g_config->loop_stall_warn_ms);
+    // Wire SSE broadcast into LogBuffer — new entries go to /np_logs/stream
+    // subscribers. Set before start(): the drainer thread reads it unlocked.
+    g_log.sse_broadcast = [](const LogEntry& e){
+        if(g_sse_subs.load(std::memory_order_relaxed) <= 0) return;
+        sse_publish(SSE_LOG, (int)e.level, "log", LogBuffer::entry_json(e));
+    };
+    g_log.start();
 
     // ── Initialize ACME client if enabled ────────────────────────────────────
 #if defined(HAVE_ACME)
@@ -2811,9 +4830,6 @@ int main(int argc, char** argv) {
     int primary_fd = port_fds[primary_port];
 
     NW_INFO("server", "Starting %d worker(s)...", nworkers);
-    // Wire SSE broadcast into LogBuffer — push new log entries to all open /np_logs/stream connections
-    // SSE broadcast removed — use /np_logs?since= polling instead
-    g_log.sse_broadcast = nullptr;
 
     // AutoBan: wire ban callback → add to blacklist + audit
     g_autoban.on_ban = [](const std::string& ip, const std::string& reason) {
@@ -2837,6 +4853,13 @@ int main(int argc, char** argv) {
         NW_WARN("autoban", "BANNED %s — %s", ip.c_str(), reason.c_str());
     };
     g_wstats_count = nworkers;
+    register_metrics();
+    register_memory();
+    log_directives_check(*g_config);
+    g_access_log.start(nworkers, (size_t)g_config->servers[0].access_log_buffer,
+                       access_log_settings(g_config->servers[0]));
+    g_capture.start(nworkers, (size_t)g_config->servers[0].capture_buffer,
+                    capture_settings(g_config->servers[0]));
 
     // ── Load persistent blacklist ─────────────────────────────────────────────
     if(g_config && !g_config->blacklist_file.empty())
@@ -2864,6 +4887,7 @@ int main(int argc, char** argv) {
     // ── Stats history collector ─────────────────────────────────────────────
     g_stats_timer_running.store(true);
     std::thread stats_thread([](){
+        pthread_setname_np(pthread_self(), "nw-stats");
         int flush_counter = 0;
         while(g_stats_timer_running.load()){
             stats_collector_tick();
@@ -2960,9 +4984,31 @@ int main(int argc, char** argv) {
                 }
             }
 
+        // h2c only on the plain listener (server_h) whose own listen line
+        // has http2 — other listeners never see the preface / Upgrade path
+        for(auto& srv : g_config->servers)
+            for(auto& l : srv.listens)
+                if(l.port == primary_port && l.http2 && !l.ssl)
+                    w->server_h2c = H2_AVAILABLE;
+
         workers.push_back(std::move(w));
     }
 
+    // libuv starts its threadpool on first use and the threads inherit the
+    // creator's name — start it here under one of its own (top -H, /np_profile)
+    {
+        char own[16] = "nas-web";
+        pthread_getname_np(pthread_self(), own, sizeof(own));
+        pthread_setname_np(pthread_self(), "uv-threadpool");
+        uv_loop_t tmp;
+        uv_loop_init(&tmp);
+        uv_work_t warm{};
+        uv_queue_work(&tmp, &warm, [](uv_work_t*){}, [](uv_work_t*, int){});
+        uv_run(&tmp, UV_RUN_DEFAULT);
+        uv_loop_close(&tmp);
+        pthread_setname_np(pthread_self(), own);
+    }
+
     // Spawn threads — workers already on heap, pointers stable
     std::atomic<int> ready_count{0};
     std::vector<std::thread> threads;
@@ -3017,6 +5063,14 @@ int main(int argc, char** argv) {
                     // (done under worker's own protection — dispatch reads w->config atomically)
                 }
                 g_config = new_cfg; // update global reference
+                g_log.min_level.store(LogBuffer::level_from(new_cfg->log_level));
+                g_slow.set_threshold_ms(new_cfg->slow_request_ms);
+                g_loop_stall_warn_ms.store(new_cfg->loop_stall_warn_ms);
+                if(!new_cfg->servers.empty()) {
+                    log_directives_check(*new_cfg);
+                    g_access_log.configure(access_log_settings(new_cfg->servers[0]));
+                    g_capture.configure(capture_settings(new_cfg->servers[0]));
+                }
 
                 // Reload SSL context if certs changed
                 for(auto& w : workers) {
@@ -3051,8 +5105,12 @@ int main(int argc, char** argv) {
     // Join worker threads
     for(auto& t : threads)
         if(t.joinable()) t.join();
+    // Workers are gone — drain the access-log / capture rings and close the files
+    g_access_log.stop();
+    g_capture.stop();
     // Final ban events flush on clean shutdown
     blacklist_flush_sync();
     NW_INFO("server", "Shutdown complete");
+    g_log.stop();
     return 0;
 }
@@ -11,8 +11,9 @@
 //  Implementacja:
 //    • nghttp2 w trybie server (callback-based API)
 //    • Każdy HTTP/2 stream mapowany na np_request_t + np_response_t
-//    • TLS wymagany (h2 bez TLS = h2c, wspieramy ale ostrzegamy)
-//    • ALPN negotiation: "h2" → HTTP/2, "http/1.1" → HTTP/1.1 fallback
+//    • TLS: ALPN negotiation "h2" → HTTP/2, "http/1.1" → HTTP/1.1 fallback
+//    • Cleartext (h2c): prior-knowledge preface albo "Upgrade: h2c"
+//      — ta sama sesja, tylko inne wejście (listen 80 http2)
 //
 //  QUIC/HTTP3:
 //    • Wymaga quiche (Cloudflare) lub ngtcp2
@@ -21,8 +22,10 @@
 // ─────────────────────────────────────────────────────────────────────────────
 #include "../../include/np_types.hh"
 #include "../../include/np_config.hh"
+#include "parser.cc"       // url_decode for :path
 #include <functional>
 #include <unordered_map>
+#include <unordered_set>
 #include <cstring>
 
 #ifdef HAVE_NGHTTP2
@@ -32,135 +35,336 @@
 #define H2_AVAILABLE 0
 #endif
 
-// Callback: called when a complete HTTP/2 stream (request) is ready
-using H2RequestCallback = std::function<
-    void(Request req, std::function<void(Response)> send_response)>;
+
+// Tunables from the server block (http2_* directives)
+struct H2Settings {
+    uint32_t max_concurrent_streams{128};
+    uint32_t initial_window_size{65535};     // per-stream receive window
+    uint32_t connection_window_size{65535};  // connection-level receive window
+    uint32_t max_frame_size{16384};
+    size_t   max_request_body{64*1024*1024};    // per stream (client_max_body_size)
+};
+
+// Callback: called when a complete HTTP/2 stream (request) is ready.
+// The response goes back via H2Handler::submit_response / submit_serialized.
+using H2RequestCallback = std::function<void(Request req)>;
+
+// Sink for outgoing frames — TLS encrypt or raw TCP write, owned by the caller
+using H2OutputFn = std::function<void(const char* data, size_t len)>;
+
+// Optional look at request bodies while they arrive (H2Handler::set_body_hooks):
+// every DATA payload before END_STREAM, with the request so far (payload
+// already appended). Returning false ends the request there — it goes to the
+// request callback as it is and later DATA of the stream is dropped.
+using H2BodyChunkFn = std::function<bool(int32_t stream_id, const Request& req, std::string_view chunk)>;
+// A stream is gone (completed, reset or the session ended with it)
+using H2StreamGoneFn = std::function<void(int32_t stream_id)>;
 
 // ═════════════════════════════════════════════════════════════════════════════
 class H2Handler {
 public:
 #if H2_AVAILABLE
-    explicit H2Handler(int fd, bool is_tls, H2RequestCallback cb)
-        : fd_(fd), is_tls_(is_tls), on_request_(std::move(cb))
+    H2Handler(const H2Settings& st, H2OutputFn out, H2RequestCallback cb)
+        : out_(std::move(out)), on_request_(std::move(cb)),
+          max_body_(st.max_request_body)
     {
         nghttp2_session_callbacks* cbs;
         nghttp2_session_callbacks_new(&cbs);
 
         nghttp2_session_callbacks_set_send_callback(cbs, send_cb);
+        nghttp2_session_callbacks_set_send_data_callback(cbs, send_data_cb);
         nghttp2_session_callbacks_set_on_frame_recv_callback(cbs, frame_recv_cb);
         nghttp2_session_callbacks_set_on_header_callback(cbs, header_cb);
         nghttp2_session_callbacks_set_on_data_chunk_recv_callback(cbs, data_chunk_cb);
         nghttp2_session_callbacks_set_on_stream_close_callback(cbs, stream_close_cb);
         nghttp2_session_callbacks_set_on_begin_headers_callback(cbs, begin_headers_cb);
+        nghttp2_session_callbacks_set_on_frame_send_callback(cbs, frame_send_cb);
 
         nghttp2_session_server_new(&session_, cbs, this);
         nghttp2_session_callbacks_del(cbs);
 
         // Send server settings
         nghttp2_settings_entry iv[] = {
-            {NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, 256},
-            {NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE,    65535},
-            {NGHTTP2_SETTINGS_MAX_FRAME_SIZE,         16384},
+            {NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, st.max_concurrent_streams},
+            {NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE,    st.initial_window_size},
+            {NGHTTP2_SETTINGS_MAX_FRAME_SIZE,         st.max_frame_size},
             {NGHTTP2_SETTINGS_ENABLE_PUSH,            0},  // disable server push
         };
         nghttp2_submit_settings(session_, NGHTTP2_FLAG_NONE,
                                 iv, sizeof(iv)/sizeof(iv[0]));
+        // Connection window is not a SETTINGS value — raise it via WINDOW_UPDATE
+        if(st.connection_window_size > 65535)
+            nghttp2_session_set_local_window_size(session_, NGHTTP2_FLAG_NONE, 0,
+                                                  (int32_t)st.connection_window_size);
     }
 
     ~H2Handler(){
         if(session_) nghttp2_session_del(session_);
     }
 
-    // Feed received data from client
+    H2Handler(const H2Handler&) = delete;
+    H2Handler& operator=(const H2Handler&) = delete;
+
+    // Feed received (already decrypted) data from client.
+    // Returns -1 on protocol error — caller should close the connection.
     int receive(const uint8_t* data, size_t len){
+        in_recv_ = true;
         ssize_t r = nghttp2_session_mem_recv(session_, data, len);
+        in_recv_ = false;
         if(r < 0){
             fprintf(stderr, "[h2] mem_recv error: %s\n",
                     nghttp2_strerror((int)r));
             return -1;
         }
-        return nghttp2_session_send(session_);
+        return flush();
     }
 
-    // Send HTTP/2 response for a stream
-    void send_response(int32_t stream_id, const Response& resp){
-        // Build HPACK headers
-        std::vector<nghttp2_nv> nv;
+    void set_body_hooks(H2BodyChunkFn chunk, H2StreamGoneFn gone){
+        on_body_chunk_ = std::move(chunk);
+        on_stream_gone_ = std::move(gone);
+    }
 
-        // :status (pseudo-header must come first)
-        auto status_str = std::to_string(resp.status);
-        nv.push_back(make_nv(":status", status_str));
+    // Send HTTP/2 response for a stream. Body is moved into the stream state
+    // and handed to nghttp2 frame by frame (no intermediate copy).
+    void submit_response(int32_t stream_id, Response resp){
+        auto& so = out_streams_[stream_id];
+        so.blob = std::move(resp.body);
+        so.off  = 0;
+        std::vector<std::pair<std::string,std::string_view>> hv;
+        hv.reserve(resp.headers.items.size());
+        for(auto&[k,v] : resp.headers.items) hv.emplace_back(k, v);
+        submit(stream_id, resp.status, hv, so);
+    }
 
-        for(auto&[k,v] : resp.headers.items){
-            // Skip hop-by-hop headers
-            if(ci_eq(k,"Connection")||ci_eq(k,"Transfer-Encoding")) continue;
-            // Lowercase header names (HTTP/2 requirement)
-            std::string lk = k;
-            for(char& c:lk) c=(char)tolower((unsigned char)c);
-            nv.push_back(make_nv(lk, v));
+    // Send a response that was already serialized as HTTP/1.1 (status line +
+    // headers + body). The head is translated to HPACK and the body is served
+    // straight out of the serialized buffer.
+    void submit_serialized(int32_t stream_id, std::string h1){
+        auto& so = out_streams_[stream_id];
+        so.blob = std::move(h1);
+        std::string_view sv{so.blob};
+        auto hend = sv.find("\r\n\r\n");
+        auto fnl  = sv.find("\r\n");
+        auto s1   = sv.find(' ');
+        if(hend == std::string_view::npos || s1 == std::string_view::npos || s1 > fnl){
+            reset_stream(stream_id);
+            return;
         }
+        int status = atoi(so.blob.c_str() + s1 + 1);
+        so.off = hend + 4;
+
+        std::vector<std::pair<std::string,std::string_view>> hv;
+        size_t pos = fnl + 2;
+        while(pos < hend){
+            auto nl = sv.find("\r\n", pos);
+            if(nl == std::string_view::npos || nl > hend) nl = hend;
+            auto line  = sv.substr(pos, nl - pos);
+            pos = nl + 2;
+            auto colon = line.find(':');
+            if(colon == std::string_view::npos) continue;
+            auto val = line.substr(colon + 1);
+            while(!val.empty() && (val[0]==' '||val[0]=='\t')) val.remove_prefix(1);
+            hv.emplace_back(std::string(line.substr(0, colon)), val);
+        }
+        submit(stream_id, status, hv, so);
+    }
 
-        // DATA provider
-        nghttp2_data_provider prd;
-        prd.source.ptr = (void*)this;
-
-        // Store body for this stream
-        stream_bodies_[stream_id] = resp.body;
-
-        prd.read_callback = [](nghttp2_session*,
-                                int32_t sid,
-                                uint8_t* buf, size_t length,
-                                uint32_t* data_flags,
-                                nghttp2_data_source* src,
-                                void* user_data) -> ssize_t {
-            auto* h = (H2Handler*)user_data;
-            auto it = h->stream_bodies_.find(sid);
-            if(it==h->stream_bodies_.end() ||
-               h->stream_offsets_[sid] >= it->second.size()){
-                *data_flags |= NGHTTP2_DATA_FLAG_EOF;
-                return 0;
-            }
-            auto& body   = it->second;
-            auto& offset = h->stream_offsets_[sid];
-            size_t avail = body.size() - offset;
-            size_t ncopy = std::min(avail, length);
-            memcpy(buf, body.data()+offset, ncopy);
-            offset += ncopy;
-            if(offset >= body.size()) *data_flags |= NGHTTP2_DATA_FLAG_EOF;
-            return (ssize_t)ncopy;
-        };
+    // Response that stays open (text/event-stream): headers and resp.body go
+    // out now, later DATA whenever stream_write() adds some. While nothing is
+    // queued the data provider defers instead of ending the stream.
+    void submit_stream(int32_t stream_id, Response resp){
+        auto& so = out_streams_[stream_id];
+        so.blob = std::move(resp.body);
+        so.off  = 0;
+        so.open = true;
+        std::vector<std::pair<std::string,std::string_view>> hv;
+        hv.reserve(resp.headers.items.size());
+        for(auto&[k,v] : resp.headers.items) hv.emplace_back(k, v);
+        submit(stream_id, resp.status, hv, so);
+    }
 
-        nghttp2_submit_response(session_, stream_id,
-                                nv.data(), nv.size(),
-                                resp.body.empty() ? nullptr : &prd);
-        nghttp2_session_send(session_);
+    // Append to a stream opened by submit_stream(); false once it is gone
+    bool stream_write(int32_t stream_id, std::string_view data){
+        auto it = out_streams_.find(stream_id);
+        if(it == out_streams_.end() || !it->second.open) return false;
+        auto& so = it->second;
+        if(so.off == so.blob.size()){ so.blob.clear(); so.off = 0; }
+        so.blob.append(data);
+        nghttp2_session_resume_data(session_, stream_id);
+        if(!in_recv_) flush();
+        return true;
+    }
+
+    // Bytes of an open stream still waiting for flow-control window
+    size_t stream_backlog(int32_t stream_id) const {
+        auto it = out_streams_.find(stream_id);
+        return it == out_streams_.end() ? 0 : it->second.blob.size() - it->second.off;
+    }
+
+    // Abort one stream (RST_STREAM); the session and its other streams go on
+    void reset_stream(int32_t stream_id, uint32_t error_code = NGHTTP2_INTERNAL_ERROR){
+        out_streams_.erase(stream_id);
+        nghttp2_submit_rst_stream(session_, NGHTTP2_FLAG_NONE, stream_id, error_code);
+        if(!in_recv_) flush();
+    }
+
+    // h2c "Upgrade: h2c" (RFC 7540 §3.2): the HTTP/1.1 request that carried
+    // the upgrade becomes stream 1, half-closed from the client side.
+    // settings_b64 is the base64url HTTP2-Settings header value.
+    bool upgrade(std::string_view settings_b64, const Request& req){
+        std::string payload;
+        if(!base64url_decode(settings_b64, payload)) return false;
+        int rv = nghttp2_session_upgrade2(session_,
+                    (const uint8_t*)payload.data(), payload.size(),
+                    req.method == Method::HEAD ? 1 : 0, nullptr);
+        if(rv != 0){
+            fprintf(stderr, "[h2] upgrade failed: %s\n", nghttp2_strerror(rv));
+            return false;
+        }
+        if(req.method == Method::HEAD) head_only_[1] = true;
+        return true;
+    }
+
+    // Push pending frames to the output sink
+    int flush(){
+        int rv = nghttp2_session_send(session_);
+        if(!wbuf_.empty()){
+            out_(wbuf_.data(), wbuf_.size());
+            wbuf_.clear();
+        }
+        return rv < 0 ? -1 : 0;
     }
 
     bool wants_write() const {
         return nghttp2_session_want_write(session_) != 0;
     }
+    // false once both sides sent GOAWAY / the session is finished
+    bool alive() const {
+        return nghttp2_session_want_read(session_) != 0 ||
+               nghttp2_session_want_write(session_) != 0;
+    }
+    size_t open_streams() const { return streams_.size() + out_streams_.size(); }
 
     // ALPN protocol string for SSL negotiation
     static constexpr std::string_view ALPN_PROTO = "h2";
 
 private:
-    int                  fd_;
-    bool                 is_tls_;
+    // Outgoing body for one stream; data provider reads [off, blob.size())
+    struct StreamOut {
+        std::string blob;
+        size_t      off{0};
+        bool        open{false};  // submit_stream(): no EOF, defer when drained
+    };
+
     nghttp2_session*     session_{nullptr};
+    H2OutputFn           out_;
     H2RequestCallback    on_request_;
+    H2BodyChunkFn        on_body_chunk_;
+    H2StreamGoneFn       on_stream_gone_;
+    std::string          wbuf_;          // frames produced during one send pass
+    bool                 in_recv_{false};
+    size_t               max_body_;      // request body limit per stream
 
     // Per-stream state
-    std::unordered_map<int32_t, Request>     streams_;
-    std::unordered_map<int32_t, std::string> stream_bodies_;
-    std::unordered_map<int32_t, size_t>      stream_offsets_;
+    std::unordered_map<int32_t, Request>   streams_;      // request being received
+    std::unordered_map<int32_t, StreamOut> out_streams_;  // response being sent
+    std::unordered_map<int32_t, bool>      head_only_;    // HEAD requests — no DATA
+    std::unordered_set<int32_t>            refused_;      // 413 queued, RST once it is out
+
+    void submit(int32_t stream_id, int status,
+                std::vector<std::pair<std::string,std::string_view>>& hv,
+                StreamOut& so){
+        std::vector<nghttp2_nv> nv;
+        nv.reserve(hv.size() + 1);
+
+        // :status (pseudo-header must come first)
+        auto status_str = std::to_string(status);
+        nv.push_back(make_nv(":status", status_str));
+
+        for(auto&[k,v] : hv){
+            // Skip hop-by-hop headers (forbidden in HTTP/2)
+            if(ci_eq(k,"Connection")||ci_eq(k,"Transfer-Encoding")||
+               ci_eq(k,"Keep-Alive")||ci_eq(k,"Upgrade")||
+               ci_eq(k,"Proxy-Connection")) continue;
+            // Lowercase header names (HTTP/2 requirement)
+            for(char& c:k) c=(char)tolower((unsigned char)c);
+            nv.push_back(make_nv(k, v));
+        }
+
+        bool head = false;
+        auto hit = head_only_.find(stream_id);
+        if(hit != head_only_.end()){ head = true; head_only_.erase(hit); }
+
+        // DATA provider — source.ptr points at the stream's StreamOut
+        nghttp2_data_provider prd;
+        prd.source.ptr    = &so;
+        prd.read_callback = data_read_cb;
+
+        bool has_body = !head && (so.open || so.off < so.blob.size());
+        int rv = nghttp2_submit_response(session_, stream_id,
+                                         nv.data(), nv.size(),
+                                         has_body ? &prd : nullptr);
+        if(rv != 0 || !has_body) out_streams_.erase(stream_id);
+        // Inside mem_recv nghttp2 must not be re-entered — receive() flushes
+        if(!in_recv_) flush();
+    }
 
     // ── nghttp2 callbacks (static → dispatch to 'this') ──────────────────────
+    // Request body over max_body_: the buffered part is dropped, 413 goes out
+    // and, once it is sent, RST_STREAM(NO_ERROR) asks the client to stop
+    // sending (RFC 9113 §8.1). Later HEADERS/DATA of the stream find no
+    // entry and are ignored.
+    void refuse_body(int32_t stream_id){
+        streams_.erase(stream_id);
+        refused_.insert(stream_id);
+        auto& so = out_streams_[stream_id];
+        so = StreamOut{};
+        std::vector<std::pair<std::string,std::string_view>> hv{{"content-length", "0"}};
+        submit(stream_id, 413, hv, so);
+    }
+
+    // Registered via nghttp2_session_callbacks_set_* - not called directly
+    static int frame_send_cb(nghttp2_session* s, const nghttp2_frame* frame, void* ud){
+        auto* h = (H2Handler*)ud;
+        if(frame->hd.type == NGHTTP2_HEADERS && h->refused_.erase(frame->hd.stream_id))
+            nghttp2_submit_rst_stream(s, NGHTTP2_FLAG_NONE, frame->hd.stream_id, NGHTTP2_NO_ERROR);
+        return 0;
+    }
+
     static ssize_t send_cb(nghttp2_session*, const uint8_t* data,
                             size_t length, int, void* ud){
         auto* h = (H2Handler*)ud;
-        ssize_t r = write(h->fd_, data, length);
-        if(r<0 && errno==EAGAIN) return NGHTTP2_ERR_WOULDBLOCK;
-        return r;
+        h->wbuf_.append((const char*)data, length);
+        return (ssize_t)length;
+    }
+
+    // Registered via nghttp2_data_provider — NO_COPY, actual bytes written in send_data_cb
+    static ssize_t data_read_cb(nghttp2_session*, int32_t,
+                                 uint8_t*, size_t length,
+                                 uint32_t* data_flags,
+                                 nghttp2_data_source* src, void*){
+        auto* so = (StreamOut*)src->ptr;
+        size_t avail = so->blob.size() - so->off;
+        if(avail == 0 && so->open) return NGHTTP2_ERR_DEFERRED;  // stream_write() resumes
+        size_t n     = std::min(avail, length);
+        *data_flags |= NGHTTP2_DATA_FLAG_NO_COPY;
+        if(n == avail && !so->open) *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+        return (ssize_t)n;
+    }
+
+    // Registered via nghttp2_session_callbacks_set_* - not called directly
+    static int send_data_cb(nghttp2_session*, nghttp2_frame* frame,
+                             const uint8_t* framehd, size_t length,
+                             nghttp2_data_source* src, void* ud){
+        auto* h  = (H2Handler*)ud;
+        auto* so = (StreamOut*)src->ptr;
+        h->wbuf_.append((const char*)framehd, 9);
+        size_t padlen = frame->data.padlen;
+        if(padlen > 0) h->wbuf_.push_back((char)(padlen - 1));
+        h->wbuf_.append(so->blob.data() + so->off, length);
+        so->off += length;
+        if(padlen > 1) h->wbuf_.append(padlen - 1, '\0');
+        return 0;
     }
 
     // Registered via nghttp2_session_callbacks_set_* - not called directly
@@ -169,9 +373,11 @@ private:
         auto* h = (H2Handler*)ud;
         if(frame->hd.type == NGHTTP2_HEADERS &&
            frame->headers.cat == NGHTTP2_HCAT_REQUEST){
-            h->streams_[frame->hd.stream_id] = Request{};
-            h->streams_[frame->hd.stream_id].h2_stream_id = frame->hd.stream_id;
-            h->streams_[frame->hd.stream_id].is_h2 = true;
+            auto& req = h->streams_[frame->hd.stream_id];
+            req = Request{};
+            req.h2_stream_id = frame->hd.stream_id;
+            req.is_h2 = true;
+            req.version = HttpVersion::HTTP20;
         }
         return 0;
     }
@@ -194,13 +400,32 @@ private:
         else if(k==":path"){
             auto q = v.find('?');
             if(q!=std::string::npos){
-                req.path  = v.substr(0,q);
+                req.path  = url_decode(v.substr(0,q));
                 req.query = v.substr(q+1);
-            } else { req.path = v; }
+            } else { req.path = url_decode(v); }
         }
         else if(k==":scheme") req.scheme = v;
         else if(k==":authority") req.host = v;
-        else req.headers.set(k, v);
+        else {
+            if(k=="host" && req.host.empty()) req.host = v;
+            if(k=="content-length"){
+                req.content_length = strtoull(v.c_str(), nullptr, 10);
+                if(req.content_length > h->max_body_){
+                    h->refuse_body(frame->hd.stream_id);
+                    return 0;
+                }
+            }
+            // Repeated fields are joined, not replaced — HTTP/2 clients send
+            // cookies as separate crumbs (RFC 9113 §8.2.3)
+            auto prev = req.headers.get(k);
+            if(prev.empty()) req.headers.set(k, v);
+            else {
+                std::string joined(prev);
+                joined += k=="cookie" ? "; " : ", ";
+                joined += v;
+                req.headers.set(k, joined);
+            }
+        }
 
         return 0;
     }
@@ -210,10 +435,29 @@ private:
                                const uint8_t* data, size_t len, void* ud){
         auto* h = (H2Handler*)ud;
         auto  it = h->streams_.find(stream_id);
-        if(it!=h->streams_.end()) it->second.body.append((char*)data, len);
+        if(it==h->streams_.end()) return 0;
+        if(it->second.body.size() + len > h->max_body_){
+            h->refuse_body(stream_id);
+            return 0;
+        }
+        it->second.body.append((char*)data, len);
+        if(h->on_body_chunk_ &&
+           !h->on_body_chunk_(stream_id, it->second, std::string_view((const char*)data, len))){
+            h->deliver(it);
+        }
         return 0;
     }
 
+    // Hand a received request to the callback — it answers later via
+    // submit_response/submit_serialized
+    void deliver(std::unordered_map<int32_t, Request>::iterator it){
+        Request req = std::move(it->second);
+        streams_.erase(it);
+        if(req.method == Method::HEAD) head_only_[req.h2_stream_id] = true;
+        if(req.content_length == 0) req.content_length = req.body.size();
+        on_request_(std::move(req));
+    }
+
     // Registered via nghttp2_session_callbacks_set_* - not called directly
     static int frame_recv_cb(nghttp2_session*, const nghttp2_frame* frame,
                                void* ud){
@@ -225,16 +469,7 @@ private:
 
             auto it = h->streams_.find(frame->hd.stream_id);
             if(it==h->streams_.end()) return 0;
-
-            Request req = std::move(it->second);
-            h->streams_.erase(it);
-            int32_t sid = req.h2_stream_id;
-
-            // Call handler — it will call send_response when ready
-            h->on_request_(std::move(req),
-                [h, sid](Response resp){
-                    h->send_response(sid, resp);
-                });
+            h->deliver(it);
         }
         return 0;
     }
@@ -244,13 +479,35 @@ private:
                                  uint32_t, void* ud){
         auto* h = (H2Handler*)ud;
         h->streams_.erase(stream_id);
-        h->stream_bodies_.erase(stream_id);
-        h->stream_offsets_.erase(stream_id);
+        h->out_streams_.erase(stream_id);
+        h->head_only_.erase(stream_id);
+        h->refused_.erase(stream_id);
+        if(h->on_stream_gone_) h->on_stream_gone_(stream_id);
         return 0;
     }
 
-    static nghttp2_nv make_nv(const std::string& name,
-                                const std::string& value){
+    static bool base64url_decode(std::string_view in, std::string& out){
+        auto val = [](char c) -> int {
+            if(c>='A'&&c<='Z') return c-'A';
+            if(c>='a'&&c<='z') return c-'a'+26;
+            if(c>='0'&&c<='9') return c-'0'+52;
+            if(c=='-'||c=='+') return 62;
+            if(c=='_'||c=='/') return 63;
+            return -1;
+        };
+        uint32_t acc = 0; int bits = 0;
+        for(char c : in){
+            if(c=='=') break;
+            int v = val(c);
+            if(v < 0) return false;
+            acc = (acc << 6) | (uint32_t)v; bits += 6;
+            if(bits >= 8){ bits -= 8; out.push_back((char)((acc >> bits) & 0xFF)); }
+        }
+        return true;
+    }
+
+    static nghttp2_nv make_nv(std::string_view name,
+                                std::string_view value){
         return {
             (uint8_t*)name.data(),  (uint8_t*)value.data(),
             name.size(), value.size(),
@@ -261,17 +518,27 @@ private:
 #else
     // ── HTTP/2 stub ────────────────────────────────────────────────────────────
 public:
-    H2Handler(int fd, bool, H2RequestCallback cb)
-        : fd_(fd), on_request_(std::move(cb)){
+    H2Handler(const H2Settings&, H2OutputFn out, H2RequestCallback cb)
+        : out_(std::move(out)), on_request_(std::move(cb)){
         fprintf(stderr, "[h2] nghttp2 not available — HTTP/2 disabled\n"
                         "     Install libnghttp2-dev and rebuild with -DHAVE_NGHTTP2\n");
     }
     int receive(const uint8_t*, size_t){ return -1; }
-    void send_response(int32_t, const Response&){}
+    void submit_response(int32_t, Response){}
+    void submit_serialized(int32_t, std::string){}
+    void submit_stream(int32_t, Response){}
+    bool stream_write(int32_t, std::string_view){ return false; }
+    size_t stream_backlog(int32_t) const { return 0; }
+    void reset_stream(int32_t, uint32_t = 0){}
+    bool upgrade(std::string_view, const Request&){ return false; }
+    void set_body_hooks(H2BodyChunkFn, H2StreamGoneFn){}
+    int flush(){ return 0; }
     bool wants_write() const { return false; }
+    bool alive() const { return false; }
+    size_t open_streams() const { return 0; }
     static constexpr std::string_view ALPN_PROTO = "h2";
 private:
-    int fd_;
+    H2OutputFn        out_;
     H2RequestCallback on_request_;
 #endif
 };
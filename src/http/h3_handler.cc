@@ -323,7 +323,7 @@ private:
         });
         for(auto&[k,v]:resp.headers.items){
             if(ci_eq(k,"Connection")||ci_eq(k,"Transfer-Encoding")) continue;
-            std::string lk=k; for(char&c:lk) c=(char)tolower((unsigned char)c);
+            std::string lk(k); for(char&c:lk) c=(char)tolower((unsigned char)c);
             hdrs.push_back({(uint8_t*)lk.data(),lk.size(),
                              (uint8_t*)v.data(),v.size()});
         }
@@ -5,6 +5,7 @@
 #include "../../include/np_types.hh"
 #include <cctype>
 #include <cstdlib>
+#include <charconv>
 
 enum class ParseResult { Complete, Incomplete, Error, TooLarge };
 
@@ -24,6 +25,9 @@ static std::string url_decode(std::string_view sv){
     return out;
 }
 
+// Complete: bytes consumed. Incomplete with the headers read but not the whole
+// body: offset of the body in `buf` (0 while the headers are incomplete), so
+// the caller can look at the body while it arrives.
 std::pair<ParseResult,size_t> parse_request(const char* buf,size_t len,Request& req){
     if(len==0) return {ParseResult::Incomplete,0};
     if(len>MAX_SAFE_BODY+NP_BUF) return {ParseResult::TooLarge,0};
@@ -53,30 +57,31 @@ std::pair<ParseResult,size_t> parse_request(const char* buf,size_t len,Request&
         if(line.empty()) break;
         auto colon=line.find(':');
         if(colon==std::string_view::npos) continue;
-        std::string k{line.substr(0,colon)};
-        auto val=line.substr(colon+1);
-        while(!val.empty()&&(val[0]==' '||val[0]=='\t')) val.remove_prefix(1);
+        // Views into `buf` until set() copies them onto the headers' resource
+        auto k=line.substr(0,colon);
+        auto v=line.substr(colon+1);
+        while(!v.empty()&&(v[0]==' '||v[0]=='\t')) v.remove_prefix(1);
         // Validate header value length — prevents header-based memory exhaustion
-        if(val.size() > MAX_HEADER_VALUE) {
-            NW_WARN("parser", "Header value too large: %s", k.c_str());
+        if(v.size() > MAX_HEADER_VALUE) {
+            NW_WARN("parser", "Header value too large: %.*s", (int)k.size(), k.data());
             return {ParseResult::Error,0};
         }
-        std::string v{val};
-        if(ci_eq(k,"Host")) req.host=v;
+        if(ci_eq(k,"Host")) req.host.assign(v.data(),v.size());
         else if(ci_eq(k,"Content-Length")) {
-            try {
-                req.content_length = std::stoul(v);
-                if(req.content_length > MAX_SAFE_BODY) return {ParseResult::TooLarge,0};
-            } catch(const std::exception& ex) {
-                NW_WARN("parser", "Invalid Content-Length: %s", ex.what());
+            unsigned long long cl=0;
+            auto [end,ec]=std::from_chars(v.data(),v.data()+v.size(),cl);
+            if(ec!=std::errc() || end==v.data()) {
+                NW_WARN("parser", "Invalid Content-Length: %.*s", (int)std::min<size_t>(v.size(),64), v.data());
                 return {ParseResult::Error,0};
             }
+            if(cl > MAX_SAFE_BODY) return {ParseResult::TooLarge,0};
+            req.content_length = (size_t)cl;
         }
         else if(ci_eq(k,"Connection")){
             if(ci_eq(v,"close")) req.keep_alive=false;
             else if(ci_eq(v,"keep-alive")) req.keep_alive=true;
         }
-        req.headers.set(std::move(k),std::move(v));
+        req.headers.set(k,v);
     }
     auto conn=req.headers.get("Connection");
     auto upg=req.headers.get("Upgrade");
@@ -84,7 +89,7 @@ std::pair<ParseResult,size_t> parse_request(const char* buf,size_t len,Request&
                      &&ci_eq(upg,"websocket"));
     size_t hdr_end=hend+4;
     if(req.content_length>0){
-        if(len-hdr_end<req.content_length) return {ParseResult::Incomplete,0};
+        if(len-hdr_end<req.content_length) return {ParseResult::Incomplete,hdr_end};
         req.body.assign(buf+hdr_end,req.content_length);
         return {ParseResult::Complete,hdr_end+req.content_length};
     }
@@ -111,12 +116,12 @@ std::pair<ParseResult,size_t> parse_response(const char* buf,size_t len,Response
         if(line.empty()) break;
         auto colon=line.find(':');
         if(colon==std::string_view::npos) continue;
-        std::string k{line.substr(0,colon)};
+        auto k=line.substr(0,colon);
         auto val=line.substr(colon+1);
         while(!val.empty()&&(val[0]==' '||val[0]=='\t')) val.remove_prefix(1);
         if(ci_eq(k,"Content-Length")) clen=std::stoul(std::string(val));
         if(ci_eq(k,"Transfer-Encoding")&&val.find("chunked")!=std::string_view::npos) chunked=true;
-        resp.headers.set(std::move(k),std::string(val));
+        resp.headers.set(k,val);
     }
     size_t body_start=hend+4;
     if(!chunked&&clen>0){
@@ -8,9 +8,17 @@
 // Compiled as part of server.cc (single-TU build)
 
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
 #include <string>
 #include <string_view>
-#include <cstring>
+#include <thread>
+#include <vector>
 
 // ── zstd ─────────────────────────────────────────────────────────────────────
 #if defined(HAVE_ZSTD)
@@ -204,66 +212,267 @@ inline bool client_accepts_webp(std::string_view accept) {
 }
 
 // ── Janet WAF scripting ───────────────────────────────────────────────────────
+// <scripts_dir>/waf_custom.janet defines (waf-check ip uri method ua) → 0 pass,
+// non-zero block. Janet is not thread-safe: every worker runs its own VM
+// (janet_init() on the worker thread), loads the script into it once and
+// keeps the resolved function — a request is one janet_pcall() on a reused
+// fiber with the values passed as Janet strings (no source text is built,
+// nothing is parsed or compiled per request).
+//
+// Timeout: the call arms a deadline in its watchdog slot; one watchdog thread
+// interrupts the VM of a call that outlived it (the fiber stops at its next
+// call / backward jump, janet_pcall returns JANET_SIGNAL_INTERRUPT) and the
+// request passes. Time spent inside a single C function is not interruptible.
+
+static constexpr int JANET_WAF_TIMEOUT_MS = 10;
+static constexpr int JANET_WAF_LOAD_MS    = 1000;   // top-level forms of the script
+
+// Shared by all workers (/np_features)
+struct JanetWafStats {
+    std::atomic<uint32_t> loaded{0};     // workers with waf-check resolved
+    std::atomic<uint64_t> calls{0}, blocks{0}, errors{0}, timeouts{0};
+    std::atomic<uint64_t> ns_total{0}, ns_max{0};
+
+    void record(uint64_t ns) {
+        calls.fetch_add(1, std::memory_order_relaxed);
+        ns_total.fetch_add(ns, std::memory_order_relaxed);
+        uint64_t m = ns_max.load(std::memory_order_relaxed);
+        while(ns > m && !ns_max.compare_exchange_weak(m, ns, std::memory_order_relaxed)) {}
+    }
+};
+static JanetWafStats g_janet_stats;
+
+// {"loaded":…,"calls":…,"avg_us":…,"max_us":…,…} — /np_features, /np_module
+inline std::string janet_stats_json() {
+    auto& js = g_janet_stats;
+    uint64_t calls = js.calls.load(std::memory_order_relaxed);
+    char buf[256];
+    snprintf(buf, sizeof(buf),
+        "{\"loaded\":%u,\"calls\":%llu,\"avg_us\":%.2f,\"max_us\":%.2f,"
+        "\"blocks\":%llu,\"errors\":%llu,\"timeouts\":%llu,\"timeout_ms\":%d}",
+        js.loaded.load(std::memory_order_relaxed), (unsigned long long)calls,
+        calls ? js.ns_total.load(std::memory_order_relaxed) / 1e3 / calls : 0.0,
+        js.ns_max.load(std::memory_order_relaxed) / 1e3,
+        (unsigned long long)js.blocks.load(std::memory_order_relaxed),
+        (unsigned long long)js.errors.load(std::memory_order_relaxed),
+        (unsigned long long)js.timeouts.load(std::memory_order_relaxed),
+        JANET_WAF_TIMEOUT_MS);
+    return buf;
+}
+
+inline uint64_t janet_now_ns() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#if JANET_REAL
+// One thread for all workers' VMs; polls the armed slots every millisecond
+// while at least one VM is registered, sleeps otherwise
+class JanetWatchdog {
+public:
+    struct Slot {
+        JanetVM*              vm{nullptr};
+        std::atomic<uint64_t> deadline{0};   // 0 = no call running
+        std::mutex            mu;            // deadline ↔ interrupt handshake
+        bool                  fired{false};
+    };
+
+    static JanetWatchdog& get() { static JanetWatchdog w; return w; }
+
+    ~JanetWatchdog() {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            quit_ = true;
+        }
+        cv_.notify_all();
+        if(th_.joinable()) th_.join();
+    }
+
+    void add(Slot* s) {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            slots_.push_back(s);
+            if(!th_.joinable()) th_ = std::thread([this]{ run(); });
+        }
+        cv_.notify_all();
+    }
+
+    void remove(Slot* s) {
+        std::lock_guard<std::mutex> lk(mu_);
+        slots_.erase(std::remove(slots_.begin(), slots_.end(), s), slots_.end());
+    }
+
+    // Before / after a call on the owning thread. disarm() returns true when
+    // the watchdog interrupted the VM; the interrupt is then marked handled
+    // (also when the call finished first — the pending suspend must not hit
+    // the next one).
+    static void arm(Slot& s, uint64_t deadline) { s.deadline.store(deadline, std::memory_order_release); }
+    static bool disarm(Slot& s) {
+        std::lock_guard<std::mutex> lk(s.mu);
+        s.deadline.store(0, std::memory_order_relaxed);
+        bool fired = s.fired;
+        if(fired) { janet_interpreter_interrupt_handled(s.vm); s.fired = false; }
+        return fired;
+    }
+
+private:
+    void run() {
+        std::unique_lock<std::mutex> lk(mu_);
+        while(!quit_) {
+            if(slots_.empty()) cv_.wait(lk, [this]{ return quit_ || !slots_.empty(); });
+            else               cv_.wait_for(lk, std::chrono::milliseconds(1));
+            uint64_t now = janet_now_ns();
+            for(Slot* s : slots_) {
+                uint64_t d = s->deadline.load(std::memory_order_acquire);
+                if(!d || now < d) continue;
+                std::lock_guard<std::mutex> sl(s->mu);
+                if(s->deadline.load(std::memory_order_relaxed) && !s->fired) {
+                    janet_interpreter_interrupt(s->vm);
+                    s->fired = true;
+                }
+            }
+        }
+    }
 
+    std::mutex              mu_;
+    std::condition_variable cv_;
+    std::vector<Slot*>      slots_;
+    std::thread             th_;
+    bool                    quit_{false};
+};
+#endif
+
+// One per worker, used on its loop thread only
 struct JanetWAF {
-    bool  enabled{false};
-    void* env{nullptr};  // JanetTable* when real Janet
+    bool enabled{false};      // VM initialized on this thread
+    int  timeout_ms{JANET_WAF_TIMEOUT_MS};
+
+    bool ready() const {
+#if JANET_REAL
+        return check_fn != nullptr;
+#else
+        return false;
+#endif
+    }
 
     void init() {
 #if JANET_REAL
+        if (enabled) return;
         janet_init();
-        env = (void*)janet_core_env(nullptr);
+        env = janet_core_env(nullptr);
+        janet_gcroot(janet_wrap_table(env));
+        wd.vm = janet_local_vm();
+        JanetWatchdog::get().add(&wd);
         enabled = true;
 #endif
     }
     void deinit() {
 #if JANET_REAL
-        if (enabled) janet_deinit();
+        if (!enabled) return;
+        JanetWatchdog::get().remove(&wd);
+        if (check_fn) g_janet_stats.loaded.fetch_sub(1, std::memory_order_relaxed);
+        janet_deinit();
+        env = nullptr; check_fn = nullptr; fiber = nullptr;
         enabled = false;
 #endif
     }
 
-    // Load WAF rules from a Janet script file
+    // Run a Janet script file and resolve its waf-check function
     // Returns error string or "" on success
     std::string load_rules(const std::string& path) {
 #if JANET_REAL
         if (!enabled) return "Janet not initialized";
-        FILE* f = fopen(path.c_str(), "r");
+        FILE* f = fopen(path.c_str(), "rb");
         if (!f) return "Cannot open: " + path;
+        std::string src;
+        char buf[4096];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), f)) > 0) src.append(buf, n);
         fclose(f);
+
         Janet out;
-        int r = janet_dostring((JanetTable*)env, nullptr, path.c_str(), &out);
+        JanetWatchdog::arm(wd, janet_now_ns() + (uint64_t)JANET_WAF_LOAD_MS * 1000000);
+        int r = janet_dobytes(env, (const uint8_t*)src.data(), (int32_t)src.size(), path.c_str(), &out);
+        bool fired = JanetWatchdog::disarm(wd);
+        if (fired) return "Janet timeout loading: " + path;
         if (r != JANET_SIGNAL_OK) return "Janet error in: " + path;
+
+        Janet fn;
+        janet_resolve(env, janet_csymbol("waf-check"), &fn);
+        if (!janet_checktype(fn, JANET_FUNCTION)) return "waf-check not defined in: " + path;
+        janet_gcroot(fn);
+        if (!check_fn) g_janet_stats.loaded.fetch_add(1, std::memory_order_relaxed);
+        check_fn = janet_unwrap_function(fn);
         return "";
 #else
         (void)path; return "Janet not compiled (run vendor/janet/fetch_janet.sh)";
 #endif
     }
 
-    // Evaluate a Janet expression for a request
-    // Returns: 0=pass, 1=block, 2=challenge
-    int eval_request(const std::string& ip, const std::string& uri,
-                     const std::string& method, const std::string& ua) {
+    // (waf-check ip uri method ua), uri = path[?query]
+    // Returns: 0=pass, otherwise the script's verdict — the server answers
+    // every non-zero value with 403 (there is no challenge page, 2 blocks
+    // too); errors and timeouts pass
+    int eval_request(std::string_view ip, std::string_view path, std::string_view query,
+                     std::string_view method, std::string_view ua) {
 #if JANET_REAL
-        if (!enabled || !env) return 0;
-        // Build Janet expression: (waf-check ip uri method ua)
-        std::string expr = "(if (defined? waf-check) "
-            "(waf-check \"" + ip + "\" \"" + uri + "\" \""
-            + method + "\" \"" + ua + "\") 0)";
+        if (!check_fn) return 0;
+        size_t ulen = path.size() + (query.empty() ? 0 : 1 + query.size());
+        uint8_t* u = janet_string_begin((int32_t)ulen);
+        memcpy(u, path.data(), path.size());
+        if (!query.empty()) {
+            u[path.size()] = '?';
+            memcpy(u + path.size() + 1, query.data(), query.size());
+        }
+        Janet argv[4] = {
+            jstr(ip), janet_wrap_string(janet_string_end(u)), jstr(method), jstr(ua),
+        };
+
+        uint64_t t0 = janet_now_ns();
+        JanetWatchdog::arm(wd, t0 + (uint64_t)timeout_ms * 1000000);
+        JanetFiber* fb = fiber;
         Janet out;
-        int r = janet_dostring((JanetTable*)env, expr.c_str(), "waf-check", &out);
-        if (r != JANET_SIGNAL_OK) return 0;
-        if (janet_checktype(out, 1 /*JANET_NUMBER*/))
-            return (int)janet_unwrap_integer(out);
-        return janet_truthy(out) ? 1 : 0;
+        JanetSignal sig = janet_pcall(check_fn, 4, argv, &out, &fb);
+        bool fired = JanetWatchdog::disarm(wd);
+        g_janet_stats.record(janet_now_ns() - t0);
+
+        // The fiber is reused while calls return normally; an errored or
+        // interrupted one is left to the GC
+        if (sig == JANET_SIGNAL_OK && fb != fiber) {
+            if (fiber) janet_gcunroot(janet_wrap_fiber(fiber));
+            if (fb) janet_gcroot(janet_wrap_fiber(fb));
+            fiber = fb;
+        } else if (sig != JANET_SIGNAL_OK && fiber) {
+            janet_gcunroot(janet_wrap_fiber(fiber));
+            fiber = nullptr;
+        }
+
+        if (sig != JANET_SIGNAL_OK) {
+            (fired && sig == JANET_SIGNAL_INTERRUPT ? g_janet_stats.timeouts : g_janet_stats.errors)
+                .fetch_add(1, std::memory_order_relaxed);
+            return 0;
+        }
+        int v = janet_checktype(out, JANET_NUMBER) ? (int)janet_unwrap_number(out)
+                                                   : (janet_truthy(out) ? 1 : 0);
+        if (v) g_janet_stats.blocks.fetch_add(1, std::memory_order_relaxed);
+        return v;
 #else
-        (void)ip; (void)uri; (void)method; (void)ua; return 0;
+        (void)ip; (void)path; (void)query; (void)method; (void)ua; return 0;
 #endif
     }
-};
 
-// Global singleton (initialized in server startup)
-static JanetWAF g_janet_waf;
+private:
+#if JANET_REAL
+    static Janet jstr(std::string_view s) {
+        return janet_stringv((const uint8_t*)s.data(), (int32_t)s.size());
+    }
+
+    JanetTable*          env{nullptr};
+    JanetFunction*       check_fn{nullptr};
+    JanetFiber*          fiber{nullptr};   // rooted, reset by every janet_pcall
+    JanetWatchdog::Slot  wd;
+#endif
+};
 
 // ── Version strings for admin panel ──────────────────────────────────────────
 
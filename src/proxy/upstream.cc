@@ -5,6 +5,8 @@
 // ─────────────────────────────────────────────────────────────────────────────
 #include "../../include/np_types.hh"
 #include "../../include/np_config.hh"
+#include "../../include/np_probes.hh"
+#include "../core/latency_hist.cc"
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
@@ -16,10 +18,12 @@
 #include <atomic>
 #include <memory>
 #include <vector>
+#include <deque>
 #include <chrono>
 #include <cstring>
 #include <cstdio>
 #include <functional>
+#include <algorithm>
 
 enum class UpState { Healthy, Degraded, Down };
 
@@ -38,34 +42,81 @@ struct PoolConn {
     bool   in_use{false};
     int64_t last_used_ms{0};
     int    requests{0};
+    int64_t connect_us{-1};   // set by acquire(): TCP connect time, -1 = reused
 };
 
+// Phase timings of one upstream exchange, µs (-1 = not measured)
+struct UpTiming {
+    int64_t connect_us{-1};
+    int64_t ttfb_us{-1};      // request sent → first response byte
+    int64_t total_us{-1};     // request sent → response complete
+};
+
+class UpstreamPool;
+// Every live pool of every worker (one UpstreamGroup per worker) — /metrics
+static std::mutex                 g_up_pools_mu;
+static std::vector<UpstreamPool*> g_up_pools;
+
 class UpstreamPool {
 public:
     const UpstreamServer cfg;
     std::atomic<UpState> state{UpState::Healthy};
     BackendStats         stats;
+    // Latency histograms shared by every worker's pool for this backend
+    LatencySeries* const lat_connect;
+    LatencySeries* const lat_ttfb;
+    LatencySeries* const lat_total;
 
-    explicit UpstreamPool(const UpstreamServer& c):cfg(c){}
+    explicit UpstreamPool(const UpstreamServer& c)
+        : cfg(c),
+          lat_connect(g_latency.get(series_name(c), "connect")),
+          lat_ttfb   (g_latency.get(series_name(c), "ttfb")),
+          lat_total  (g_latency.get(series_name(c), "total")) {
+        std::lock_guard lk(g_up_pools_mu);
+        g_up_pools.push_back(this);
+    }
+    ~UpstreamPool(){
+        std::lock_guard lk(g_up_pools_mu);
+        g_up_pools.erase(std::remove(g_up_pools.begin(), g_up_pools.end(), this), g_up_pools.end());
+    }
+
+    static std::string series_name(const UpstreamServer& c){
+        return "up:" + c.host + ":" + std::to_string(c.port);
+    }
 
     PoolConn* acquire(){
         std::lock_guard lg(mu_);
         for(auto& c:pool_){
             if(!c.in_use&&c.fd>=0){
+                c.connect_us=-1;
                 char probe; int r=recv(c.fd,&probe,1,MSG_PEEK|MSG_DONTWAIT);
-                if(r==0){close(c.fd);c.fd=connect_new();if(c.fd<0)continue;}
+                if(r==0){
+                    close(c.fd);
+                    int64_t t0=now_us(); c.fd=connect_new(); if(c.fd<0)continue;
+                    c.connect_us=now_us()-t0;
+                }
                 c.in_use=true; c.last_used_ms=now_ms();
                 stats.active++; return &c;
             }
         }
+        int64_t t0=now_us();
         int fd=connect_new(); if(fd<0) return nullptr;
-        pool_.push_back({fd,true,now_ms(),0});
+        pool_.push_back({fd,true,now_ms(),0,now_us()-t0});
         stats.active++; return &pool_.back();
     }
 
     void release(PoolConn* c, bool ok, int64_t latency_ms=0){
         std::lock_guard lg(mu_);
         stats.active--; c->requests++; c->in_use=false;
+        NW_PROBE4(upstream__release, cfg.host.c_str(), cfg.port, (int)ok, c->requests);
+        record(ok, latency_ms);
+        if(!ok||c->requests>2000||c->fd<0){
+            if(c->fd>=0){close(c->fd);c->fd=-1;}
+        }
+    }
+
+    // Per-request outcome (HTTP/1.1 release() and HTTP/2 streams)
+    void record(bool ok, int64_t latency_ms=0){
         stats.req_total++;
         if(ok){
             stats.latency_sum_ms.fetch_add((uint64_t)latency_ms);
@@ -74,9 +125,6 @@ public:
             stats.req_err++;
             mark_fail();
         }
-        if(!ok||c->requests>2000||c->fd<0){
-            if(c->fd>=0){close(c->fd);c->fd=-1;}
-        }
     }
 
     void mark_fail(){
@@ -117,7 +165,7 @@ public:
 
 private:
     std::mutex mu_;
-    std::vector<PoolConn> pool_;
+    std::deque<PoolConn> pool_;   // deque: PoolConn* handed out must survive push_back
 
     int connect_new(){
         int fd=socket(AF_INET,SOCK_STREAM,0);
@@ -136,6 +184,12 @@ private:
     }
 };
 
+// f(const UpstreamPool&) for every live pool; pools of one backend share lat_*
+template<class F> static void for_each_upstream_pool(F&& f){
+    std::lock_guard lk(g_up_pools_mu);
+    for(auto* p : g_up_pools) f(static_cast<const UpstreamPool&>(*p));
+}
+
 class UpstreamGroup {
 public:
     explicit UpstreamGroup(const UpstreamConfig& cfg):cfg_(cfg){
@@ -220,6 +274,7 @@ public:
     }
 
     size_t server_count() const { return pools_.size(); }
+    const UpstreamConfig& config() const { return cfg_; }
 
 private:
     const UpstreamConfig cfg_;
@@ -229,6 +284,7 @@ private:
     std::atomic<uint64_t> rr_idx_{0};
 
     void hc_loop(){
+        pthread_setname_np(pthread_self(),"nw-health");
         while(hc_run_){
             std::this_thread::sleep_for(std::chrono::seconds(cfg_.hc_interval));
             if(!hc_run_) break;
@@ -238,7 +294,9 @@ private:
                     int64_t elapsed = (now_ms() - pool->stats.last_fail_ms) / 1000;
                     if(elapsed < pool->cfg.fail_timeout) continue;
                 }
-                bool ok = probe_http(pool->cfg.host, pool->cfg.port,
+                bool ok = cfg_.proto == UpstreamProto::H2
+                        ? probe_h2(pool->cfg.host, pool->cfg.port)
+                        : probe_http(pool->cfg.host, pool->cfg.port,
                                      cfg_.hc_path, cfg_.hc_expected_status);
                 if(ok){
                     if(pool->state.load() != UpState::Healthy){
@@ -257,6 +315,30 @@ private:
         }
     }
 
+    // proto h2 backends may speak only h2c: connection preface + empty
+    // SETTINGS, healthy when the backend answers with its own SETTINGS frame
+    static bool probe_h2(const std::string& host, int port){
+        int fd = socket(AF_INET,SOCK_STREAM,0);
+        if(fd < 0) return false;
+        struct timeval tv{3,0};
+        setsockopt(fd,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv));
+        setsockopt(fd,SOL_SOCKET,SO_SNDTIMEO,&tv,sizeof(tv));
+        struct sockaddr_in addr{}; addr.sin_family=AF_INET;
+        addr.sin_port = htons(port);
+        inet_pton(AF_INET,host.c_str(),&addr.sin_addr);
+        bool ok = false;
+        if(connect(fd,(sockaddr*)&addr,sizeof(addr))==0){
+            static const char hello[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+                                        "\x00\x00\x00\x04\x00\x00\x00\x00\x00";
+            if(send(fd,hello,sizeof(hello)-1,0) > 0){
+                unsigned char hd[9]; int n=recv(fd,hd,sizeof(hd),MSG_WAITALL);
+                ok = n == 9 && hd[3] == 0x04;   // first server frame must be SETTINGS
+            }
+        }
+        close(fd);
+        return ok;
+    }
+
     static bool probe_http(const std::string& host, int port,
                            const std::string& path, int expected){
         int fd = socket(AF_INET,SOCK_STREAM,0);
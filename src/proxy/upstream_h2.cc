@@ -0,0 +1,517 @@
+#pragma once
+// ─────────────────────────────────────────────────────────────────────────────
+//  upstream_h2.cc  —  HTTP/2 (h2c prior-knowledge) client to a backend
+//
+//  upstream node_app { proto h2; h2_connections 2; server 127.0.0.1:3000; }
+//
+//    • Kilka połączeń TCP na backend (per worker), każde z sesją nghttp2
+//    • Żądania multipleksowane jako streamy — mniej połączeń do Node API,
+//      brak head-of-line blocking jednego wolnego żądania
+//    • SETTINGS_MAX_CONCURRENT_STREAMS backendu respektowane; nadmiar czeka
+//      w kolejce na wolny stream albo na nowe połączenie
+//    • Flow control: nghttp2 (okna + auto WINDOW_UPDATE), body przez data provider
+//    • GOAWAY: połączenie przestaje przyjmować streamy; streamy odrzucone
+//      (REFUSED_STREAM / id > last_stream_id) idą ponownie na inne połączenie
+//
+//  Wszystko działa na pętli workera (uv_tcp_t) — bez threadpoola i bez
+//  blokujących read/write jak w ścieżce HTTP/1.1.
+// ─────────────────────────────────────────────────────────────────────────────
+#include "../../include/np_types.hh"
+#include "../http/h2_handler.cc"   // H2_AVAILABLE + nghttp2
+#include "upstream.cc"
+#include <uv.h>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+#include <unordered_set>
+
+// Process-wide counters for /np_upstream
+static std::atomic<int>      g_h2up_links{0};
+static std::atomic<int>      g_h2up_streams{0};
+static std::atomic<uint64_t> g_h2up_goaway{0};
+static std::atomic<uint64_t> g_h2up_retried{0};
+
+struct H2UpRequest {
+    std::string method;
+    std::string path;        // path + "?query"
+    std::string authority;
+    Headers     headers;
+    std::string body;
+    int         timeout_s{30};   // proxy_timeout of the location
+};
+
+// Called on the worker loop exactly once per submit(). On failure resp is
+// a ready-made 502/504 error page. Timing has ttfb/total for answered streams.
+using H2UpDone = std::function<void(bool ok, Response resp, const UpTiming& t)>;
+
+// ═════════════════════════════════════════════════════════════════════════════
+class H2Upstream {
+public:
+#if H2_AVAILABLE
+    H2Upstream(uv_loop_t* loop, UpstreamPool* pool, int max_links, int connect_timeout_s,
+               int worker_id)
+        : loop_(loop), pool_(pool), worker_id_(worker_id), max_links_(max_links < 1 ? 1 : max_links),
+          connect_timeout_ms_((int64_t)(connect_timeout_s > 0 ? connect_timeout_s : 5) * 1000)
+    {
+        uv_timer_init(loop_, &timer_);
+        timer_.data = this;
+    }
+
+    // The worker loop is gone by now — free memory only, no callbacks
+    ~H2Upstream(){
+        for(Link* l : links_){
+            for(Stream* st : l->streams) delete st;
+            if(l->s) nghttp2_session_del(l->s);
+            delete l;
+        }
+        for(Stream* st : pending_) delete st;
+    }
+
+    H2Upstream(const H2Upstream&) = delete;
+    H2Upstream& operator=(const H2Upstream&) = delete;
+
+    void submit(H2UpRequest req, H2UpDone done){
+        auto* st = new Stream();
+        st->req  = std::move(req);
+        st->done = std::move(done);
+        st->started_ms  = now_ms();
+        st->deadline_ms = st->started_ms + (int64_t)(st->req.timeout_s > 0 ? st->req.timeout_s : 30) * 1000;
+        pending_.push_back(st);
+        if(!timer_on_){
+            timer_on_ = true;
+            uv_timer_start(&timer_, on_timer, 1000, 1000);
+        }
+        busy_++;
+        pump();
+        leave();
+    }
+
+private:
+    struct Link;
+    struct Stream {
+        H2UpRequest req;
+        H2UpDone    done;
+        Response    resp;
+        bool        got_headers{false};
+        bool        timed_out{false};
+        size_t      body_off{0};
+        int         retries{0};
+        int32_t     id{0};
+        int64_t     started_ms{0};
+        int64_t     deadline_ms{0};
+        int64_t     sent_us{0};          // HEADERS submitted
+        int64_t     first_byte_us{0};    // final :status received
+        Link*       link{nullptr};
+    };
+    struct Link {
+        H2Upstream*      owner{nullptr};
+        uv_tcp_t         tcp{};
+        uv_connect_t     creq{};
+        nghttp2_session* s{nullptr};
+        bool             ready{false};
+        bool             goaway{false};
+        int64_t          opened_ms{0};
+        int64_t          opened_us{0};
+        std::unordered_set<Stream*> streams;
+        char             rbuf[16384];
+    };
+    struct WriteReq {
+        uv_write_t  w{};
+        std::string data;
+    };
+
+    uv_loop_t*          loop_;
+    UpstreamPool*       pool_;
+    int                 worker_id_;   // owning worker (latency histograms)
+    int                 max_links_;
+    int64_t             connect_timeout_ms_;
+    uv_timer_t          timer_{};
+    bool                timer_on_{false};
+    int                 busy_{0};   // >0 while inside nghttp2 / done callbacks
+    std::vector<Link*>  links_;     // open or connecting (closing ones removed)
+    std::deque<Stream*> pending_;   // waiting for a stream slot
+
+    static constexpr int      kMaxRetries = 2;
+    static constexpr uint32_t kWindow     = 1u << 20;   // per-stream receive window
+    static constexpr int32_t  kConnWindow = 16 << 20;   // connection receive window
+
+    // ── scheduling ───────────────────────────────────────────────────────────
+    static uint32_t capacity(const Link* l){
+        return nghttp2_session_get_remote_settings(l->s,
+                   NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS);
+    }
+
+    void pump(){
+        while(!pending_.empty()){
+            Link* best = nullptr;
+            bool connecting = false;
+            for(Link* l : links_){
+                if(l->goaway) continue;
+                if(!l->ready){ connecting = true; continue; }
+                if(l->streams.size() >= capacity(l)) continue;
+                if(!best || l->streams.size() < best->streams.size()) best = l;
+            }
+            if(!best){
+                // Every link is full: open another one (up to h2_connections),
+                // unless one is already on its way
+                int usable = 0;
+                for(Link* l : links_) if(!l->goaway) usable++;
+                if(!connecting && usable < max_links_) open_link();
+                return;
+            }
+            Stream* st = pending_.front();
+            pending_.pop_front();
+            start_stream(best, st);
+        }
+    }
+
+    void start_stream(Link* l, Stream* st){
+        // Lowercased, connection-specific headers dropped (forbidden in HTTP/2)
+        std::vector<std::pair<std::string, std::string_view>> hv;
+        hv.reserve(st->req.headers.items.size());
+        for(auto&[k,v] : st->req.headers.items){
+            std::string lk(k);
+            for(auto& ch : lk) ch = (char)tolower((unsigned char)ch);
+            if(lk == "host" || lk == "connection" || lk == "keep-alive" ||
+               lk == "proxy-connection" || lk == "transfer-encoding" ||
+               lk == "upgrade" || lk == "http2-settings" ||
+               (lk == "te" && v != "trailers"))
+                continue;
+            hv.emplace_back(std::move(lk), v);
+        }
+        static const std::string m = ":method", sc = ":scheme", a = ":authority",
+                                 p = ":path", http = "http";
+        std::vector<nghttp2_nv> nv;
+        nv.reserve(hv.size() + 4);
+        auto add = [&](std::string_view k, std::string_view v){
+            nv.push_back({(uint8_t*)k.data(), (uint8_t*)v.data(), k.size(), v.size(),
+                          NGHTTP2_NV_FLAG_NONE});
+        };
+        add(m, st->req.method);
+        add(sc, http);
+        add(a, st->req.authority);
+        add(p, st->req.path);
+        for(auto&[k,v] : hv) add(k, v);
+
+        nghttp2_data_provider prd{};
+        prd.source.ptr    = st;
+        prd.read_callback = body_read_cb;
+        int32_t id = nghttp2_submit_request(l->s, nullptr, nv.data(), nv.size(),
+                                            st->req.body.empty() ? nullptr : &prd, st);
+        if(id < 0){
+            // Stream ids exhausted or session going away — drain this link
+            l->goaway = true;
+            pending_.push_front(st);
+            return;
+        }
+        st->id   = id;
+        st->link = l;
+        st->sent_us = now_us();
+        st->first_byte_us = 0;
+        l->streams.insert(st);
+        pool_->stats.active++;
+        g_h2up_streams++;
+    }
+
+    void finish(Stream* st, bool ok, int err_status = 502, const char* err = "Upstream h2 error"){
+        int64_t lat = now_ms() - st->started_ms;
+        pool_->record(ok, lat);
+        UpTiming t;
+        if(ok && st->sent_us){
+            t.total_us = now_us() - st->sent_us;
+            if(st->first_byte_us) t.ttfb_us = st->first_byte_us - st->sent_us;
+        }
+        H2UpDone done = std::move(st->done);
+        Response resp = ok ? std::move(st->resp) : Response::make_error(err_status, err);
+        delete st;
+        if(done) done(ok, std::move(resp), t);
+    }
+
+    void requeue(Stream* st){
+        st->retries++;
+        st->resp = Response{};
+        st->body_off = 0;
+        g_h2up_retried++;
+        pending_.push_front(st);
+    }
+
+    void fail_pending(int status, const char* msg){
+        std::deque<Stream*> q;
+        q.swap(pending_);
+        for(Stream* st : q) finish(st, false, status, msg);
+    }
+
+    // Leaving an entry point: flush every session once nothing else is on
+    // the stack. Completions run user code that may submit() again, so keep
+    // busy_ held and repeat while a session still has frames to send.
+    void leave(){
+        if(busy_ > 1){ busy_--; return; }
+        for(int pass = 0; pass < 8; pass++){
+            std::vector<Link*> snap = links_;
+            for(Link* l : snap){
+                if(!l->owner || !l->ready) continue;
+                flush(l);
+                if(l->owner && !nghttp2_session_want_read(l->s) &&
+                   !nghttp2_session_want_write(l->s))
+                    close_link(l, false);   // drained after GOAWAY
+            }
+            bool again = false;
+            for(Link* l : links_)
+                if(l->ready && nghttp2_session_want_write(l->s)) again = true;
+            if(!again) break;
+        }
+        busy_--;
+        if(links_.empty() && pending_.empty() && timer_on_){
+            timer_on_ = false;
+            uv_timer_stop(&timer_);
+        }
+    }
+
+    // ── links ────────────────────────────────────────────────────────────────
+    void open_link(){
+        auto* l = new Link();
+        l->owner = this;
+        l->opened_ms = now_ms();
+        l->opened_us = now_us();
+        uv_tcp_init(loop_, &l->tcp);
+        l->tcp.data  = l;
+        l->creq.data = l;
+        struct sockaddr_in addr{};
+        uv_ip4_addr(pool_->cfg.host.c_str(), pool_->cfg.port, &addr);
+        links_.push_back(l);
+        g_h2up_links++;
+        if(uv_tcp_connect(&l->creq, &l->tcp, (const sockaddr*)&addr, on_connect) != 0)
+            close_link(l, true);
+    }
+
+    static void on_connect(uv_connect_t* req, int status){
+        auto* l = static_cast<Link*>(req->data);
+        H2Upstream* self = l->owner;
+        if(!self) return;   // closed while connecting (timeout)
+        self->busy_++;
+        if(status < 0){
+            NW_WARN("upstream", "h2 connect %s:%d failed: %s",
+                    self->pool_->cfg.host.c_str(), self->pool_->cfg.port, uv_strerror(status));
+            self->close_link(l, true);
+        } else {
+            uv_tcp_nodelay(&l->tcp, 1);
+            self->pool_->lat_connect->record(self->worker_id_, now_us() - l->opened_us);
+            self->init_session(l);
+            l->ready = true;
+            uv_read_start((uv_stream_t*)&l->tcp,
+                [](uv_handle_t* h, size_t, uv_buf_t* b){
+                    auto* lk = static_cast<Link*>(h->data);
+                    *b = uv_buf_init(lk->rbuf, sizeof(lk->rbuf));
+                }, on_read);
+            self->pump();
+        }
+        self->leave();
+    }
+
+    void init_session(Link* l){
+        nghttp2_session_callbacks* cbs;
+        nghttp2_session_callbacks_new(&cbs);
+        nghttp2_session_callbacks_set_on_frame_recv_callback(cbs, frame_recv_cb);
+        nghttp2_session_callbacks_set_on_header_callback(cbs, header_cb);
+        nghttp2_session_callbacks_set_on_data_chunk_recv_callback(cbs, data_chunk_cb);
+        nghttp2_session_callbacks_set_on_stream_close_callback(cbs, stream_close_cb);
+        nghttp2_session_client_new(&l->s, cbs, l);
+        nghttp2_session_callbacks_del(cbs);
+        nghttp2_settings_entry iv[] = {
+            {NGHTTP2_SETTINGS_ENABLE_PUSH,         0},
+            {NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, kWindow},
+        };
+        nghttp2_submit_settings(l->s, NGHTTP2_FLAG_NONE, iv, sizeof(iv)/sizeof(iv[0]));
+        nghttp2_session_set_local_window_size(l->s, NGHTTP2_FLAG_NONE, 0, kConnWindow);
+    }
+
+    // Tear a link down. Streams the backend never answered go back to the
+    // queue when that is safe (unprocessed or idempotent), the rest fail.
+    void close_link(Link* l, bool error){
+        auto it = std::find(links_.begin(), links_.end(), l);
+        if(it == links_.end()) return;
+        links_.erase(it);
+        g_h2up_links--;
+        if(error) pool_->mark_fail();
+        for(Stream* st : l->streams){
+            st->link = nullptr;
+            pool_->stats.active--;
+            g_h2up_streams--;
+            bool idem = st->req.method == "GET" || st->req.method == "HEAD" ||
+                        st->req.method == "OPTIONS";
+            if(!st->got_headers && idem && st->retries < kMaxRetries) requeue(st);
+            else finish(st, false);
+        }
+        l->streams.clear();
+        if(l->s){ nghttp2_session_del(l->s); l->s = nullptr; }
+        l->owner = nullptr;
+        uv_close((uv_handle_t*)&l->tcp, [](uv_handle_t* h){
+            delete static_cast<Link*>(h->data);
+        });
+        // Nothing left that could take the queue → give up on it now
+        if(error){
+            bool usable = false;
+            for(Link* o : links_) if(!o->goaway) usable = true;
+            if(!usable) fail_pending(502, "Upstream connect failed");
+        }
+        pump();
+    }
+
+    void flush(Link* l){
+        std::string out;
+        for(;;){
+            const uint8_t* data;
+            ssize_t n = nghttp2_session_mem_send(l->s, &data);
+            if(n < 0){ close_link(l, true); return; }
+            if(n == 0) break;
+            out.append((const char*)data, (size_t)n);
+        }
+        if(out.empty()) return;
+        auto* wr = new WriteReq();
+        wr->data = std::move(out);
+        wr->w.data = l;
+        uv_buf_t b = uv_buf_init(wr->data.data(), wr->data.size());
+        int r = uv_write(&wr->w, (uv_stream_t*)&l->tcp, &b, 1, [](uv_write_t* w, int status){
+            auto* wq = reinterpret_cast<WriteReq*>(w);
+            auto* lk = static_cast<Link*>(w->data);
+            delete wq;
+            if(status < 0 && status != UV_ECANCELED && lk->owner){
+                H2Upstream* self = lk->owner;
+                self->busy_++;
+                self->close_link(lk, true);
+                self->leave();
+            }
+        });
+        if(r != 0){ delete wr; close_link(l, true); }
+    }
+
+    static void on_read(uv_stream_t* s, ssize_t nread, const uv_buf_t* buf){
+        auto* l = static_cast<Link*>(s->data);
+        H2Upstream* self = l->owner;
+        if(!self || nread == 0) return;
+        self->busy_++;
+        if(nread < 0){
+            self->close_link(l, nread != UV_EOF || !l->streams.empty());
+        } else {
+            ssize_t r = nghttp2_session_mem_recv(l->s, (const uint8_t*)buf->base, (size_t)nread);
+            if(r < 0){
+                NW_WARN("upstream", "h2 %s:%d protocol error: %s",
+                        self->pool_->cfg.host.c_str(), self->pool_->cfg.port,
+                        nghttp2_strerror((int)r));
+                self->close_link(l, true);
+            } else {
+                self->pump();
+            }
+        }
+        self->leave();
+    }
+
+    static void on_timer(uv_timer_t* t){
+        auto* self = static_cast<H2Upstream*>(t->data);
+        int64_t now = now_ms();
+        self->busy_++;
+        // Queued too long (backend saturated or unreachable)
+        std::deque<Stream*> keep, expired;
+        for(Stream* st : self->pending_)
+            (now > st->deadline_ms ? expired : keep).push_back(st);
+        self->pending_.swap(keep);
+        for(Stream* st : expired) self->finish(st, false, 504, "Upstream timeout");
+        std::vector<Link*> snap = self->links_;
+        for(Link* l : snap){
+            if(!l->ready){
+                if(now - l->opened_ms > self->connect_timeout_ms_) self->close_link(l, true);
+                continue;
+            }
+            for(Stream* st : l->streams){
+                if(!st->timed_out && now > st->deadline_ms){
+                    st->timed_out = true;
+                    nghttp2_submit_rst_stream(l->s, NGHTTP2_FLAG_NONE, st->id, NGHTTP2_CANCEL);
+                }
+            }
+        }
+        self->leave();
+    }
+
+    // ── nghttp2 callbacks ────────────────────────────────────────────────────
+    static ssize_t body_read_cb(nghttp2_session*, int32_t, uint8_t* buf, size_t len,
+                                uint32_t* flags, nghttp2_data_source* src, void*){
+        auto* st = static_cast<Stream*>(src->ptr);
+        size_t n = std::min(len, st->req.body.size() - st->body_off);
+        memcpy(buf, st->req.body.data() + st->body_off, n);
+        st->body_off += n;
+        if(st->body_off >= st->req.body.size()) *flags |= NGHTTP2_DATA_FLAG_EOF;
+        return (ssize_t)n;
+    }
+
+    static int frame_recv_cb(nghttp2_session*, const nghttp2_frame* f, void* ud){
+        auto* l = static_cast<Link*>(ud);
+        if(f->hd.type == NGHTTP2_GOAWAY && !l->goaway){
+            // No new streams here; nghttp2 closes the ones above last_stream_id
+            // with REFUSED_STREAM and stream_close_cb puts them back in the queue
+            l->goaway = true;
+            g_h2up_goaway++;
+            NW_INFO("upstream", "h2 GOAWAY from %s:%d (last_stream_id=%d, error=%u)",
+                    l->owner->pool_->cfg.host.c_str(), l->owner->pool_->cfg.port,
+                    f->goaway.last_stream_id, f->goaway.error_code);
+        }
+        return 0;
+    }
+
+    static int header_cb(nghttp2_session* s, const nghttp2_frame* f,
+                         const uint8_t* name, size_t namelen,
+                         const uint8_t* value, size_t valuelen, uint8_t, void*){
+        if(f->hd.type != NGHTTP2_HEADERS) return 0;
+        auto* st = static_cast<Stream*>(nghttp2_session_get_stream_user_data(s, f->hd.stream_id));
+        if(!st) return 0;
+        std::string_view k((const char*)name, namelen), v((const char*)value, valuelen);
+        if(k == ":status"){
+            int code = 0;
+            for(char ch : v) code = code * 10 + (ch - '0');
+            // 1xx informational responses are skipped; the final one follows
+            if(code >= 200){
+                st->resp.status = code; st->got_headers = true;
+                if(!st->first_byte_us) st->first_byte_us = now_us();
+            }
+        } else if(!k.empty() && k[0] != ':' && st->got_headers){
+            st->resp.headers.items.emplace_back(k, v);
+        }
+        return 0;
+    }
+
+    static int data_chunk_cb(nghttp2_session* s, uint8_t, int32_t id,
+                             const uint8_t* data, size_t len, void*){
+        auto* st = static_cast<Stream*>(nghttp2_session_get_stream_user_data(s, id));
+        if(st) st->resp.body.append((const char*)data, len);
+        return 0;
+    }
+
+    static int stream_close_cb(nghttp2_session* s, int32_t id, uint32_t error_code, void* ud){
+        auto* l  = static_cast<Link*>(ud);
+        auto* st = static_cast<Stream*>(nghttp2_session_get_stream_user_data(s, id));
+        if(!st || !l->streams.erase(st)) return 0;
+        H2Upstream* self = l->owner;
+        st->link = nullptr;
+        self->pool_->stats.active--;
+        g_h2up_streams--;
+        if(error_code == NGHTTP2_NO_ERROR && st->got_headers){
+            self->finish(st, true);
+        } else if(st->timed_out){
+            self->finish(st, false, 504, "Upstream timeout");
+        } else if(!st->got_headers && error_code == NGHTTP2_REFUSED_STREAM &&
+                  st->retries < kMaxRetries){
+            // Never processed by the backend (GOAWAY / over its stream limit)
+            self->requeue(st);
+        } else {
+            self->finish(st, false);
+        }
+        return 0;
+    }
+#else
+    H2Upstream(uv_loop_t*, UpstreamPool*, int, int, int) {}
+    void submit(H2UpRequest, H2UpDone done){
+        if(done) done(false, Response::make_error(502, "HTTP/2 upstream not compiled"), UpTiming{});
+    }
+#endif
+};
@@ -83,12 +83,16 @@ public:
         return buf;
     }
 
+    // Entries are never erased — one bucket per IP ever seen by this worker
+    MemUsage mem_usage() const { return {mem_hash_nodes(table_)+key_heap_, table_.size()}; }
+
 private:
     Bucket& get(const std::string& ip){
         auto [it,ins]=table_.emplace(ip,Bucket{});
-        if(ins){it->second={cfg_.burst,cfg_.rate,cfg_.burst,now_ms()};}
+        if(ins){it->second={cfg_.burst,cfg_.rate,cfg_.burst,now_ms()}; key_heap_+=mem_heap(it->first);}
         return it->second;
     }
     std::unordered_map<std::string,Bucket> table_;
+    uint64_t key_heap_{0};
     Config cfg_;
 };
@@ -718,6 +718,7 @@ private:
     }
 
     void renew_loop(){
+        pthread_setname_np(pthread_self(),"nw-acme");
         // Wait 5min before first check so server is fully started
         for(int i=0;i<300&&running_;i++)
             std::this_thread::sleep_for(std::chrono::seconds(1));
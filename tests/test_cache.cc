@@ -76,10 +76,29 @@ void test_non_200_cacheable(){
     auto key=ResponseCache::make_key(req);
     CHK(c.put(key,resp,req),"410 Gone is cacheable");
 }
+void test_mem_accounting(){
+    ResponseCache c(2,60);
+    uint64_t empty=c.mem_usage().bytes;
+    auto req=make_req("/m"); auto key=ResponseCache::make_key(req);
+    c.put(key,make_resp(200,std::string(4000,'a')),req);
+    uint64_t one=c.mem_usage().bytes;
+    CHK(one>empty+4000,"mem counts the stored response");
+    c.put(key,make_resp(200,std::string(4000,'b')),req);
+    CHK(c.mem_usage().bytes==one,"replacing a key keeps mem flat");
+    CHK(c.stats().bytes_stored<5000,"replacing a key keeps bytes_stored flat");
+    for(int i=0;i<4;i++){
+        auto r=make_req("/m"+std::to_string(i));
+        c.put(ResponseCache::make_key(r),make_resp(200,"x"),r);
+    }
+    CHK(c.mem_usage().objects==2,"objects = entries after eviction");
+    c.flush();
+    CHK(c.mem_usage().objects==0&&c.mem_usage().bytes<one-4000,"flush releases the entries (bucket array stays)");
+}
 int main(){
     printf("=== Cache ===\n\n");
     test_store_and_hit(); test_no_store(); test_post_skip();
     test_lru_eviction(); test_etag_304(); test_non_200_cacheable();
+    test_mem_accounting();
     printf("\n%d passed, %d failed\n",ok,fail);
     return fail>0?1:0;
 }
